@@ -0,0 +1,741 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Runs the whole benchmark suite: sn_mda_gmatmul at several shapes, every element-wise operator, sn_sum, axis reductions,
+// sn_map at scale, and sn_op_flow / sn_op_dflow on an MLP layer, a deep chain and a wide fan-in.
+//
+// Usage: sinae_benchmark [--csv | --json] [filter]
+//   --csv, --json  Prints one record per benchmark for tracking over time instead of a table.
+//   filter         Runs only the benchmarks whose "group/name" contains it.
+//
+// Allocations are always counted, so the library and this file must be built with one of:
+//   -DSN_USE_ALLOCATION_HOOK  Routes SN_MALLOC and SN_FREE to the counters of this file, which barely change the timings.
+//   -DSN_USE_MEMORY           Counts them with sinae_memory.h, whose accounting is also timed.
+// Building only this file with either flag is detected when the suite starts, which then fails instead of reporting zeros.
+// With -DSN_USE_MEMORY, the suite also fails first if a steady run of a plan of an MLP layer and reductions allocates.
+// The backward pass is counted as twice the flops of the forward pass, so dflow reports three times those of flow.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+
+/* Suite */
+
+typedef enum format_en_ {
+    FORMAT_TABLE,
+    FORMAT_CSV,
+    FORMAT_JSON,
+} format_;
+
+typedef struct suite_st_ {
+    format_ format;
+    const char* filter;
+    SN_UINT count; //!< Number of printed records.
+} suite_;
+
+typedef void run_fn_(void* context);
+
+#define MIN_BATCH_NS_ 1e7
+#define BATCH_COUNT_ 5
+
+
+/* Allocation counters */
+
+#if defined(SN_USE_MEMORY)
+static void counters_reset_(void) {
+    sn_memory_reset();
+}
+
+static void counters_query_(SN_UINT* allocation_count, SN_UINT* allocated_bytes) {
+    *allocation_count = sn_memory_query().allocation_count;
+    *allocated_bytes = 0;
+    for (SN_UINT i = 0; i < sn_memory_op_count(); ++i) {
+        *allocated_bytes += sn_memory_ops()[i].allocated_bytes;
+    }
+}
+#elif defined(SN_USE_ALLOCATION_HOOK)
+// The benchmarks run on the calling thread only, so the counters are plain.
+static SN_UINT allocation_count_ = 0;
+static SN_UINT allocated_bytes_ = 0;
+
+void* sn_allocation_hook_malloc(size_t size) {
+    ++allocation_count_;
+    allocated_bytes_ += size;
+    return malloc(size);
+}
+
+void sn_allocation_hook_free(void* ptr) {
+    free(ptr);
+}
+
+static void counters_reset_(void) {
+    allocation_count_ = 0;
+    allocated_bytes_ = 0;
+}
+
+static void counters_query_(SN_UINT* allocation_count, SN_UINT* allocated_bytes) {
+    *allocation_count = allocation_count_;
+    *allocated_bytes = allocated_bytes_;
+}
+#else
+    #error "Build the library and this file with -DSN_USE_ALLOCATION_HOOK or -DSN_USE_MEMORY so that allocations are counted."
+#endif
+
+/* Returns false if the library does not allocate through the counters, because it was built without the flag of this file. */
+static bool counters_check_(void) {
+    counters_reset_();
+    sn_mda_destroy(sn_mda_create(0, NULL));
+    SN_UINT allocation_count;
+    SN_UINT allocated_bytes;
+    counters_query_(&allocation_count, &allocated_bytes);
+    return allocation_count > 0;
+}
+
+// Counts the allocations of one more batch, so that the counters do not disturb the timed ones.
+static void count_allocations_(run_fn_* run, void* context, SN_UINT iterations, double* allocations, double* allocated_bytes) {
+    counters_reset_();
+    for (SN_UINT i = 0; i < iterations; ++i) {
+        run(context);
+    }
+    SN_UINT allocation_count;
+    SN_UINT bytes;
+    counters_query_(&allocation_count, &bytes);
+    *allocations = (double)allocation_count / (double)iterations;
+    *allocated_bytes = (double)bytes / (double)iterations;
+}
+
+
+/* Measurement */
+
+/* Times run() in batches of at least MIN_BATCH_NS_ and prints the best batch divided by op_count operations per run.
+   flop and bytes are per run, and zero for benchmarks without a meaningful rate. */
+static void measure_(suite_* suite, const char* group, const char* name, run_fn_* run, void* context,
+                     SN_UINT op_count, double flop, double bytes) {
+    char full_name[128];
+    snprintf(full_name, sizeof(full_name), "%s/%s", group, name);
+    if (suite->filter != NULL && strstr(full_name, suite->filter) == NULL) {
+        return;
+    }
+
+    run(context);
+    SN_UINT iterations = 1;
+    double elapsed = 0.0;
+    while (true) {
+        double start = now_ns_();
+        for (SN_UINT i = 0; i < iterations; ++i) {
+            run(context);
+        }
+        elapsed = now_ns_() - start;
+        if (elapsed >= MIN_BATCH_NS_) {
+            break;
+        }
+        iterations *= 2;
+    }
+    double best = elapsed;
+    for (SN_UINT b = 1; b < BATCH_COUNT_; ++b) {
+        double start = now_ns_();
+        for (SN_UINT i = 0; i < iterations; ++i) {
+            run(context);
+        }
+        elapsed = now_ns_() - start;
+        best = (elapsed < best) ? elapsed : best;
+    }
+    double run_ns = best / (double)iterations;
+    double allocations;
+    double allocated_bytes;
+    count_allocations_(run, context, iterations, &allocations, &allocated_bytes);
+
+    double ns_per_op = run_ns / (double)op_count;
+    double gflops = flop / run_ns;
+    double gbps = bytes / run_ns;
+    double allocations_per_op = allocations / (double)op_count;
+    double bytes_per_op = allocated_bytes / (double)op_count;
+    switch (suite->format) {
+    case FORMAT_TABLE:
+        printf("%-32s %14.1f ns/op %10.3f GFLOP/s %10.3f GB/s %10.1f allocs/op %14.1f B/op\n",
+               full_name, ns_per_op, gflops, gbps, allocations_per_op, bytes_per_op);
+        break;
+    case FORMAT_CSV:
+        printf("%s,%s,%.3f,%.6f,%.6f,%.3f,%.3f,%ju\n",
+               group, name, ns_per_op, gflops, gbps, allocations_per_op, bytes_per_op, (uintmax_t)iterations * op_count);
+        break;
+    case FORMAT_JSON:
+        printf("%s\n    {\"group\": \"%s\", \"name\": \"%s\", \"ns_per_op\": %.3f, \"gflops\": %.6f, \"gbps\": %.6f, "
+               "\"allocations_per_op\": %.3f, \"allocated_bytes_per_op\": %.3f, \"ops_per_batch\": %ju}",
+               (suite->count > 0) ? "," : "", group, name, ns_per_op, gflops, gbps,
+               allocations_per_op, bytes_per_op, (uintmax_t)iterations * op_count);
+        break;
+    }
+    fflush(stdout);
+    ++(suite->count);
+}
+
+static void fill_(sn_mda* x, SN_UINT seed) {
+    SN_UINT size = sn_mda_size(x);
+    for (SN_UINT i = 0; i < size; ++i) {
+        x->ptr[i] = (SN_FLOAT)0.5 + (SN_FLOAT)((i * seed) % 13) / 13;
+    }
+}
+
+
+/* Kernels */
+
+typedef struct gmatmul_context_st_ {
+    const sn_mda* x0;
+    const sn_mda* x1;
+} gmatmul_context_;
+
+static void run_gmatmul_(void* context) {
+    gmatmul_context_* c = (gmatmul_context_*)context;
+    sn_mda_destroy(sn_mda_gmatmul(c->x0, c->x1, 1));
+}
+
+static void benchmark_gmatmul_(suite_* suite, SN_UINT rows, SN_UINT overwrap_size, SN_UINT columns) {
+    sn_mda* x0 = sn_mda_create(2, SN_SHAPE(rows, overwrap_size));
+    sn_mda* x1 = sn_mda_create(2, SN_SHAPE(overwrap_size, columns));
+    fill_(x0, 7);
+    fill_(x1, 5);
+    gmatmul_context_ context = { x0, x1 };
+    char name[64];
+    snprintf(name, sizeof(name), "%jux%jux%ju", (uintmax_t)rows, (uintmax_t)overwrap_size, (uintmax_t)columns);
+    double flop = 2.0 * (double)rows * (double)overwrap_size * (double)columns;
+    double bytes = (double)(rows * overwrap_size + overwrap_size * columns + rows * columns) * sizeof(SN_FLOAT);
+    measure_(suite, "gmatmul", name, &run_gmatmul_, &context, 1, flop, bytes);
+    sn_mda_destroy(x1);
+    sn_mda_destroy(x0);
+}
+
+typedef struct op_context_st_ {
+    sn_op* op;
+    const sn_mda* x[2];
+} op_context_;
+
+static void run_op_(void* context) {
+    op_context_* c = (op_context_*)context;
+    sn_mda_destroy(c->op->flow(c->op, c->x));
+}
+
+// Evaluates one operator through its flow function, so the cost of the graph is not included.
+static void benchmark_op_(suite_* suite, const char* group, sn_op* op, SN_UINT size) {
+    sn_mda* x0 = sn_mda_create(1, &size);
+    sn_mda* x1 = sn_mda_create(1, &size);
+    fill_(x0, 7);
+    fill_(x1, 5);
+    op_context_ context = { op, { x0, x1 } };
+    char name[64];
+    snprintf(name, sizeof(name), "%s/%ju", op->name, (uintmax_t)size);
+    double elements = (double)size;
+    double bytes = (double)(op->x_count + 1) * elements * sizeof(SN_FLOAT);
+    measure_(suite, group, name, &run_op_, &context, 1, elements, bytes);
+    sn_op_destroy(op);
+    sn_mda_destroy(x1);
+    sn_mda_destroy(x0);
+}
+
+static void benchmark_ops_(suite_* suite, SN_UINT size) {
+    sn_op* (*unary[])(sn_op*) = { &sn_abs, &sn_exp, &sn_negative, &sn_reciprocal, &sn_sqrt };
+    sn_op* (*binary[])(sn_op*, sn_op*) = { &sn_add, &sn_subtract, &sn_multiply, &sn_divide };
+    for (SN_UINT k = 0; k < sizeof(unary) / sizeof(unary[0]); ++k) {
+        benchmark_op_(suite, "unary", unary[k](sn_placeholder()), size);
+    }
+    for (SN_UINT k = 0; k < sizeof(binary) / sizeof(binary[0]); ++k) {
+        benchmark_op_(suite, "binary", binary[k](sn_placeholder(), sn_placeholder()), size);
+    }
+    benchmark_op_(suite, "reduction", sn_sum(sn_placeholder()), size);
+}
+
+
+/* Map */
+
+typedef struct map_context_st_ {
+    SN_UINT count;
+    sn_op** keys;
+    sn_mda** values;
+    sn_map* map;
+    SN_UINT checksum;
+} map_context_;
+
+static void run_map_insert_(void* context) {
+    map_context_* c = (map_context_*)context;
+    sn_map* map = sn_map_create(1, NULL, NULL);
+    for (SN_UINT i = 0; i < c->count; ++i) {
+        sn_map_insert(map, c->keys[i], c->values[i]);
+    }
+    sn_map_release(map);
+}
+
+static void run_map_get_(void* context) {
+    map_context_* c = (map_context_*)context;
+    for (SN_UINT i = 0; i < c->count; ++i) {
+        c->checksum += (sn_map_get(c->map, c->keys[i]) == c->values[i]);
+    }
+}
+
+static void benchmark_map_(suite_* suite, SN_UINT count) {
+    map_context_ context = { count, SN_DYNAMIC_ARRAY(sn_op*, count), SN_DYNAMIC_ARRAY(sn_mda*, count), NULL, 0 };
+    for (SN_UINT i = 0; i < count; ++i) {
+        context.keys[i] = sn_placeholder();
+        context.values[i] = sn_mda_full(0, NULL, (SN_FLOAT)i);
+    }
+    context.map = sn_map_create(count, context.keys, context.values);
+    char name[64];
+    snprintf(name, sizeof(name), "insert/%ju", (uintmax_t)count);
+    measure_(suite, "map", name, &run_map_insert_, &context, count, 0.0, 0.0);
+    snprintf(name, sizeof(name), "get/%ju", (uintmax_t)count);
+    measure_(suite, "map", name, &run_map_get_, &context, count, 0.0, 0.0);
+    sn_map_destroy(context.map);
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op_destroy(context.keys[i]);
+    }
+    SN_FREE(context.values);
+    SN_FREE(context.keys);
+}
+
+
+/* Files */
+
+typedef struct file_context_st_ {
+    const char* path;
+    SN_FLOAT checksum;
+} file_context_;
+
+static void run_file_load_(void* context) {
+    file_context_* c = (file_context_*)context;
+    sn_mda* x = sn_mda_load(c->path);
+    c->checksum += x->ptr[0];
+    sn_mda_destroy(x);
+}
+
+static void run_file_map_(void* context) {
+    file_context_* c = (file_context_*)context;
+    sn_mda* x = sn_mda_map(c->path);
+    c->checksum += x->ptr[0];
+    sn_mda_destroy(x);
+}
+
+/* Loading reads every byte, while mapping touches only the first page, which is the cost of a cold start. */
+static void benchmark_file_(suite_* suite, SN_UINT size) {
+    file_context_ context = { "sinae_benchmark.snmda", 0 };
+    sn_mda* x = sn_mda_create(2, SN_SHAPE(size / 1024, 1024));
+    fill_(x, 7);
+    if (!sn_mda_save(x, context.path)) {
+        fprintf(stderr, "cannot write %s\n", context.path);
+        sn_mda_destroy(x);
+        return;
+    }
+    double bytes = (double)(size * sizeof(SN_FLOAT));
+    char name[64];
+    snprintf(name, sizeof(name), "load/%ju", (uintmax_t)size);
+    measure_(suite, "file", name, &run_file_load_, &context, 1, 0.0, bytes);
+    snprintf(name, sizeof(name), "map/%ju", (uintmax_t)size);
+    measure_(suite, "file", name, &run_file_map_, &context, 1, 0.0, bytes);
+    remove(context.path);
+    sn_mda_destroy(x);
+}
+
+
+/* Graphs */
+
+typedef struct graph_context_st_ {
+    sn_op* y;
+    sn_map* feed;
+} graph_context_;
+
+static void run_flow_(void* context) {
+    graph_context_* c = (graph_context_*)context;
+    sn_mda_destroy(sn_op_usflow(c->y, c->feed));
+}
+
+static void run_dflow_(void* context) {
+    graph_context_* c = (graph_context_*)context;
+    sn_map_destroy(sn_op_usdflow(c->y, c->feed));
+}
+
+// Destroys y, the feed and its values.
+static void benchmark_graph_(suite_* suite, const char* name, sn_op* y, sn_map* feed, double flop) {
+    graph_context_ context = { y, feed };
+    char full_name[64];
+    snprintf(full_name, sizeof(full_name), "%s/flow", name);
+    measure_(suite, "graph", full_name, &run_flow_, &context, 1, flop, 0.0);
+    snprintf(full_name, sizeof(full_name), "%s/dflow", name);
+    measure_(suite, "graph", full_name, &run_dflow_, &context, 1, 3.0 * flop, 0.0);
+    sn_map_destroy(feed);
+    sn_op_destroy(y);
+}
+
+// sum((W * X + b) .* (W * X + b)) with a bias broadcasted over the batch.
+static void benchmark_mlp_(suite_* suite, SN_UINT width, SN_UINT batch) {
+    sn_op* w = sn_placeholder();
+    sn_op* x = sn_placeholder();
+    sn_op* b = sn_placeholder();
+    sn_op* h = sn_add(sn_matmul(w, x, 1), b);
+    sn_op* y = sn_sum(sn_multiply(h, h));
+    sn_mda* vw = sn_mda_create(2, SN_SHAPE(width, width));
+    sn_mda* vx = sn_mda_create(2, SN_SHAPE(width, batch));
+    sn_mda* vb = sn_mda_create(1, &width);
+    fill_(vw, 7);
+    fill_(vx, 5);
+    fill_(vb, 3);
+    char name[64];
+    snprintf(name, sizeof(name), "mlp/%jux%ju", (uintmax_t)width, (uintmax_t)batch);
+    double elements = (double)width * (double)batch;
+    benchmark_graph_(suite, name, y, sn_map_from(3, w, vw, x, vx, b, vb), 2.0 * (double)width * elements + 3.0 * elements);
+}
+
+// sum(reduce(X)) of a rows x columns matrix over its first axis, its second axis or both, named by its size.
+static void benchmark_reduce_(suite_* suite, SN_UINT rows, SN_UINT columns) {
+    static const SN_UINT axes[][2] = { { 0, 0 }, { 1, 0 }, { 0, 1 } };
+    static const SN_UINT axis_counts[] = { 1, 1, 2 };
+    static const char* const axis_names[] = { "0", "1", "01" };
+    double elements = (double)rows * (double)columns;
+    for (SN_UINT i = 0; i < 3; ++i) {
+        for (SN_UINT j = 0; j < 2; ++j) {
+            sn_op* x = sn_placeholder();
+            sn_op* r = j == 0 ? sn_reduce_sum(x, axis_counts[i], axes[i]) : sn_reduce_max(x, axis_counts[i], axes[i]);
+            sn_mda* vx = sn_mda_create(2, SN_SHAPE(rows, columns));
+            fill_(vx, 7);
+            char name[64];
+            snprintf(name, sizeof(name), "reduce/%ju/%s%s", (uintmax_t)(rows * columns), j == 0 ? "sum" : "max", axis_names[i]);
+            benchmark_graph_(suite, name, sn_sum(r), sn_map_from(1, x, vx), elements);
+        }
+    }
+}
+
+#ifdef SN_USE_MEMORY
+/* Returns the number of allocations of a steady run of a plan of an MLP layer exp(W * X + b) followed by its mean
+   over the batch, its maximum over the units and their sums, so that kernels which start to allocate are caught. */
+static SN_UINT plan_allocation_count_(SN_UINT width, SN_UINT batch) {
+    sn_op* w = sn_placeholder();
+    sn_op* x = sn_placeholder();
+    sn_op* b = sn_placeholder();
+    sn_op* h = sn_exp(sn_add(sn_matmul(w, x, 1), b));
+    sn_op* y = sn_add(sn_sum(sn_reduce_mean(h, 1, SN_TEMP_ARRAY(SN_UINT, 1))),
+                      sn_sum(sn_reduce_max(h, 1, SN_TEMP_ARRAY(SN_UINT, 0))));
+    sn_mda* vw = sn_mda_full(2, SN_SHAPE(width, width), 0.01);
+    sn_mda* vx = sn_mda_full(2, SN_SHAPE(width, batch), 0.5);
+    sn_mda* vb = sn_mda_full(1, &width, -0.25);
+    const sn_mda* inputs[] = { vw, vx, vb };
+    sn_plan* plan = sn_plan_compile(y, 3, SN_TEMP_ARRAY(sn_op*, w, x, b), inputs);
+    sn_plan_run(plan, inputs);
+    sn_memory_reset();
+    sn_plan_run(plan, inputs);
+    SN_UINT allocation_count = sn_memory_query().allocation_count;
+    sn_plan_destroy(plan);
+    sn_op_destroy(y);
+    sn_mda_destroy(vw);
+    sn_mda_destroy(vx);
+    sn_mda_destroy(vb);
+    return allocation_count;
+}
+#endif
+
+// depth layers of y = sqrt(abs(y) + 1) with a final sum.
+static sn_op* chain_(sn_op* x, SN_UINT depth) {
+    sn_op* one = sn_scalar(1.0);
+    sn_op* y = x;
+    for (SN_UINT l = 0; l < depth; ++l) {
+        y = sn_sqrt(sn_add(sn_abs(y), one));
+    }
+    return sn_sum(y);
+}
+
+typedef struct checkpoint_context_st_ {
+    sn_op* y;
+    sn_op* x;
+    const sn_mda* vx;
+} checkpoint_context_;
+
+static void run_cdflow_(void* context) {
+    checkpoint_context_* c = (checkpoint_context_*)context;
+    sn_map_destroy(sn_op_cdflow(c->y, sn_map_from(1, c->x, sn_mda_copy(c->vx)), 0, NULL));
+}
+
+static void benchmark_chain_(suite_* suite, SN_UINT width, SN_UINT depth) {
+    sn_op* x = sn_placeholder();
+    sn_op* y = chain_(x, depth);
+    sn_mda* vx = sn_mda_create(1, &width);
+    fill_(vx, 7);
+    double flop = (3.0 * (double)depth + 1.0) * (double)width;
+    char name[64];
+    // The checkpointed gradient recomputes the forward pass once more to hold O(sqrt(depth)) values instead of depth.
+    checkpoint_context_ context = { y, x, vx };
+    snprintf(name, sizeof(name), "chain/%jux%ju/cdflow", (uintmax_t)depth, (uintmax_t)width);
+    measure_(suite, "graph", name, &run_cdflow_, &context, 1, 4.0 * flop, 0.0);
+    snprintf(name, sizeof(name), "chain/%jux%ju", (uintmax_t)depth, (uintmax_t)width);
+    benchmark_graph_(suite, name, y, sn_map_from(1, x, vx), flop);
+}
+
+// depth layers of y = sqrt(h) / h with h = abs(y) + 0.5 * 2 built twice, as a front end which does not share nodes would.
+static sn_op* redundant_(sn_op* x, SN_UINT depth) {
+    sn_op* y = x;
+    for (SN_UINT l = 0; l < depth; ++l) {
+        sn_op* h0 = sn_add(sn_abs(y), sn_multiply(sn_scalar(0.5), sn_scalar(2.0)));
+        sn_op* h1 = sn_add(sn_abs(y), sn_multiply(sn_scalar(0.5), sn_scalar(2.0)));
+        y = sn_divide(sn_sqrt(h0), h1);
+    }
+    return sn_sum(y);
+}
+
+// The same graph as built and after sn_opt_fold() and sn_opt_cse(), which leave 4 operators per layer instead of 8.
+static void benchmark_redundant_(suite_* suite, SN_UINT width, SN_UINT depth) {
+    char name[64];
+    for (int optimized = 0; optimized < 2; ++optimized) {
+        sn_op* x = sn_placeholder();
+        sn_op* y = redundant_(x, depth);
+        if (optimized) {
+            y = sn_opt_cse(sn_opt_fold(y, NULL), NULL);
+        }
+        sn_mda* vx = sn_mda_create(1, &width);
+        fill_(vx, 7);
+        snprintf(name, sizeof(name), "cse/%jux%ju%s", (uintmax_t)depth, (uintmax_t)width, optimized ? "/opt" : "");
+        benchmark_graph_(suite, name, y, sn_map_from(1, x, vx), 4.0 * (double)depth * (double)width);
+    }
+}
+
+typedef struct deep_context_st_ {
+    sn_op* y;
+    sn_op* x;
+    const sn_mda* vx;
+    SN_UINT depth;
+} deep_context_;
+
+static void run_deep_build_(void* context) {
+    deep_context_* c = (deep_context_*)context;
+    sn_op_destroy(chain_(sn_placeholder(), c->depth));
+}
+
+static void run_deep_graph_(void* context) {
+    deep_context_* c = (deep_context_*)context;
+    sn_graph_destroy(sn_graph_create(c->y));
+}
+
+static void run_deep_flow_(void* context) {
+    deep_context_* c = (deep_context_*)context;
+    sn_mda_destroy(sn_op_flow(c->y, sn_map_from(1, c->x, sn_mda_copy(c->vx))));
+}
+
+static void run_deep_dflow_(void* context) {
+    deep_context_* c = (deep_context_*)context;
+    sn_map_destroy(sn_op_dflow(c->y, sn_map_from(1, c->x, sn_mda_copy(c->vx))));
+}
+
+// The chain of a single element over 3 * depth + 3 nodes, per node. Building includes destroying, and graph is the
+// topological sort which every evaluation starts with. None of them grows the native stack with the depth.
+static void benchmark_deep_(suite_* suite, SN_UINT depth) {
+    SN_UINT width = 1;
+    sn_op* x = sn_placeholder();
+    sn_mda* vx = sn_mda_create(1, &width);
+    fill_(vx, 7);
+    deep_context_ context = { chain_(x, depth), x, vx, depth };
+    SN_UINT node_count = 3 * depth + 3;
+    char name[64];
+    snprintf(name, sizeof(name), "deep/%ju/build", (uintmax_t)node_count);
+    measure_(suite, "graph", name, &run_deep_build_, &context, node_count, 0.0, 0.0);
+    snprintf(name, sizeof(name), "deep/%ju/graph", (uintmax_t)node_count);
+    measure_(suite, "graph", name, &run_deep_graph_, &context, node_count, 0.0, 0.0);
+    snprintf(name, sizeof(name), "deep/%ju/flow", (uintmax_t)node_count);
+    measure_(suite, "graph", name, &run_deep_flow_, &context, node_count, 0.0, 0.0);
+    snprintf(name, sizeof(name), "deep/%ju/dflow", (uintmax_t)node_count);
+    measure_(suite, "graph", name, &run_deep_dflow_, &context, node_count, 0.0, 0.0);
+    sn_op_destroy(context.y);
+    sn_mda_destroy(vx);
+}
+
+// x[0] + x[1] + ... + x[fan_in - 1] with a final sum.
+static void benchmark_fan_in_(suite_* suite, SN_UINT fan_in, SN_UINT width) {
+    sn_map* feed = sn_map_create(fan_in, NULL, NULL);
+    sn_op* y = NULL;
+    for (SN_UINT k = 0; k < fan_in; ++k) {
+        sn_op* x = sn_placeholder();
+        sn_mda* vx = sn_mda_create(1, &width);
+        fill_(vx, k + 1);
+        sn_map_insert(feed, x, vx);
+        y = (y == NULL) ? x : sn_add(y, x);
+    }
+    y = sn_sum(y);
+    char name[64];
+    snprintf(name, sizeof(name), "fan_in/%jux%ju", (uintmax_t)fan_in, (uintmax_t)width);
+    benchmark_graph_(suite, name, y, feed, (double)fan_in * (double)width);
+}
+
+
+/* Graph files */
+
+typedef struct graph_file_context_st_ {
+    const char* path;
+    SN_UINT depth;
+} graph_file_context_;
+
+static void run_graph_build_(void* context) {
+    graph_file_context_* c = (graph_file_context_*)context;
+    sn_op_destroy(chain_(sn_placeholder(), c->depth));
+}
+
+static void run_graph_load_(void* context) {
+    graph_file_context_* c = (graph_file_context_*)context;
+    sn_op* x;
+    sn_op_unload(sn_op_load(c->path, 1, &x));
+}
+
+// Building the chain with its constructors against loading it from a file, per node.
+static void benchmark_graph_file_(suite_* suite, SN_UINT depth) {
+    graph_file_context_ context = { "sinae_benchmark.sngrf", depth };
+    sn_op* x = sn_placeholder();
+    sn_op* y = chain_(x, depth);
+    bool saved = sn_op_save(y, 1, &x, 0, NULL, NULL, context.path);
+    sn_op_destroy(y);
+    if (!saved) {
+        fprintf(stderr, "cannot write %s\n", context.path);
+        return;
+    }
+    SN_UINT node_count = 3 * depth + 3;
+    char name[64];
+    snprintf(name, sizeof(name), "build/%ju", (uintmax_t)node_count);
+    measure_(suite, "graph_file", name, &run_graph_build_, &context, node_count, 0.0, 0.0);
+    snprintf(name, sizeof(name), "load/%ju", (uintmax_t)node_count);
+    measure_(suite, "graph_file", name, &run_graph_load_, &context, node_count, 0.0, 0.0);
+    remove(context.path);
+}
+
+
+/* Forward mode */
+
+typedef struct forward_context_st_ {
+    sn_op* y;
+    sn_op* x;
+    const sn_mda* vx;
+    const sn_mda* tx;
+    SN_UINT tangent_count;
+} forward_context_;
+
+static void run_jvp_(void* context) {
+    forward_context_* c = (forward_context_*)context;
+    sn_mda* dy;
+    sn_mda_destroy(sn_op_jvp(c->y, sn_map_from(1, c->x, sn_mda_copy(c->vx)), c->tangent_count,
+                             sn_map_from(1, c->x, sn_mda_copy(c->tx)), &dy));
+    sn_mda_destroy(dy);
+}
+
+static void run_hvp_(void* context) {
+    forward_context_* c = (forward_context_*)context;
+    sn_map_destroy(sn_op_hvp(c->y, sn_map_from(1, c->x, sn_mda_copy(c->vx)), sn_map_from(1, c->x, sn_mda_copy(c->tx)), NULL));
+}
+
+// tangent_count directional derivatives of the chain in one forward pass, and with a single tangent its Hessian-vector product,
+// to compare with chain/.../dflow.
+static void benchmark_jvp_(suite_* suite, SN_UINT width, SN_UINT depth, SN_UINT tangent_count) {
+    sn_op* x = sn_placeholder();
+    sn_op* y = chain_(x, depth);
+    sn_mda* vx = sn_mda_create(1, &width);
+    sn_mda* tx = sn_mda_create(2, SN_SHAPE(width, tangent_count));
+    fill_(vx, 7);
+    fill_(tx, 5);
+    forward_context_ context = { y, x, vx, tx, tangent_count };
+    char name[64];
+    snprintf(name, sizeof(name), "chain/%jux%ju/jvp%ju", (uintmax_t)depth, (uintmax_t)width, (uintmax_t)tangent_count);
+    measure_(suite, "forward", name, &run_jvp_, &context, 1, (3.0 * (double)depth + 1.0) * (double)width * (double)(1 + 2 * tangent_count), 0.0);
+    if (tangent_count == 1) {
+        snprintf(name, sizeof(name), "chain/%jux%ju/hvp", (uintmax_t)depth, (uintmax_t)width);
+        measure_(suite, "forward", name, &run_hvp_, &context, 1, 0.0, 0.0);
+    }
+    sn_mda_destroy(tx);
+    sn_mda_destroy(vx);
+    sn_op_destroy(y);
+}
+
+
+int main(int argc, char* argv[]) {
+    suite_ suite = { FORMAT_TABLE, NULL, 0 };
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--csv") == 0) {
+            suite.format = FORMAT_CSV;
+        }
+        else if (strcmp(argv[i], "--json") == 0) {
+            suite.format = FORMAT_JSON;
+        }
+        else if (argv[i][0] != '-') {
+            suite.filter = argv[i];
+        }
+        else {
+            fprintf(stderr, "usage: %s [--csv | --json] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+#ifdef SN_USE_MEMORY
+    bool memory = true;
+#else
+    bool memory = false;
+#endif
+    if (!counters_check_()) {
+        fprintf(stderr, "%s: the library does not allocate through the counters; build it with the flag of this file\n", argv[0]);
+        return 1;
+    }
+#ifdef SN_USE_MEMORY
+    SN_UINT plan_allocation_count = plan_allocation_count_(256, 64);
+    if (plan_allocation_count != 0) {
+        fprintf(stderr, "%s: a steady run of a plan allocated %ju times\n", argv[0], (uintmax_t)plan_allocation_count);
+        return 1;
+    }
+#endif
+
+    switch (suite.format) {
+    case FORMAT_TABLE:
+        printf("SN_FLOAT is %zu bytes, micro-kernel is %s, allocations are %s\n",
+               sizeof(SN_FLOAT), sn_gemm_isa_name(sn_gemm_get_isa()), memory ? "counted by sinae_memory.h" : "counted by the allocation hook");
+        break;
+    case FORMAT_CSV:
+        printf("group,name,ns_per_op,gflops,gbps,allocations_per_op,allocated_bytes_per_op,ops_per_batch\n");
+        break;
+    case FORMAT_JSON:
+        printf("{\n  \"timestamp\": %jd,\n  \"float_bytes\": %zu,\n  \"isa\": \"%s\",\n  \"memory_accounting\": %s,\n  \"results\": [",
+               (intmax_t)time(NULL), sizeof(SN_FLOAT), sn_gemm_isa_name(sn_gemm_get_isa()), memory ? "true" : "false");
+        break;
+    }
+
+    SN_UINT squares[] = { 64, 256, 512 };
+    for (SN_UINT i = 0; i < sizeof(squares) / sizeof(squares[0]); ++i) {
+        benchmark_gmatmul_(&suite, squares[i], squares[i], squares[i]);
+    }
+    benchmark_gmatmul_(&suite, 1024, 64, 1024);
+    benchmark_gmatmul_(&suite, 64, 1024, 64);
+    benchmark_gmatmul_(&suite, 1024, 1024, 1);
+
+    SN_UINT sizes[] = { 1024, 1048576 };
+    for (SN_UINT i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        benchmark_ops_(&suite, sizes[i]);
+    }
+
+    SN_UINT key_counts[] = { 1000, 100000 };
+    for (SN_UINT i = 0; i < sizeof(key_counts) / sizeof(key_counts[0]); ++i) {
+        benchmark_map_(&suite, key_counts[i]);
+    }
+
+    benchmark_file_(&suite, 1048576);
+    benchmark_file_(&suite, 16777216);
+
+    benchmark_mlp_(&suite, 256, 64);
+    benchmark_reduce_(&suite, 1024, 1024);
+    benchmark_chain_(&suite, 256, 1000);
+    benchmark_redundant_(&suite, 256, 1000);
+    benchmark_fan_in_(&suite, 256, 4096);
+    benchmark_deep_(&suite, 333333);
+    benchmark_graph_file_(&suite, 1000);
+    benchmark_graph_file_(&suite, 10000);
+    benchmark_jvp_(&suite, 256, 1000, 1);
+    benchmark_jvp_(&suite, 256, 1000, 8);
+
+    if (suite.format == FORMAT_JSON) {
+        printf("\n  ]\n}\n");
+    }
+    return 0;
+}
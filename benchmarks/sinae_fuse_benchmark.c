@@ -0,0 +1,118 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Measures two chains and their sums before and after sn_opt_fuse(), through plans so that only the operators are timed:
+// - "exp": negative(exp(abs(add(a, b)))), whose time goes to exp() at every size, so fusion saves little.
+// - "mul": negative(abs(multiply(add(a, b), b))), which is bound by memory once the arrays leave the cache.
+// A fused chain reads a and b once and writes only its result, so the bandwidth is counted as three arrays,
+// or two with the sum. Each time is the best of several runs.
+// If the library and this file are built with -DSN_USE_MEMORY, the runs of plans are also checked not to allocate,
+// including a partially broadcasted input, which is gathered by the fused operator.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static sn_op* chain_(sn_op* a, sn_op* b, bool is_exp, bool reduction) {
+    sn_op* y = is_exp ? sn_negative(sn_exp(sn_abs(sn_add(a, b)))) : sn_negative(sn_abs(sn_multiply(sn_add(a, b), b)));
+    return reduction ? sn_sum(y) : y;
+}
+
+static double time_ns_(sn_op* root, sn_op* a, sn_op* b, const sn_mda* inputs[], SN_UINT repeat, SN_FLOAT* checksum) {
+    sn_plan* plan = sn_plan_compile(root, 2, SN_TEMP_ARRAY(sn_op*, a, b), inputs);
+    sn_plan_run(plan, inputs);
+    double best = 0.0;
+    for (SN_UINT r = 0; r < repeat; ++r) {
+        double start = now_ns_();
+        *checksum += sn_plan_run(plan, inputs)->ptr[0];
+        double elapsed = now_ns_() - start;
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    sn_plan_destroy(plan);
+    return best;
+}
+
+static void benchmark_(SN_UINT size, bool is_exp, bool reduction) {
+    sn_mda* va = sn_mda_create(1, &size);
+    sn_mda* vb = sn_mda_create(1, &size);
+    for (SN_UINT i = 0; i < size; ++i) {
+        va->ptr[i] = (SN_FLOAT)(i % 17) / 17.0;
+        vb->ptr[i] = (SN_FLOAT)(i % 13) / -13.0;
+    }
+    const sn_mda* inputs[] = { va, vb };
+    SN_UINT repeat = (size < 1048576) ? 200 : 20;
+    SN_FLOAT checksum = 0.0;
+
+    sn_op* a = sn_placeholder();
+    sn_op* b = sn_placeholder();
+    sn_op* root = chain_(a, b, is_exp, reduction);
+    double unfused_ns = time_ns_(root, a, b, inputs, repeat, &checksum);
+    root = sn_opt_fuse(root);
+    double fused_ns = time_ns_(root, a, b, inputs, repeat, &checksum);
+    sn_op_destroy(root);
+
+    double bytes = (double)((reduction ? 2 : 3) * size * sizeof(SN_FLOAT));
+    printf("%s %10ju elements%s: unfused %9.3f ms, fused %9.3f ms (%5.2fx, %6.2f GB/s) (checksum %.3e)\n",
+           is_exp ? "exp" : "mul", (uintmax_t)size, reduction ? " + sum" : "      ", unfused_ns * 1e-6, fused_ns * 1e-6,
+           unfused_ns / fused_ns, bytes / fused_ns, (double)checksum);
+
+    sn_mda_destroy(va);
+    sn_mda_destroy(vb);
+}
+
+#ifdef SN_USE_MEMORY
+// Returns the number of allocations of a run of the chain with b broadcasted along the columns of a, before and after fusion.
+static SN_UINT plan_allocation_count_(bool reduction) {
+    sn_mda* va = sn_mda_full(2, SN_SHAPE(64, 1024), 0.5);
+    sn_mda* vb = sn_mda_full(2, SN_SHAPE(64, 1), -0.25);
+    const sn_mda* inputs[] = { va, vb };
+    sn_op* a = sn_placeholder();
+    sn_op* b = sn_placeholder();
+    sn_op* root = chain_(a, b, true, reduction);
+    SN_UINT allocation_count = 0;
+    for (SN_UINT fused = 0; fused < 2; ++fused) {
+        if (fused) {
+            root = sn_opt_fuse(root);
+        }
+        sn_plan* plan = sn_plan_compile(root, 2, SN_TEMP_ARRAY(sn_op*, a, b), inputs);
+        sn_plan_run(plan, inputs);
+        sn_memory_reset();
+        sn_plan_run(plan, inputs);
+        allocation_count += sn_memory_query().allocation_count;
+        sn_plan_destroy(plan);
+    }
+    sn_op_destroy(root);
+    sn_mda_destroy(va);
+    sn_mda_destroy(vb);
+    return allocation_count;
+}
+#endif
+
+
+int main(void) {
+#ifdef SN_USE_MEMORY
+    SN_UINT allocation_count = plan_allocation_count_(false) + plan_allocation_count_(true);
+    printf("allocations in runs of plans: %ju\n", (uintmax_t)allocation_count);
+    if (allocation_count != 0) {
+        return 1;
+    }
+#endif
+    SN_UINT sizes[] = { 4096, 65536, 1048576, 16777216 };
+    for (SN_UINT k = 0; k < 2; ++k) {
+        for (SN_UINT i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+            benchmark_(sizes[i], k == 0, false);
+            benchmark_(sizes[i], k == 0, true);
+        }
+    }
+    return 0;
+}
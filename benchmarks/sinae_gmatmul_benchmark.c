@@ -0,0 +1,89 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Measures sn_mda_gmatmul on square matrices with every micro-kernel the CPU supports,
+// against the naive triple loop which sn_mda_gmatmul used to be.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void naive_gmatmul_(const sn_mda* x0, const sn_mda* x1, sn_mda* y) {
+    SN_UINT rows = x0->shape[0];
+    SN_UINT overwrap_size = x0->shape[1];
+    SN_UINT columns = x1->shape[1];
+    for (SN_UINT j = 0; j < columns; ++j) {
+        for (SN_UINT i = 0; i < rows; ++i) {
+            SN_FLOAT temp_sum = 0;
+            for (SN_UINT k = 0; k < overwrap_size; ++k) {
+                temp_sum += SN_MATRIX_GET(x0->ptr, rows, i, k) * SN_MATRIX_GET(x1->ptr, overwrap_size, k, j);
+            }
+            SN_MATRIX_GET(y->ptr, rows, i, j) = temp_sum;
+        }
+    }
+}
+
+// Returns the best time of several repeats in ns.
+static double time_gmatmul_(const sn_mda* x0, const sn_mda* x1, sn_mda* y, bool naive) {
+    double best = 0.0;
+    for (SN_UINT r = 0; r < 5; ++r) {
+        double start = now_ns_();
+        if (naive) {
+            naive_gmatmul_(x0, x1, y);
+        }
+        else {
+            sn_mda_gmatmul_into(x0, x1, 1, y);
+        }
+        double elapsed = now_ns_() - start;
+        if (r == 0 || elapsed < best) {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+static void benchmark_(SN_UINT size) {
+    sn_mda* x0 = sn_mda_create(2, SN_SHAPE(size, size));
+    sn_mda* x1 = sn_mda_create(2, SN_SHAPE(size, size));
+    sn_mda* y = sn_mda_create(2, SN_SHAPE(size, size));
+    for (SN_UINT i = 0; i < size * size; ++i) {
+        x0->ptr[i] = (SN_FLOAT)((i * 7) % 13) / 13;
+        x1->ptr[i] = (SN_FLOAT)((i * 5) % 11) / 11;
+    }
+    double flop = 2.0 * (double)size * (double)size * (double)size;
+
+    double naive_ns = time_gmatmul_(x0, x1, y, true);
+    printf("%5ju x %-5ju %-8s %10.3f ms %8.2f GFLOP/s\n", (uintmax_t)size, (uintmax_t)size, "naive", naive_ns / 1e6, flop / naive_ns);
+
+    sn_gemm_isa default_isa = sn_gemm_get_isa();
+    for (sn_gemm_isa isa = GEMM_SCALAR; isa <= GEMM_AVX512; ++isa) {
+        if (!sn_gemm_set_isa(isa)) {
+            continue;
+        }
+        double ns = time_gmatmul_(x0, x1, y, false);
+        printf("%5ju x %-5ju %-8s %10.3f ms %8.2f GFLOP/s %7.1fx\n",
+            (uintmax_t)size, (uintmax_t)size, sn_gemm_isa_name(isa), ns / 1e6, flop / ns, naive_ns / ns);
+    }
+    sn_gemm_set_isa(default_isa);
+
+    sn_mda_destroy(y);
+    sn_mda_destroy(x1);
+    sn_mda_destroy(x0);
+}
+
+
+int main(void) {
+    printf("SN_FLOAT is %zu bytes, default micro-kernel is %s\n", sizeof(SN_FLOAT), sn_gemm_isa_name(sn_gemm_get_isa()));
+    SN_UINT sizes[] = { 64, 128, 256, 512 };
+    for (SN_UINT i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        benchmark_(sizes[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Measures the memory and the time of a deep stack of layers y = sqrt(abs(W * x + x)) with a final sum.
+// Keeping every intermediate grows with the depth, while releasing dead values keeps a couple of buffers.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void benchmark_(SN_UINT width, SN_UINT batch, SN_UINT depth) {
+    sn_op* x = sn_placeholder();
+    sn_mda* vw = sn_mda_create(2, SN_SHAPE(width, width));
+    for (SN_UINT i = 0; i < width * width; ++i) {
+        vw->ptr[i] = (SN_FLOAT)((i * 7) % 11) / (11.0 * (SN_FLOAT)width);
+    }
+    sn_op* w = sn_const(vw);
+    sn_op* y = x;
+    for (SN_UINT l = 0; l < depth; ++l) {
+        y = sn_sqrt(sn_abs(sn_add(sn_matmul(w, y, 1), y)));
+    }
+    y = sn_sum(y);
+    sn_mda* vx = sn_mda_full(2, SN_SHAPE(width, batch), 0.5);
+
+    // The first pass keeps every value, as sn_op_flow() used to.
+    double start = now_ns_();
+    sn_mda* y0 = sn_op_pflow(y, sn_map_from(1, x, sn_mda_copy(vx)), 2);
+    double keep_ns = now_ns_() - start;
+    sn_flow_stats stats;
+    start = now_ns_();
+    sn_mda* y1 = sn_op_mflow(y, sn_map_from(1, x, sn_mda_copy(vx)), &stats);
+    double live_ns = now_ns_() - start;
+    sn_plan* plan = sn_plan_compile(y, 1, &x, SN_TEMP_ARRAY(const sn_mda*, vx));
+
+    printf("%4ju layers of %4jux%-4ju: flow peak %9.2f MB of %9.2f MB (%ju in place, %ju reused, %7.2f ms vs %7.2f ms), plan %9.2f MB of %9.2f MB (checksum %.6e)\n",
+           (uintmax_t)depth, (uintmax_t)width, (uintmax_t)batch, (double)stats.peak_bytes * 1e-6, (double)stats.total_bytes * 1e-6,
+           (uintmax_t)stats.in_place_count, (uintmax_t)stats.reuse_count, live_ns * 1e-6, keep_ns * 1e-6,
+           (double)plan->buffer_bytes * 1e-6, (double)plan->value_bytes * 1e-6, (double)(y1->ptr[0] - y0->ptr[0]));
+
+    sn_plan_destroy(plan);
+    sn_mda_destroy(y1);
+    sn_mda_destroy(y0);
+    sn_mda_destroy(vx);
+    sn_op_destroy(y);
+}
+
+
+int main(void) {
+    SN_UINT depths[] = { 4, 16, 64 };
+    for (SN_UINT i = 0; i < sizeof(depths) / sizeof(depths[0]); ++i) {
+        benchmark_(256, 256, depths[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,62 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Measures sn_map_insert and sn_map_get at several key counts.
+// Constant time per operation means the numbers stay flat as the key count grows.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void benchmark_(SN_UINT key_count) {
+    // Keys only need to be distinct pointers, so placeholders are used as they are.
+    sn_op** keys = SN_DYNAMIC_ARRAY(sn_op*, key_count);
+    sn_mda** values = SN_DYNAMIC_ARRAY(sn_mda*, key_count);
+    for (SN_UINT i = 0; i < key_count; ++i) {
+        keys[i] = sn_placeholder();
+        values[i] = sn_mda_full(0, NULL, (SN_FLOAT)i);
+    }
+
+    double start = now_ns_();
+    sn_map* map = sn_map_create(1, NULL, NULL);
+    for (SN_UINT i = 0; i < key_count; ++i) {
+        sn_map_insert(map, keys[i], values[i]);
+    }
+    double insert_ns = (now_ns_() - start) / (double)key_count;
+
+    // Visits the keys in a scattered order so that the lookups do not follow the insertion order.
+    SN_UINT repeat = 10;
+    SN_FLOAT checksum = 0.0;
+    start = now_ns_();
+    for (SN_UINT r = 0; r < repeat; ++r) {
+        for (SN_UINT i = 0; i < key_count; ++i) {
+            checksum += sn_map_get(map, keys[(i * 7919) % key_count])->ptr[0];
+        }
+    }
+    double get_ns = (now_ns_() - start) / (double)(repeat * key_count);
+
+    printf("%10ju keys: insert %8.1f ns/op, get %8.1f ns/op (checksum %.0f)\n", (uintmax_t)key_count, insert_ns, get_ns, (double)checksum);
+
+    sn_map_destroy(map);
+    for (SN_UINT i = 0; i < key_count; ++i) {
+        sn_op_destroy(keys[i]);
+    }
+    SN_FREE(values);
+    SN_FREE(keys);
+}
+
+
+int main(void) {
+    SN_UINT key_counts[] = { 100, 1000, 10000, 100000 };
+    for (SN_UINT i = 0; i < sizeof(key_counts) / sizeof(key_counts[0]); ++i) {
+        benchmark_(key_counts[i]);
+    }
+    return 0;
+}
@@ -0,0 +1,101 @@
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <time.h>
+
+#include "../sinae/sinae.h"
+
+
+// Measures a transpose, a slice and a broadcast as views against copying them,
+// and a matrix plus a column vector broadcasted by sn_add() against adding an expanded copy of the vector.
+
+static double now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static void benchmark_views_(SN_UINT rows, SN_UINT columns, SN_UINT repeat) {
+    sn_mda* x = sn_mda_full(2, SN_SHAPE(rows, columns), 1.0);
+    sn_mda* column = sn_mda_full(1, &rows, 2.0);
+    sn_view* view = sn_view_create(x);
+    sn_view* column_view = sn_view_create(column);
+    double view_ns[3] = { 0.0, 0.0, 0.0 };
+    double copy_ns[3] = { 0.0, 0.0, 0.0 };
+    SN_FLOAT checksum = 0.0;
+    for (SN_UINT r = 0; r < repeat; ++r) {
+        for (SN_UINT k = 0; k < 3; ++k) {
+            double start = now_ns_();
+            sn_view* derived = (k == 0) ? sn_view_transpose(view, NULL)
+                             : (k == 1) ? sn_view_slice(view, 1, 0, columns, 2)
+                             : sn_view_broadcast(column_view, 2, SN_SHAPE(rows, columns));
+            double middle = now_ns_();
+            sn_mda* copy = sn_view_to_mda(derived);
+            double end = now_ns_();
+            view_ns[k] += middle - start;
+            copy_ns[k] += end - middle;
+            checksum += copy->ptr[sn_mda_size(copy) - 1];
+            sn_mda_destroy(copy);
+            sn_view_destroy(derived);
+        }
+    }
+    const char* names[3] = { "transpose", "slice    ", "broadcast" };
+    for (SN_UINT k = 0; k < 3; ++k) {
+        printf("%5jux%-5ju %s: view %9.3f us, copy %9.3f us (checksum %.3e)\n",
+               (uintmax_t)rows, (uintmax_t)columns, names[k], view_ns[k] / (double)repeat * 1e-3, copy_ns[k] / (double)repeat * 1e-3, (double)checksum);
+    }
+    sn_view_destroy(column_view);
+    sn_view_destroy(view);
+    sn_mda_destroy(column);
+    sn_mda_destroy(x);
+}
+
+static double time_add_ns_(const sn_mda* x, const sn_mda* column, SN_UINT repeat, SN_FLOAT* checksum) {
+    sn_op* a = sn_placeholder();
+    sn_op* b = sn_placeholder();
+    sn_op* y = sn_add(a, b);
+    const sn_mda* inputs[] = { x, column };
+    sn_plan* plan = sn_plan_compile(y, 2, SN_TEMP_ARRAY(sn_op*, a, b), inputs);
+    sn_plan_run(plan, inputs);
+    double start = now_ns_();
+    for (SN_UINT r = 0; r < repeat; ++r) {
+        *checksum += sn_plan_run(plan, inputs)->ptr[0];
+    }
+    double ns = (now_ns_() - start) / (double)repeat;
+    sn_plan_destroy(plan);
+    sn_op_destroy(y);
+    return ns;
+}
+
+static void benchmark_add_(SN_UINT rows, SN_UINT columns, SN_UINT repeat) {
+    sn_mda* x = sn_mda_full(2, SN_SHAPE(rows, columns), 1.0);
+    sn_mda* column = sn_mda_full(1, &rows, 2.0);
+    SN_FLOAT checksum = 0.0;
+    double broadcasted_ns = time_add_ns_(x, column, repeat, &checksum);
+
+    double start = now_ns_();
+    sn_view* column_view = sn_view_create(column);
+    sn_view* broadcasted = sn_view_broadcast(column_view, 2, SN_SHAPE(rows, columns));
+    sn_mda* expanded = sn_view_to_mda(broadcasted);
+    double expand_ns = now_ns_() - start;
+    double expanded_ns = time_add_ns_(x, expanded, repeat, &checksum);
+
+    printf("%5jux%-5ju + column: broadcasted %9.3f us, expanded %9.3f us + %9.3f us to expand (checksum %.3e)\n",
+           (uintmax_t)rows, (uintmax_t)columns, broadcasted_ns * 1e-3, expanded_ns * 1e-3, expand_ns * 1e-3, (double)checksum);
+    sn_mda_destroy(expanded);
+    sn_view_destroy(broadcasted);
+    sn_view_destroy(column_view);
+    sn_mda_destroy(column);
+    sn_mda_destroy(x);
+}
+
+
+int main(void) {
+    SN_UINT sizes[] = { 64, 256, 1024, 4096 };
+    for (SN_UINT i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+        SN_UINT repeat = (sizes[i] < 1024) ? 100 : 10;
+        benchmark_views_(sizes[i], sizes[i], repeat);
+        benchmark_add_(sizes[i], sizes[i], repeat);
+    }
+    return 0;
+}
@@ -41,16 +41,36 @@ static sn_mda* add_and_sum_flow_(sn_op* self, const sn_mda* x[]) {
 //  [ { dy/x0[0], dy/x0[1], dy/x0[2], dy/x0[3], dy/x0[4] },
 //    { dy/x1[0], dy/x1[1], dy/x1[2], dy/x1[3], dy/x1[4] } ]
 
-static sn_mda** add_and_sum_dflow_(sn_op* self, const sn_mda* x[]) {
-    sn_mda** dy_dx_list = SN_DYNAMIC_ARRAY(sn_mda*, 2);
-    dy_dx_list[0] = sn_mda_full(1, x[0]->shape, 1.0);
-    dy_dx_list[1] = sn_mda_full(1, x[0]->shape, 1.0);
+//
+// Jacobians are returned as sn_jac so that their structure is kept.
+// Every element of dy/dx0 and dy/dx1 is 1, so both are BROADCAST Jacobians.
+// sn_jac_dense() wraps a dense sn_mda in the shape described above.
+
+static sn_jac** add_and_sum_dflow_(sn_op* self, const sn_mda* x[]) {
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 2);
+    dy_dx_list[0] = sn_jac_broadcast(0, NULL, x[0]->rank, x[0]->shape, 1.0);
+    dy_dx_list[1] = sn_jac_broadcast(0, NULL, x[1]->rank, x[1]->shape, 1.0);
     return dy_dx_list;
 }
 
+// Vector-Jacobian product used by reverse-mode differentiation.
+// dx[i] is NULL when the gradient of the i-th input is not required.
+static void add_and_sum_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_UINT size = sn_mda_size(x[0]);
+    for (SN_UINT i = 0; i < 2; ++i) {
+        if (dx[i]) {
+            for (SN_UINT j = 0; j < size; ++j) {
+                dx[i]->ptr[j] += dy->ptr[0];
+            }
+        }
+    }
+}
+
 // Adds two sn_mda in the same shape and returns sum in a scalar.
 sn_op* add_and_sum(sn_op* x0, sn_op* x1) {
-    return sn_op_create(OPERATOR, &add_and_sum_flow_, &add_and_sum_dflow_, 2, SN_TEMP_ARRAY(sn_op*, x0, x1));
+    sn_op* obj = sn_op_create(OPERATOR, &add_and_sum_flow_, &add_and_sum_dflow_, 2, SN_TEMP_ARRAY(sn_op*, x0, x1));
+    sn_op_set_vjp(obj, &add_and_sum_vjp_);
+    return obj;
 }
 
 
@@ -60,8 +80,15 @@ int main(void) {
     // Creates placeholders and operators.
     sn_op* placeholder0 = sn_placeholder();
     sn_op* placeholder1 = sn_placeholder();
-    sn_op* op = add_and_sum(placeholder0, placeholder1);
-    op = sn_negative(op);
+    sn_op* sum = add_and_sum(placeholder0, placeholder1);
+    sn_op* op = sn_negative(sum);
+
+    // Registers the custom operator so that graphs using it can be saved and loaded.
+    // Any operator of the kind serves as the prototype, since only its functions are copied.
+    if (!sn_op_register("add_and_sum", sum, 0)) {
+        fprintf(stderr, "add_and_sum cannot be registered\n");
+        return 1;
+    }
 
     // Creates a sn_mda for input.
     sn_mda* mda0 = sn_mda_full(1, (SN_UINT[]) { 5 }, 5.0);
@@ -70,14 +97,33 @@ int main(void) {
     // Evaluates the expression.
     // sn_op_flow destroys the sn_map objects.
     sn_mda* result = sn_op_flow(op, sn_map_from(2, placeholder0, sn_mda_copy(mda0), placeholder1, sn_mda_copy(mda1)));
-    printf("result: rank = %u, value = %f\n", result->rank, result->ptr[0]);
+    printf("result: rank = %ju, value = %f\n", (uintmax_t)result->rank, result->ptr[0]);
+    sn_mda_destroy(result);
+
+    /* Saving and loading a graph with the custom operator */
+
+    // The placeholders are saved by their order in the list and given back in the same order by sn_op_load().
+    sn_op* loaded_placeholders[2];
+    sn_op* loaded = NULL;
+    if (sn_op_save(op, 2, SN_TEMP_ARRAY(sn_op*, placeholder0, placeholder1), 0, NULL, NULL, "add_and_sum.sngrf")) {
+        loaded = sn_op_load("add_and_sum.sngrf", 2, loaded_placeholders);
+        remove("add_and_sum.sngrf");
+    }
+    if (loaded == NULL) {
+        fprintf(stderr, "the graph cannot be saved or loaded\n");
+        return 1;
+    }
+    result = sn_op_flow(loaded, sn_map_from(2, loaded_placeholders[0], sn_mda_copy(mda0), loaded_placeholders[1], sn_mda_copy(mda1)));
+    printf("loaded result: rank = %ju, value = %f\n", (uintmax_t)result->rank, result->ptr[0]);
+    sn_mda_destroy(result);
+    sn_op_unload(loaded);
 
     // Calculates the gradient of the expression.
     sn_map* gradient_map = sn_op_dflow(op, sn_map_from(2, placeholder0, mda0, placeholder1, mda1));
     sn_mda* gradient0 = sn_map_get(gradient_map, placeholder0);
     sn_mda* gradient1 = sn_map_get(gradient_map, placeholder1);
-    printf("gradient0: rank = %u, value = { %f, %f, %f, %f, %f }\n", gradient0->rank, gradient0->ptr[0], gradient0->ptr[1], gradient0->ptr[2], gradient0->ptr[3], gradient0->ptr[4]);
-    printf("gradient1: rank = %u, value = { %f, %f, %f, %f, %f }\n", gradient1->rank, gradient1->ptr[0], gradient1->ptr[1], gradient1->ptr[2], gradient1->ptr[3], gradient1->ptr[4]);
+    printf("gradient0: rank = %ju, value = { %f, %f, %f, %f, %f }\n", (uintmax_t)gradient0->rank, gradient0->ptr[0], gradient0->ptr[1], gradient0->ptr[2], gradient0->ptr[3], gradient0->ptr[4]);
+    printf("gradient1: rank = %ju, value = { %f, %f, %f, %f, %f }\n", (uintmax_t)gradient1->rank, gradient1->ptr[0], gradient1->ptr[1], gradient1->ptr[2], gradient1->ptr[3], gradient1->ptr[4]);
     
     // Destroys every associated operator.
     sn_op_destroy(op);
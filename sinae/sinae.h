@@ -11,7 +11,20 @@
 #ifndef SINAE_H_INCLUDED_
 #define SINAE_H_INCLUDED_
 
+#include "sinae_arena.h"
+#include "sinae_batch.h"
 #include "sinae_core.h"
+#include "sinae_file.h"
+#include "sinae_forward.h"
+#include "sinae_gemm.h"
+#include "sinae_graph.h"
+#include "sinae_jac.h"
+#include "sinae_memory.h"
 #include "sinae_op.h"
+#include "sinae_opt.h"
+#include "sinae_plan.h"
+#include "sinae_profile.h"
+#include "sinae_thread.h"
+#include "sinae_view.h"
 
 #endif // !SINAE_H_INCLUDED_
\ No newline at end of file
@@ -0,0 +1,87 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_arena.h
+//! \brief This file includes a bump allocator for per-evaluation temporaries.
+
+#ifndef SINAE_ARENA_H_INCLUDED_
+#define SINAE_ARENA_H_INCLUDED_
+
+#include <stdbool.h>
+
+#include "sinae_core.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_ARENA_ALIGNMENT
+    //! \brief Overridable alignment in bytes of every allocation from sn_arena. Must be a power of two.
+    #define SN_ARENA_ALIGNMENT 16
+#endif // !SN_ARENA_ALIGNMENT
+
+
+/* Forward declarations */
+
+//! \ingroup arena_group
+typedef struct sn_arena_st sn_arena;
+
+//! \ingroup arena_group
+typedef struct sn_arena_chunk_st sn_arena_chunk;
+
+
+/* struct sn_arena_st */
+
+//! \defgroup arena_group Arena allocator (sn_arena)
+//! \brief    Provides a bump allocator whose allocations are released all at once by sn_arena_reset().
+//!
+//! \details  If "SN_USE_ARENA" is defined, SN_MALLOC and SN_FREE allocate from the arena bound by sn_arena_bind().
+//!           sn_op_aflow() and sn_op_adflow() bind an arena for the whole evaluation, copy the results to the heap
+//!           and reset the arena, so all temporaries of one evaluation cost a single reset.
+//!           Without "SN_USE_ARENA", the arena can still be used directly through sn_arena_alloc().
+//!
+//! \{
+
+struct sn_arena_chunk_st {
+    sn_arena_chunk* next; //!< Next chunk.
+    SN_UINT capacity;     //!< Number of usable bytes.
+    SN_UINT used;         //!< Number of used bytes.
+    unsigned char* ptr;   //!< Aligned pointer to the usable bytes.
+};
+
+struct sn_arena_st {
+    sn_arena_chunk* chunks;   //!< Chunks. The first one is the current one.
+    SN_UINT chunk_size;       //!< Minimum capacity of a new chunk.
+    SN_UINT allocation_count; //!< Number of allocations since the last reset.
+    SN_UINT allocated_bytes;  //!< Number of bytes allocated since the last reset.
+    SN_UINT peak_bytes;       //!< Largest \p allocated_bytes ever reached.
+    SN_UINT reserved_bytes;   //!< Number of bytes reserved from the heap.
+};
+
+//! \brief Creates a sn_arena object whose first chunk has \p chunk_size bytes. Returns NULL if the object cannot be allocated.
+sn_arena* sn_arena_create(SN_UINT chunk_size);
+//! \brief Destroys the object and every chunk.
+void sn_arena_destroy(sn_arena* self);
+//! \brief Allocates \p size bytes aligned to SN_ARENA_ALIGNMENT.
+void* sn_arena_alloc(sn_arena* self, SN_UINT size);
+//! \brief   Releases every allocation at once.
+//! \details If the last evaluation needed several chunks, they are merged into one so that the next one fits.
+void sn_arena_reset(sn_arena* self);
+//! \brief Returns true if \p ptr was allocated from the object.
+bool sn_arena_owns(const sn_arena* self, const void* ptr);
+//! \brief   Binds the object to SN_MALLOC and SN_FREE of the calling thread and returns the previously bound one. NULL unbinds.
+//! \details The binding is process-wide instead if the compiler has no thread-local storage for SN_THREAD_LOCAL.
+sn_arena* sn_arena_bind(sn_arena* self);
+
+//! \brief Calculates a symbolic expression with temporaries from \p arena and destroys the \p feed. The result is on the heap.
+sn_mda* sn_op_aflow(sn_op* self, sn_map* feed, sn_arena* arena);
+//! \brief Calculates a gradient of symbolic expression with temporaries from \p arena and destroys the \p feed. The result is on the heap.
+sn_map* sn_op_adflow(sn_op* self, sn_map* feed, sn_arena* arena);
+
+//! \}
+
+
+#endif // !SINAE_ARENA_H_INCLUDED_
@@ -0,0 +1,42 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_batch.h
+//! \brief This file includes batched evaluation of one expression over many feeds.
+
+#ifndef SINAE_BATCH_H_INCLUDED_
+#define SINAE_BATCH_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Batched evaluation */
+
+//! \defgroup batch_group Batched evaluation
+//! \brief    Provides sn_op_flow() and sn_op_dflow() over \p batch_count feeds in a single traversal.
+//!
+//! \details  The values of each placeholder are stacked along a new last axis, so that every sample is contiguous,
+//!           and every operator runs once over the whole batch through its \p bflow and \p bvjp.
+//!           Nodes which do not depend on any placeholder are evaluated once and shared by every sample.
+//!           Operators without \p bflow or \p bvjp are evaluated sample by sample.
+//!
+//! \{
+
+//! \brief   Calculates a symbolic expression for each feed and destroys the \p feeds.
+//! \details Returns a dynamically allocated array of \p batch_count results.
+//!          Returns NULL if \p batch_count is zero or a feed does not give a placeholder of the expression in the shape
+//!          of the first feed.
+sn_mda** sn_op_bflow(sn_op* self, SN_UINT batch_count, sn_map* feeds[]);
+//! \brief   Calculates a gradient of symbolic expression for each feed and destroys the \p feeds.
+//! \details Returns a dynamically allocated array of \p batch_count maps from placeholders to gradients.
+//!          The expression must be a scalar for each sample. Returns NULL for the feeds which sn_op_bflow() rejects.
+sn_map** sn_op_bdflow(sn_op* self, SN_UINT batch_count, sn_map* feeds[]);
+
+//! \}
+
+
+#endif // !SINAE_BATCH_H_INCLUDED_
@@ -13,6 +13,7 @@
 
 #include <stdbool.h>
 
+#include "sinae_jac.h"
 #include "sinae_macro.h"
 #include "sinae_mda.h"
 
@@ -30,13 +31,21 @@ typedef struct sn_op_st sn_op;
 
 //! \defgroup hashed_multimap_group Hashed multimap (sn_map)
 //! \brief    Provides a hashed multimap object where { key: sn_op*, value: sn_mda* }.
+//!
+//! \details  Key-value pairs are stored in the insertion order in \p keys and \p values.
+//!           An open-addressing table on the sn_op* key indexes the first pair of every key, and the pairs
+//!           of the same key are chained through \p next, so lookups take constant time on average.
+//!
 //! \{
 
 struct sn_map_st {
-    SN_UINT capacity;
-    SN_UINT count;
-    sn_op** keys;
-    sn_mda** values;
+    SN_UINT capacity;       //!< Number of pairs which can be stored without extension.
+    SN_UINT count;          //!< Number of stored pairs.
+    sn_op** keys;           //!< Keys in the insertion order.
+    sn_mda** values;        //!< Values in the insertion order.
+    SN_UINT* next;          //!< Index + 1 of the next pair with the same key. Zero terminates the chain.
+    SN_UINT table_capacity; //!< Capacity of the hash table. Always a power of two.
+    SN_UINT* table;         //!< Index + 1 of the first and the last pair of each key, interleaved. Zero means empty.
 };
 
 //! \brief Creates a sn_map object.
@@ -45,14 +54,18 @@ sn_map* sn_map_create(SN_UINT capacity, sn_op* keys[], sn_mda* values[]);
 sn_map* sn_map_from(SN_UINT capacity, ... /* sn_op*, sn_mda*, ... */);
 //! \brief Destroys the object.
 void sn_map_destroy(sn_map* self);
+//! \brief Destroys the object but not its values, which are borrowed from the caller.
+void sn_map_release(sn_map* self);
 //! \brief Extend the capacity of the object preserving the values.
 void sn_map_extend(sn_map* self, SN_UINT offset);
 //! \brief Inserts an key-value pair to the object. Increases the capacity by double if the capacity is exhausted.
 void sn_map_insert(sn_map* self, sn_op* key, sn_mda* value);
 //! \brief Returns the first value associated with the key.
 sn_mda* sn_map_get(sn_map* self, sn_op* key);
-//! \brief Returns a dynamically allocated array of all values associated with the key.
+//! \brief Returns a dynamically allocated array of all values associated with the key in the insertion order.
 sn_mda** sn_map_get_all(sn_map* self, sn_op* key);
+//! \brief Returns the number of values associated with the key.
+SN_UINT sn_map_count(const sn_map* self, const sn_op* key);
 
 //! \}
 
@@ -63,13 +76,54 @@ sn_mda** sn_map_get_all(sn_map* self, sn_op* key);
 //! \brief    Provides a symbolic calculation operator object.
 //!
 //! \details  Currently, sn_op can have multiple inputs but only a single output.
+//!           If "SN_USE_MEMORY" is defined and the budget of sn_memory_set_budget() is exceeded,
+//!           evaluations and their gradients return NULL after releasing their temporaries.
 //!
 //! \{
 
 //! \brief Function type which evaluates operators.
 typedef sn_mda* sn_flow_fn(sn_op* op, const sn_mda* x[]);
-//! \brief Function type which calculates gradients.
-typedef sn_mda* sn_dflow_fn(sn_op* op, const sn_mda* x[]);
+//! \brief   Function type which calculates gradients.
+//! \details Returns a dynamically allocated list of structured Jacobians, one for each input.
+typedef sn_jac** sn_dflow_fn(sn_op* op, const sn_mda* x[]);
+//! \brief   Function type which calculates vector-Jacobian products.
+//! \details Accumulates \p dy times the Jacobian of \p y with respect to each input into \p dx.
+//!          \p dx[i] has the shape of \p x[i] and is NULL if the gradient of the input is not required.
+typedef void sn_vjp_fn(sn_op* op, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]);
+//! \brief   Function type which evaluates operators into a preallocated output.
+//! \details \p y already has the shape which \p sn_flow_fn would return for the same inputs.
+typedef void sn_kernel_fn(sn_op* op, const sn_mda* x[], sn_mda* y);
+//! \brief   Function type which evaluates operators over a batch.
+//! \details A batched value has the shape of a sample followed by \p batch_count, so samples are contiguous.
+//!          \p x_batched[i] is false if \p x[i] is shared by every sample. The output is always batched.
+typedef sn_mda* sn_bflow_fn(sn_op* op, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]);
+//! \brief   Function type which calculates vector-Jacobian products over a batch.
+//! \details \p y and \p dy are batched. \p dx[i] is batched, or NULL if the gradient of the input is not required.
+typedef void sn_bvjp_fn(sn_op* op, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]);
+//! \brief   Function type which calculates Jacobian-vector products for \p tangent_count tangents at once.
+//! \details \p dx[i] holds the tangents of \p x[i] in its shape followed by \p tangent_count, or is NULL if they are zero.
+//!          Accumulates the tangents of \p y into \p dy in the same layout.
+typedef void sn_jvp_fn(sn_op* op, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy);
+//! \brief   Function type which calculates the second-order term of Hessian-vector products.
+//! \details Accumulates the derivative of the vector-Jacobian product of \p dy along the tangents \p tx of the inputs into \p dx,
+//!          with \p dy held constant. \p tx[i] holds the elements of a tangent of \p x[i], or is NULL if it is zero.
+//!          \p dx[i] has the shape of \p x[i] and is NULL if the gradient of the input is not required.
+typedef void sn_hvp_fn(sn_op* op, const sn_mda* x[], const sn_mda* tx[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]);
+
+//! \brief   Function type which applies an element-wise operator to \p n elements.
+//! \details The element i of an input is at \p x0[ i * \p step0 ], so a step of 0 broadcasts a scalar. Unary operators ignore \p x1.
+typedef void sn_tile_fn(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1, SN_FLOAT y[]);
+//! \brief   Function type which accumulates the vector-Jacobian products of an element-wise operator over \p n elements.
+//! \details \p dx0 and \p dx1 are indexed like \p x0 and \p x1, and are NULL if the gradient of the input is not required.
+typedef void sn_tile_vjp_fn(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1,
+                            const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[]);
+
+//! \brief Describes an element-wise operator to the graph optimization passes.
+typedef struct sn_element_wise_st {
+    sn_tile_fn* flow;
+    sn_tile_vjp_fn* vjp;
+    bool reduction; //!< True if the operator sums its only input into a scalar. \p flow and \p vjp are NULL then.
+} sn_element_wise;
 
 //! \brief Enum type to distinguish the type of sn_op object.
 typedef enum sn_op_type_en {
@@ -83,24 +137,69 @@ struct sn_op_st {
     sn_op_type type;
     sn_flow_fn* flow;
     sn_dflow_fn* dflow;
+    sn_vjp_fn* vjp;       //!< Optional. Without it, gradients are accumulated through the \p dflow Jacobians.
+    sn_kernel_fn* kernel; //!< Optional. Set by operators which can be evaluated without allocation.
+    sn_bflow_fn* bflow;   //!< Optional. Without it, a batch is evaluated sample by sample.
+    sn_bvjp_fn* bvjp;     //!< Optional. Without it, a batch is differentiated sample by sample.
+    sn_jvp_fn* jvp;       //!< Optional. Without it, tangents are pushed through the \p dflow Jacobians.
+    sn_hvp_fn* hvp;       //!< Optional. Without it, the second-order term is a central difference of \p vjp.
+    const sn_element_wise* element_wise; //!< Optional. Set by operators which can be fused by sn_opt_fuse().
+    const char* name;     //!< Optional. Name of the kind of the operator, used by the profiler.
     SN_UINT x_count;
     sn_op* x[];
 };
 
+//! \brief Memory statistics of a forward pass.
+typedef struct sn_flow_stats_st {
+    SN_UINT peak_bytes;     //!< Largest number of bytes held at once by the outputs of operators, including released buffers kept for reuse.
+    SN_UINT total_bytes;    //!< Sum of the bytes of the outputs of every operator, which a pass keeping every value would hold.
+    SN_UINT in_place_count; //!< Number of operators which wrote into the buffer of a dead input.
+    SN_UINT reuse_count;    //!< Number of operators which wrote into a released buffer.
+} sn_flow_stats;
+
 //! \brief Creates a sn_op object.
 sn_op* sn_op_create(sn_op_type type, sn_flow_fn* flow, sn_dflow_fn* dflow, SN_UINT x_count, sn_op* x[]);
+//! \brief Sets the optional vector-Jacobian product of an operator created by sn_op_create().
+void sn_op_set_vjp(sn_op* self, sn_vjp_fn* vjp);
 //! \brief Destroys the object without managing a reference counting.
 void sn_op_destroy(sn_op* self);
 //! \brief Recursively destroys the object, managing a reference counting.
 void sn_op_rdestroy(sn_op* self);
-//! \brief Calculates a symbolic expression.
+//! \brief   Calculates a symbolic expression reading the values of the \p feed in place.
+//! \details The \p feed is neither copied nor destroyed, so it can be fed again.
+//!          Values of placeholders and constants are never written. Only the result is owned by the caller.
 sn_mda* sn_op_usflow(sn_op* self, sn_map* feed);
-//! \brief Calculates a symbolic expression and destroys the \p feed.
+//! \brief   Calculates a symbolic expression and destroys the \p feed.
+//! \details Every distinct node is evaluated exactly once, even if it is shared by several consumers.
+//!          Intermediate values are released as soon as they are dead, as sn_op_mflow() does.
 sn_mda* sn_op_flow(sn_op* self, sn_map* feed);
-//! \brief Calculates a gradient of symbolic expression.
+//! \brief   Calculates a symbolic expression like sn_op_flow(), reports its memory into \p stats and destroys the \p feed.
+//! \details The value of an operator is released after its last consumer, and element-wise operators write
+//!          into a dead input or a released buffer of the same shape, so only the working set is held at once.
+sn_mda* sn_op_mflow(sn_op* self, sn_map* feed, sn_flow_stats* stats);
+//! \brief   Calculates a symbolic expression running independent operators on up to \p thread_count threads and destroys the \p feed.
+//! \details Needs the pool of sinae_thread.h. The result is the same as sn_op_flow().
+sn_mda* sn_op_pflow(sn_op* self, sn_map* feed, SN_UINT thread_count);
+//! \brief   Calculates a gradient of symbolic expression reading the values of the \p feed in place.
+//! \details The \p feed is neither copied nor destroyed, like sn_op_usflow().
 sn_map* sn_op_usdflow(sn_op* self, sn_map* feed);
-//! \brief Calculates a gradient of symbolic expression and destroys the \p feed.
+//! \brief   Calculates a gradient of symbolic expression and destroys the \p feed.
+//! \details Runs the forward pass once and accumulates adjoints in reverse topological order.
+//!          Operators without \p vjp fall back to their \p dflow Jacobian.
+//!          If the expression is not a scalar, structured Jacobians are chained and materialized at the end.
 sn_map* sn_op_dflow(sn_op* self, sn_map* feed);
+//! \brief   Calculates a gradient of symbolic expression running independent operators on up to \p thread_count threads and destroys the \p feed.
+//! \details Needs the pool of sinae_thread.h. The result is the same as sn_op_dflow(), since every adjoint accumulates
+//!          the contributions of its consumers in the same order. Jacobians of a non-scalar expression are chained on one thread.
+sn_map* sn_op_pdflow(sn_op* self, sn_map* feed, SN_UINT thread_count);
+//! \brief   Calculates a gradient of a scalar expression keeping only the values at checkpoints and destroys the \p feed.
+//! \details The topological order is split into segments which end at the \p checkpoints, or at every ceil(sqrt(N))-th
+//!          of the N operators if \p checkpoint_count is 0. The forward pass keeps the values of the checkpoints and of the nodes
+//!          read by a later segment, and the backward pass recomputes each segment right before propagating its adjoints.
+//!          A chain then holds O(sqrt(N)) values instead of N for about one more forward pass. The result is the same as sn_op_dflow().
+sn_map* sn_op_cdflow(sn_op* self, sn_map* feed, SN_UINT checkpoint_count, sn_op* checkpoints[]);
+//! \brief Calculates a structured Jacobian of symbolic expression with respect to the placeholder \p x and destroys the \p feed.
+sn_jac* sn_op_jacobian(sn_op* self, sn_map* feed, sn_op* x);
 
 //! \brief Creates a placeholder.
 sn_op* sn_placeholder(void);
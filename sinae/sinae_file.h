@@ -0,0 +1,109 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_file.h
+//! \brief This file includes binary file formats of sn_mda, which can be memory-mapped, and of sn_op graphs.
+
+#ifndef SINAE_FILE_H_INCLUDED_
+#define SINAE_FILE_H_INCLUDED_
+
+#include <stdbool.h>
+
+#include "sinae_core.h"
+#include "sinae_mda.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_FILE_ALIGNMENT
+    //! \brief Overridable alignment in bytes of the payload in a file. Must be a multiple of 64.
+    #define SN_FILE_ALIGNMENT 64
+#endif // !SN_FILE_ALIGNMENT
+
+
+/* Tensor file */
+
+//! \defgroup file_group Tensor file
+//! \brief    Saves and loads sn_mda objects in a versioned binary format.
+//!
+//! \details  A file starts with a 64-byte header: the magic "SNMDA\0", the version as a 16-bit integer, the element type
+//!           (1 for 32-bit and 2 for 64-bit floats), then the rank, the offset and the size in bytes of the payload as
+//!           64-bit integers. The shape follows as 64-bit integers, and the payload starts at a multiple of SN_FILE_ALIGNMENT
+//!           after some reserved bytes. Every number is little-endian.
+//!
+//!           If "SN_USE_MMAP" is defined, sn_mda_map() maps the file privately and builds the sn_mda in the reserved bytes,
+//!           so its data points straight into the file and nothing is copied or parsed.
+//!           This needs a little-endian host whose SN_FLOAT is the element type and whose SN_UINT has 64 bits.
+//!           Otherwise sn_mda_map() falls back to sn_mda_load(). In both cases, sn_mda_destroy() releases the object,
+//!           so a mapped array can be handed to sn_const() like any other.
+//!
+//! \{
+
+//! \brief Version of the format written by sn_mda_save().
+#define SN_FILE_VERSION 1
+
+//! \brief Saves the object into the file at \p path. Returns false if the file cannot be written.
+bool sn_mda_save(const sn_mda* self, const char* path);
+//! \brief   Loads an object from the file at \p path into memory of SN_MALLOC, converting the element type if needed.
+//! \details Returns NULL if the file cannot be read or is not a valid file of a supported version.
+sn_mda* sn_mda_load(const char* path);
+//! \brief   Loads an object from the file at \p path by mapping it if possible, or by sn_mda_load() otherwise.
+//! \details Pages are read on first access. Writes to the object are private to the process and never reach the file.
+sn_mda* sn_mda_map(const char* path);
+
+//! \}
+
+
+/* Graph file */
+
+//! \defgroup graph_file_group Graph file
+//! \brief    Saves a sn_op DAG and loads it back without rebuilding it operator by operator.
+//!
+//! \details  A file holds a 128-byte header of counts, the table of the kinds of operators by name, and the nodes
+//!           in topological order. Each node is a placeholder given by its index, a constant embedded with its shape
+//!           and elements, a constant referring to a tensor file, or an operator with its kind, the indices of its
+//!           inputs and its parameters, such as the overwrap of sn_matmul().
+//!
+//!           Operators are identified by their \p flow function, so only registered kinds can be saved or loaded.
+//!           Every operator of sinae_op.h is registered. Custom operators are registered by sn_op_register() with a
+//!           prototype, which can be destroyed afterwards. Fused operators of sn_opt_fuse() cannot be saved.
+//!
+//!           sn_op_load() reads the file once into a single allocation holding every node and embedded constant.
+//!           Loaded nodes keep an extra reference, so operators built on top of them can be destroyed as usual,
+//!           but the loaded graph itself is released by sn_op_unload() and never by sn_op_destroy().
+//!
+//! \{
+
+//! \brief Version of the format written by sn_op_save().
+#define SN_GRAPH_FILE_VERSION 1
+
+//! \brief   Registers the kind of operator of \p prototype under \p name for sn_op_save() and sn_op_load().
+//! \details The functions of the prototype are copied. \p parameter_count is the number of SN_UINT stored right after
+//!          the inputs of the operator. Returns false if the name is longer than 255 bytes or taken by another kind,
+//!          or if the registry cannot grow.
+bool sn_op_register(const char* name, const sn_op* prototype, SN_UINT parameter_count);
+//! \brief   Stores the number of parameters of the kind of \p self into \p parameter_count.
+//! \details Returns false if \p self is not an operator of a registered kind.
+bool sn_op_parameter_count(const sn_op* self, SN_UINT* parameter_count);
+//! \brief   Saves the graph of \p self into the file at \p path.
+//! \details Placeholders are saved by their index in \p placeholders, which must list every placeholder of the graph.
+//!          The constants in \p externals are saved as references to the tensor files at \p external_paths, which are
+//!          not written; a relative path is resolved from the directory of the graph file. Other constants are embedded.
+//!          Returns false if the file cannot be written, a placeholder is not listed or an operator is not registered.
+bool sn_op_save(sn_op* self, SN_UINT placeholder_count, sn_op* placeholders[],
+                SN_UINT external_count, sn_op* externals[], const char* external_paths[], const char* path);
+//! \brief   Loads a graph saved by sn_op_save() and stores its placeholders into \p placeholders in the saved order.
+//! \details External constants are loaded by sn_mda_map(). Returns NULL if the file is invalid, an operator is not
+//!          registered, \p placeholder_count is not the saved one or an external constant cannot be loaded.
+sn_op* sn_op_load(const char* path, SN_UINT placeholder_count, sn_op* placeholders[]);
+//! \brief Releases a graph loaded by sn_op_load(), including its placeholders and constants.
+void sn_op_unload(sn_op* self);
+
+//! \}
+
+
+#endif // !SINAE_FILE_H_INCLUDED_
@@ -0,0 +1,63 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_forward.h
+//! \brief This file includes forward-mode differentiation of sn_op graphs and Hessian-vector products.
+
+#ifndef SINAE_FORWARD_H_INCLUDED_
+#define SINAE_FORWARD_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Forward mode */
+
+//! \defgroup forward_group Forward mode
+//! \brief    Propagates directional derivatives from the placeholders to the result along with the values.
+//!
+//! \details  Each operator is evaluated once and pushes the tangents of its inputs through its \p jvp right after,
+//!           so \p tangent_count directional derivatives cost a single traversal. This is cheaper than sn_op_dflow()
+//!           when the placeholders have fewer elements than the result.
+//!           Tangents are stacked along a new last axis like the samples of sinae_batch.h, so every tangent is contiguous.
+//!           Operators without \p jvp fall back to their \p dflow Jacobian.
+//!
+//! \{
+
+//! \brief   Calculates a symbolic expression and its Jacobian-vector products with \p tangent_count tangents,
+//!          and destroys the \p feed and the \p tangents.
+//! \details \p tangents maps placeholders to their tangents in their shape followed by \p tangent_count.
+//!          Placeholders without tangents are held constant. Returns the value and stores the tangents of the result
+//!          into \p dy in its shape followed by \p tangent_count, or returns NULL if the memory budget is exceeded.
+sn_mda* sn_op_jvp(sn_op* self, sn_map* feed, SN_UINT tangent_count, sn_map* tangents, sn_mda** dy);
+
+//! \}
+
+
+/* Hessian-vector product */
+
+//! \defgroup hvp_group Hessian-vector product
+//! \brief    Multiplies the Hessian of a scalar expression by a vector without materializing the Hessian.
+//!
+//! \details  The product is computed forward-over-reverse: a forward pass carries the values and a single tangent,
+//!           then the reverse pass of sn_op_dflow() differentiates every adjoint along that tangent as well.
+//!           An operator passes the tangent of its adjoint back through its \p vjp and adds the second-order term of its \p hvp,
+//!           so the product costs a small constant multiple of one gradient.
+//!           Every operator of sinae_op.h has an exact \p hvp. For an operator without one, the term is a central difference
+//!           of its \p vjp, whose relative error is about the machine epsilon to the power of 2/3.
+//!
+//! \{
+
+//! \brief   Calculates the Hessian-vector product of a scalar expression and destroys the \p feed and the \p tangents.
+//! \details \p tangents maps placeholders to the blocks of the vector in their shapes. Placeholders without tangents
+//!          contribute zero blocks. Returns a sn_map of the blocks of the product for every placeholder, and stores the gradient
+//!          like sn_op_dflow() into \p gradient unless it is NULL. Returns NULL if the memory budget is exceeded.
+sn_map* sn_op_hvp(sn_op* self, sn_map* feed, sn_map* tangents, sn_map** gradient);
+
+//! \}
+
+
+#endif // !SINAE_FORWARD_H_INCLUDED_
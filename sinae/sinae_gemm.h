@@ -0,0 +1,80 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_gemm.h
+//! \brief This file includes a blocked general matrix multiplication kernel.
+
+#ifndef SINAE_GEMM_H_INCLUDED_
+#define SINAE_GEMM_H_INCLUDED_
+
+#include <stdbool.h>
+
+#include "sinae_macro.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_GEMM_MC
+    //! \brief Overridable number of rows of A packed at once. Rounded down to a multiple of the micro-kernel height.
+    #define SN_GEMM_MC 192
+#endif // !SN_GEMM_MC
+
+#ifndef SN_GEMM_KC
+    //! \brief Overridable depth of the packed panels of A and B.
+    #define SN_GEMM_KC 256
+#endif // !SN_GEMM_KC
+
+#ifndef SN_GEMM_NC
+    //! \brief Overridable number of columns of B packed at once.
+    #define SN_GEMM_NC 4096
+#endif // !SN_GEMM_NC
+
+
+/* sn_gemm */
+
+//! \defgroup gemm_group General matrix multiplication (sn_gemm)
+//! \brief    Provides C = A * B on column-major SN_FLOAT matrices with arbitrary element steps.
+//!
+//! \details  Blocks of A and B are packed into contiguous panels, which are multiplied by a register-blocked micro-kernel.
+//!           On x86 compiled by GCC or Clang, SSE2, AVX2 and AVX-512 micro-kernels are chosen at runtime
+//!           by the features of the CPU. Otherwise, or if "SN_NO_SIMD" is defined, the portable one is used.
+//!
+//! \{
+
+//! \brief Enum type to distinguish the micro-kernels of sn_gemm().
+typedef enum sn_gemm_isa_en {
+    GEMM_SCALAR, //!< Portable C.
+    GEMM_SSE2,   //!< 128-bit SSE2.
+    GEMM_AVX2,   //!< 256-bit AVX2 with FMA.
+    GEMM_AVX512, //!< 512-bit AVX-512F.
+} sn_gemm_isa;
+
+//! \brief   Calculates C = A * B, or C += A * B if \p accumulate is true.
+//! \details A is \p m x \p k, B is \p k x \p n and C is \p m x \p n with the leading dimension \p ldc.
+//!          The element ( i, j ) of A is at a[ i * \p a_row_step + j * \p a_column_step ], and so is B.
+//!          A transpose is therefore a swap of the steps.
+//!          The packed panels are kept by each thread and reused, so only a product larger than any before on that
+//!          thread allocates, with malloc() and never through SN_MALLOC.
+//!          Under "SN_USE_PTHREAD", they are freed when their thread exits.
+void sn_gemm(SN_UINT m, SN_UINT n, SN_UINT k,
+    const SN_FLOAT* a, SN_UINT a_row_step, SN_UINT a_column_step,
+    const SN_FLOAT* b, SN_UINT b_row_step, SN_UINT b_column_step,
+    SN_FLOAT* c, SN_UINT ldc, bool accumulate);
+//! \brief Frees the packed panels kept by the calling thread. The next sn_gemm() on it allocates them again.
+void sn_gemm_release(void);
+//! \brief Returns the micro-kernel in use. The best one supported by the CPU is chosen by default.
+sn_gemm_isa sn_gemm_get_isa(void);
+//! \brief   Selects the micro-kernel. Returns false and changes nothing if the CPU or the build does not support \p isa.
+//! \details Must not be called while another thread runs sn_gemm().
+bool sn_gemm_set_isa(sn_gemm_isa isa);
+//! \brief Returns the name of \p isa.
+const char* sn_gemm_isa_name(sn_gemm_isa isa);
+
+//! \}
+
+
+#endif // !SINAE_GEMM_H_INCLUDED_
@@ -0,0 +1,55 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_graph.h
+//! \brief This file includes a topologically sorted view of sn_op graphs.
+
+#ifndef SINAE_GRAPH_H_INCLUDED_
+#define SINAE_GRAPH_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Forward declarations */
+
+//! \ingroup graph_group
+typedef struct sn_graph_st sn_graph;
+
+
+/* struct sn_graph_st */
+
+//! \defgroup graph_group Graph (sn_graph)
+//! \brief    Provides a topologically sorted view of a sn_op DAG.
+//!
+//! \details  Every distinct sn_op reachable from the root appears exactly once, after all of its inputs.
+//!           The root is always the last node.
+//!           The sort keeps its stack on the heap, so the depth of a graph is limited only by memory.
+//!
+//! \{
+
+struct sn_graph_st {
+    SN_UINT count;          //!< Number of distinct nodes.
+    sn_op** ops;            //!< Nodes in topological order.
+    SN_UINT* x_offset;      //!< Offset of the input positions of each node in \p x_index. Has \p count + 1 elements.
+    SN_UINT* x_index;       //!< Positions of the inputs of every node, concatenated.
+    SN_UINT table_capacity; //!< Capacity of the hash table. Always a power of two.
+    SN_UINT* table;         //!< Open-addressing hash table from sn_op* to position + 1. Zero means empty.
+};
+
+//! \brief Creates a sn_graph object from the root node.
+sn_graph* sn_graph_create(sn_op* root);
+//! \brief Destroys the object. The nodes are not destroyed.
+void sn_graph_destroy(sn_graph* self);
+//! \brief Returns the position of the node, or \p count if the node is not in the graph.
+SN_UINT sn_graph_find(const sn_graph* self, const sn_op* op);
+//! \brief Returns the positions of the inputs of the node at \p position.
+#define sn_graph_x_index(self, position) (&((self)->x_index[(self)->x_offset[position]]))
+
+//! \}
+
+
+#endif // !SINAE_GRAPH_H_INCLUDED_
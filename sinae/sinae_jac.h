@@ -0,0 +1,86 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_jac.h
+//! \brief This file includes a structured Jacobian object.
+
+#ifndef SINAE_JAC_H_INCLUDED_
+#define SINAE_JAC_H_INCLUDED_
+
+#include "sinae_macro.h"
+#include "sinae_mda.h"
+
+
+/* Forward declarations */
+
+//! \ingroup jacobian_group
+typedef struct sn_jac_st sn_jac;
+
+
+/* struct sn_jac_st */
+
+//! \defgroup jacobian_group Structured Jacobian (sn_jac)
+//! \brief    Provides a Jacobian dy/dx which stores only its non-trivial structure.
+//!
+//! \details  A dense Jacobian is a column-major sn_mda in the shape of ( y.shape, x.shape ).
+//!           Identity, diagonal and broadcast Jacobians are never materialized unless sn_jac_to_mda() is called.
+//!
+//! \{
+
+//! \brief Enum type to distinguish the structure of sn_jac object.
+typedef enum sn_jac_kind_en {
+    IDENTITY,  //!< dy/dx = I. y and x are in the same shape.
+    DIAGONAL,  //!< dy/dx = diag(values). y and x are in the same shape.
+    BROADCAST, //!< Every element of dy/dx is \p scalar.
+    DENSE,     //!< dy/dx = values.
+    EXPANDED,  //!< dy/dx = diag(values) * B, where B broadcasts x to y. Its vjp sums over the broadcasted axes.
+} sn_jac_kind;
+
+struct sn_jac_st {
+    sn_jac_kind kind; //!< Structure of the Jacobian.
+    SN_UINT y_rank;   //!< Rank of y.
+    SN_UINT x_rank;   //!< Rank of x.
+    SN_UINT* shape;   //!< Shape of y followed by the shape of x.
+    SN_FLOAT scalar;  //!< Value of every element if \p kind is BROADCAST.
+    sn_mda* values;   //!< Diagonal in the shape of x if \p kind is DIAGONAL, the dense Jacobian if \p kind is DENSE,
+                      //!< the diagonal in the shape of y if \p kind is EXPANDED, NULL otherwise.
+};
+
+//! \brief Creates an identity sn_jac object.
+sn_jac* sn_jac_identity(SN_UINT rank, const SN_UINT shape[]);
+//! \brief Creates a diagonal sn_jac object taking the ownership of \p diagonal.
+sn_jac* sn_jac_diagonal(sn_mda* diagonal);
+//! \brief Creates a sn_jac object whose every element is \p value.
+sn_jac* sn_jac_broadcast(SN_UINT y_rank, const SN_UINT y_shape[], SN_UINT x_rank, const SN_UINT x_shape[], SN_FLOAT value);
+//! \brief Creates a dense sn_jac object taking the ownership of \p dense in the shape of ( y.shape, x.shape ).
+sn_jac* sn_jac_dense(SN_UINT y_rank, sn_mda* dense);
+//! \brief   Creates the sn_jac object of an element-wise function of x broadcasted to y, taking the ownership of \p derivatives.
+//! \details \p derivatives holds dy[i]/dx at each element i of y and is in the shape of y.
+//!          It is a diagonal if x is in the same shape, and otherwise an EXPANDED Jacobian, which is never materialized.
+sn_jac* sn_jac_expand(sn_mda* derivatives, SN_UINT x_rank, const SN_UINT x_shape[]);
+//! \brief Destroys the object.
+void sn_jac_destroy(sn_jac* self);
+//! \brief Returns the size of y.
+SN_UINT sn_jac_y_size(const sn_jac* self);
+//! \brief Returns the size of x.
+SN_UINT sn_jac_x_size(const sn_jac* self);
+//! \brief Returns the dense Jacobian in the shape of ( y.shape, x.shape ).
+sn_mda* sn_jac_to_mda(const sn_jac* self);
+//! \brief   Returns the chain rule product dy/dx = dy/dm * dm/dx.
+//! \details Keeps the structure whenever possible, e.g. composing two diagonals costs O(n).
+sn_jac* sn_jac_compose(const sn_jac* dy_dm, const sn_jac* dm_dx);
+//! \brief Returns the sum of two Jacobians in the same shape.
+sn_jac* sn_jac_add(const sn_jac* x0, const sn_jac* x1);
+//! \brief Accumulates the vector-Jacobian product \p dy * \p self into \p dx.
+void sn_jac_vjp(const sn_jac* self, const SN_FLOAT dy[], SN_FLOAT dx[]);
+//! \brief Accumulates the Jacobian-vector product \p self * \p dx into \p dy.
+void sn_jac_jvp(const sn_jac* self, const SN_FLOAT dx[], SN_FLOAT dy[]);
+
+//! \}
+
+
+#endif // !SINAE_JAC_H_INCLUDED_
@@ -44,21 +44,129 @@
     #define SN_UINT uintmax_t
 #endif // !SN_SIZE_T
 
+/* Profiling macros */
+
+#ifdef SN_USE_PROFILE
+    #include <stddef.h>
+    //! \brief Adds \p size to the bytes allocated on this thread, which are reported for the operator being profiled, and returns it.
+    size_t sn_profile_count_(size_t size);
+    //! \brief Counts the bytes allocated by SN_MALLOC() if "SN_USE_PROFILE" is defined.
+    #define SN_PROFILE_COUNT(SIZE) (sn_profile_count_(SIZE))
+    //! \brief Starts to profile an operator into the sn_profile_mark variable \p MARK if "SN_USE_PROFILE" is defined.
+    #define SN_PROFILE_BEGIN(MARK) sn_profile_mark MARK = sn_profile_begin_()
+    //! \brief Records the operator \p OP with its output \p Y in the phase \p PHASE started at \p MARK if "SN_USE_PROFILE" is defined.
+    #define SN_PROFILE_END(MARK, PHASE, OP, Y) sn_profile_end_(&(MARK), (PHASE), (OP), (Y))
+#else
+    #define SN_PROFILE_COUNT(SIZE) (SIZE)
+    #define SN_PROFILE_BEGIN(MARK)
+    #define SN_PROFILE_END(MARK, PHASE, OP, Y)
+#endif // SN_USE_PROFILE
+
+
+/* Memory accounting macros */
+
+#ifdef SN_USE_MEMORY
+    #include <stddef.h>
+    //! \brief Allocates \p size bytes with a header recording them for sinae_memory.h.
+    void* sn_memory_malloc_(size_t size);
+    //! \brief Frees memory allocated by sn_memory_malloc_().
+    void sn_memory_free_(void* ptr);
+    //! \brief Drops the sn_op \p op from the lookup of records, before it is freed.
+    void sn_memory_forget_(const void* op);
+    //! \brief Attributes the allocations of this thread to the sn_op \p op and returns the previous one.
+    const void* sn_memory_enter_(const void* op);
+    //! \brief Restores the sn_op returned by sn_memory_enter_().
+    void sn_memory_leave_(const void* previous);
+    //! \brief Returns non-zero if the live bytes exceed the budget, counting a failure.
+    int sn_memory_exceeded_(void);
+    //! \brief Attributes allocations to the operator \p OP until SN_MEMORY_END(\p MARK) if "SN_USE_MEMORY" is defined.
+    #define SN_MEMORY_BEGIN(MARK, OP) const void* MARK = sn_memory_enter_(OP)
+    //! \brief Ends SN_MEMORY_BEGIN(\p MARK) if "SN_USE_MEMORY" is defined.
+    #define SN_MEMORY_END(MARK) sn_memory_leave_(MARK)
+    //! \brief Evaluates to non-zero if an evaluation must stop for the budget of sinae_memory.h, or to zero if "SN_USE_MEMORY" is not defined.
+    #define SN_MEMORY_EXCEEDED() (sn_memory_exceeded_())
+    //! \brief Ends the records of the operator \p OP, which is being freed, if "SN_USE_MEMORY" is defined.
+    #define SN_MEMORY_FORGET(OP) sn_memory_forget_(OP)
+#else
+    #define SN_MEMORY_BEGIN(MARK, OP)
+    #define SN_MEMORY_END(MARK)
+    #define SN_MEMORY_EXCEEDED() (0)
+    #define SN_MEMORY_FORGET(OP)
+#endif // SN_USE_MEMORY
+
+
 /* Overridable memory allocation macros */
 
+#ifdef SN_USE_ARENA
+    #include <stddef.h>
+    //! \brief Allocates from the sn_arena bound by sn_arena_bind(), or from the heap if none is bound.
+    void* sn_arena_malloc_(size_t size);
+    //! \brief Frees heap memory. Memory of the bound sn_arena is released only by sn_arena_reset().
+    void sn_arena_free_(void* ptr);
+#endif // SN_USE_ARENA
+
+#ifdef SN_USE_ALLOCATION_HOOK
+    #include <stddef.h>
+    //! \brief Allocates \p size bytes. Defined by the application if "SN_USE_ALLOCATION_HOOK" is defined, e.g. to count allocations.
+    void* sn_allocation_hook_malloc(size_t size);
+    //! \brief Frees memory allocated by sn_allocation_hook_malloc(). Defined by the application like it.
+    void sn_allocation_hook_free(void* ptr);
+#endif // SN_USE_ALLOCATION_HOOK
+
 #ifndef SN_MALLOC
-    #include <stdlib.h>
-    #define SN_MALLOC(SIZE) (malloc(SIZE))
+    #if defined(SN_USE_MEMORY)
+        //! \brief Overridable memory allocation macro counted by sinae_memory.h if "SN_USE_MEMORY" is defined, on top of the arena if any.
+        #define SN_MALLOC(SIZE) (sn_memory_malloc_(SN_PROFILE_COUNT(SIZE)))
+    #elif defined(SN_USE_ALLOCATION_HOOK)
+        //! \brief Overridable memory allocation macro routed to the application if "SN_USE_ALLOCATION_HOOK" is defined, instead of the arena.
+        #define SN_MALLOC(SIZE) (sn_allocation_hook_malloc(SN_PROFILE_COUNT(SIZE)))
+    #elif defined(SN_USE_ARENA)
+        //! \brief Overridable memory allocation macro routed to the bound sn_arena if "SN_USE_ARENA" is defined.
+        #define SN_MALLOC(SIZE) (sn_arena_malloc_(SN_PROFILE_COUNT(SIZE)))
+    #else
+        #include <stdlib.h>
+        #define SN_MALLOC(SIZE) (malloc(SN_PROFILE_COUNT(SIZE)))
+    #endif // SN_USE_ARENA
 #endif
 
 #ifndef SN_FREE
-    #include <stdlib.h>
-    #define SN_FREE(PTR) (free(PTR))
+    #if defined(SN_USE_MEMORY)
+        //! \brief Overridable memory deallocation macro counted by sinae_memory.h if "SN_USE_MEMORY" is defined.
+        #define SN_FREE(PTR) (sn_memory_free_(PTR))
+    #elif defined(SN_USE_ALLOCATION_HOOK)
+        //! \brief Overridable memory deallocation macro routed to the application if "SN_USE_ALLOCATION_HOOK" is defined.
+        #define SN_FREE(PTR) (sn_allocation_hook_free(PTR))
+    #elif defined(SN_USE_ARENA)
+        //! \brief Overridable memory deallocation macro routed to the bound sn_arena if "SN_USE_ARENA" is defined.
+        #define SN_FREE(PTR) (sn_arena_free_(PTR))
+    #else
+        #include <stdlib.h>
+        #define SN_FREE(PTR) (free(PTR))
+    #endif // SN_USE_ARENA
 #endif
 
 
+/* Overridable storage class macros */
+
+#ifndef SN_THREAD_LOCAL
+    #if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && !defined(__STDC_NO_THREADS__)
+        //! \brief   Overridable storage class of per-thread states such as the bound sn_arena.
+        //! \details Empty if the compiler has no thread-local storage, in which case those states are process-wide.
+        #define SN_THREAD_LOCAL _Thread_local
+    #elif defined(__GNUC__)
+        #define SN_THREAD_LOCAL __thread
+    #elif defined(_MSC_VER)
+        #define SN_THREAD_LOCAL __declspec(thread)
+    #else
+        #define SN_THREAD_LOCAL
+    #endif // __STDC_VERSION__
+#endif // !SN_THREAD_LOCAL
+
+
 /* Function-like macros */
 
+#include <stdint.h>
+
 //! \brief Returns dynamically allocated array.
 #define SN_DYNAMIC_ARRAY(TYPE, SIZE) ((TYPE*)SN_MALLOC((SIZE) * sizeof(TYPE)))
 
@@ -75,7 +183,10 @@
 #define SN_SHAPE(...) SN_CONST_TEMP_ARRAY(SN_UINT, __VA_ARGS__)
 
 //! \brief Interprets the given pointer as a column-major matrix and returns the element.
-#define SN_MATRIX_GET(PTR, ROW_SIZE, ROW_INDEX, COLUMN_INDEX) ((PTR)[ROW_INDEX + COLUMN_INDEX * ROW_SIZE])
+#define SN_MATRIX_GET(PTR, ROW_SIZE, ROW_INDEX, COLUMN_INDEX) ((PTR)[(ROW_INDEX) + (COLUMN_INDEX) * (ROW_SIZE)])
+
+//! \brief Returns a well-mixed hash of a pointer, suitable for masking with a power-of-two capacity.
+#define SN_PTR_HASH(PTR) ((SN_UINT)(((uint64_t)(uintptr_t)(PTR) * UINT64_C(0x9E3779B97F4A7C15)) >> 29))
 
 
 #endif // !SINAE_MACRO_H_INCLUDED_
@@ -11,6 +11,9 @@
 #ifndef SINAE_MDA_H_INCLUDED_
 #define SINAE_MDA_H_INCLUDED_
 
+#include <stdbool.h>
+#include <stddef.h>
+
 #include "sinae_macro.h"
 
 
@@ -40,8 +43,13 @@ sn_mda* sn_mda_full(SN_UINT rank, const SN_UINT shape[], SN_FLOAT value);
 sn_mda* sn_mda_diagonal_full(SN_UINT one_side_rank, const SN_UINT one_side_shape[], SN_FLOAT value);
 //! \brief Returns the copy of the object.
 sn_mda* sn_mda_copy(const sn_mda* self);
-//! \brief Destroys the object.
+//! \brief Destroys the object, unmapping it if it was mapped by sn_mda_map() of sinae_file.h.
 void sn_mda_destroy(sn_mda* self);
+//! \brief Returns true if the object was mapped by sn_mda_map() of sinae_file.h, and false for NULL.
+bool sn_mda_is_mapped(const sn_mda* self);
+//! \brief   Records the object mapped by sn_mda_map() at \p base for \p length bytes, so that sn_mda_destroy() unmaps it.
+//! \details Returns false if the records cannot grow, or always if "SN_USE_MMAP" is not defined.
+bool sn_mda_add_mapping_(const sn_mda* self, void* base, size_t length);
 //! \brief Returns the size of the array.
 SN_UINT sn_mda_size(const sn_mda* self);
 //! \brief Gets the pointer to the element of the array.
@@ -51,6 +59,8 @@ SN_FLOAT sn_mda_view(const sn_mda* self, const SN_UINT index[]);
 //! \brief   Performs generalized matrix multiplication.
 //! \details When \p x0 = (2, 3, 5, 1), \p x1 = (5, 1, 2) and \p overwrap = 2, treats x0 as (2x3, 5x1) and x1 as (5x1, 2) and performs matrix multiplication.
 sn_mda* sn_mda_gmatmul(const sn_mda* x0, const sn_mda* x1, SN_UINT overwrap);
+//! \brief Performs generalized matrix multiplication into \p y already in the shape of the result.
+void sn_mda_gmatmul_into(const sn_mda* x0, const sn_mda* x1, SN_UINT overwrap, sn_mda* y);
 //! \brief Performs matrix multiplication.
 #define sn_mda_matmul(x0, x1) sn_mda_gmatmul(x0, x1, 1);
 
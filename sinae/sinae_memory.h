@@ -0,0 +1,70 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_memory.h
+//! \brief This file includes opt-in accounting of the memory allocated through SN_MALLOC.
+
+#ifndef SINAE_MEMORY_H_INCLUDED_
+#define SINAE_MEMORY_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Memory accounting */
+
+//! \defgroup memory_group Memory accounting
+//! \brief    Counts the live and peak bytes of SN_MALLOC, attributes them to operators and enforces a budget.
+//!
+//! \details  Allocations are counted only if "SN_USE_MEMORY" is defined. Every allocation then carries a small header
+//!           with its size and the operator being evaluated by the thread, or NULL outside operators.
+//!           The budget is soft: an allocation is never refused, but once the live bytes exceed the budget,
+//!           sn_op_flow(), sn_op_dflow() and their variants stop at the next operator, release their temporaries
+//!           and return NULL.
+//!           If the records of operators cannot grow, a new operator is counted only in the totals.
+//!           Records of destroyed operators are kept until the end of the process, and their outputs freed later
+//!           are still subtracted from their live bytes.
+//!
+//! \{
+
+//! \brief Counters of every allocation.
+typedef struct sn_memory_stats_st {
+    SN_UINT live_bytes;       //!< Bytes allocated and not freed yet, excluding headers.
+    SN_UINT peak_bytes;       //!< Largest \p live_bytes since the last sn_memory_reset().
+    SN_UINT allocation_count; //!< Number of allocations since the last sn_memory_reset().
+    SN_UINT budget_bytes;     //!< Budget set by sn_memory_set_budget(). Zero means unlimited.
+    SN_UINT failure_count;    //!< Number of evaluations stopped by the budget since the last sn_memory_reset().
+} sn_memory_stats;
+
+//! \brief Counters of the allocations made while an operator was evaluated.
+typedef struct sn_memory_op_stats_st {
+    const sn_op* op;          //!< Operator, or NULL for allocations outside operators. Once the operator is destroyed,
+                              //!< the pointer only identifies the record, and a new operator at its address gets another.
+    SN_UINT allocation_count; //!< Number of allocations since the last sn_memory_reset().
+    SN_UINT allocated_bytes;  //!< Bytes allocated since the last sn_memory_reset().
+    SN_UINT live_bytes;       //!< Bytes not freed yet, such as the output of the operator.
+} sn_memory_op_stats;
+
+//! \brief Returns the counters of every allocation.
+sn_memory_stats sn_memory_query(void);
+//! \brief Returns the counters of the operator \p op, which are zero if it allocated nothing.
+sn_memory_op_stats sn_memory_query_op(const sn_op* op);
+//! \brief Returns the number of operators which allocated memory.
+SN_UINT sn_memory_op_count(void);
+//! \brief   Returns the counters of the operators in the order of their first allocation.
+//! \details The pointer is valid until the next allocation, so read it while no other thread allocates.
+const sn_memory_op_stats* sn_memory_ops(void);
+//! \brief Sets the soft budget of the live bytes. Zero removes it.
+void sn_memory_set_budget(SN_UINT bytes);
+//! \brief   Starts a new measurement.
+//! \details The peak restarts from the current live bytes, and the allocation and failure counts from zero.
+//!          Live bytes are kept, since they are still held.
+void sn_memory_reset(void);
+
+//! \}
+
+
+#endif // !SINAE_MEMORY_H_INCLUDED_
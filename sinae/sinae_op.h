@@ -25,7 +25,18 @@ sn_op* sn_sqrt(sn_op* x);
 
 /* Unary operatros */
 
+//! \brief   Sums every element of x pairwise within each block of SN_THREAD_BLOCK elements.
+//! \details The rounding error of a block grows with log(n) instead of n, and the blocks are added in order.
 sn_op* sn_sum(sn_op* x);
+//! \brief Returns the pairwise sum of the \p n elements of \p x. Used by sn_sum() and fused sums for each block.
+SN_FLOAT sn_sum_block_(const SN_FLOAT x[], SN_UINT n);
+
+//! \brief   Reductions over the \p axis_count axes listed in \p axes, or over every axis if \p axis_count is 0.
+//! \details The result has the kept axes of x in order. An extremum passes its gradient to the first element equal to it.
+sn_op* sn_reduce_sum(sn_op* x, SN_UINT axis_count, const SN_UINT axes[]);
+sn_op* sn_reduce_mean(sn_op* x, SN_UINT axis_count, const SN_UINT axes[]);
+sn_op* sn_reduce_max(sn_op* x, SN_UINT axis_count, const SN_UINT axes[]);
+sn_op* sn_reduce_min(sn_op* x, SN_UINT axis_count, const SN_UINT axes[]);
 
 
 /* Element-wise binary operatros */
@@ -0,0 +1,67 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_opt.h
+//! \brief This file includes optimization passes which rewrite a graph into an equivalent one.
+
+#ifndef SINAE_OPT_H_INCLUDED_
+#define SINAE_OPT_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_FUSE_TILE
+    //! \brief Overridable number of elements which a fused operator evaluates at once. The intermediates of a tile stay in cache.
+    #define SN_FUSE_TILE 256
+#endif // !SN_FUSE_TILE
+
+#ifndef SN_FUSE_MAX_LENGTH
+    //! \brief Overridable maximum number of element-wise operators fused into one.
+    #define SN_FUSE_MAX_LENGTH 8
+#endif // !SN_FUSE_MAX_LENGTH
+
+
+/* Graph optimization */
+
+//! \defgroup opt_group Graph optimization
+//! \brief    Provides passes which take a root, rewrite its graph in place and return the new root.
+//!
+//! \details  Placeholders are never replaced, so feeds built for the original root remain valid.
+//!           Nodes which are also referenced from outside the graph are left as they are.
+//!
+//! \{
+
+//! \brief   Fuses chains of element-wise operators, with a trailing sn_sum() if any, into single operators.
+//! \details A fused operator reads each of its inputs once and materializes only its result.
+//!          The intermediates are computed SN_FUSE_TILE elements at a time and never leave the cache.
+//!          An operator is fused into its consumer only if it has no other consumer.
+//!          A fused sum adds the same blocks in the same order as sn_sum(), so the result does not change.
+//!
+//!          Fusion saves memory traffic, not arithmetic. In benchmarks/sinae_fuse_benchmark.c on a single core,
+//!          a chain of add(), multiply(), abs() and negative() runs 1.2x faster at 65536 elements and 1.8x to 2.2x
+//!          at 16M elements, but only about as fast at 4096 elements, whose intermediates stay in L1 anyway.
+//!          A chain dominated by exp() or another costly function runs within a few percent of the unfused one up
+//!          to 1M elements, and gains 1.1x to 1.2x only once its arrays exceed the last-level cache.
+sn_op* sn_opt_fuse(sn_op* root);
+//! \brief   Folds every subtree made only of constants into a single constant, evaluated once.
+//! \details The number of nodes removed from the graph is stored into \p removed_count if it is not NULL.
+//!          A constant-only operator which is referenced from outside is kept, and its inputs are folded instead.
+sn_op* sn_opt_fold(sn_op* root, SN_UINT* removed_count);
+//! \brief   Merges nodes which compute the same values into one.
+//! \details Two operators are merged if they have the same \p flow function, the same inputs in the same order and
+//!          the same parameters, such as the overwrap of sn_matmul(). Constants are merged if they have the same shape
+//!          and the same bits. Only operators of kinds registered for sn_op_save() are merged, so fused operators and
+//!          unregistered custom operators are left as they are. Commutative inputs are not reordered.
+//!          The number of removed nodes is stored into \p removed_count if it is not NULL.
+sn_op* sn_opt_cse(sn_op* root, SN_UINT* removed_count);
+
+//! \}
+
+
+#endif // !SINAE_OPT_H_INCLUDED_
@@ -0,0 +1,70 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_plan.h
+//! \brief This file includes a compiled execution plan for repeated evaluation.
+
+#ifndef SINAE_PLAN_H_INCLUDED_
+#define SINAE_PLAN_H_INCLUDED_
+
+#include "sinae_core.h"
+
+
+/* Forward declarations */
+
+//! \ingroup plan_group
+typedef struct sn_plan_st sn_plan;
+
+
+/* struct sn_plan_st */
+
+//! \defgroup plan_group Execution plan (sn_plan)
+//! \brief    Provides a graph flattened into a linear instruction list with preallocated buffers.
+//!
+//! \details  Shapes are resolved once by sn_plan_compile() from sample inputs, and every operator gets its output buffer.
+//!           sn_plan_run() reads the inputs directly from the caller. Once a plan has run on a thread, later runs
+//!           on it do no heap allocation as long as every operator has a \p kernel, since the first run grows the
+//!           packing panels of sn_gemm() for that thread. Operators without a kernel fall back to \p flow and a copy,
+//!           and kernels broadcasting over more than SN_VIEW_LOOP_MAX_RANK merged axes allocate their loop.
+//!           With SN_USE_MEMORY, sinae_benchmark checks this on an MLP layer followed by reductions.
+//!           Operators whose lifetimes do not overlap share a buffer of the same shape, and element-wise operators
+//!           write into the buffer of an input which is dead after them, so the buffers hold only the working set.
+//!
+//! \{
+
+struct sn_plan_st {
+    SN_UINT value_count;    //!< Number of values, one for each node.
+    sn_mda** values;        //!< Output buffers of operators, borrowed constants and borrowed inputs.
+    SN_UINT input_count;    //!< Number of inputs.
+    SN_UINT* input_index;   //!< Value index of each input.
+    SN_UINT* input_shapes;  //!< Rank and shape of each input at compilation, concatenated, to check later inputs against.
+    SN_UINT step_count;     //!< Number of instructions.
+    sn_op** step_ops;       //!< Operator of each instruction.
+    SN_UINT* step_y_index;  //!< Value index of the output of each instruction.
+    SN_UINT* step_x_offset; //!< Offset of the inputs of each instruction in \p step_x_index. Has \p step_count + 1 elements.
+    SN_UINT* step_x_index;  //!< Value indices of the inputs of every instruction, concatenated.
+    const sn_mda** x;       //!< Scratch array passed to kernels.
+    SN_UINT output_index;   //!< Value index of the root.
+    SN_UINT buffer_count;   //!< Number of distinct output buffers.
+    sn_mda** buffers;       //!< Distinct output buffers, owned by the plan.
+    SN_UINT buffer_bytes;   //!< Bytes of the elements of \p buffers.
+    SN_UINT value_bytes;    //!< Bytes of the outputs of every operator, which one buffer for each operator would take.
+};
+
+//! \brief   Compiles the expression into a sn_plan object.
+//! \details \p inputs are samples used to resolve shapes and are not retained. Every later input must have the same shape.
+sn_plan* sn_plan_compile(sn_op* root, SN_UINT input_count, sn_op* placeholders[], const sn_mda* inputs[]);
+//! \brief Destroys the object. The nodes are not destroyed.
+void sn_plan_destroy(sn_plan* self);
+//! \brief   Evaluates the plan with \p inputs given in the order of the placeholders at compilation.
+//! \details Returns the output buffer owned by the plan. It is valid until the next run or the destruction of the plan.
+const sn_mda* sn_plan_run(sn_plan* self, const sn_mda* inputs[]);
+
+//! \}
+
+
+#endif // !SINAE_PLAN_H_INCLUDED_
@@ -0,0 +1,85 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_profile.h
+//! \brief This file includes an opt-in profiler of operators.
+
+#ifndef SINAE_PROFILE_H_INCLUDED_
+#define SINAE_PROFILE_H_INCLUDED_
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "sinae_core.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_PROFILE_MAX_RANK
+    //! \brief Overridable number of axes of the output shape kept by an event. Further axes are dropped.
+    #define SN_PROFILE_MAX_RANK 8
+#endif // !SN_PROFILE_MAX_RANK
+
+
+/* Profiler */
+
+//! \defgroup profile_group Profiler
+//! \brief    Records every evaluation of an operator in the forward and backward passes.
+//!
+//! \details  Events are recorded only if "SN_USE_PROFILE" is defined. Otherwise SN_PROFILE_BEGIN() and SN_PROFILE_END()
+//!           expand to nothing and the functions below see no event.
+//!           An event measures the wall time of one call of \p flow, \p kernel, \p bflow, \p vjp, \p bvjp or \p dflow,
+//!           and the bytes allocated through SN_MALLOC() by its thread meanwhile.
+//!
+//! \{
+
+//! \brief Enum type to distinguish the passes of an event.
+typedef enum sn_profile_phase_en {
+    PROFILE_FLOW,  //!< Evaluation of the output.
+    PROFILE_DFLOW, //!< Propagation of the gradient.
+} sn_profile_phase;
+
+//! \brief Evaluation of an operator.
+typedef struct sn_profile_event_st {
+    const sn_op* op;        //!< Node, which may be destroyed since.
+    const char* name;       //!< Name of the kind of the node, or "operator" if it has none.
+    sn_profile_phase phase; //!< Pass.
+    SN_UINT thread;         //!< Index of the recording thread, in the order of their first event.
+    uint64_t start_ns;      //!< Start time in nanoseconds on the monotonic clock.
+    uint64_t duration_ns;   //!< Wall time in nanoseconds.
+    SN_UINT bytes;          //!< Bytes allocated by the thread during the event.
+    SN_UINT rank;           //!< Rank of the output.
+    SN_UINT shape[SN_PROFILE_MAX_RANK]; //!< Shape of the output.
+} sn_profile_event;
+
+//! \brief State of an event in progress. Used through SN_PROFILE_BEGIN().
+typedef struct sn_profile_mark_st {
+    uint64_t start_ns;
+    SN_UINT bytes;
+} sn_profile_mark;
+
+//! \brief Starts an event. Used through SN_PROFILE_BEGIN().
+sn_profile_mark sn_profile_begin_(void);
+//! \brief Records an event started at \p mark. Used through SN_PROFILE_END().
+void sn_profile_end_(const sn_profile_mark* mark, sn_profile_phase phase, const sn_op* op, const sn_mda* y);
+
+//! \brief Discards every recorded event.
+void sn_profile_reset(void);
+//! \brief Returns the number of recorded events.
+SN_UINT sn_profile_count(void);
+//! \brief Returns the recorded events in the order of their end. The pointer is valid until the next event or reset.
+const sn_profile_event* sn_profile_events(void);
+//! \brief   Prints the call count, time and bytes of each kind of operator, then of the \p node_count most expensive nodes.
+//! \details Every line is one kind or one node in one phase.
+void sn_profile_print_summary(FILE* stream, SN_UINT node_count);
+//! \brief Writes the events as a Chrome trace-event JSON, which chrome://tracing and Perfetto can load.
+void sn_profile_write_trace(FILE* stream);
+
+//! \}
+
+
+#endif // !SINAE_PROFILE_H_INCLUDED_
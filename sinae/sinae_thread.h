@@ -0,0 +1,81 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_thread.h
+//! \brief This file includes a thread pool which splits large kernels across threads.
+
+#ifndef SINAE_THREAD_H_INCLUDED_
+#define SINAE_THREAD_H_INCLUDED_
+
+#include <stdbool.h>
+
+#include "sinae_macro.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_THREAD_THRESHOLD
+    //! \brief Overridable default number of elements below which a kernel is not split.
+    #define SN_THREAD_THRESHOLD 32768
+#endif // !SN_THREAD_THRESHOLD
+
+#ifndef SN_THREAD_BLOCK
+    //! \brief Overridable number of elements of a block of sn_thread_reduce(). Partial results are combined block by block.
+    #define SN_THREAD_BLOCK 4096
+#endif // !SN_THREAD_BLOCK
+
+
+/* Thread pool */
+
+//! \defgroup thread_group Thread pool (sn_thread)
+//! \brief    Provides intra-operator parallelism to the kernels of the built-in operators.
+//!
+//! \details  The pool exists only if "SN_USE_PTHREAD" is defined. Otherwise, or until sn_thread_set_count() is called
+//!           with more than one thread, every kernel runs on the calling thread.
+//!           The result of a kernel does not depend on the number of threads, since every element is calculated
+//!           by the same operations and sn_thread_reduce() always combines the same blocks in the same order.
+//!           sn_thread_run_dag() schedules independent operators on the same threads.
+//!
+//! \{
+
+//! \brief Function type which processes the elements in [ \p begin, \p end ).
+typedef void sn_thread_range_fn(void* context, SN_UINT begin, SN_UINT end);
+//! \brief Function type which returns the partial result of the elements in [ \p begin, \p end ).
+typedef SN_FLOAT sn_thread_reduce_fn(void* context, SN_UINT begin, SN_UINT end);
+//! \brief Function type which runs the task \p task on the worker \p worker.
+typedef void sn_thread_task_fn(void* context, SN_UINT worker, SN_UINT task);
+
+//! \brief   Sets the number of threads including the calling one. 1 stops the pool.
+//! \details Returns false if the build does not have the pool or the threads cannot be created.
+//!          Must not be called while a kernel is running.
+bool sn_thread_set_count(SN_UINT count);
+//! \brief Returns the number of threads including the calling one.
+SN_UINT sn_thread_get_count(void);
+//! \brief Sets the number of elements below which a kernel is not split.
+void sn_thread_set_threshold(SN_UINT threshold);
+//! \brief Returns the number of elements below which a kernel is not split.
+SN_UINT sn_thread_get_threshold(void);
+//! \brief   Calls \p fn on contiguous ranges covering [ 0, \p size ), each of at least \p grain elements.
+//! \details Called from a thread of the pool or while the pool is busy, it runs on the calling thread.
+void sn_thread_parallel_for(SN_UINT size, SN_UINT grain, sn_thread_range_fn* fn, void* context);
+//! \brief   Returns the sum of \p fn over the blocks of SN_THREAD_BLOCK elements covering [ 0, \p size ).
+//! \details The partial results are added pairwise in the order of the blocks, whatever the number of threads is.
+SN_FLOAT sn_thread_reduce(SN_UINT size, sn_thread_reduce_fn* fn, void* context);
+
+//! \brief   Runs \p task_count tasks of a DAG on up to \p worker_count workers and returns when every task is done.
+//! \details A task becomes ready when \p pending of it, the number of its unfinished predecessors, reaches zero.
+//!          The successors of the task t are successor_index[ successor_offset[ t ] ] to successor_index[ successor_offset[ t + 1 ] - 1 ].
+//!          Each worker has a deque. It runs its newest ready task and steals the oldest one of another worker when idle.
+//!          The number of workers is at most sn_thread_get_count(), and \p fn gets a worker index below \p worker_count.
+//!          \p pending is consumed.
+void sn_thread_run_dag(SN_UINT task_count, SN_UINT pending[], const SN_UINT successor_offset[], const SN_UINT successor_index[],
+                       sn_thread_task_fn* fn, void* context, SN_UINT worker_count);
+
+//! \}
+
+
+#endif // !SINAE_THREAD_H_INCLUDED_
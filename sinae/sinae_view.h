@@ -0,0 +1,138 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_view.h
+//! \brief This file includes a strided view of a sn_mda object and broadcasting.
+
+#ifndef SINAE_VIEW_H_INCLUDED_
+#define SINAE_VIEW_H_INCLUDED_
+
+#include <stdbool.h>
+
+#include "sinae_macro.h"
+#include "sinae_mda.h"
+
+
+/* Overridable macros */
+
+#ifndef SN_VIEW_LOOP_MAX_RANK
+    //! \brief Overridable largest merged rank of a loop which is built in a sn_view_loop_storage or run without allocation.
+    #define SN_VIEW_LOOP_MAX_RANK 16
+#endif // !SN_VIEW_LOOP_MAX_RANK
+
+#ifndef SN_VIEW_LOOP_MAX_COUNT
+    //! \brief Overridable largest number of operands of a loop which is built in a sn_view_loop_storage or run without allocation.
+    #define SN_VIEW_LOOP_MAX_COUNT 16
+#endif // !SN_VIEW_LOOP_MAX_COUNT
+
+
+/* Forward declarations */
+
+//! \ingroup view_group
+typedef struct sn_view_st sn_view;
+//! \ingroup view_group
+typedef struct sn_view_loop_st sn_view_loop;
+
+
+/* Broadcasting */
+
+//! \defgroup view_group Strided view (sn_view)
+//! \brief    Provides views which share the data of a sn_mda object with their own shape, strides and offset.
+//!
+//! \details  Reshaping, transposing, slicing and broadcasting a view only computes new strides, so it costs O(rank).
+//!           A view borrows the data of its base, which must outlive it.
+//!
+//!           Shapes are broadcasted like NumPy does, except that they are aligned at their first axis,
+//!           which is the counterpart of the NumPy rule for column-major arrays. Missing axes are treated as 1,
+//!           and an axis of 1 is repeated along the other shape. For example, ( 3, 1 ) and ( 1, 4 ) are broadcasted to ( 3, 4 ),
+//!           and ( 3 ) is added to every column of ( 3, 4 ).
+//!
+//! \{
+
+//! \brief   Writes the broadcasted shape of two shapes into \p shape, which holds the larger rank.
+//! \details Returns false if they cannot be broadcasted.
+bool sn_broadcast_shape(SN_UINT rank0, const SN_UINT shape0[], SN_UINT rank1, const SN_UINT shape1[], SN_UINT* rank, SN_UINT shape[]);
+
+
+/* struct sn_view_st */
+
+struct sn_view_st {
+    SN_UINT rank;    //!< Rank of the view.
+    SN_UINT* shape;  //!< Shape of the view.
+    SN_UINT* stride; //!< Distance between two consecutive elements along each axis. A broadcasted axis has a stride of 0.
+    SN_UINT offset;  //!< Position of the first element in the data of the base.
+    sn_mda* base;    //!< Array whose data is viewed.
+};
+
+//! \brief Creates a view of the whole array.
+sn_view* sn_view_create(sn_mda* base);
+//! \brief Destroys the view. The base is not destroyed.
+void sn_view_destroy(sn_view* self);
+//! \brief Returns the size of the view.
+SN_UINT sn_view_size(const sn_view* self);
+//! \brief Returns true if the view reads the data of the base in order without gaps.
+bool sn_view_is_contiguous(const sn_view* self);
+//! \brief Gets the pointer to the element of the view.
+SN_FLOAT* sn_view_get(const sn_view* self, const SN_UINT index[]);
+//! \brief   Returns a view in another shape of the same size, or NULL if the strides cannot express it.
+//! \details A contiguous view can always be reshaped. Otherwise only the axes which are contiguous among themselves can be merged.
+sn_view* sn_view_reshape(const sn_view* self, SN_UINT rank, const SN_UINT shape[]);
+//! \brief Returns a view whose axis i is the axis \p axes[i] of the view. The order of the axes is reversed if \p axes is NULL.
+sn_view* sn_view_transpose(const sn_view* self, const SN_UINT axes[]);
+//! \brief Returns a view of the indices [ \p begin, \p end ) of \p axis taken every \p step.
+sn_view* sn_view_slice(const sn_view* self, SN_UINT axis, SN_UINT begin, SN_UINT end, SN_UINT step);
+//! \brief Returns a view broadcasted to \p shape, which repeats the elements with a stride of 0.
+sn_view* sn_view_broadcast(const sn_view* self, SN_UINT rank, const SN_UINT shape[]);
+//! \brief Returns a contiguous copy of the view.
+sn_mda* sn_view_to_mda(const sn_view* self);
+//! \brief   Adds the elements of \p x to the elements of the view in the same shape.
+//! \details An element which is viewed several times through a broadcasted axis receives the sum of its elements of \p x.
+void sn_view_accumulate(sn_view* self, const sn_view* x);
+
+
+/* struct sn_view_loop_st */
+
+//! \brief   Function type called for a run of \p n elements along the first axis of a sn_view_loop.
+//! \details The run starts at the \p position -th element of the loop in column-major order.
+//!          The operand k starts at \p offset[k] of the data of its base and advances by \p step[k].
+typedef void sn_view_run_fn(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]);
+
+//! \brief   Strided loop over several operands in the same shape.
+//! \details Axes of 1 are dropped and consecutive axes which every operand steps through without gaps are merged,
+//!          so operands in the same contiguous layout are visited by a single run.
+struct sn_view_loop_st {
+    SN_UINT count;   //!< Number of operands.
+    SN_UINT rank;    //!< Rank of the merged shape, which is at least 1.
+    SN_UINT* shape;  //!< Merged shape.
+    SN_UINT* stride; //!< Stride of the operand k along the axis a at stride[ a * count + k ].
+    SN_UINT* offset; //!< Offset of the first element of each operand.
+};
+
+//! \brief Storage of a sn_view_loop built without allocation, for example on the stack.
+typedef struct sn_view_loop_storage_st {
+    sn_view_loop loop; //!< Loop.
+    SN_UINT data[SN_VIEW_LOOP_MAX_RANK * (SN_VIEW_LOOP_MAX_COUNT + 1) + SN_VIEW_LOOP_MAX_COUNT]; //!< Shape, strides and offsets.
+} sn_view_loop_storage;
+
+//! \brief Creates a loop over views in the same shape.
+sn_view_loop* sn_view_loop_create(SN_UINT count, const sn_view* views[]);
+//! \brief Creates a loop over whole arrays broadcasted to \p shape.
+sn_view_loop* sn_view_loop_broadcast(SN_UINT count, const sn_mda* x[], SN_UINT rank, const SN_UINT shape[]);
+//! \brief   Builds the loop of sn_view_loop_broadcast() in \p storage without allocation. The loop is not destroyed.
+//! \details If \p shape is NULL, the arrays are broadcasted to each other and \p rank is ignored. Returns NULL if \p count
+//!          is more than SN_VIEW_LOOP_MAX_COUNT or the merged shape has more than SN_VIEW_LOOP_MAX_RANK axes.
+sn_view_loop* sn_view_loop_broadcast_in(sn_view_loop_storage* storage, SN_UINT count, const sn_mda* x[], SN_UINT rank, const SN_UINT shape[]);
+//! \brief Destroys the object.
+void sn_view_loop_destroy(sn_view_loop* self);
+//! \brief   Calls \p run for every run of the elements [ \p begin, \p end ) of the loop in column-major order.
+//! \details Does not allocate unless the loop has more than SN_VIEW_LOOP_MAX_RANK axes or SN_VIEW_LOOP_MAX_COUNT operands.
+void sn_view_loop_run(const sn_view_loop* self, SN_UINT begin, SN_UINT end, sn_view_run_fn* run, void* context);
+
+//! \}
+
+
+#endif // !SINAE_VIEW_H_INCLUDED_
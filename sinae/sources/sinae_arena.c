@@ -0,0 +1,171 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_arena.c
+//! \brief This file implements sinae_arena.h.
+
+#include "../sinae_arena.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+
+
+/* struct sn_arena_st */
+
+// Chunks always come from the heap, never from SN_MALLOC, which may be routed to an arena.
+
+static SN_THREAD_LOCAL sn_arena* bound_arena_ = NULL;
+
+static sn_arena_chunk* arena_chunk_create_(SN_UINT capacity) {
+    sn_arena_chunk* obj = (sn_arena_chunk*)malloc(sizeof(sn_arena_chunk) + capacity + SN_ARENA_ALIGNMENT);
+    if (obj == NULL) {
+        return NULL;
+    }
+    uintptr_t ptr = (uintptr_t)&(obj[1]);
+    obj->next = NULL;
+    obj->capacity = capacity;
+    obj->used = 0;
+    obj->ptr = (unsigned char*)((ptr + SN_ARENA_ALIGNMENT - 1) & ~(uintptr_t)(SN_ARENA_ALIGNMENT - 1));
+    return obj;
+}
+
+sn_arena* sn_arena_create(SN_UINT chunk_size) {
+    sn_arena* obj = (sn_arena*)malloc(sizeof(sn_arena));
+    if (obj == NULL) {
+        return NULL;
+    }
+    obj->chunk_size = (chunk_size > 0) ? chunk_size : 4096;
+    obj->chunks = arena_chunk_create_(obj->chunk_size); // If it fails, sn_arena_alloc() tries again.
+    obj->allocation_count = 0;
+    obj->allocated_bytes = 0;
+    obj->peak_bytes = 0;
+    obj->reserved_bytes = obj->chunks ? obj->chunk_size : 0;
+    return obj;
+}
+
+void sn_arena_destroy(sn_arena* self) {
+    if (bound_arena_ == self) {
+        bound_arena_ = NULL;
+    }
+    while (self->chunks) {
+        sn_arena_chunk* next = self->chunks->next;
+        free(self->chunks);
+        self->chunks = next;
+    }
+    free(self);
+}
+
+void* sn_arena_alloc(sn_arena* self, SN_UINT size) {
+    SN_UINT aligned_size = (size + SN_ARENA_ALIGNMENT - 1) & ~(SN_UINT)(SN_ARENA_ALIGNMENT - 1);
+    if (aligned_size == 0) {
+        aligned_size = SN_ARENA_ALIGNMENT;
+    }
+    if (self->chunks == NULL || self->chunks->used + aligned_size > self->chunks->capacity) {
+        SN_UINT capacity = (aligned_size > self->chunk_size) ? aligned_size : self->chunk_size;
+        sn_arena_chunk* chunk = arena_chunk_create_(capacity);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->next = self->chunks;
+        self->chunks = chunk;
+        self->reserved_bytes += capacity;
+    }
+    void* ptr = &(self->chunks->ptr[self->chunks->used]);
+    self->chunks->used += aligned_size;
+    ++(self->allocation_count);
+    self->allocated_bytes += aligned_size;
+    if (self->allocated_bytes > self->peak_bytes) {
+        self->peak_bytes = self->allocated_bytes;
+    }
+    return ptr;
+}
+
+void sn_arena_reset(sn_arena* self) {
+    if (self->chunks && self->chunks->next) { // Merges the chunks into one large enough for the last evaluation.
+        SN_UINT capacity = 0;
+        while (self->chunks) {
+            sn_arena_chunk* next = self->chunks->next;
+            capacity += self->chunks->capacity;
+            free(self->chunks);
+            self->chunks = next;
+        }
+        self->chunks = arena_chunk_create_(capacity);
+        self->reserved_bytes = capacity;
+    }
+    if (self->chunks) {
+        self->chunks->used = 0;
+    }
+    self->allocation_count = 0;
+    self->allocated_bytes = 0;
+}
+
+bool sn_arena_owns(const sn_arena* self, const void* ptr) {
+    for (const sn_arena_chunk* chunk = self->chunks; chunk != NULL; chunk = chunk->next) {
+        if ((const unsigned char*)ptr >= chunk->ptr && (const unsigned char*)ptr < chunk->ptr + chunk->capacity) {
+            return true;
+        }
+    }
+    return false;
+}
+
+sn_arena* sn_arena_bind(sn_arena* self) {
+    sn_arena* previous = bound_arena_;
+    bound_arena_ = self;
+    return previous;
+}
+
+void* sn_arena_malloc_(size_t size) {
+    return bound_arena_ ? sn_arena_alloc(bound_arena_, (SN_UINT)size) : malloc(size);
+}
+
+void sn_arena_free_(void* ptr) {
+    if (ptr != NULL && !(bound_arena_ && sn_arena_owns(bound_arena_, ptr))) {
+        free(ptr);
+    }
+}
+
+// Results are copied to the heap, then the copies in the arena are destroyed while it is still bound.
+// Freeing arena memory does nothing but lets SN_FREE observe it, as the memory accounting of sinae_memory.h does.
+
+sn_mda* sn_op_aflow(sn_op* self, sn_map* feed, sn_arena* arena) {
+    sn_arena* previous = sn_arena_bind(arena);
+    sn_mda* y = sn_op_flow(self, feed);
+    if (y != NULL && sn_arena_owns(arena, y)) {
+        sn_arena_bind(previous);
+        sn_mda* temp = sn_mda_copy(y);
+        sn_arena_bind(arena);
+        sn_mda_destroy(y);
+        y = temp;
+    }
+    sn_arena_bind(previous);
+    sn_arena_reset(arena);
+    return y;
+}
+
+sn_map* sn_op_adflow(sn_op* self, sn_map* feed, sn_arena* arena) {
+    sn_arena* previous = sn_arena_bind(arena);
+    sn_map* dy_dx_map = sn_op_dflow(self, feed);
+    if (dy_dx_map != NULL && sn_arena_owns(arena, dy_dx_map)) {
+        sn_arena_bind(previous);
+        sn_map* temp = sn_map_create(dy_dx_map->count, NULL, NULL);
+        for (SN_UINT i = 0; i < dy_dx_map->count; ++i) {
+            sn_mda* value = dy_dx_map->values[i];
+            sn_map_insert(temp, dy_dx_map->keys[i], sn_arena_owns(arena, value) ? sn_mda_copy(value) : value);
+        }
+        sn_arena_bind(arena);
+        for (SN_UINT i = 0; i < dy_dx_map->count; ++i) {
+            if (sn_arena_owns(arena, dy_dx_map->values[i])) {
+                sn_mda_destroy(dy_dx_map->values[i]);
+            }
+        }
+        sn_map_release(dy_dx_map);
+        dy_dx_map = temp;
+    }
+    sn_arena_bind(previous);
+    sn_arena_reset(arena);
+    return dy_dx_map;
+}
@@ -0,0 +1,340 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_batch.c
+//! \brief This file implements sinae_batch.h.
+
+#include "../sinae_batch.h"
+#include "../sinae_graph.h"
+#include "../sinae_profile.h"
+
+
+/* Batched evaluation */
+
+/* Returns true if the batch is not empty and every feed gives every placeholder of the graph in the shape of the first feed. */
+static bool batch_feeds_are_valid_(const sn_graph* graph, SN_UINT batch_count, sn_map* feeds[]) {
+    if (batch_count == 0) {
+        return false;
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        if (op->type != PLACEHOLDER) {
+            continue;
+        }
+        if (sn_map_count(feeds[0], op) == 0) {
+            return false;
+        }
+        const sn_mda* first = sn_map_get(feeds[0], op);
+        for (SN_UINT s = 1; s < batch_count; ++s) {
+            if (sn_map_count(feeds[s], op) == 0) {
+                return false;
+            }
+            const sn_mda* sample = sn_map_get(feeds[s], op);
+            if (sample->rank != first->rank) {
+                return false;
+            }
+            for (SN_UINT a = 0; a < first->rank; ++a) {
+                if (sample->shape[a] != first->shape[a]) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+static void batch_feeds_destroy_(SN_UINT batch_count, sn_map* feeds[]) {
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        sn_map_destroy(feeds[s]);
+    }
+}
+
+/* Returns the values of the placeholder in every feed stacked along a new last axis. */
+static sn_mda* batch_stack_(SN_UINT batch_count, sn_map* feeds[], sn_op* placeholder) {
+    const sn_mda* first = sn_map_get(feeds[0], placeholder);
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, first->rank + 1);
+    for (SN_UINT i = 0; i < first->rank; ++i) {
+        shape[i] = first->shape[i];
+    }
+    shape[first->rank] = batch_count;
+    sn_mda* obj = sn_mda_create(first->rank + 1, shape);
+    SN_FREE(shape);
+
+    SN_UINT size = sn_mda_size(first);
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        const sn_mda* sample = sn_map_get(feeds[s], placeholder);
+        for (SN_UINT i = 0; i < size; ++i) {
+            obj->ptr[s * size + i] = sample->ptr[i];
+        }
+    }
+    return obj;
+}
+
+/* Returns a copy of the sample s of a batched value, whose last axis is the batch. */
+static sn_mda* batch_sample_(const sn_mda* x, SN_UINT batch_count, SN_UINT s) {
+    sn_mda* obj = sn_mda_create(x->rank - 1, x->shape);
+    SN_UINT size = sn_mda_size(x) / batch_count;
+    for (SN_UINT i = 0; i < size; ++i) {
+        obj->ptr[i] = x->ptr[s * size + i];
+    }
+    return obj;
+}
+
+/* Evaluates an operator without bflow sample by sample. */
+static sn_mda* batch_flow_fallback_(sn_op* op, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]) {
+    const sn_mda** x_sample = SN_DYNAMIC_ARRAY(const sn_mda*, op->x_count);
+    sn_mda* y = NULL;
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x_sample[j] = x_batched[j] ? batch_sample_(x[j], batch_count, s) : x[j];
+        }
+        sn_mda* y_sample = op->flow(op, x_sample);
+        SN_UINT size = sn_mda_size(y_sample);
+        if (y == NULL) {
+            SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, y_sample->rank + 1);
+            for (SN_UINT i = 0; i < y_sample->rank; ++i) {
+                shape[i] = y_sample->shape[i];
+            }
+            shape[y_sample->rank] = batch_count;
+            y = sn_mda_create(y_sample->rank + 1, shape);
+            SN_FREE(shape);
+        }
+        for (SN_UINT i = 0; i < size; ++i) {
+            y->ptr[s * size + i] = y_sample->ptr[i];
+        }
+        sn_mda_destroy(y_sample);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            if (x_batched[j]) {
+                sn_mda_destroy((sn_mda*)x_sample[j]);
+            }
+        }
+    }
+    SN_FREE(x_sample);
+    return y;
+}
+
+/* Differentiates an operator without bvjp sample by sample, through vjp or the dflow Jacobians. */
+static void batch_vjp_fallback_(sn_op* op, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    const sn_mda** x_sample = SN_DYNAMIC_ARRAY(const sn_mda*, op->x_count);
+    sn_mda** dx_sample = SN_DYNAMIC_ARRAY(sn_mda*, op->x_count);
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x_sample[j] = x_batched[j] ? batch_sample_(x[j], batch_count, s) : x[j];
+            dx_sample[j] = dx[j] ? sn_mda_full(x_sample[j]->rank, x_sample[j]->shape, 0.0) : NULL;
+        }
+        sn_mda* y_sample = batch_sample_(y, batch_count, s);
+        sn_mda* dy_sample = batch_sample_(dy, batch_count, s);
+        if (op->vjp) {
+            op->vjp(op, x_sample, y_sample, dy_sample, dx_sample);
+        }
+        else {
+            SN_ASSERT(op->dflow != NULL);
+            sn_jac** dy_dx_list = op->dflow(op, x_sample);
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (dx_sample[j]) {
+                    sn_jac_vjp(dy_dx_list[j], dy_sample->ptr, dx_sample[j]->ptr);
+                }
+                sn_jac_destroy(dy_dx_list[j]);
+            }
+            SN_FREE(dy_dx_list);
+        }
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            if (dx_sample[j]) {
+                SN_UINT size = sn_mda_size(dx_sample[j]);
+                for (SN_UINT i = 0; i < size; ++i) {
+                    dx[j]->ptr[s * size + i] += dx_sample[j]->ptr[i];
+                }
+                sn_mda_destroy(dx_sample[j]);
+            }
+            if (x_batched[j]) {
+                sn_mda_destroy((sn_mda*)x_sample[j]);
+            }
+        }
+        sn_mda_destroy(dy_sample);
+        sn_mda_destroy(y_sample);
+    }
+    SN_FREE(dx_sample);
+    SN_FREE(x_sample);
+}
+
+/* Evaluates every node once over the batch. A node is batched if it depends on a placeholder.
+   Values of constants are borrowed. */
+static sn_mda** batch_graph_flow_(const sn_graph* graph, SN_UINT batch_count, sn_map* feeds[], bool batched[]) {
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
+        }
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    bool* x_batched = SN_DYNAMIC_ARRAY(bool, x_capacity);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        batched[i] = (op->type == PLACEHOLDER);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
+            x_batched[j] = batched[x_index[j]];
+            batched[i] = batched[i] || x_batched[j];
+        }
+        if (op->type == CONSTANT) {
+            y[i] = *((sn_mda**)(op->x));
+        }
+        else if (op->type == PLACEHOLDER) {
+            y[i] = batch_stack_(batch_count, feeds, op);
+        }
+        else {
+            SN_MEMORY_BEGIN(owner, op);
+            SN_PROFILE_BEGIN(mark);
+            if (!batched[i]) {
+                y[i] = op->flow(op, x);
+            }
+            else if (op->bflow) {
+                y[i] = op->bflow(op, batch_count, x, x_batched);
+            }
+            else {
+                y[i] = batch_flow_fallback_(op, batch_count, x, x_batched);
+            }
+            SN_PROFILE_END(mark, PROFILE_FLOW, op, y[i]);
+            SN_MEMORY_END(owner);
+        }
+    }
+    SN_FREE(x_batched);
+    SN_FREE(x);
+    return y;
+}
+
+/* Destroys the values owned by batch_graph_flow_() and the feeds. */
+static void batch_graph_destroy_(const sn_graph* graph, sn_mda** y, SN_UINT batch_count, sn_map* feeds[]) {
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->type != CONSTANT && y[i] != NULL) {
+            sn_mda_destroy(y[i]);
+        }
+    }
+    SN_FREE(y);
+    batch_feeds_destroy_(batch_count, feeds);
+}
+
+sn_mda** sn_op_bflow(sn_op* self, SN_UINT batch_count, sn_map* feeds[]) {
+    sn_graph* graph = sn_graph_create(self);
+    if (!batch_feeds_are_valid_(graph, batch_count, feeds)) {
+        batch_feeds_destroy_(batch_count, feeds);
+        sn_graph_destroy(graph);
+        return NULL;
+    }
+    bool* batched = SN_DYNAMIC_ARRAY(bool, graph->count);
+    sn_mda** y = batch_graph_flow_(graph, batch_count, feeds, batched);
+
+    SN_UINT root = graph->count - 1;
+    sn_mda** result = SN_DYNAMIC_ARRAY(sn_mda*, batch_count);
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        result[s] = batched[root] ? batch_sample_(y[root], batch_count, s) : sn_mda_copy(y[root]);
+    }
+
+    SN_FREE(batched);
+    batch_graph_destroy_(graph, y, batch_count, feeds);
+    sn_graph_destroy(graph);
+    return result;
+}
+
+sn_map** sn_op_bdflow(sn_op* self, SN_UINT batch_count, sn_map* feeds[]) {
+    sn_graph* graph = sn_graph_create(self);
+    if (!batch_feeds_are_valid_(graph, batch_count, feeds)) {
+        batch_feeds_destroy_(batch_count, feeds);
+        sn_graph_destroy(graph);
+        return NULL;
+    }
+    bool* batched = SN_DYNAMIC_ARRAY(bool, graph->count);
+    sn_mda** y = batch_graph_flow_(graph, batch_count, feeds, batched);
+
+    // Every placeholder is batched, so the nodes which need a gradient are exactly the batched ones.
+    SN_UINT root = graph->count - 1;
+    sn_mda** dy = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        dy[i] = NULL;
+    }
+    if (batched[root]) {
+        SN_ASSERT(sn_mda_size(y[root]) == batch_count); // If the expression is not a scalar for each sample.
+        dy[root] = sn_mda_full(y[root]->rank, y[root]->shape, 1.0);
+    }
+
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
+        }
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    bool* x_batched = SN_DYNAMIC_ARRAY(bool, x_capacity);
+    sn_mda** dx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity);
+    for (SN_UINT i = graph->count; i-- > 0;) {
+        sn_op* op = graph->ops[i];
+        if (op->type != OPERATOR || dy[i] == NULL) {
+            continue;
+        }
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
+            x_batched[j] = batched[x_index[j]];
+            dx[j] = NULL;
+            if (x_batched[j]) {
+                if (dy[x_index[j]] == NULL) {
+                    dy[x_index[j]] = sn_mda_full(x[j]->rank, x[j]->shape, 0.0);
+                }
+                dx[j] = dy[x_index[j]];
+            }
+        }
+        SN_MEMORY_BEGIN(owner, op);
+        SN_PROFILE_BEGIN(mark);
+        if (op->bvjp) {
+            op->bvjp(op, batch_count, x, x_batched, y[i], dy[i], dx);
+        }
+        else {
+            batch_vjp_fallback_(op, batch_count, x, x_batched, y[i], dy[i], dx);
+        }
+        SN_PROFILE_END(mark, PROFILE_DFLOW, op, y[i]);
+        SN_MEMORY_END(owner);
+        sn_mda_destroy(dy[i]);
+        dy[i] = NULL;
+    }
+    SN_FREE(dx);
+    SN_FREE(x_batched);
+    SN_FREE(x);
+
+    SN_UINT placeholder_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        placeholder_count += (graph->ops[i]->type == PLACEHOLDER);
+    }
+    sn_map** result = SN_DYNAMIC_ARRAY(sn_map*, batch_count);
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        result[s] = sn_map_create(placeholder_count > 0 ? placeholder_count : 1, NULL, NULL);
+        for (SN_UINT i = 0; i < graph->count; ++i) {
+            if (graph->ops[i]->type == PLACEHOLDER) {
+                sn_mda* gradient = dy[i] ? batch_sample_(dy[i], batch_count, s) : batch_sample_(y[i], batch_count, s);
+                if (dy[i] == NULL) { // The expression does not depend on the placeholder.
+                    SN_UINT size = sn_mda_size(gradient);
+                    for (SN_UINT k = 0; k < size; ++k) {
+                        gradient->ptr[k] = 0.0;
+                    }
+                }
+                sn_map_insert(result[s], graph->ops[i], gradient);
+            }
+        }
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (dy[i]) {
+            sn_mda_destroy(dy[i]);
+        }
+    }
+
+    SN_FREE(dy);
+    SN_FREE(batched);
+    batch_graph_destroy_(graph, y, batch_count, feeds);
+    sn_graph_destroy(graph);
+    return result;
+}
@@ -9,6 +9,10 @@
 //! \brief This file implements sinae_core.h.
 
 #include "../sinae_core.h"
+#include "../sinae_arena.h"
+#include "../sinae_graph.h"
+#include "../sinae_profile.h"
+#include "../sinae_thread.h"
 
 #include <stdarg.h>
 
@@ -16,12 +20,50 @@
 /* struct sn_map_st */
 
 
+/* Returns the slot of the key, or the empty slot where the key would be placed. */
+static SN_UINT map_slot_(const sn_map* self, const sn_op* key) {
+    SN_UINT slot = SN_PTR_HASH(key) & (self->table_capacity - 1);
+    while (self->table[2 * slot] != 0 && self->keys[self->table[2 * slot] - 1] != key) {
+        slot = (slot + 1) & (self->table_capacity - 1);
+    }
+    return slot;
+}
+
+/* Links the pair at the index into the chain of its key. */
+static void map_link_(sn_map* self, SN_UINT index) {
+    SN_UINT slot = map_slot_(self, self->keys[index]);
+    self->next[index] = 0;
+    if (self->table[2 * slot] == 0) {
+        self->table[2 * slot] = index + 1;
+    }
+    else {
+        self->next[self->table[2 * slot + 1] - 1] = index + 1;
+    }
+    self->table[2 * slot + 1] = index + 1;
+}
+
+static void map_rehash_(sn_map* self, SN_UINT table_capacity) {
+    SN_FREE(self->table);
+    self->table_capacity = table_capacity;
+    self->table = SN_DYNAMIC_ARRAY(SN_UINT, 2 * table_capacity);
+    for (SN_UINT i = 0; i < 2 * table_capacity; ++i) {
+        self->table[i] = 0;
+    }
+    for (SN_UINT i = 0; i < self->count; ++i) {
+        map_link_(self, i);
+    }
+}
+
 sn_map* sn_map_create(SN_UINT capacity, sn_op* keys[], sn_mda* values[]) {
     sn_map* obj = (sn_map*)SN_MALLOC(sizeof(sn_map));
-    obj->capacity = capacity;
+    obj->capacity = 0;
     obj->count = 0;
-    obj->keys = (sn_op**)SN_MALLOC(capacity * (sizeof(sn_op*) + sizeof(sn_mda*)));
-    obj->values = (sn_mda**)&(obj->keys[capacity]);
+    obj->keys = NULL;
+    obj->values = NULL;
+    obj->next = NULL;
+    obj->table_capacity = 0;
+    obj->table = NULL;
+    sn_map_extend(obj, (capacity > 0) ? capacity : 1);
     if (keys && values) {
         for (SN_UINT i = 0; i < capacity; ++i) {
             sn_map_insert(obj, keys[i], values[i]);
@@ -44,66 +86,76 @@ sn_map* sn_map_from(SN_UINT capacity, ... /* sn_op*, sn_mda*, ... */) {
 }
 
 void sn_map_extend(sn_map* self, SN_UINT offset) {
-    sn_op** new_keys = (sn_op**)SN_MALLOC((self->capacity + offset) * (sizeof(sn_op*) + sizeof(sn_mda*)));
-    sn_mda** new_values = (sn_mda**)&(new_keys[self->capacity + offset]);
+    SN_UINT capacity = self->capacity + offset;
+    sn_op** new_keys = (sn_op**)SN_MALLOC(capacity * (sizeof(sn_op*) + sizeof(sn_mda*) + sizeof(SN_UINT)));
+    sn_mda** new_values = (sn_mda**)&(new_keys[capacity]);
+    SN_UINT* new_next = (SN_UINT*)&(new_values[capacity]);
     for (SN_UINT i = 0; i < self->count; ++i) {
         new_keys[i] = self->keys[i];
         new_values[i] = self->values[i];
     }
     SN_FREE(self->keys);
-    self->capacity += offset;
+    self->capacity = capacity;
     self->keys = new_keys;
     self->values = new_values;
+    self->next = new_next;
+
+    // Keeps the load factor of the table at most 1/2 and relinks the moved chains.
+    SN_UINT table_capacity = (self->table_capacity > 0) ? self->table_capacity : 1;
+    while (table_capacity < 2 * capacity) {
+        table_capacity *= 2;
+    }
+    map_rehash_(self, table_capacity);
 }
 
 void sn_map_destroy(sn_map* self) {
     for (SN_UINT i = 0; i < self->count; ++i) {
         sn_mda_destroy(self->values[i]);
     }
+    sn_map_release(self);
+}
+
+void sn_map_release(sn_map* self) {
     SN_FREE(self->keys);
+    SN_FREE(self->table);
     SN_FREE(self);
 }
 
 void sn_map_insert(sn_map* self, sn_op* key, sn_mda* value) {
-    if (self->count < self->capacity) {
-        self->keys[self->count] = key;
-        self->values[self->count] = value;
-        ++(self->count);
-    }
-    else {
+    if (self->count == self->capacity) {
         sn_map_extend(self, self->capacity);
-        sn_map_insert(self, key, value);
     }
+    self->keys[self->count] = key;
+    self->values[self->count] = value;
+    ++(self->count);
+    map_link_(self, self->count - 1);
 }
 
 sn_mda* sn_map_get(sn_map* self, sn_op* key) {
-    for (SN_UINT i = 0; i < self->count; ++i) {
-        if (self->keys[i] == key) {
-            return self->values[i];
-        }
-    }
-    SN_ASSERT(false);
-    return NULL;
+    SN_UINT slot = map_slot_(self, key);
+    SN_ASSERT(self->table[2 * slot] != 0);
+    return (self->table[2 * slot] != 0) ? self->values[self->table[2 * slot] - 1] : NULL;
 }
 
 sn_mda** sn_map_get_all(sn_map* self, sn_op* key) {
-    SN_UINT count = 0;
-    for (SN_UINT i = 0; i < self->count; ++i) {
-        if (self->keys[i] == key) {
-            ++count;
-        }
-    }
+    SN_UINT count = sn_map_count(self, key);
     sn_mda** values = SN_DYNAMIC_ARRAY(sn_mda*, count);
     count = 0;
-    for (SN_UINT i = 0; i < self->count; ++i) {
-        if (self->keys[i] == key) {
-            values[count] = self->values[i];
-            ++count;
-        }
+    for (SN_UINT i = self->table[2 * map_slot_(self, key)]; i != 0; i = self->next[i - 1]) {
+        values[count] = self->values[i - 1];
+        ++count;
     }
     return values;
 }
 
+SN_UINT sn_map_count(const sn_map* self, const sn_op* key) {
+    SN_UINT count = 0;
+    for (SN_UINT i = self->table[2 * map_slot_(self, key)]; i != 0; i = self->next[i - 1]) {
+        ++count;
+    }
+    return count;
+}
+
 
 /* struct sn_op_st */
 
@@ -113,6 +165,14 @@ sn_op* sn_op_create(sn_op_type type, sn_flow_fn* flow, sn_dflow_fn* dflow, SN_UI
     obj->type = type;
     obj->flow = flow;
     obj->dflow = dflow;
+    obj->vjp = NULL;
+    obj->kernel = NULL;
+    obj->bflow = NULL;
+    obj->bvjp = NULL;
+    obj->jvp = NULL;
+    obj->hvp = NULL;
+    obj->element_wise = NULL;
+    obj->name = NULL;
     obj->x_count = x_count;
     if (x) {
         for (SN_UINT i = 0; i < x_count; ++i) {
@@ -123,8 +183,13 @@ sn_op* sn_op_create(sn_op_type type, sn_flow_fn* flow, sn_dflow_fn* dflow, SN_UI
     return obj;
 }
 
+void sn_op_set_vjp(sn_op* self, sn_vjp_fn* vjp) {
+    self->vjp = vjp;
+}
+
 void sn_op_destroy_one(sn_op* self) {
     if (self != NULL) {
+        SN_MEMORY_FORGET(self);
         switch (self->type) {
         case CONSTANT:
             sn_mda_destroy(*((sn_mda**)(self->x)));
@@ -134,106 +199,910 @@ void sn_op_destroy_one(sn_op* self) {
     }
 }
 
+// The nodes whose inputs are still to be released wait on an explicit stack instead of the native one,
+// which starts in place and moves to the heap only for graphs deeper than OP_DESTROY_STACK_.
+#define OP_DESTROY_STACK_ 64
+
 void sn_op_destroy(sn_op* self) {
-    if (self != NULL) {
-        --(self->ref_count);
-        if (self->ref_count < 2) {
-            for (SN_UINT i = 0; i < self->x_count; ++i) {
-                sn_op_destroy(self->x[i]);
+    if (self == NULL) {
+        return;
+    }
+    sn_op* local_stack[OP_DESTROY_STACK_];
+    sn_op** stack = local_stack;
+    SN_UINT stack_capacity = OP_DESTROY_STACK_;
+    SN_UINT stack_count = 1;
+    stack[0] = self;
+    while (stack_count > 0) {
+        sn_op* op = stack[--stack_count];
+        --(op->ref_count);
+        if (op->ref_count >= 2) {
+            continue;
+        }
+        if (stack_count + op->x_count > stack_capacity) {
+            while (stack_count + op->x_count > stack_capacity) {
+                stack_capacity *= 2;
             }
-            sn_op_destroy_one(self);
+            sn_op** new_stack = SN_DYNAMIC_ARRAY(sn_op*, stack_capacity);
+            for (SN_UINT i = 0; i < stack_count; ++i) {
+                new_stack[i] = stack[i];
+            }
+            if (stack != local_stack) {
+                SN_FREE(stack);
+            }
+            stack = new_stack;
+        }
+        for (SN_UINT i = op->x_count; i-- > 0;) { // The inputs are released in order, as x[ 0 ] is popped first.
+            stack[stack_count++] = op->x[i];
+        }
+        sn_op_destroy_one(op);
+    }
+    if (stack != local_stack) {
+        SN_FREE(stack);
+    }
+}
+
+/* Returns the largest number of inputs of a node. */
+static SN_UINT graph_x_capacity_(const sn_graph* graph) {
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
         }
     }
+    return x_capacity;
 }
 
-static sn_mda* op_flow_(sn_op* self, sn_map* feed) {
-    sn_mda* y = NULL;
-    if (self->type == CONSTANT) {
-        y = sn_mda_copy(*((sn_mda**)(self->x)));
+/* Evaluates the node at position i, whose inputs are already evaluated. x is a scratch array. */
+static void graph_flow_node_(const sn_graph* graph, SN_UINT i, sn_mda* y[], const sn_mda* x[], sn_map* feed) {
+    sn_op* op = graph->ops[i];
+    if (op->type == CONSTANT) {
+        y[i] = *((sn_mda**)(op->x));
     }
-    else if (self->type == OPERATOR) {
-        sn_mda** x = SN_DYNAMIC_ARRAY(sn_mda*, self->x_count);
-        for (SN_UINT i = 0; i < self->x_count; ++i) {
-            x[i] = op_flow_(self->x[i], feed);
-            sn_map_insert(feed, self, x[i]);
+    else if (op->type == OPERATOR) {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
         }
-        y = self->flow(self, x);
-        SN_FREE(x);
+        SN_MEMORY_BEGIN(owner, op);
+        SN_PROFILE_BEGIN(mark);
+        y[i] = op->flow(op, x);
+        SN_PROFILE_END(mark, PROFILE_FLOW, op, y[i]);
+        SN_MEMORY_END(owner);
     }
-    else if (self->type == PLACEHOLDER) {
-        y = sn_mda_copy(sn_map_get(feed, self));
+    else if (op->type == PLACEHOLDER) {
+        y[i] = sn_map_get(feed, op);
     }
     else {
         SN_ASSERT(false);
     }
+}
+
+/* Propagates the complete adjoint of the node at position i to its inputs and destroys it. x and dx are scratch arrays. */
+static void graph_vjp_node_(const sn_graph* graph, SN_UINT i, sn_mda* y[], const bool required[], sn_mda* dy[], const sn_mda* x[], sn_mda* dx[]);
+
+// Scheduled evaluation runs the nodes as tasks of sn_thread_run_dag(). Every worker has its own scratch arrays.
+typedef struct graph_task_context_st_ {
+    const sn_graph* graph;
+    sn_mda** y;
+    sn_map* feed;
+    const bool* required;
+    sn_mda** dy;
+    SN_UINT x_capacity;
+    const sn_mda** x; //!< x_capacity elements for each worker.
+    sn_mda** dx;      //!< x_capacity elements for each worker.
+} graph_task_context_;
+
+static void graph_flow_task_(void* context, SN_UINT worker, SN_UINT task) {
+    graph_task_context_* c = (graph_task_context_*)context;
+    graph_flow_node_(c->graph, task, c->y, &(c->x[worker * c->x_capacity]), c->feed);
+}
+
+static void graph_vjp_task_(void* context, SN_UINT worker, SN_UINT task) {
+    graph_task_context_* c = (graph_task_context_*)context;
+    graph_vjp_node_(c->graph, task, c->y, c->required, c->dy, &(c->x[worker * c->x_capacity]), &(c->dx[worker * c->x_capacity]));
+}
+
+/* Returns true if the input at x_index[ j ] also appears before it, so that an edge is made once per distinct input. */
+static bool graph_x_is_repeated_(const SN_UINT x_index[], SN_UINT j) {
+    for (SN_UINT k = 0; k < j; ++k) {
+        if (x_index[k] == x_index[j]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Builds the task dependencies of the forward pass, or of the backward pass if required is not NULL.
+   Forward, a node waits for its inputs. Backward, the consumers of an input accumulate into its adjoint one by one
+   from the last one in topological order, as the sequential pass does, and the input waits for the first consumer. */
+static void graph_dependencies_(const sn_graph* graph, const bool required[], SN_UINT pending[], SN_UINT** successor_offset, SN_UINT** successor_index) {
+    SN_UINT edge_capacity = graph->x_offset[graph->count] + 1;
+    SN_UINT* edge_from = SN_DYNAMIC_ARRAY(SN_UINT, edge_capacity);
+    SN_UINT* edge_to = SN_DYNAMIC_ARRAY(SN_UINT, edge_capacity);
+    SN_UINT* first_consumer = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    SN_UINT* last_consumer = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    SN_UINT edge_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        pending[i] = 0;
+        first_consumer[i] = graph->count;
+        last_consumer[i] = graph->count;
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            SN_UINT x = x_index[j];
+            if (graph_x_is_repeated_(x_index, j)) {
+                continue;
+            }
+            if (required == NULL) {
+                edge_from[edge_count] = x;
+                edge_to[edge_count++] = i;
+            }
+            else if (required[x]) {
+                if (last_consumer[x] == graph->count) {
+                    first_consumer[x] = i;
+                }
+                else {
+                    edge_from[edge_count] = i;
+                    edge_to[edge_count++] = last_consumer[x];
+                }
+                last_consumer[x] = i;
+            }
+        }
+    }
+    if (required) {
+        for (SN_UINT x = 0; x < graph->count; ++x) {
+            if (first_consumer[x] != graph->count) {
+                edge_from[edge_count] = first_consumer[x];
+                edge_to[edge_count++] = x;
+            }
+        }
+    }
+
+    *successor_offset = SN_DYNAMIC_ARRAY(SN_UINT, graph->count + 1);
+    *successor_index = SN_DYNAMIC_ARRAY(SN_UINT, edge_count + 1);
+    for (SN_UINT i = 0; i <= graph->count; ++i) {
+        (*successor_offset)[i] = 0;
+    }
+    for (SN_UINT e = 0; e < edge_count; ++e) {
+        ++((*successor_offset)[edge_from[e] + 1]);
+        ++(pending[edge_to[e]]);
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        (*successor_offset)[i + 1] += (*successor_offset)[i];
+    }
+    for (SN_UINT e = 0; e < edge_count; ++e) { // Uses first_consumer as the fill position of each node.
+        first_consumer[edge_from[e]] = 0;
+    }
+    for (SN_UINT e = 0; e < edge_count; ++e) {
+        SN_UINT from = edge_from[e];
+        (*successor_index)[(*successor_offset)[from] + first_consumer[from]++] = edge_to[e];
+    }
+    SN_FREE(last_consumer);
+    SN_FREE(first_consumer);
+    SN_FREE(edge_to);
+    SN_FREE(edge_from);
+}
+
+/* Runs the forward pass, or the backward pass if required is not NULL, as a DAG of tasks on up to thread_count threads. */
+static void graph_run_scheduled_(const sn_graph* graph, sn_mda* y[], sn_map* feed, const bool required[], sn_mda* dy[], SN_UINT thread_count) {
+    SN_UINT x_capacity = graph_x_capacity_(graph);
+    graph_task_context_ context = { graph, y, feed, required, dy, x_capacity, NULL, NULL };
+    context.x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity * thread_count);
+    context.dx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity * thread_count);
+    SN_UINT* pending = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    SN_UINT* successor_offset = NULL;
+    SN_UINT* successor_index = NULL;
+    graph_dependencies_(graph, required, pending, &successor_offset, &successor_index);
+    sn_thread_run_dag(graph->count, pending, successor_offset, successor_index,
+                      required ? &graph_vjp_task_ : &graph_flow_task_, &context, thread_count);
+    SN_FREE(successor_index);
+    SN_FREE(successor_offset);
+    SN_FREE(pending);
+    SN_FREE(context.dx);
+    SN_FREE(context.x);
+}
+
+/* Destroys the values owned by graph_flow_(). */
+static void graph_values_destroy_(const sn_graph* graph, sn_mda** y) {
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->type == OPERATOR && y[i] != NULL) {
+            sn_mda_destroy(y[i]);
+        }
+    }
+    SN_FREE(y);
+}
+
+/* Evaluates every node once in topological order, so shared subexpressions are computed once.
+   Values of constants and placeholders are borrowed. With more than one thread, independent nodes run concurrently.
+   Returns NULL if the memory budget is exceeded. */
+static sn_mda** graph_flow_(const sn_graph* graph, sn_map* feed, SN_UINT thread_count) {
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    if (thread_count > 1) {
+        graph_run_scheduled_(graph, y, feed, NULL, NULL, thread_count);
+        if (SN_MEMORY_EXCEEDED()) {
+            graph_values_destroy_(graph, y);
+            return NULL;
+        }
+        return y;
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, graph_x_capacity_(graph));
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        graph_flow_node_(graph, i, y, x, feed);
+        if (SN_MEMORY_EXCEEDED()) {
+            for (SN_UINT k = i + 1; k < graph->count; ++k) {
+                y[k] = NULL;
+            }
+            graph_values_destroy_(graph, y);
+            SN_FREE(x);
+            return NULL;
+        }
+    }
+    SN_FREE(x);
     return y;
 }
 
-sn_mda* sn_op_usflow(sn_op* self, sn_map* feed) {
-    /* !!! Not implemented !!! */
+// Released buffers are kept for a while, so that later element-wise operators of the same shape can write into them.
+#define GRAPH_POOL_CAPACITY_ 2
+
+static bool graph_is_same_shape_(const sn_mda* x0, const sn_mda* x1) {
+    if (x0->rank != x1->rank) {
+        return false;
+    }
+    for (SN_UINT i = 0; i < x0->rank; ++i) {
+        if (x0->shape[i] != x1->shape[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Returns the input whose shape is the shape of the output of an element-wise operator, or NULL if the inputs are broadcasted
+   to a shape which none of them has. */
+static const sn_mda* graph_element_wise_like_(const sn_op* op, const sn_mda* x[]) {
+    SN_UINT rank = 0;
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        rank = (x[j]->rank > rank) ? x[j]->rank : rank;
+    }
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        bool is_y_like = (x[j]->rank == rank);
+        for (SN_UINT k = 0; k < op->x_count && is_y_like; ++k) {
+            for (SN_UINT a = 0; a < x[k]->rank && is_y_like; ++a) {
+                is_y_like = (x[k]->shape[a] == 1 || x[k]->shape[a] == x[j]->shape[a]);
+            }
+        }
+        if (is_y_like) {
+            return x[j];
+        }
+    }
     return NULL;
 }
 
+/* Evaluates the nodes in topological order and returns the value of the root. The value of an operator is released
+   right after its last consumer, and an element-wise operator writes into a dead input or a released buffer of its shape.
+   Values of constants and placeholders are borrowed. Returns NULL if the memory budget is exceeded. */
+static sn_mda* graph_flow_live_(const sn_graph* graph, sn_map* feed, sn_flow_stats* stats) {
+    SN_UINT* last_use = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        last_use[i] = i;
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            last_use[x_index[j]] = i;
+        }
+    }
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, graph_x_capacity_(graph));
+    sn_mda* pool[GRAPH_POOL_CAPACITY_];
+    SN_UINT pool_count = 0;
+    SN_UINT held_bytes = 0; // Values of operators which are alive or kept in the pool.
+    sn_flow_stats temp_stats = { 0, 0, 0, 0 };
+    bool exceeded = false;
+
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        if (op->type != OPERATOR) {
+            graph_flow_node_(graph, i, y, x, feed);
+            continue;
+        }
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
+        }
+        SN_MEMORY_BEGIN(owner, op);
+        SN_PROFILE_BEGIN(mark);
+        const sn_mda* y_like = (op->element_wise && !op->element_wise->reduction && op->kernel) ? graph_element_wise_like_(op, x) : NULL;
+        if (y_like) {
+            y[i] = NULL;
+            for (SN_UINT j = 0; j < op->x_count && y[i] == NULL; ++j) {
+                SN_UINT p = x_index[j];
+                if (graph->ops[p]->type == OPERATOR && last_use[p] == i && graph_is_same_shape_(y[p], y_like)) {
+                    y[i] = y[p];
+                    ++(temp_stats.in_place_count);
+                }
+            }
+            for (SN_UINT k = 0; k < pool_count && y[i] == NULL; ++k) {
+                if (graph_is_same_shape_(pool[k], y_like)) {
+                    y[i] = pool[k];
+                    pool[k] = pool[--pool_count];
+                    ++(temp_stats.reuse_count);
+                }
+            }
+            if (y[i] == NULL) {
+                y[i] = sn_mda_create(y_like->rank, y_like->shape);
+                held_bytes += sn_mda_size(y[i]) * sizeof(SN_FLOAT);
+            }
+            op->kernel(op, x, y[i]);
+        }
+        else {
+            y[i] = op->flow(op, x);
+            held_bytes += sn_mda_size(y[i]) * sizeof(SN_FLOAT);
+        }
+        SN_PROFILE_END(mark, PROFILE_FLOW, op, y[i]);
+        SN_MEMORY_END(owner);
+        temp_stats.total_bytes += sn_mda_size(y[i]) * sizeof(SN_FLOAT);
+        if (held_bytes > temp_stats.peak_bytes) {
+            temp_stats.peak_bytes = held_bytes;
+        }
+
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            SN_UINT p = x_index[j];
+            if (graph->ops[p]->type != OPERATOR || last_use[p] != i || y[p] == NULL) {
+                continue;
+            }
+            if (y[p] != y[i]) {
+                if (pool_count == GRAPH_POOL_CAPACITY_) {
+                    held_bytes -= sn_mda_size(pool[0]) * sizeof(SN_FLOAT);
+                    sn_mda_destroy(pool[0]);
+                    pool[0] = pool[--pool_count];
+                }
+                pool[pool_count++] = y[p];
+            }
+            y[p] = NULL;
+        }
+        if (SN_MEMORY_EXCEEDED()) {
+            for (SN_UINT k = 0; k <= i; ++k) {
+                if (graph->ops[k]->type == OPERATOR && y[k] != NULL) {
+                    sn_mda_destroy(y[k]);
+                }
+            }
+            exceeded = true;
+            break;
+        }
+    }
+
+    sn_mda* result = exceeded ? NULL : y[graph->count - 1];
+    if (!exceeded && graph->ops[graph->count - 1]->type != OPERATOR) {
+        result = sn_mda_copy(result);
+    }
+    for (SN_UINT k = 0; k < pool_count; ++k) {
+        sn_mda_destroy(pool[k]);
+    }
+    SN_FREE(x);
+    SN_FREE(y);
+    SN_FREE(last_use);
+    if (stats) {
+        *stats = temp_stats;
+    }
+    return result;
+}
+
+/* Implements sn_op_usflow(), sn_op_flow() and sn_op_pflow(). The feed is only read. */
+static sn_mda* op_flow_(sn_op* self, sn_map* feed, SN_UINT thread_count) {
+    sn_graph* graph = sn_graph_create(self);
+    if (thread_count == 1) {
+        sn_mda* result = graph_flow_live_(graph, feed, NULL);
+        sn_graph_destroy(graph);
+        return result;
+    }
+    sn_mda** y = graph_flow_(graph, feed, thread_count);
+    if (y == NULL) {
+        sn_graph_destroy(graph);
+        return NULL;
+    }
+    SN_UINT root = graph->count - 1;
+    sn_mda* result = y[root];
+    if (self->type == OPERATOR) {
+        y[root] = NULL;
+    }
+    else {
+        result = sn_mda_copy(result);
+    }
+    graph_values_destroy_(graph, y);
+    sn_graph_destroy(graph);
+    return result;
+}
+
+sn_mda* sn_op_usflow(sn_op* self, sn_map* feed) {
+    return op_flow_(self, feed, 1);
+}
+
 sn_mda* sn_op_flow(sn_op* self, sn_map* feed) {
-    sn_mda* y = op_flow_(self, feed);
+    sn_mda* y = op_flow_(self, feed, 1);
+    sn_map_destroy(feed);
+    return y;
+}
+
+sn_mda* sn_op_mflow(sn_op* self, sn_map* feed, sn_flow_stats* stats) {
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda* result = graph_flow_live_(graph, feed, stats);
+    sn_graph_destroy(graph);
+    sn_map_destroy(feed);
+    return result;
+}
+
+sn_mda* sn_op_pflow(sn_op* self, sn_map* feed, SN_UINT thread_count) {
+#ifdef SN_USE_ARENA
+    sn_arena* arena = sn_arena_bind(NULL); // Values may be freed by other threads, which cannot see the arena.
+    sn_mda* y = op_flow_(self, feed, thread_count);
+    sn_arena_bind(arena);
+#else
+    sn_mda* y = op_flow_(self, feed, thread_count);
+#endif
     sn_map_destroy(feed);
     return y;
 }
 
-static sn_map* op_dflow_(sn_op* self, sn_map* feed) {
-    sn_map* dy_dx_map = NULL;
-    if (self->type == CONSTANT) {
-        /* !!! Not implemented !!! */
-        sn_mda* dy_dm = NULL;
+/* Accumulates the vector-Jacobian product through the Jacobians of an operator without vjp. */
+static void dflow_vjp_(sn_op* op, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_ASSERT(op->dflow != NULL);
+    sn_jac** dy_dx_list = op->dflow(op, x);
+    for (SN_UINT i = 0; i < op->x_count; ++i) {
+        if (dx[i]) {
+            sn_jac_vjp(dy_dx_list[i], dy->ptr, dx[i]->ptr);
+        }
+        sn_jac_destroy(dy_dx_list[i]);
+    }
+    SN_FREE(dy_dx_list);
+}
+
+static void graph_vjp_node_(const sn_graph* graph, SN_UINT i, sn_mda* y[], const bool required[], sn_mda* dy[], const sn_mda* x[], sn_mda* dx[]) {
+    sn_op* op = graph->ops[i];
+    if (op->type != OPERATOR || dy[i] == NULL) {
+        return;
     }
-    else if (self->type == OPERATOR) {
-        sn_map** dm_dx_maps = SN_DYNAMIC_ARRAY(sn_map*, self->x_count);
-        SN_UINT dy_dx_map_capacity = 0;
-        for (SN_UINT i = 0; i < self->x_count; ++i) {
-            dm_dx_maps[i] = op_dflow_(self->x[i], feed);
-            dy_dx_map_capacity += dm_dx_maps[i]->count;
+    SN_UINT* x_index = sn_graph_x_index(graph, i);
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        x[j] = y[x_index[j]];
+        dx[j] = NULL;
+        if (required[x_index[j]]) {
+            if (dy[x_index[j]] == NULL) {
+                dy[x_index[j]] = sn_mda_full(x[j]->rank, x[j]->shape, 0.0);
+            }
+            dx[j] = dy[x_index[j]];
         }
+    }
+    SN_MEMORY_BEGIN(owner, op);
+    SN_PROFILE_BEGIN(mark);
+    if (op->vjp) {
+        op->vjp(op, x, y[i], dy[i], dx);
+    }
+    else {
+        dflow_vjp_(op, x, y[i], dy[i], dx);
+    }
+    SN_PROFILE_END(mark, PROFILE_DFLOW, op, y[i]);
+    SN_MEMORY_END(owner);
+    sn_mda_destroy(dy[i]);
+    dy[i] = NULL;
+}
 
-        sn_mda** x = sn_map_get_all(feed, self);
-        sn_mda** dy_dm_list = self->dflow(self, x);
+/* Propagates the adjoint of the root in reverse topological order. Adjoints of operators are destroyed on the way.
+   With more than one thread, the scheduled pass keeps the order of accumulation into every adjoint.
+   Returns false if the memory budget is exceeded. The remaining adjoints are left to the caller then. */
+static bool graph_vjp_(const sn_graph* graph, sn_mda* y[], const bool required[], sn_mda* dy[], SN_UINT thread_count) {
+    if (thread_count > 1) {
+        graph_run_scheduled_(graph, y, NULL, required, dy, thread_count);
+        return !SN_MEMORY_EXCEEDED();
+    }
+    SN_UINT x_capacity = graph_x_capacity_(graph);
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    sn_mda** dx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity);
+    bool completed = true;
+    for (SN_UINT i = graph->count; i-- > 0 && completed;) {
+        graph_vjp_node_(graph, i, y, required, dy, x, dx);
+        completed = !SN_MEMORY_EXCEEDED();
+    }
+    SN_FREE(dx);
+    SN_FREE(x);
+    return completed;
+}
+
+/* Chains structured Jacobians in topological order and writes those of the root into dy_dx_list, one for each placeholder in topological order.
+   A Jacobian is NULL if the root does not depend on the placeholder. Jacobians of a node are destroyed after its last consumer.
+   Returns false if the memory budget is exceeded, and dy_dx_list is not written then. */
+static bool graph_jacobian_(const sn_graph* graph, sn_mda* y[], SN_UINT placeholder_count, sn_jac** dy_dx_list) {
+    SN_UINT p_count = placeholder_count;
+    sn_jac** jac = SN_DYNAMIC_ARRAY(sn_jac*, graph->count * p_count);
+    SN_UINT* consumer_count = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    for (SN_UINT i = 0; i < graph->count * p_count; ++i) {
+        jac[i] = NULL;
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        consumer_count[i] = 0;
+    }
+    for (SN_UINT i = 0; i < graph->x_offset[graph->count]; ++i) {
+        ++(consumer_count[graph->x_index[i]]);
+    }
 
-        dy_dx_map = sn_map_create(dy_dx_map_capacity, NULL, NULL);
-        for (SN_UINT i = 0; i < self->x_count; ++i) {
-            for (SN_UINT j = 0; j < dm_dx_maps[i]->count; ++j) {
-                sn_map_insert(dy_dx_map, dm_dx_maps[i]->keys[j], sn_mda_gmatmul(dy_dm_list[i], dm_dx_maps[i]->values[j], x[i]->rank));
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
+        }
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    for (SN_UINT i = 0, k = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (op->type == PLACEHOLDER) {
+            jac[i * p_count + k] = sn_jac_identity(y[i]->rank, y[i]->shape);
+            ++k;
+        }
+        else if (op->type == OPERATOR) {
+            bool required = false;
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                x[j] = y[x_index[j]];
+                for (SN_UINT m = 0; m < p_count; ++m) {
+                    required = required || (jac[x_index[j] * p_count + m] != NULL);
+                }
+            }
+            if (required) {
+                SN_ASSERT(op->dflow != NULL);
+                SN_MEMORY_BEGIN(owner, op);
+                SN_PROFILE_BEGIN(mark);
+                sn_jac** dy_dm_list = op->dflow(op, x);
+                for (SN_UINT j = 0; j < op->x_count; ++j) {
+                    for (SN_UINT m = 0; m < p_count; ++m) {
+                        sn_jac* dm_dx = jac[x_index[j] * p_count + m];
+                        if (dm_dx) {
+                            sn_jac* dy_dx = sn_jac_compose(dy_dm_list[j], dm_dx);
+                            if (jac[i * p_count + m]) {
+                                sn_jac* temp = sn_jac_add(jac[i * p_count + m], dy_dx);
+                                sn_jac_destroy(jac[i * p_count + m]);
+                                sn_jac_destroy(dy_dx);
+                                dy_dx = temp;
+                            }
+                            jac[i * p_count + m] = dy_dx;
+                        }
+                    }
+                    sn_jac_destroy(dy_dm_list[j]);
+                }
+                SN_FREE(dy_dm_list);
+                SN_PROFILE_END(mark, PROFILE_DFLOW, op, y[i]);
+                SN_MEMORY_END(owner);
             }
         }
-
-        for (SN_UINT i = 0; i < self->x_count; ++i) {
-            sn_mda_destroy(dy_dm_list[i]);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            --(consumer_count[x_index[j]]);
+            if (consumer_count[x_index[j]] == 0) {
+                for (SN_UINT m = 0; m < p_count; ++m) {
+                    if (jac[x_index[j] * p_count + m]) {
+                        sn_jac_destroy(jac[x_index[j] * p_count + m]);
+                        jac[x_index[j] * p_count + m] = NULL;
+                    }
+                }
+            }
         }
-        SN_FREE(dy_dm_list);
-        SN_FREE(x);
-        for (SN_UINT i = 0; i < self->x_count; ++i) {
-            sn_map_destroy(dm_dx_maps[i]);
+        if (SN_MEMORY_EXCEEDED()) {
+            for (SN_UINT k = 0; k < graph->count * p_count; ++k) {
+                if (jac[k]) {
+                    sn_jac_destroy(jac[k]);
+                }
+            }
+            SN_FREE(x);
+            SN_FREE(consumer_count);
+            SN_FREE(jac);
+            return false;
         }
-        SN_FREE(dm_dx_maps);
     }
-    else if (self->type == PLACEHOLDER) {
-        sn_mda* feed_mda = sn_map_get(feed, self);
-        sn_mda* dy_dx = sn_mda_diagonal_full(feed_mda->rank, feed_mda->shape, 1.0);
-        dy_dx_map = sn_map_create(1, &self, &dy_dx);
+    SN_FREE(x);
+
+    for (SN_UINT m = 0; m < p_count; ++m) {
+        dy_dx_list[m] = jac[(graph->count - 1) * p_count + m];
     }
-    else {
-        SN_ASSERT(false);
+    SN_FREE(consumer_count);
+    SN_FREE(jac);
+    return true;
+}
+
+/* Creates a zero-filled Jacobian in the shape of ( y.shape, x.shape ). */
+static sn_mda* jacobian_create_(const sn_mda* y, const sn_mda* x) {
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, y->rank + x->rank + 1);
+    for (SN_UINT i = 0; i < y->rank; ++i) {
+        shape[i] = y->shape[i];
+    }
+    for (SN_UINT i = 0; i < x->rank; ++i) {
+        shape[y->rank + i] = x->shape[i];
+    }
+    sn_mda* obj = sn_mda_full(y->rank + x->rank, shape, 0.0);
+    SN_FREE(shape);
+    return obj;
+}
+
+/* Implements sn_op_usdflow(), sn_op_dflow() and sn_op_pdflow(). The feed is only read. */
+static sn_map* op_dflow_(sn_op* self, sn_map* feed, SN_UINT thread_count) {
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda** y = graph_flow_(graph, feed, thread_count);
+    if (y == NULL) {
+        sn_graph_destroy(graph);
+        return NULL;
+    }
+
+    bool* required = SN_DYNAMIC_ARRAY(bool, graph->count);
+    sn_mda** dy = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    SN_UINT placeholder_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        required[i] = (op->type == PLACEHOLDER);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            required[i] = required[i] || required[x_index[j]];
+        }
+        dy[i] = NULL;
+        placeholder_count += (op->type == PLACEHOLDER);
     }
 
+    SN_UINT root = graph->count - 1;
+    SN_UINT y_size = sn_mda_size(y[root]);
+    sn_map* dy_dx_map = sn_map_create(placeholder_count > 0 ? placeholder_count : 1, NULL, NULL);
+    if (y_size == 1) { // Scalar output: a single sweep whose adjoints are the gradients.
+        bool completed = true;
+        if (required[root]) {
+            dy[root] = sn_mda_full(y[root]->rank, y[root]->shape, 1.0);
+            completed = graph_vjp_(graph, y, required, dy, thread_count);
+        }
+        for (SN_UINT i = 0; i < graph->count; ++i) {
+            if (!completed) {
+                if (dy[i]) {
+                    sn_mda_destroy(dy[i]);
+                }
+            }
+            else if (graph->ops[i]->type == PLACEHOLDER) {
+                sn_map_insert(dy_dx_map, graph->ops[i], dy[i] ? dy[i] : sn_mda_full(y[i]->rank, y[i]->shape, 0.0));
+            }
+        }
+        if (!completed) {
+            sn_map_destroy(dy_dx_map);
+            dy_dx_map = NULL;
+        }
+    }
+    else { // Non-scalar output: chains structured Jacobians and materializes them at the end.
+        sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, placeholder_count);
+        bool completed = graph_jacobian_(graph, y, placeholder_count, dy_dx_list);
+        for (SN_UINT i = 0, m = 0; completed && i < graph->count; ++i) {
+            if (graph->ops[i]->type == PLACEHOLDER) {
+                sn_map_insert(dy_dx_map, graph->ops[i], dy_dx_list[m] ? sn_jac_to_mda(dy_dx_list[m]) : jacobian_create_(y[root], y[i]));
+                if (dy_dx_list[m]) {
+                    sn_jac_destroy(dy_dx_list[m]);
+                }
+                ++m;
+            }
+        }
+        if (!completed) {
+            sn_map_destroy(dy_dx_map);
+            dy_dx_map = NULL;
+        }
+        SN_FREE(dy_dx_list);
+    }
+
+    SN_FREE(dy);
+    SN_FREE(required);
+    graph_values_destroy_(graph, y);
+    sn_graph_destroy(graph);
     return dy_dx_map;
 }
 
 sn_map* sn_op_usdflow(sn_op* self, sn_map* feed) {
-    /* !!! Not implemented !!! */
-    return NULL;
+    return op_dflow_(self, feed, 1);
 }
 
 sn_map* sn_op_dflow(sn_op* self, sn_map* feed) {
-    sn_mda_destroy(op_flow_(self, feed));
-    sn_map* dy_dx = op_dflow_(self, feed);
+    sn_map* dy_dx_map = op_dflow_(self, feed, 1);
+    sn_map_destroy(feed);
+    return dy_dx_map;
+}
+
+sn_map* sn_op_pdflow(sn_op* self, sn_map* feed, SN_UINT thread_count) {
+#ifdef SN_USE_ARENA
+    sn_arena* arena = sn_arena_bind(NULL); // Adjoints are destroyed by other threads, which cannot see the arena.
+    sn_map* dy_dx_map = op_dflow_(self, feed, thread_count);
+    sn_arena_bind(arena);
+#else
+    sn_map* dy_dx_map = op_dflow_(self, feed, thread_count);
+#endif
+    sn_map_destroy(feed);
+    return dy_dx_map;
+}
+
+/* Splits the topological order into segments which end at the checkpoints, and returns the position where each segment begins,
+   followed by graph->count. Checkpoints are the marked nodes, or every ceil(sqrt(N))-th of the N operators if none is marked.
+   stored[i] is true for the operators whose values outlive their segment: the checkpoints and the nodes read by a later segment. */
+static SN_UINT* graph_segments_(const sn_graph* graph, SN_UINT checkpoint_count, sn_op* checkpoints[], SN_UINT* segment_count, bool stored[]) {
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        stored[i] = false;
+    }
+    if (checkpoint_count > 0) {
+        for (SN_UINT k = 0; k < checkpoint_count; ++k) {
+            SN_UINT position = sn_graph_find(graph, checkpoints[k]);
+            if (position != graph->count && graph->ops[position]->type == OPERATOR) {
+                stored[position] = true;
+            }
+        }
+    }
+    else {
+        SN_UINT operator_count = 0;
+        for (SN_UINT i = 0; i < graph->count; ++i) {
+            operator_count += (graph->ops[i]->type == OPERATOR);
+        }
+        SN_UINT step = 1;
+        while (step * step < operator_count) {
+            ++step;
+        }
+        for (SN_UINT i = 0, m = 0; i < graph->count; ++i) {
+            if (graph->ops[i]->type == OPERATOR && ++m % step == 0) {
+                stored[i] = true;
+            }
+        }
+    }
+    stored[graph->count - 1] = true;
+
+    SN_UINT* segment_begin = SN_DYNAMIC_ARRAY(SN_UINT, graph->count + 1);
+    SN_UINT* segment = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    *segment_count = 0;
+    segment_begin[0] = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        segment[i] = *segment_count;
+        if (stored[i]) {
+            segment_begin[++(*segment_count)] = i + 1;
+        }
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            if (segment[x_index[j]] != segment[i] && graph->ops[x_index[j]]->type == OPERATOR) {
+                stored[x_index[j]] = true;
+            }
+        }
+    }
+    SN_FREE(segment);
+    return segment_begin;
+}
+
+// Only the values which outlive their segment and those of the last segment are kept by the forward pass.
+// The backward pass then recomputes one segment at a time from the kept values, propagates its adjoints and releases it,
+// so a chain of N operators holds O(sqrt(N)) values at once for about one extra forward pass.
+sn_map* sn_op_cdflow(sn_op* self, sn_map* feed, SN_UINT checkpoint_count, sn_op* checkpoints[]) {
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    sn_mda** dy = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    bool* required = SN_DYNAMIC_ARRAY(bool, graph->count);
+    bool* stored = SN_DYNAMIC_ARRAY(bool, graph->count);
+    SN_UINT* consumer_count = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    SN_UINT placeholder_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        required[i] = (op->type == PLACEHOLDER);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            required[i] = required[i] || required[x_index[j]];
+        }
+        y[i] = NULL;
+        dy[i] = NULL;
+        consumer_count[i] = 0;
+        placeholder_count += (op->type == PLACEHOLDER);
+    }
+    for (SN_UINT e = 0; e < graph->x_offset[graph->count]; ++e) {
+        ++(consumer_count[graph->x_index[e]]);
+    }
+    SN_UINT segment_count;
+    SN_UINT* segment_begin = graph_segments_(graph, checkpoint_count, checkpoints, &segment_count, stored);
+    SN_UINT x_capacity = graph_x_capacity_(graph);
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    sn_mda** dx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity);
+
+    SN_UINT root = graph->count - 1;
+    SN_UINT last_begin = segment_begin[segment_count - 1];
+    bool completed = true;
+    for (SN_UINT i = 0; i < graph->count && completed; ++i) {
+        graph_flow_node_(graph, i, y, x, feed);
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            SN_UINT k = x_index[j];
+            if (--(consumer_count[k]) == 0 && !stored[k] && k < last_begin && graph->ops[k]->type == OPERATOR) {
+                sn_mda_destroy(y[k]);
+                y[k] = NULL;
+            }
+        }
+        completed = !SN_MEMORY_EXCEEDED();
+    }
+
+    if (completed && required[root]) {
+        SN_ASSERT(sn_mda_size(y[root]) == 1); // If the expression is not a scalar.
+        dy[root] = sn_mda_full(y[root]->rank, y[root]->shape, 1.0);
+        for (SN_UINT s = segment_count; s-- > 0 && completed;) {
+            for (SN_UINT i = segment_begin[s]; i < segment_begin[s + 1] && completed; ++i) {
+                if (y[i] == NULL) {
+                    graph_flow_node_(graph, i, y, x, feed);
+                    completed = !SN_MEMORY_EXCEEDED();
+                }
+            }
+            for (SN_UINT i = segment_begin[s + 1]; i-- > segment_begin[s] && completed;) {
+                graph_vjp_node_(graph, i, y, required, dy, x, dx);
+                completed = !SN_MEMORY_EXCEEDED();
+            }
+            for (SN_UINT i = segment_begin[s]; i < segment_begin[s + 1]; ++i) {
+                if (graph->ops[i]->type == OPERATOR && y[i] != NULL) {
+                    sn_mda_destroy(y[i]);
+                    y[i] = NULL;
+                }
+            }
+        }
+    }
+
+    sn_map* dy_dx_map = completed ? sn_map_create(placeholder_count > 0 ? placeholder_count : 1, NULL, NULL) : NULL;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (completed && graph->ops[i]->type == PLACEHOLDER) {
+            sn_map_insert(dy_dx_map, graph->ops[i], dy[i] ? dy[i] : sn_mda_full(y[i]->rank, y[i]->shape, 0.0));
+            dy[i] = NULL;
+        }
+        if (dy[i] != NULL) {
+            sn_mda_destroy(dy[i]);
+        }
+    }
+    SN_FREE(dx);
+    SN_FREE(x);
+    SN_FREE(segment_begin);
+    SN_FREE(consumer_count);
+    SN_FREE(stored);
+    SN_FREE(required);
+    SN_FREE(dy);
+    graph_values_destroy_(graph, y);
+    sn_graph_destroy(graph);
+    sn_map_destroy(feed);
+    return dy_dx_map;
+}
+
+sn_jac* sn_op_jacobian(sn_op* self, sn_map* feed, sn_op* x) {
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda** y = graph_flow_(graph, feed, 1);
+    if (y == NULL) {
+        sn_graph_destroy(graph);
+        sn_map_destroy(feed);
+        return NULL;
+    }
+
+    SN_UINT placeholder_count = 0;
+    SN_UINT x_position = sn_graph_find(graph, x);
+    SN_UINT x_placeholder_index = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (i == x_position) {
+            x_placeholder_index = placeholder_count;
+        }
+        placeholder_count += (graph->ops[i]->type == PLACEHOLDER);
+    }
+
+    sn_jac* dy_dx = NULL;
+    bool completed = true;
+    if (x_position != graph->count) {
+        sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, placeholder_count);
+        completed = graph_jacobian_(graph, y, placeholder_count, dy_dx_list);
+        for (SN_UINT m = 0; completed && m < placeholder_count; ++m) {
+            if (m == x_placeholder_index) {
+                dy_dx = dy_dx_list[m];
+            }
+            else if (dy_dx_list[m]) {
+                sn_jac_destroy(dy_dx_list[m]);
+            }
+        }
+        SN_FREE(dy_dx_list);
+    }
+    if (completed && dy_dx == NULL) { // The expression does not depend on x.
+        const sn_mda* x_value = sn_map_get(feed, x);
+        sn_mda* root = y[graph->count - 1];
+        dy_dx = sn_jac_broadcast(root->rank, root->shape, x_value->rank, x_value->shape, 0.0);
+    }
+
+    graph_values_destroy_(graph, y);
+    sn_graph_destroy(graph);
     sn_map_destroy(feed);
     return dy_dx;
 }
@@ -249,6 +1118,14 @@ sn_op* sn_const(sn_mda* array) {
     obj->type = CONSTANT;
     obj->flow = NULL;
     obj->dflow = NULL;
+    obj->vjp = NULL;
+    obj->kernel = NULL;
+    obj->bflow = NULL;
+    obj->bvjp = NULL;
+    obj->jvp = NULL;
+    obj->hvp = NULL;
+    obj->element_wise = NULL;
+    obj->name = NULL;
     obj->x_count = 0;
     *((sn_mda**)(obj->x)) = array;
     return obj;
@@ -0,0 +1,1027 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_file.c
+//! \brief This file implements sinae_file.h.
+
+#ifdef SN_USE_MMAP
+    #define _POSIX_C_SOURCE 200112L
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SN_USE_PTHREAD
+    #include <pthread.h>
+#endif
+
+#include "../sinae_file.h"
+#include "../sinae_graph.h"
+#include "../sinae_op.h"
+
+
+/* Encoding */
+
+#define FILE_HEADER_BYTES_ 64
+#define FILE_RESERVED_BYTES_ 64 //!< Bytes before the payload where sn_mda_map() builds the sn_mda.
+#define FILE_CHUNK_ 4096        //!< Number of elements converted at once.
+#define FILE_MAX_RANK_ 1024     //!< Largest rank accepted from a file, so that a corrupt header cannot ask for a huge shape.
+
+static const unsigned char file_magic_[6] = { 'S', 'N', 'M', 'D', 'A', '\0' };
+
+typedef enum file_type_en_ {
+    FILE_FLOAT32 = 1,
+    FILE_FLOAT64 = 2,
+} file_type_;
+
+typedef struct file_header_st_ {
+    SN_UINT version;
+    file_type_ type;
+    SN_UINT rank;
+    uint64_t payload_offset;
+    uint64_t payload_bytes;
+} file_header_;
+
+static bool file_is_little_endian_(void) {
+    const uint16_t probe = 1;
+    return *(const unsigned char*)&probe == 1;
+}
+
+static void file_put_(unsigned char* bytes, uint64_t value, SN_UINT count) {
+    for (SN_UINT i = 0; i < count; ++i) {
+        bytes[i] = (unsigned char)(value >> (8 * i));
+    }
+}
+
+static uint64_t file_get_(const unsigned char* bytes, SN_UINT count) {
+    uint64_t value = 0;
+    for (SN_UINT i = 0; i < count; ++i) {
+        value |= (uint64_t)bytes[i] << (8 * i);
+    }
+    return value;
+}
+
+static SN_UINT file_type_bytes_(file_type_ type) {
+    return (type == FILE_FLOAT32) ? 4 : 8;
+}
+
+/* Returns the offset of the payload of an array of the rank, after the header, the shape and the reserved bytes. */
+static uint64_t file_payload_offset_(SN_UINT rank) {
+    uint64_t end = FILE_HEADER_BYTES_ + 8 * (uint64_t)rank + FILE_RESERVED_BYTES_;
+    return (end + SN_FILE_ALIGNMENT - 1) / SN_FILE_ALIGNMENT * SN_FILE_ALIGNMENT;
+}
+
+static void file_encode_header_(const file_header_* header, unsigned char bytes[FILE_HEADER_BYTES_]) {
+    memset(bytes, 0, FILE_HEADER_BYTES_);
+    memcpy(bytes, file_magic_, sizeof(file_magic_));
+    file_put_(&(bytes[6]), header->version, 2);
+    bytes[8] = (unsigned char)header->type;
+    file_put_(&(bytes[16]), header->rank, 8);
+    file_put_(&(bytes[24]), header->payload_offset, 8);
+    file_put_(&(bytes[32]), header->payload_bytes, 8);
+}
+
+/* Decodes and validates a header. Returns false if it is not one of a supported version. */
+static bool file_decode_header_(const unsigned char bytes[FILE_HEADER_BYTES_], file_header_* header) {
+    if (memcmp(bytes, file_magic_, sizeof(file_magic_)) != 0) {
+        return false;
+    }
+    header->version = (SN_UINT)file_get_(&(bytes[6]), 2);
+    header->type = (file_type_)bytes[8];
+    header->rank = (SN_UINT)file_get_(&(bytes[16]), 8);
+    header->payload_offset = file_get_(&(bytes[24]), 8);
+    header->payload_bytes = file_get_(&(bytes[32]), 8);
+    return header->version == SN_FILE_VERSION
+        && (header->type == FILE_FLOAT32 || header->type == FILE_FLOAT64)
+        && file_get_(&(bytes[16]), 8) <= FILE_MAX_RANK_
+        && header->payload_offset == file_payload_offset_(header->rank)
+        && header->payload_bytes % file_type_bytes_(header->type) == 0;
+}
+
+/* Decodes the shape of the header from its bytes into shape unless it is NULL, and stores the number of elements into size.
+   Returns false unless every extent fits in SN_UINT, the shape matches the payload, and an array of it fits in memory. */
+static bool file_decode_shape_(const file_header_* header, const unsigned char bytes[], SN_UINT shape[], SN_UINT* size) {
+    uint64_t count = 1;
+    bool is_empty = false;
+    for (SN_UINT i = 0; i < header->rank; ++i) {
+        uint64_t extent = file_get_(&(bytes[8 * i]), 8);
+        if (extent > (uint64_t)(SN_UINT)-1) {
+            return false;
+        }
+        is_empty = is_empty || (extent == 0);
+        if (!is_empty && count > UINT64_MAX / extent) {
+            return false;
+        }
+        count = is_empty ? 0 : count * extent;
+        if (shape != NULL) {
+            shape[i] = (SN_UINT)extent;
+        }
+    }
+    uint64_t limit = (SIZE_MAX - sizeof(sn_mda) - (uint64_t)header->rank * sizeof(SN_UINT)) / sizeof(SN_FLOAT);
+    if (count > limit || count > (uint64_t)(SN_UINT)-1 || count > UINT64_MAX / file_type_bytes_(header->type)
+        || count * file_type_bytes_(header->type) != header->payload_bytes) {
+        return false;
+    }
+    *size = (SN_UINT)count;
+    return true;
+}
+
+static void file_encode_(const SN_FLOAT x[], SN_UINT n, file_type_ type, unsigned char bytes[]) {
+    for (SN_UINT i = 0; i < n; ++i) {
+        if (type == FILE_FLOAT32) {
+            float value = (float)x[i];
+            uint32_t bits;
+            memcpy(&bits, &value, 4);
+            file_put_(&(bytes[4 * i]), bits, 4);
+        }
+        else {
+            double value = (double)x[i];
+            uint64_t bits;
+            memcpy(&bits, &value, 8);
+            file_put_(&(bytes[8 * i]), bits, 8);
+        }
+    }
+}
+
+static void file_decode_(const unsigned char bytes[], SN_UINT n, file_type_ type, SN_FLOAT x[]) {
+    for (SN_UINT i = 0; i < n; ++i) {
+        if (type == FILE_FLOAT32) {
+            uint32_t bits = (uint32_t)file_get_(&(bytes[4 * i]), 4);
+            float value;
+            memcpy(&value, &bits, 4);
+            x[i] = (SN_FLOAT)value;
+        }
+        else {
+            uint64_t bits = file_get_(&(bytes[8 * i]), 8);
+            double value;
+            memcpy(&value, &bits, 8);
+            x[i] = (SN_FLOAT)value;
+        }
+    }
+}
+
+/* Returns the element type which SN_FLOAT can be stored as without conversion, or 0 if it has no such type. */
+static file_type_ file_native_type_(void) {
+    return (sizeof(SN_FLOAT) == 4) ? FILE_FLOAT32 : (sizeof(SN_FLOAT) == 8) ? FILE_FLOAT64 : (file_type_)0;
+}
+
+/* Writes n elements in the type, directly if it is the layout of SN_FLOAT in memory or converted by chunks otherwise. */
+static bool file_write_elements_(FILE* stream, const SN_FLOAT x[], SN_UINT n, file_type_ type) {
+    if (type == file_native_type_() && file_is_little_endian_()) {
+        return fwrite(x, sizeof(SN_FLOAT), n, stream) == n;
+    }
+    bool ok = true;
+    unsigned char* chunk = SN_DYNAMIC_ARRAY(unsigned char, FILE_CHUNK_ * file_type_bytes_(type));
+    for (SN_UINT i = 0; ok && i < n; i += FILE_CHUNK_) {
+        SN_UINT m = (n - i < FILE_CHUNK_) ? n - i : FILE_CHUNK_;
+        file_encode_(&(x[i]), m, type, chunk);
+        ok = (fwrite(chunk, file_type_bytes_(type), m, stream) == m);
+    }
+    SN_FREE(chunk);
+    return ok;
+}
+
+/* Reads n elements of the type like file_write_elements_() writes them. */
+static bool file_read_elements_(FILE* stream, SN_FLOAT x[], SN_UINT n, file_type_ type) {
+    if (type == file_native_type_() && file_is_little_endian_()) {
+        return fread(x, sizeof(SN_FLOAT), n, stream) == n;
+    }
+    bool ok = true;
+    unsigned char* chunk = SN_DYNAMIC_ARRAY(unsigned char, FILE_CHUNK_ * file_type_bytes_(type));
+    for (SN_UINT i = 0; ok && i < n; i += FILE_CHUNK_) {
+        SN_UINT m = (n - i < FILE_CHUNK_) ? n - i : FILE_CHUNK_;
+        ok = (fread(chunk, file_type_bytes_(type), m, stream) == m);
+        file_decode_(chunk, m, type, &(x[i]));
+    }
+    SN_FREE(chunk);
+    return ok;
+}
+
+
+/* Saving and loading */
+
+bool sn_mda_save(const sn_mda* self, const char* path) {
+    file_type_ type = file_native_type_();
+    type = (type != 0) ? type : FILE_FLOAT64;
+    SN_UINT size = sn_mda_size(self);
+    file_header_ header = { SN_FILE_VERSION, type, self->rank, file_payload_offset_(self->rank), (uint64_t)size * file_type_bytes_(type) };
+    FILE* stream = fopen(path, "wb");
+    if (stream == NULL) {
+        return false;
+    }
+
+    unsigned char bytes[FILE_HEADER_BYTES_];
+    file_encode_header_(&header, bytes);
+    bool ok = (fwrite(bytes, 1, FILE_HEADER_BYTES_, stream) == FILE_HEADER_BYTES_);
+    for (SN_UINT i = 0; ok && i < self->rank; ++i) {
+        file_put_(bytes, self->shape[i], 8);
+        ok = (fwrite(bytes, 1, 8, stream) == 8);
+    }
+    for (uint64_t at = FILE_HEADER_BYTES_ + 8 * (uint64_t)self->rank; ok && at < header.payload_offset; ++at) {
+        ok = (fputc(0, stream) != EOF);
+    }
+
+    ok = ok && file_write_elements_(stream, self->ptr, size, type);
+    return (fclose(stream) == 0) && ok;
+}
+
+sn_mda* sn_mda_load(const char* path) {
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return NULL;
+    }
+    unsigned char bytes[FILE_HEADER_BYTES_];
+    file_header_ header;
+    if (fread(bytes, 1, FILE_HEADER_BYTES_, stream) != FILE_HEADER_BYTES_ || !file_decode_header_(bytes, &header)) {
+        fclose(stream);
+        return NULL;
+    }
+
+    // The payload must be in the file before anything of its size is allocated. A file too long for ftell() is not
+    // checked here, and a short one still fails to be read.
+    bool ok = (fseek(stream, 0, SEEK_END) == 0);
+    long length = ok ? ftell(stream) : -1;
+    ok = ok && (length < 0 || ((uint64_t)length >= header.payload_offset
+                               && header.payload_bytes == (uint64_t)length - header.payload_offset));
+    ok = ok && (fseek(stream, FILE_HEADER_BYTES_, SEEK_SET) == 0);
+
+    unsigned char* shape_bytes = SN_DYNAMIC_ARRAY(unsigned char, 8 * header.rank + 1);
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, header.rank + 1);
+    SN_UINT size = 0;
+    ok = ok && (fread(shape_bytes, 8, header.rank, stream) == header.rank);
+    ok = ok && file_decode_shape_(&header, shape_bytes, shape, &size);
+    SN_FREE(shape_bytes);
+    for (uint64_t at = FILE_HEADER_BYTES_ + 8 * (uint64_t)header.rank; ok && at < header.payload_offset; ++at) {
+        ok = (fgetc(stream) != EOF);
+    }
+    sn_mda* obj = ok ? sn_mda_create(header.rank, shape) : NULL;
+    SN_FREE(shape);
+
+    ok = ok && file_read_elements_(stream, obj->ptr, size, header.type);
+    fclose(stream);
+    if (!ok && obj != NULL) {
+        sn_mda_destroy(obj);
+        obj = NULL;
+    }
+    return obj;
+}
+
+
+/* Mapping */
+
+// A mapped sn_mda lies in the reserved bytes right before the payload, and its shape points to the shape in the file.
+// The mapping is recorded by sinae_mda.c, which owns the lifetime of sn_mda, so that sn_mda_destroy() unmaps it.
+
+#ifdef SN_USE_MMAP
+
+sn_mda* sn_mda_map(const char* path) {
+    if (file_native_type_() == 0 || !file_is_little_endian_() || sizeof(SN_UINT) != 8 || offsetof(sn_mda, ptr) > FILE_RESERVED_BYTES_) {
+        return sn_mda_load(path);
+    }
+    int descriptor = open(path, O_RDONLY);
+    if (descriptor < 0) {
+        return NULL;
+    }
+    struct stat status;
+    unsigned char bytes[FILE_HEADER_BYTES_];
+    file_header_ header;
+    if (fstat(descriptor, &status) != 0 || status.st_size < FILE_HEADER_BYTES_
+        || read(descriptor, bytes, FILE_HEADER_BYTES_) != FILE_HEADER_BYTES_ || !file_decode_header_(bytes, &header)
+        || (uint64_t)status.st_size < header.payload_offset
+        || header.payload_bytes != (uint64_t)status.st_size - header.payload_offset
+        || (uint64_t)status.st_size > SIZE_MAX) {
+        close(descriptor);
+        return NULL;
+    }
+    if (header.type != file_native_type_()) {
+        close(descriptor);
+        return sn_mda_load(path);
+    }
+    size_t length = (size_t)status.st_size;
+    unsigned char* base = (unsigned char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, descriptor, 0);
+    close(descriptor);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    SN_UINT size;
+    sn_mda* obj = (sn_mda*)&(base[header.payload_offset - offsetof(sn_mda, ptr)]);
+    if (!file_decode_shape_(&header, &(base[FILE_HEADER_BYTES_]), NULL, &size) || !sn_mda_add_mapping_(obj, base, length)) {
+        munmap(base, length);
+        return NULL;
+    }
+    obj->rank = header.rank;
+    obj->shape = (SN_UINT*)&(base[FILE_HEADER_BYTES_]);
+    return obj;
+}
+
+#else
+
+sn_mda* sn_mda_map(const char* path) {
+    return sn_mda_load(path);
+}
+
+#endif // SN_USE_MMAP
+
+
+
+/* Registry of kinds */
+
+// Kinds are kept with malloc() and realloc() like the records of sinae_memory.c, since they live as long as the process.
+// Their names are allocated one by one, so that loaded operators can point to them while the table grows.
+typedef struct graph_kind_st_ {
+    char* name;
+    sn_flow_fn* flow;
+    sn_dflow_fn* dflow;
+    sn_vjp_fn* vjp;
+    sn_kernel_fn* kernel;
+    sn_bflow_fn* bflow;
+    sn_bvjp_fn* bvjp;
+    sn_jvp_fn* jvp;
+    sn_hvp_fn* hvp;
+    const sn_element_wise* element_wise;
+    SN_UINT parameter_count;
+} graph_kind_;
+
+#define GRAPH_NAME_BYTES_ 256 //!< Bytes of the longest name of a kind, including the terminator.
+
+static graph_kind_* graph_kinds_ = NULL;
+static SN_UINT graph_kind_count_ = 0;
+static SN_UINT graph_kind_capacity_ = 0;
+static bool graph_builtins_registered_ = false;
+
+#ifdef SN_USE_PTHREAD
+static pthread_mutex_t graph_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+    #define GRAPH_LOCK_() pthread_mutex_lock(&graph_mutex_)
+    #define GRAPH_UNLOCK_() pthread_mutex_unlock(&graph_mutex_)
+#else
+    #define GRAPH_LOCK_()
+    #define GRAPH_UNLOCK_()
+#endif // SN_USE_PTHREAD
+
+/* Returns the position of the kind named name, or graph_kind_count_ if there is none. */
+static SN_UINT graph_kind_by_name_(const char* name) {
+    SN_UINT i = 0;
+    while (i < graph_kind_count_ && strcmp(graph_kinds_[i].name, name) != 0) {
+        ++i;
+    }
+    return i;
+}
+
+/* Returns the position of the kind evaluated by flow, or graph_kind_count_ if there is none. */
+static SN_UINT graph_kind_by_flow_(sn_flow_fn* flow) {
+    SN_UINT i = 0;
+    while (i < graph_kind_count_ && graph_kinds_[i].flow != flow) {
+        ++i;
+    }
+    return i;
+}
+
+/* Registers a kind. Called with the lock held. */
+static bool graph_register_(const char* name, const sn_op* prototype, SN_UINT parameter_count) {
+    size_t length = strlen(name);
+    if (length >= GRAPH_NAME_BYTES_) {
+        return false;
+    }
+    SN_UINT i = graph_kind_by_name_(name);
+    if (i < graph_kind_count_) {
+        return graph_kinds_[i].flow == prototype->flow && graph_kinds_[i].parameter_count == parameter_count;
+    }
+    if (graph_kind_by_flow_(prototype->flow) < graph_kind_count_) {
+        return false;
+    }
+    if (graph_kind_count_ == graph_kind_capacity_) {
+        SN_UINT capacity = (graph_kind_capacity_ > 0) ? 2 * graph_kind_capacity_ : 32;
+        graph_kind_* kinds = (graph_kind_*)realloc(graph_kinds_, capacity * sizeof(graph_kind_));
+        if (kinds == NULL) {
+            return false;
+        }
+        graph_kinds_ = kinds;
+        graph_kind_capacity_ = capacity;
+    }
+    graph_kind_ kind = {
+        (char*)malloc(length + 1), prototype->flow, prototype->dflow, prototype->vjp,
+        prototype->kernel, prototype->bflow, prototype->bvjp, prototype->jvp, prototype->hvp,
+        prototype->element_wise, parameter_count
+    };
+    if (kind.name == NULL) {
+        return false;
+    }
+    memcpy(kind.name, name, length + 1);
+    graph_kinds_[graph_kind_count_++] = kind;
+    return true;
+}
+
+/* Registers the operators of sinae_op.h from prototypes on a single placeholder. Called with the lock held.
+   If the table cannot grow, the remaining ones are registered by the next call, since registered ones are kept. */
+static void graph_register_builtins_(void) {
+    if (graph_builtins_registered_) {
+        return;
+    }
+    graph_builtins_registered_ = true;
+    sn_op* x = sn_placeholder();
+    sn_op* prototypes[] = {
+        sn_abs(x), sn_exp(x), sn_negative(x), sn_reciprocal(x), sn_sqrt(x), sn_sum(x),
+        sn_add(x, x), sn_subtract(x, x), sn_multiply(x, x), sn_divide(x, x), sn_matmul(x, x, 0),
+        sn_reduce_sum(x, 0, NULL), sn_reduce_mean(x, 0, NULL), sn_reduce_max(x, 0, NULL), sn_reduce_min(x, 0, NULL)
+    };
+    SN_UINT parameter_counts[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 1 }; // The overwrap and the masks of axes.
+    SN_UINT count = sizeof(prototypes) / sizeof(prototypes[0]);
+    for (SN_UINT i = 0; i < count; ++i) {
+        if (!graph_register_(prototypes[i]->name, prototypes[i], parameter_counts[i])) {
+            graph_builtins_registered_ = false;
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op_destroy(prototypes[i]);
+    }
+}
+
+bool sn_op_register(const char* name, const sn_op* prototype, SN_UINT parameter_count) {
+    GRAPH_LOCK_();
+    graph_register_builtins_();
+    bool registered = graph_register_(name, prototype, parameter_count);
+    GRAPH_UNLOCK_();
+    return registered;
+}
+
+bool sn_op_parameter_count(const sn_op* self, SN_UINT* parameter_count) {
+    if (self->type != OPERATOR) {
+        return false;
+    }
+    GRAPH_LOCK_();
+    graph_register_builtins_();
+    SN_UINT i = graph_kind_by_flow_(self->flow);
+    bool is_registered = i < graph_kind_count_;
+    if (is_registered) {
+        *parameter_count = graph_kinds_[i].parameter_count;
+    }
+    GRAPH_UNLOCK_();
+    return is_registered;
+}
+
+
+/* Graph encoding */
+
+// The header holds the totals of the whole file, so that sn_op_load() sizes its allocation before reading any node.
+// The root is placed first in the allocation, right after a block header, so that sn_op_unload() finds the block from it.
+
+#define GRAPH_HEADER_BYTES_ 128
+#define GRAPH_PATH_BYTES_ 4096 //!< Bytes of the longest path of an external constant, including the terminator.
+#define GRAPH_NONE_ ((SN_UINT)-1)
+#define GRAPH_ROUND_(bytes) (((bytes) + 15) / 16 * 16)
+
+static const unsigned char graph_magic_[6] = { 'S', 'N', 'G', 'R', 'F', '\0' };
+
+typedef enum graph_tag_en_ {
+    GRAPH_PLACEHOLDER = 1,
+    GRAPH_EMBEDDED = 2,
+    GRAPH_EXTERNAL = 3,
+    GRAPH_OPERATOR = 4,
+} graph_tag_;
+
+//! Counts are 64-bit integers from the byte 16 of the header, in the order of the fields.
+typedef struct graph_header_st_ {
+    SN_UINT version;
+    file_type_ type;           //!< Element type of the embedded constants.
+    uint64_t node_count;
+    uint64_t kind_count;
+    uint64_t placeholder_count;
+    uint64_t edge_count;       //!< Sum of the inputs of the operators.
+    uint64_t parameter_count;  //!< Sum of the parameters of the operators.
+    uint64_t constant_count;
+    uint64_t rank_count;       //!< Sum of the ranks of the embedded constants.
+    uint64_t element_count;    //!< Sum of the elements of the embedded constants.
+    uint64_t external_count;
+    uint64_t root_x_count;
+    uint64_t root_parameter_count;
+} graph_header_;
+
+#define GRAPH_COUNT_FIELDS_ 11
+
+typedef union graph_block_un_ {
+    struct {
+        SN_UINT external_count;
+        sn_mda** externals; //!< External constants, which are not in the block.
+        SN_UINT node_count;
+        sn_op** ops;        //!< Every node, in the block, so that sn_op_unload() ends their records of sinae_memory.h.
+    } info;
+    long double alignment;
+    void* pointer;
+} graph_block_;
+
+static uint64_t* graph_header_field_(graph_header_* header, SN_UINT i) {
+    uint64_t* fields[GRAPH_COUNT_FIELDS_] = {
+        &(header->node_count), &(header->kind_count), &(header->placeholder_count), &(header->edge_count),
+        &(header->parameter_count), &(header->constant_count), &(header->rank_count), &(header->element_count),
+        &(header->external_count), &(header->root_x_count), &(header->root_parameter_count)
+    };
+    return fields[i];
+}
+
+/* Returns the bytes of a node, which always has room for the array of a constant. */
+static size_t graph_node_bytes_(uint64_t x_count, uint64_t parameter_count) {
+    return GRAPH_ROUND_(sizeof(sn_op) + ((x_count > 0) ? x_count : 1) * sizeof(sn_op*) + parameter_count * sizeof(SN_UINT));
+}
+
+/* Returns the bytes of an embedded constant, whose shape follows its elements. */
+static size_t graph_mda_bytes_(uint64_t rank, uint64_t size) {
+    return GRAPH_ROUND_(offsetof(sn_mda, ptr) + size * sizeof(SN_FLOAT)) + GRAPH_ROUND_(rank * sizeof(SN_UINT));
+}
+
+/* Returns the bytes of the allocation of a graph, which bounds the sum of the rounded pieces. */
+static size_t graph_block_bytes_(const graph_header_* header) {
+    return GRAPH_ROUND_(sizeof(graph_block_))
+        + graph_node_bytes_(header->root_x_count, header->root_parameter_count)
+        + header->node_count * (GRAPH_ROUND_(sizeof(sn_op) + sizeof(sn_op*)) + 16 + sizeof(sn_op*))
+        + header->edge_count * sizeof(sn_op*) + header->parameter_count * sizeof(SN_UINT)
+        + header->constant_count * (GRAPH_ROUND_(offsetof(sn_mda, ptr)) + 32)
+        + header->element_count * sizeof(SN_FLOAT) + header->rank_count * sizeof(SN_UINT)
+        + GRAPH_ROUND_(header->external_count * sizeof(sn_mda*));
+}
+
+static void graph_write_(FILE* stream, uint64_t value, bool* ok) {
+    unsigned char bytes[8];
+    file_put_(bytes, value, 8);
+    *ok = *ok && (fwrite(bytes, 1, 8, stream) == 8);
+}
+
+
+/* Saving graphs */
+
+bool sn_op_save(sn_op* self, SN_UINT placeholder_count, sn_op* placeholders[],
+                SN_UINT external_count, sn_op* externals[], const char* external_paths[], const char* path) {
+    file_type_ type = file_native_type_();
+    graph_header_ header = { SN_GRAPH_FILE_VERSION, (type != 0) ? type : FILE_FLOAT64, 0, 0, placeholder_count, 0, 0, 0, 0, 0, 0, 0, 0 };
+    sn_graph* graph = sn_graph_create(self);
+
+    // The argument of a node is the index of a placeholder or an external constant, or the kind of an operator in the file.
+    // Listed placeholders which are not in the graph are written before it, so that every one is loaded.
+    SN_UINT* argument = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        argument[i] = GRAPH_NONE_;
+    }
+    SN_UINT extra_count = 0;
+    for (SN_UINT k = 0; k < placeholder_count; ++k) {
+        SN_UINT position = sn_graph_find(graph, placeholders[k]);
+        if (position < graph->count) {
+            argument[position] = k;
+        }
+        else {
+            ++extra_count;
+        }
+    }
+    for (SN_UINT k = 0; k < external_count; ++k) {
+        SN_UINT position = sn_graph_find(graph, externals[k]);
+        if (position < graph->count && externals[k]->type == CONSTANT) {
+            argument[position] = k;
+        }
+    }
+
+    GRAPH_LOCK_();
+    graph_register_builtins_();
+    SN_UINT* kind_ids = SN_DYNAMIC_ARRAY(SN_UINT, graph_kind_count_ + 1);
+    SN_UINT* kinds = SN_DYNAMIC_ARRAY(SN_UINT, graph_kind_count_ + 1);
+    for (SN_UINT r = 0; r < graph_kind_count_; ++r) {
+        kind_ids[r] = GRAPH_NONE_;
+    }
+    bool ok = true;
+    header.node_count = extra_count + graph->count;
+    for (SN_UINT i = 0; ok && i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        if (op->type == PLACEHOLDER) {
+            ok = (argument[i] != GRAPH_NONE_);
+        }
+        else if (op->type == CONSTANT) {
+            sn_mda* array = *((sn_mda**)(op->x));
+            ++(header.constant_count);
+            if (argument[i] != GRAPH_NONE_) {
+                ++(header.external_count);
+            }
+            else {
+                header.rank_count += array->rank;
+                header.element_count += sn_mda_size(array);
+            }
+        }
+        else {
+            SN_UINT r = graph_kind_by_flow_(op->flow);
+            ok = (r < graph_kind_count_);
+            if (ok && kind_ids[r] == GRAPH_NONE_) {
+                kind_ids[r] = (SN_UINT)header.kind_count;
+                kinds[header.kind_count++] = r;
+            }
+            argument[i] = ok ? kind_ids[r] : GRAPH_NONE_;
+            header.edge_count += op->x_count;
+            header.parameter_count += ok ? graph_kinds_[r].parameter_count : 0;
+            if (ok && i == graph->count - 1) {
+                header.root_x_count = op->x_count;
+                header.root_parameter_count = graph_kinds_[r].parameter_count;
+            }
+        }
+    }
+
+    FILE* stream = ok ? fopen(path, "wb") : NULL;
+    ok = (stream != NULL);
+    if (ok) {
+        unsigned char bytes[GRAPH_HEADER_BYTES_];
+        memset(bytes, 0, GRAPH_HEADER_BYTES_);
+        memcpy(bytes, graph_magic_, sizeof(graph_magic_));
+        file_put_(&(bytes[6]), header.version, 2);
+        bytes[8] = (unsigned char)header.type;
+        for (SN_UINT f = 0; f < GRAPH_COUNT_FIELDS_; ++f) {
+            file_put_(&(bytes[16 + 8 * f]), *graph_header_field_(&header, f), 8);
+        }
+        ok = (fwrite(bytes, 1, GRAPH_HEADER_BYTES_, stream) == GRAPH_HEADER_BYTES_);
+    }
+    for (SN_UINT j = 0; ok && j < header.kind_count; ++j) {
+        const graph_kind_* kind = &(graph_kinds_[kinds[j]]);
+        size_t length = strlen(kind->name);
+        graph_write_(stream, length, &ok);
+        ok = ok && (fwrite(kind->name, 1, length, stream) == length);
+        graph_write_(stream, kind->parameter_count, &ok);
+    }
+    for (SN_UINT k = 0; ok && k < placeholder_count; ++k) {
+        if (sn_graph_find(graph, placeholders[k]) == graph->count) {
+            graph_write_(stream, GRAPH_PLACEHOLDER, &ok);
+            graph_write_(stream, k, &ok);
+        }
+    }
+    for (SN_UINT i = 0; ok && i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        if (op->type == PLACEHOLDER) {
+            graph_write_(stream, GRAPH_PLACEHOLDER, &ok);
+            graph_write_(stream, argument[i], &ok);
+        }
+        else if (op->type == CONSTANT && argument[i] != GRAPH_NONE_) {
+            size_t length = strlen(external_paths[argument[i]]);
+            graph_write_(stream, GRAPH_EXTERNAL, &ok);
+            graph_write_(stream, length, &ok);
+            ok = ok && (fwrite(external_paths[argument[i]], 1, length, stream) == length);
+        }
+        else if (op->type == CONSTANT) {
+            sn_mda* array = *((sn_mda**)(op->x));
+            graph_write_(stream, GRAPH_EMBEDDED, &ok);
+            graph_write_(stream, array->rank, &ok);
+            graph_write_(stream, sn_mda_size(array), &ok);
+            for (SN_UINT d = 0; d < array->rank; ++d) {
+                graph_write_(stream, array->shape[d], &ok);
+            }
+            ok = ok && file_write_elements_(stream, array->ptr, sn_mda_size(array), header.type);
+        }
+        else {
+            const SN_UINT* x_index = sn_graph_x_index(graph, i);
+            const SN_UINT* parameters = (const SN_UINT*)&(op->x[op->x_count]);
+            graph_write_(stream, GRAPH_OPERATOR, &ok);
+            graph_write_(stream, argument[i], &ok);
+            graph_write_(stream, op->x_count, &ok);
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                graph_write_(stream, extra_count + x_index[j], &ok);
+            }
+            for (SN_UINT j = 0; j < graph_kinds_[kinds[argument[i]]].parameter_count; ++j) {
+                graph_write_(stream, parameters[j], &ok);
+            }
+        }
+    }
+    GRAPH_UNLOCK_();
+
+    if (stream != NULL) {
+        ok = (fclose(stream) == 0) && ok;
+    }
+    SN_FREE(kinds);
+    SN_FREE(kind_ids);
+    SN_FREE(argument);
+    sn_graph_destroy(graph);
+    return ok;
+}
+
+
+/* Loading graphs */
+
+#define GRAPH_BUFFER_BYTES_ 16384
+
+// Numbers are read through a buffer of the loader, which saves a call of fread() for each of them.
+typedef struct graph_loader_st_ {
+    FILE* stream;
+    bool ok;
+    unsigned char* cursor; //!< Next free byte of the block.
+    unsigned char* end;
+    size_t buffer_at;
+    size_t buffer_count;
+    unsigned char buffer[GRAPH_BUFFER_BYTES_];
+} graph_loader_;
+
+static void graph_read_bytes_(graph_loader_* loader, void* bytes, size_t n) {
+    unsigned char* out = (unsigned char*)bytes;
+    while (loader->ok && n > 0) {
+        if (loader->buffer_at == loader->buffer_count) {
+            if (n >= GRAPH_BUFFER_BYTES_) {
+                loader->ok = (fread(out, 1, n, loader->stream) == n);
+                return;
+            }
+            loader->buffer_at = 0;
+            loader->buffer_count = fread(loader->buffer, 1, GRAPH_BUFFER_BYTES_, loader->stream);
+            loader->ok = (loader->buffer_count > 0);
+        }
+        else {
+            size_t m = (n < loader->buffer_count - loader->buffer_at) ? n : loader->buffer_count - loader->buffer_at;
+            memcpy(out, &(loader->buffer[loader->buffer_at]), m);
+            loader->buffer_at += m;
+            out += m;
+            n -= m;
+        }
+    }
+}
+
+static uint64_t graph_read_(graph_loader_* loader) {
+    unsigned char bytes[8];
+    if (loader->buffer_count - loader->buffer_at >= 8) {
+        memcpy(bytes, &(loader->buffer[loader->buffer_at]), 8);
+        loader->buffer_at += 8;
+    }
+    else {
+        graph_read_bytes_(loader, bytes, 8);
+    }
+    if (loader->ok && file_is_little_endian_()) {
+        uint64_t value;
+        memcpy(&value, bytes, 8);
+        return value;
+    }
+    return loader->ok ? file_get_(bytes, 8) : 0;
+}
+
+/* Reads n elements of the type like file_read_elements_(), through the buffer of the loader. */
+static void graph_read_elements_(graph_loader_* loader, SN_FLOAT x[], SN_UINT n, file_type_ type) {
+    if (type == file_native_type_() && file_is_little_endian_()) {
+        graph_read_bytes_(loader, x, n * sizeof(SN_FLOAT));
+        return;
+    }
+    unsigned char* chunk = SN_DYNAMIC_ARRAY(unsigned char, FILE_CHUNK_ * file_type_bytes_(type));
+    for (SN_UINT i = 0; loader->ok && i < n; i += FILE_CHUNK_) {
+        SN_UINT m = (n - i < FILE_CHUNK_) ? n - i : FILE_CHUNK_;
+        graph_read_bytes_(loader, chunk, m * file_type_bytes_(type));
+        file_decode_(chunk, m, type, &(x[i]));
+    }
+    SN_FREE(chunk);
+}
+
+/* Returns the next bytes of the block, or NULL if the file asks for more than its header promised. */
+static void* graph_take_(graph_loader_* loader, size_t bytes) {
+    if (!loader->ok || bytes > (size_t)(loader->end - loader->cursor)) {
+        loader->ok = false;
+        return NULL;
+    }
+    void* ptr = loader->cursor;
+    loader->cursor += bytes;
+    return ptr;
+}
+
+static void graph_init_node_(sn_op* op, sn_op_type type, SN_UINT x_count) {
+    op->ref_count = 2; // The reference of the graph itself, which is never released by sn_op_destroy().
+    op->type = type;
+    op->flow = NULL;
+    op->dflow = NULL;
+    op->vjp = NULL;
+    op->kernel = NULL;
+    op->bflow = NULL;
+    op->bvjp = NULL;
+    op->jvp = NULL;
+    op->hvp = NULL;
+    op->element_wise = NULL;
+    op->name = NULL;
+    op->x_count = x_count;
+}
+
+/* Loads the external constant at name, relative to the directory of the graph file at path. */
+static sn_mda* graph_load_external_(const char* path, const char* name) {
+    const char* slash = strrchr(path, '/');
+    size_t directory_length = (name[0] != '/' && slash != NULL) ? (size_t)(slash - path) + 1 : 0;
+    size_t name_length = strlen(name);
+    char* full_path = SN_DYNAMIC_ARRAY(char, directory_length + name_length + 1);
+    memcpy(full_path, path, directory_length);
+    memcpy(&(full_path[directory_length]), name, name_length + 1);
+    sn_mda* array = sn_mda_map(full_path);
+    SN_FREE(full_path);
+    return array;
+}
+
+/* Reads the node at position i into the block. ops holds the nodes before it. */
+static sn_op* graph_load_node_(graph_loader_* loader, const char* path, const graph_header_* header, const graph_kind_ kinds[],
+                               SN_UINT i, sn_op* ops[], sn_op* root, graph_block_* block, sn_op* placeholders[]) {
+    bool is_root = (i == header->node_count - 1);
+    uint64_t tag = graph_read_(loader);
+    uint64_t x_count = 0;
+    uint64_t parameter_count = 0;
+    const graph_kind_* kind = NULL;
+    if (tag == GRAPH_OPERATOR) {
+        uint64_t kind_id = graph_read_(loader);
+        loader->ok = loader->ok && kind_id < header->kind_count;
+        kind = loader->ok ? &(kinds[kind_id]) : NULL;
+        x_count = graph_read_(loader);
+        parameter_count = loader->ok ? kind->parameter_count : 0;
+        loader->ok = loader->ok && x_count <= header->edge_count;
+    }
+    if (is_root) {
+        loader->ok = loader->ok && x_count == header->root_x_count && parameter_count == header->root_parameter_count;
+    }
+    sn_op* op = is_root ? root : (sn_op*)graph_take_(loader, graph_node_bytes_(x_count, parameter_count));
+    if (!loader->ok) {
+        return NULL;
+    }
+
+    if (tag == GRAPH_PLACEHOLDER) {
+        uint64_t k = graph_read_(loader);
+        loader->ok = loader->ok && k < header->placeholder_count && placeholders[k] == NULL;
+        graph_init_node_(op, PLACEHOLDER, 0);
+        if (loader->ok) {
+            placeholders[k] = op;
+        }
+    }
+    else if (tag == GRAPH_EMBEDDED) {
+        uint64_t rank = graph_read_(loader);
+        uint64_t size = graph_read_(loader);
+        loader->ok = loader->ok && rank <= header->rank_count && size <= header->element_count;
+        sn_mda* array = loader->ok ? (sn_mda*)graph_take_(loader, graph_mda_bytes_(rank, size)) : NULL;
+        if (array == NULL) {
+            return NULL;
+        }
+        array->rank = (SN_UINT)rank;
+        array->shape = (rank > 0) ? (SN_UINT*)((unsigned char*)array + GRAPH_ROUND_(offsetof(sn_mda, ptr) + size * sizeof(SN_FLOAT))) : NULL;
+        uint64_t shape_size = 1;
+        for (SN_UINT d = 0; d < rank; ++d) {
+            array->shape[d] = (SN_UINT)graph_read_(loader);
+            shape_size *= array->shape[d];
+        }
+        loader->ok = loader->ok && shape_size == size;
+        graph_read_elements_(loader, array->ptr, (SN_UINT)size, header->type);
+        graph_init_node_(op, CONSTANT, 0);
+        *((sn_mda**)(op->x)) = array;
+    }
+    else if (tag == GRAPH_EXTERNAL) {
+        char name[GRAPH_PATH_BYTES_];
+        uint64_t length = graph_read_(loader);
+        loader->ok = loader->ok && length < GRAPH_PATH_BYTES_ && block->info.external_count < header->external_count;
+        if (loader->ok) {
+            graph_read_bytes_(loader, name, (size_t)length);
+        }
+        sn_mda* array = NULL;
+        if (loader->ok) {
+            name[length] = '\0';
+            array = graph_load_external_(path, name);
+            loader->ok = (array != NULL);
+        }
+        if (array != NULL) {
+            block->info.externals[block->info.external_count++] = array;
+        }
+        graph_init_node_(op, CONSTANT, 0);
+        *((sn_mda**)(op->x)) = array;
+    }
+    else if (tag == GRAPH_OPERATOR) {
+        graph_init_node_(op, OPERATOR, (SN_UINT)x_count);
+        op->flow = kind->flow;
+        op->dflow = kind->dflow;
+        op->vjp = kind->vjp;
+        op->kernel = kind->kernel;
+        op->bflow = kind->bflow;
+        op->bvjp = kind->bvjp;
+        op->jvp = kind->jvp;
+        op->hvp = kind->hvp;
+        op->element_wise = kind->element_wise;
+        op->name = kind->name;
+        for (SN_UINT j = 0; loader->ok && j < x_count; ++j) {
+            uint64_t input = graph_read_(loader);
+            loader->ok = loader->ok && input < i;
+            op->x[j] = loader->ok ? ops[input] : NULL;
+            if (loader->ok) {
+                ++(op->x[j]->ref_count);
+            }
+        }
+        SN_UINT* parameters = (SN_UINT*)&(op->x[x_count]);
+        for (SN_UINT j = 0; j < parameter_count; ++j) {
+            parameters[j] = (SN_UINT)graph_read_(loader);
+        }
+    }
+    else {
+        loader->ok = false;
+    }
+    return loader->ok ? op : NULL;
+}
+
+sn_op* sn_op_load(const char* path, SN_UINT placeholder_count, sn_op* placeholders[]) {
+    FILE* stream = fopen(path, "rb");
+    if (stream == NULL) {
+        return NULL;
+    }
+    // Every count is bounded by the size of the file, since each one takes at least a byte of it.
+    unsigned char bytes[GRAPH_HEADER_BYTES_];
+    graph_header_ header;
+    bool ok = (fseek(stream, 0, SEEK_END) == 0);
+    long file_bytes = ok ? ftell(stream) : -1;
+    ok = (file_bytes >= GRAPH_HEADER_BYTES_) && (fseek(stream, 0, SEEK_SET) == 0)
+        && fread(bytes, 1, GRAPH_HEADER_BYTES_, stream) == GRAPH_HEADER_BYTES_
+        && memcmp(bytes, graph_magic_, sizeof(graph_magic_)) == 0;
+    if (ok) {
+        header.version = (SN_UINT)file_get_(&(bytes[6]), 2);
+        header.type = (file_type_)bytes[8];
+        for (SN_UINT f = 0; f < GRAPH_COUNT_FIELDS_; ++f) {
+            *graph_header_field_(&header, f) = file_get_(&(bytes[16 + 8 * f]), 8);
+            ok = ok && *graph_header_field_(&header, f) <= (uint64_t)file_bytes;
+        }
+        ok = ok && header.version == SN_GRAPH_FILE_VERSION && (header.type == FILE_FLOAT32 || header.type == FILE_FLOAT64)
+            && header.node_count > 0 && header.placeholder_count == placeholder_count;
+    }
+    if (!ok) {
+        fclose(stream);
+        return NULL;
+    }
+
+    // The loader is large for the stack of a thread, so it is allocated with the kinds.
+    // Kinds are copied, since the table may grow once the lock is released. Their names stay in place.
+    graph_loader_* loader = (graph_loader_*)SN_MALLOC(sizeof(graph_loader_));
+    loader->stream = stream;
+    loader->ok = true;
+    loader->cursor = NULL;
+    loader->end = NULL;
+    loader->buffer_at = 0;
+    loader->buffer_count = 0;
+    GRAPH_LOCK_();
+    graph_register_builtins_();
+    graph_kind_* kinds = SN_DYNAMIC_ARRAY(graph_kind_, header.kind_count + 1);
+    for (SN_UINT j = 0; loader->ok && j < header.kind_count; ++j) {
+        char name[GRAPH_NAME_BYTES_];
+        uint64_t length = graph_read_(loader);
+        loader->ok = loader->ok && length < GRAPH_NAME_BYTES_;
+        if (loader->ok) {
+            graph_read_bytes_(loader, name, (size_t)length);
+        }
+        uint64_t parameter_count = graph_read_(loader);
+        if (loader->ok) {
+            name[length] = '\0';
+            SN_UINT r = graph_kind_by_name_(name);
+            loader->ok = (r < graph_kind_count_) && graph_kinds_[r].parameter_count == parameter_count;
+            if (loader->ok) {
+                kinds[j] = graph_kinds_[r];
+            }
+        }
+    }
+    GRAPH_UNLOCK_();
+
+    size_t block_bytes = graph_block_bytes_(&header);
+    graph_block_* block = loader->ok ? (graph_block_*)SN_MALLOC(block_bytes) : NULL;
+    sn_op* root = NULL;
+    if (block != NULL) {
+        loader->cursor = (unsigned char*)block;
+        loader->end = (unsigned char*)block + block_bytes;
+        graph_take_(loader, GRAPH_ROUND_(sizeof(graph_block_)));
+        root = (sn_op*)graph_take_(loader, graph_node_bytes_(header.root_x_count, header.root_parameter_count));
+        block->info.external_count = 0;
+        block->info.externals = (sn_mda**)graph_take_(loader, GRAPH_ROUND_(header.external_count * sizeof(sn_mda*)));
+        sn_op** ops = (sn_op**)graph_take_(loader, GRAPH_ROUND_(header.node_count * sizeof(sn_op*)));
+        block->info.node_count = header.node_count;
+        block->info.ops = ops;
+        for (SN_UINT k = 0; k < placeholder_count; ++k) {
+            placeholders[k] = NULL;
+        }
+        for (SN_UINT i = 0; loader->ok && i < header.node_count; ++i) {
+            ops[i] = graph_load_node_(loader, path, &header, kinds, i, ops, root, block, placeholders);
+        }
+        for (SN_UINT k = 0; loader->ok && k < placeholder_count; ++k) {
+            loader->ok = (placeholders[k] != NULL);
+        }
+        if (!loader->ok) {
+            for (SN_UINT e = 0; e < block->info.external_count; ++e) {
+                sn_mda_destroy(block->info.externals[e]);
+            }
+            SN_FREE(block);
+            root = NULL;
+            for (SN_UINT k = 0; k < placeholder_count; ++k) {
+                placeholders[k] = NULL;
+            }
+        }
+    }
+    SN_FREE(kinds);
+    SN_FREE(loader);
+    fclose(stream);
+    return root;
+}
+
+void sn_op_unload(sn_op* self) {
+    graph_block_* block = (graph_block_*)((unsigned char*)self - GRAPH_ROUND_(sizeof(graph_block_)));
+    for (SN_UINT e = 0; e < block->info.external_count; ++e) {
+        sn_mda_destroy(block->info.externals[e]);
+    }
+    for (SN_UINT i = 0; i < block->info.node_count; ++i) {
+        SN_MEMORY_FORGET(block->info.ops[i]);
+    }
+    SN_FREE(block);
+}
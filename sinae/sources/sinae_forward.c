@@ -0,0 +1,392 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_forward.c
+//! \brief This file implements sinae_forward.h.
+
+#include "../sinae_forward.h"
+#include "../sinae_graph.h"
+#include "../sinae_profile.h"
+
+#include <float.h>
+#include <math.h>
+
+
+/* Forward mode */
+
+/* Returns zero tangents of y in its shape followed by tangent_count. */
+static sn_mda* forward_tangent_create_(const sn_mda* y, SN_UINT tangent_count) {
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, y->rank + 1);
+    for (SN_UINT i = 0; i < y->rank; ++i) {
+        shape[i] = y->shape[i];
+    }
+    shape[y->rank] = tangent_count;
+    sn_mda* obj = sn_mda_full(y->rank + 1, shape, 0.0);
+    SN_FREE(shape);
+    return obj;
+}
+
+/* Accumulates the Jacobian-vector products through the Jacobians of an operator without jvp. */
+static void dflow_jvp_(sn_op* op, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy) {
+    SN_ASSERT(op->dflow != NULL);
+    sn_jac** dy_dx_list = op->dflow(op, x);
+    SN_UINT y_size = sn_mda_size(y);
+    for (SN_UINT i = 0; i < op->x_count; ++i) {
+        if (dx[i]) {
+            SN_UINT x_size = sn_mda_size(x[i]);
+            for (SN_UINT k = 0; k < tangent_count; ++k) {
+                sn_jac_jvp(dy_dx_list[i], &(dx[i]->ptr[k * x_size]), &(dy->ptr[k * y_size]));
+            }
+        }
+        sn_jac_destroy(dy_dx_list[i]);
+    }
+    SN_FREE(dy_dx_list);
+}
+
+/* Evaluates the node at position i and, if one of its inputs has tangents, pushes them through its jvp. */
+static void forward_node_(const sn_graph* graph, SN_UINT i, sn_map* feed, SN_UINT tangent_count, sn_map* tangents,
+                          sn_mda* y[], sn_mda* t[], const sn_mda* x[], const sn_mda* dx[]) {
+    sn_op* op = graph->ops[i];
+    t[i] = NULL;
+    if (op->type == CONSTANT) {
+        y[i] = *((sn_mda**)(op->x));
+    }
+    else if (op->type == PLACEHOLDER) {
+        y[i] = sn_map_get(feed, op);
+        t[i] = (sn_map_count(tangents, op) != 0) ? sn_map_get(tangents, op) : NULL;
+        SN_ASSERT(t[i] == NULL || sn_mda_size(t[i]) == sn_mda_size(y[i]) * tangent_count); // If the tangents are not in the shape of the value followed by tangent_count.
+    }
+    else if (op->type == OPERATOR) {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        bool has_tangent = false;
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
+            dx[j] = t[x_index[j]];
+            has_tangent = has_tangent || (dx[j] != NULL);
+        }
+        SN_MEMORY_BEGIN(owner, op);
+        SN_PROFILE_BEGIN(mark);
+        y[i] = op->flow(op, x);
+        SN_PROFILE_END(mark, PROFILE_FLOW, op, y[i]);
+        if (has_tangent) {
+            SN_PROFILE_BEGIN(jvp_mark);
+            t[i] = forward_tangent_create_(y[i], tangent_count);
+            if (op->jvp) {
+                op->jvp(op, x, y[i], tangent_count, dx, t[i]);
+            }
+            else {
+                dflow_jvp_(op, x, y[i], tangent_count, dx, t[i]);
+            }
+            SN_PROFILE_END(jvp_mark, PROFILE_DFLOW, op, t[i]);
+        }
+        SN_MEMORY_END(owner);
+    }
+    else {
+        SN_ASSERT(false);
+    }
+}
+
+/* Destroys the value and the tangents of the node at position i if they are owned by the pass. */
+static void forward_release_(const sn_graph* graph, SN_UINT i, sn_mda* y[], sn_mda* dy[]) {
+    if (graph->ops[i]->type == OPERATOR) {
+        sn_mda_destroy(y[i]);
+        if (dy[i] != NULL) {
+            sn_mda_destroy(dy[i]);
+        }
+    }
+    y[i] = NULL;
+    dy[i] = NULL;
+}
+
+// Values and tangents of an operator are released after its last consumer, and those of placeholders and constants are borrowed.
+// A node whose inputs have no tangents has none either, so only the nodes depending on a tangent pay for the derivatives.
+sn_mda* sn_op_jvp(sn_op* self, sn_map* feed, SN_UINT tangent_count, sn_map* tangents, sn_mda** dy) {
+    *dy = NULL;
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    sn_mda** t = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    SN_UINT* consumer_count = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        consumer_count[i] = 0;
+        x_capacity = (graph->ops[i]->x_count > x_capacity) ? graph->ops[i]->x_count : x_capacity;
+    }
+    for (SN_UINT e = 0; e < graph->x_offset[graph->count]; ++e) {
+        ++(consumer_count[graph->x_index[e]]);
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    const sn_mda** dx = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+
+    SN_UINT root = graph->count - 1;
+    bool completed = true;
+    for (SN_UINT i = 0; i < graph->count && completed; ++i) {
+        forward_node_(graph, i, feed, tangent_count, tangents, y, t, x, dx);
+        if (graph->ops[i]->type == OPERATOR) {
+            SN_UINT* x_index = sn_graph_x_index(graph, i);
+            for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+                if (--(consumer_count[x_index[j]]) == 0) {
+                    forward_release_(graph, x_index[j], y, t);
+                }
+            }
+        }
+        completed = !SN_MEMORY_EXCEEDED();
+        if (!completed) {
+            for (SN_UINT k = 0; k <= i; ++k) {
+                if (y[k] != NULL) {
+                    forward_release_(graph, k, y, t);
+                }
+            }
+        }
+    }
+
+    sn_mda* result = NULL;
+    if (completed) {
+        result = y[root];
+        *dy = t[root];
+        if (self->type != OPERATOR) {
+            result = sn_mda_copy(result);
+            *dy = (*dy != NULL) ? sn_mda_copy(*dy) : NULL;
+        }
+        if (*dy == NULL) {
+            *dy = forward_tangent_create_(result, tangent_count);
+        }
+    }
+    SN_FREE(dx);
+    SN_FREE(x);
+    SN_FREE(consumer_count);
+    SN_FREE(t);
+    SN_FREE(y);
+    sn_graph_destroy(graph);
+    sn_map_destroy(tangents);
+    sn_map_destroy(feed);
+    return result;
+}
+
+
+/* Hessian-vector product */
+
+/* Accumulates the vector-Jacobian product, through the Jacobians if the operator has no vjp. */
+static void forward_vjp_(sn_op* op, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    if (op->vjp) {
+        op->vjp(op, x, y, dy, dx);
+        return;
+    }
+    SN_ASSERT(op->dflow != NULL);
+    sn_jac** dy_dx_list = op->dflow(op, x);
+    for (SN_UINT i = 0; i < op->x_count; ++i) {
+        if (dx[i]) {
+            sn_jac_vjp(dy_dx_list[i], dy->ptr, dx[i]->ptr);
+        }
+        sn_jac_destroy(dy_dx_list[i]);
+    }
+    SN_FREE(dy_dx_list);
+}
+
+/* Approximates the second-order term of an operator without hvp by a central difference of its vjp along the tangents.
+   The step is the cube root of the machine epsilon relative to the magnitudes of the inputs and the tangents. */
+static void difference_hvp_(sn_op* op, const sn_mda* x[], const sn_mda* tx[], const sn_mda* dy, sn_mda* dx[]) {
+    SN_FLOAT x_norm = 0.0;
+    SN_FLOAT t_norm = 0.0;
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        if (tx[j]) {
+            SN_UINT size = sn_mda_size(x[j]);
+            for (SN_UINT i = 0; i < size; ++i) {
+                x_norm = (fabs(x[j]->ptr[i]) > x_norm) ? fabs(x[j]->ptr[i]) : x_norm;
+                t_norm = (fabs(tx[j]->ptr[i]) > t_norm) ? fabs(tx[j]->ptr[i]) : t_norm;
+            }
+        }
+    }
+    if (t_norm == 0.0) {
+        return;
+    }
+    SN_FLOAT epsilon = (sizeof(SN_FLOAT) == sizeof(float)) ? FLT_EPSILON : DBL_EPSILON;
+    SN_FLOAT h = (SN_FLOAT)cbrt(epsilon) * (1 + x_norm) / t_norm;
+
+    const sn_mda** shifted = SN_DYNAMIC_ARRAY(const sn_mda*, op->x_count);
+    sn_mda** dx_shifted = SN_DYNAMIC_ARRAY(sn_mda*, op->x_count);
+    for (SN_UINT side = 0; side < 2; ++side) {
+        SN_FLOAT sign = (side == 0) ? 1.0 : -1.0;
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            shifted[j] = x[j];
+            if (tx[j]) {
+                sn_mda* x_shifted = sn_mda_copy(x[j]);
+                SN_UINT size = sn_mda_size(x_shifted);
+                for (SN_UINT i = 0; i < size; ++i) {
+                    x_shifted->ptr[i] += sign * h * tx[j]->ptr[i];
+                }
+                shifted[j] = x_shifted;
+            }
+            dx_shifted[j] = dx[j] ? sn_mda_full(x[j]->rank, x[j]->shape, 0.0) : NULL;
+        }
+        sn_mda* y_shifted = op->flow(op, shifted);
+        forward_vjp_(op, shifted, y_shifted, dy, dx_shifted);
+        sn_mda_destroy(y_shifted);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            if (dx[j]) {
+                SN_UINT size = sn_mda_size(dx[j]);
+                for (SN_UINT i = 0; i < size; ++i) {
+                    dx[j]->ptr[i] += sign * dx_shifted[j]->ptr[i] / (2 * h);
+                }
+                sn_mda_destroy(dx_shifted[j]);
+            }
+            if (tx[j]) {
+                sn_mda_destroy((sn_mda*)shifted[j]);
+            }
+        }
+    }
+    SN_FREE(dx_shifted);
+    SN_FREE(shifted);
+}
+
+/* Propagates the adjoint dy[i] of an operator and its tangent ty[i] to its inputs, and destroys them.
+   The tangent of an adjoint of an input gets the vjp of ty[i] and the second-order term along the tangents of the inputs. */
+static void hvp_node_(const sn_graph* graph, SN_UINT i, sn_mda* y[], sn_mda* t[], const bool required[], sn_mda* dy[], sn_mda* ty[],
+                      const sn_mda* x[], const sn_mda* tx[], sn_mda* dx[], sn_mda* tdx[]) {
+    sn_op* op = graph->ops[i];
+    if (op->type != OPERATOR || dy[i] == NULL) {
+        return;
+    }
+    SN_UINT* x_index = sn_graph_x_index(graph, i);
+    bool has_x_tangent = false;
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        x[j] = y[x_index[j]];
+        tx[j] = t[x_index[j]];
+        has_x_tangent = has_x_tangent || (tx[j] != NULL);
+    }
+    for (SN_UINT j = 0; j < op->x_count; ++j) {
+        dx[j] = NULL;
+        tdx[j] = NULL;
+        if (required[x_index[j]]) {
+            if (dy[x_index[j]] == NULL) {
+                dy[x_index[j]] = sn_mda_full(x[j]->rank, x[j]->shape, 0.0);
+            }
+            dx[j] = dy[x_index[j]];
+            if (has_x_tangent || ty[i] != NULL) {
+                if (ty[x_index[j]] == NULL) {
+                    ty[x_index[j]] = sn_mda_full(x[j]->rank, x[j]->shape, 0.0);
+                }
+                tdx[j] = ty[x_index[j]];
+            }
+        }
+    }
+    SN_MEMORY_BEGIN(owner, op);
+    SN_PROFILE_BEGIN(mark);
+    forward_vjp_(op, x, y[i], dy[i], dx);
+    if (ty[i] != NULL) {
+        forward_vjp_(op, x, y[i], ty[i], tdx);
+    }
+    if (has_x_tangent) {
+        if (op->hvp) {
+            op->hvp(op, x, tx, y[i], dy[i], tdx);
+        }
+        else {
+            difference_hvp_(op, x, tx, dy[i], tdx);
+        }
+    }
+    SN_PROFILE_END(mark, PROFILE_DFLOW, op, y[i]);
+    SN_MEMORY_END(owner);
+    sn_mda_destroy(dy[i]);
+    dy[i] = NULL;
+    if (ty[i] != NULL) {
+        sn_mda_destroy(ty[i]);
+        ty[i] = NULL;
+    }
+}
+
+// The forward pass keeps every value and tangent for the reverse pass, which differentiates the adjoints along the tangents.
+// Adjoints and their tangents are destroyed as soon as they are propagated, like those of sn_op_dflow().
+sn_map* sn_op_hvp(sn_op* self, sn_map* feed, sn_map* tangents, sn_map** gradient) {
+    if (gradient != NULL) {
+        *gradient = NULL;
+    }
+    sn_graph* graph = sn_graph_create(self);
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    sn_mda** t = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    sn_mda** dy = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    sn_mda** ty = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    bool* required = SN_DYNAMIC_ARRAY(bool, graph->count);
+    SN_UINT x_capacity = 1;
+    SN_UINT placeholder_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        y[i] = NULL;
+        t[i] = NULL;
+        dy[i] = NULL;
+        ty[i] = NULL;
+        required[i] = (op->type == PLACEHOLDER);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            required[i] = required[i] || required[x_index[j]];
+        }
+        x_capacity = (op->x_count > x_capacity) ? op->x_count : x_capacity;
+        placeholder_count += (op->type == PLACEHOLDER);
+    }
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    const sn_mda** tx = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+    sn_mda** dx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity);
+    sn_mda** tdx = SN_DYNAMIC_ARRAY(sn_mda*, x_capacity);
+
+    SN_UINT root = graph->count - 1;
+    bool completed = true;
+    for (SN_UINT i = 0; i < graph->count && completed; ++i) {
+        forward_node_(graph, i, feed, 1, tangents, y, t, x, tx);
+        completed = !SN_MEMORY_EXCEEDED();
+    }
+    if (completed && required[root]) {
+        SN_ASSERT(sn_mda_size(y[root]) == 1); // If the expression is not a scalar.
+        dy[root] = sn_mda_full(y[root]->rank, y[root]->shape, 1.0);
+        for (SN_UINT i = graph->count; i-- > 0 && completed;) {
+            hvp_node_(graph, i, y, t, required, dy, ty, x, tx, dx, tdx);
+            completed = !SN_MEMORY_EXCEEDED();
+        }
+    }
+
+    sn_map* hv_map = NULL;
+    if (completed) {
+        hv_map = sn_map_create(placeholder_count > 0 ? placeholder_count : 1, NULL, NULL);
+        if (gradient != NULL) {
+            *gradient = sn_map_create(placeholder_count > 0 ? placeholder_count : 1, NULL, NULL);
+        }
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (completed && graph->ops[i]->type == PLACEHOLDER) {
+            sn_map_insert(hv_map, graph->ops[i], ty[i] ? ty[i] : sn_mda_full(y[i]->rank, y[i]->shape, 0.0));
+            ty[i] = NULL;
+            if (gradient != NULL) {
+                sn_map_insert(*gradient, graph->ops[i], dy[i] ? dy[i] : sn_mda_full(y[i]->rank, y[i]->shape, 0.0));
+                dy[i] = NULL;
+            }
+        }
+        if (dy[i] != NULL) {
+            sn_mda_destroy(dy[i]);
+        }
+        if (ty[i] != NULL) {
+            sn_mda_destroy(ty[i]);
+        }
+        if (graph->ops[i]->type == OPERATOR) {
+            if (y[i] != NULL) {
+                sn_mda_destroy(y[i]);
+            }
+            if (t[i] != NULL) {
+                sn_mda_destroy(t[i]);
+            }
+        }
+    }
+    SN_FREE(tdx);
+    SN_FREE(dx);
+    SN_FREE(tx);
+    SN_FREE(x);
+    SN_FREE(required);
+    SN_FREE(ty);
+    SN_FREE(dy);
+    SN_FREE(t);
+    SN_FREE(y);
+    sn_graph_destroy(graph);
+    sn_map_destroy(tangents);
+    sn_map_destroy(feed);
+    return hv_map;
+}
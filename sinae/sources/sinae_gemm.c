@@ -0,0 +1,440 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_gemm.c
+//! \brief This file implements sinae_gemm.h.
+
+#include <stdlib.h>
+
+#ifdef SN_USE_PTHREAD
+    #include <pthread.h>
+#endif
+
+#include "../sinae_gemm.h"
+#include "../sinae_thread.h"
+
+#if !defined(SN_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define GEMM_X86_
+    #include <immintrin.h>
+#endif
+
+
+/* Micro-kernels */
+
+// A micro-kernel accumulates an MR x NR tile of C from kc columns of a packed A panel and kc rows of a packed B panel.
+// A panel stores MR elements per column and B panel stores NR elements per row, both zero-padded.
+
+typedef void gemm_kernel_fn_(SN_UINT kc, const SN_FLOAT* a, const SN_FLOAT* b, SN_FLOAT* c, SN_UINT ldc);
+
+typedef struct gemm_kernel_st_ {
+    gemm_kernel_fn_* kernel; //!< NULL if the build does not have it.
+    SN_UINT mr;              //!< Height of the tile.
+    SN_UINT nr;              //!< Width of the tile.
+} gemm_kernel_;
+
+#define GEMM_SCALAR_MR_ 4
+#define GEMM_SCALAR_NR_ 4
+
+static void gemm_scalar_kernel_(SN_UINT kc, const SN_FLOAT* a, const SN_FLOAT* b, SN_FLOAT* c, SN_UINT ldc) {
+    SN_FLOAT acc[GEMM_SCALAR_NR_][GEMM_SCALAR_MR_] = { { 0 } };
+    for (SN_UINT p = 0; p < kc; ++p) {
+        for (SN_UINT j = 0; j < GEMM_SCALAR_NR_; ++j) {
+            for (SN_UINT i = 0; i < GEMM_SCALAR_MR_; ++i) {
+                acc[j][i] += a[i] * b[j];
+            }
+        }
+        a += GEMM_SCALAR_MR_;
+        b += GEMM_SCALAR_NR_;
+    }
+    for (SN_UINT j = 0; j < GEMM_SCALAR_NR_; ++j) {
+        for (SN_UINT i = 0; i < GEMM_SCALAR_MR_; ++i) {
+            c[i + j * ldc] += acc[j][i];
+        }
+    }
+}
+
+#ifdef GEMM_X86_
+
+// The vector kernels use GCC vector extensions, so that the same code serves both float and double SN_FLOAT.
+// Only the fused multiply-add needs intrinsics, since ISO C modes do not contract a * b + c.
+// The loops over the tile are fully unrolled so that the accumulators stay in registers.
+
+#define GEMM_DEFINE_VECTOR_KERNEL_(NAME, TARGET, VECTOR_BYTES, MR_VECTORS, NR, FMADD)                                    \
+    static __attribute__((target(TARGET))) void NAME(SN_UINT kc, const SN_FLOAT* a, const SN_FLOAT* b, SN_FLOAT* c, SN_UINT ldc) { \
+        typedef SN_FLOAT vector_ __attribute__((vector_size(VECTOR_BYTES)));                                          \
+        typedef SN_FLOAT unaligned_vector_ __attribute__((vector_size(VECTOR_BYTES), aligned(sizeof(SN_FLOAT)), may_alias)); \
+        const SN_UINT width = VECTOR_BYTES / sizeof(SN_FLOAT);                                                          \
+        vector_ acc[MR_VECTORS][NR];                                                                                    \
+        _Pragma("GCC unroll 16")                                                                                        \
+        for (SN_UINT v = 0; v < MR_VECTORS; ++v) {                                                                      \
+            _Pragma("GCC unroll 16")                                                                                    \
+            for (SN_UINT j = 0; j < NR; ++j) {                                                                          \
+                acc[v][j] = (vector_){ 0 };                                                                             \
+            }                                                                                                           \
+        }                                                                                                               \
+        for (SN_UINT p = 0; p < kc; ++p) {                                                                              \
+            vector_ a_vector[MR_VECTORS];                                                                               \
+            _Pragma("GCC unroll 16")                                                                                    \
+            for (SN_UINT v = 0; v < MR_VECTORS; ++v) {                                                                  \
+                a_vector[v] = *((const unaligned_vector_*)&(a[v * width]));                                             \
+            }                                                                                                           \
+            _Pragma("GCC unroll 16")                                                                                    \
+            for (SN_UINT j = 0; j < NR; ++j) {                                                                          \
+                vector_ b_vector = (vector_){ 0 } + b[j];                                                               \
+                _Pragma("GCC unroll 16")                                                                                \
+                for (SN_UINT v = 0; v < MR_VECTORS; ++v) {                                                              \
+                    acc[v][j] = FMADD(vector_, a_vector[v], b_vector, acc[v][j]);                                       \
+                }                                                                                                       \
+            }                                                                                                           \
+            a += MR_VECTORS * width;                                                                                    \
+            b += NR;                                                                                                    \
+        }                                                                                                               \
+        _Pragma("GCC unroll 16")                                                                                        \
+        for (SN_UINT j = 0; j < NR; ++j) {                                                                              \
+            _Pragma("GCC unroll 16")                                                                                    \
+            for (SN_UINT v = 0; v < MR_VECTORS; ++v) {                                                                  \
+                unaligned_vector_* c_vector = (unaligned_vector_*)&(c[v * width + j * ldc]);                            \
+                *c_vector = *c_vector + acc[v][j];                                                                      \
+            }                                                                                                           \
+        }                                                                                                               \
+    }
+
+#define GEMM_MULADD_(VECTOR, X, Y, Z) ((X) * (Y) + (Z))
+#define GEMM_FMADD256_(VECTOR, X, Y, Z) (sizeof(SN_FLOAT) == sizeof(double)                     \
+    ? (VECTOR)_mm256_fmadd_pd((__m256d)(X), (__m256d)(Y), (__m256d)(Z))                          \
+    : (VECTOR)_mm256_fmadd_ps((__m256)(X), (__m256)(Y), (__m256)(Z)))
+#define GEMM_FMADD512_(VECTOR, X, Y, Z) (sizeof(SN_FLOAT) == sizeof(double)                     \
+    ? (VECTOR)_mm512_fmadd_pd((__m512d)(X), (__m512d)(Y), (__m512d)(Z))                          \
+    : (VECTOR)_mm512_fmadd_ps((__m512)(X), (__m512)(Y), (__m512)(Z)))
+
+GEMM_DEFINE_VECTOR_KERNEL_(gemm_sse2_kernel_, "sse2", 16, 2, 4, GEMM_MULADD_)
+GEMM_DEFINE_VECTOR_KERNEL_(gemm_avx2_kernel_, "avx2,fma", 32, 2, 6, GEMM_FMADD256_)
+GEMM_DEFINE_VECTOR_KERNEL_(gemm_avx512_kernel_, "avx512f", 64, 2, 8, GEMM_FMADD512_)
+
+static gemm_kernel_ gemm_kernels_[] = {
+    { &gemm_scalar_kernel_, GEMM_SCALAR_MR_, GEMM_SCALAR_NR_ },
+    { &gemm_sse2_kernel_, 2 * 16 / sizeof(SN_FLOAT), 4 },
+    { &gemm_avx2_kernel_, 2 * 32 / sizeof(SN_FLOAT), 6 },
+    { &gemm_avx512_kernel_, 2 * 64 / sizeof(SN_FLOAT), 8 },
+};
+
+#else
+
+static gemm_kernel_ gemm_kernels_[] = {
+    { &gemm_scalar_kernel_, GEMM_SCALAR_MR_, GEMM_SCALAR_NR_ },
+    { NULL, 0, 0 },
+    { NULL, 0, 0 },
+    { NULL, 0, 0 },
+};
+
+#endif // GEMM_X86_
+
+// Large enough for the tile of every micro-kernel.
+#define GEMM_TILE_CAPACITY_ 256
+
+static sn_gemm_isa gemm_isa_ = GEMM_SCALAR;
+
+static bool gemm_supports_(sn_gemm_isa isa) {
+    if (gemm_kernels_[isa].kernel == NULL) {
+        return false;
+    }
+#ifdef GEMM_X86_
+    __builtin_cpu_init();
+    switch (isa) {
+    case GEMM_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case GEMM_AVX2:
+        return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    case GEMM_AVX512:
+        return __builtin_cpu_supports("avx512f");
+    default:
+        break;
+    }
+#endif
+    return true;
+}
+
+/* Selects the best micro-kernel supported by the CPU. Runs once, before the first read of gemm_isa_. */
+static void gemm_isa_detect_(void) {
+    sn_gemm_isa candidates[] = { GEMM_AVX512, GEMM_AVX2, GEMM_SSE2, GEMM_SCALAR };
+    for (SN_UINT i = 0; i < sizeof(candidates) / sizeof(candidates[0]); ++i) {
+        if (gemm_supports_(candidates[i])) {
+            gemm_isa_ = candidates[i];
+            break;
+        }
+    }
+}
+
+// Threads may call sn_gemm() for the first time concurrently, so the detection must not race.
+#ifdef SN_USE_PTHREAD
+static pthread_once_t gemm_isa_once_ = PTHREAD_ONCE_INIT;
+#else
+static bool gemm_isa_detected_ = false;
+#endif // SN_USE_PTHREAD
+
+static void gemm_isa_detect_once_(void) {
+#ifdef SN_USE_PTHREAD
+    pthread_once(&gemm_isa_once_, &gemm_isa_detect_);
+#else
+    if (!gemm_isa_detected_) {
+        gemm_isa_detect_();
+        gemm_isa_detected_ = true;
+    }
+#endif // SN_USE_PTHREAD
+}
+
+sn_gemm_isa sn_gemm_get_isa(void) {
+    gemm_isa_detect_once_();
+    return gemm_isa_;
+}
+
+bool sn_gemm_set_isa(sn_gemm_isa isa) {
+    if (!gemm_supports_(isa)) {
+        return false;
+    }
+    // Detects first, so that a later detection never overwrites the selection.
+    gemm_isa_detect_once_();
+    gemm_isa_ = isa;
+    return true;
+}
+
+const char* sn_gemm_isa_name(sn_gemm_isa isa) {
+    static const char* names[] = { "scalar", "sse2", "avx2", "avx512" };
+    return names[isa];
+}
+
+
+/* Packing */
+
+static void gemm_pack_a_(SN_UINT mc, SN_UINT kc, const SN_FLOAT* a, SN_UINT row_step, SN_UINT column_step, SN_UINT mr, SN_FLOAT* a_pack) {
+    for (SN_UINT ir = 0; ir < mc; ir += mr) {
+        SN_UINT rows = (mc - ir < mr) ? mc - ir : mr;
+        for (SN_UINT p = 0; p < kc; ++p) {
+            const SN_FLOAT* column = &(a[ir * row_step + p * column_step]);
+            for (SN_UINT i = 0; i < rows; ++i) {
+                a_pack[i] = column[i * row_step];
+            }
+            for (SN_UINT i = rows; i < mr; ++i) {
+                a_pack[i] = 0.0;
+            }
+            a_pack += mr;
+        }
+    }
+}
+
+static void gemm_pack_b_(SN_UINT kc, SN_UINT nc, const SN_FLOAT* b, SN_UINT row_step, SN_UINT column_step, SN_UINT nr, SN_FLOAT* b_pack) {
+    for (SN_UINT jr = 0; jr < nc; jr += nr) {
+        SN_UINT columns = (nc - jr < nr) ? nc - jr : nr;
+        for (SN_UINT p = 0; p < kc; ++p) {
+            const SN_FLOAT* row = &(b[p * row_step + jr * column_step]);
+            for (SN_UINT j = 0; j < columns; ++j) {
+                b_pack[j] = row[j * column_step];
+            }
+            for (SN_UINT j = columns; j < nr; ++j) {
+                b_pack[j] = 0.0;
+            }
+            b_pack += nr;
+        }
+    }
+}
+
+
+/* sn_gemm */
+
+// The packed panels of a thread are kept and only grow, so that repeated products such as those of a sn_plan never allocate.
+// They are allocated with malloc(), so that they are neither counted nor taken from an arena which is reset between evaluations.
+typedef struct gemm_pack_st_ {
+    SN_UINT capacity; //!< Number of elements of data.
+    SN_FLOAT data[];
+} gemm_pack_;
+
+#ifdef SN_USE_PTHREAD
+// A key rather than SN_THREAD_LOCAL, so that the panels are freed when their thread exits.
+static pthread_key_t gemm_pack_key_;
+static bool gemm_pack_key_created_ = false;
+static pthread_once_t gemm_pack_once_ = PTHREAD_ONCE_INIT;
+
+static void gemm_pack_key_create_(void) {
+    gemm_pack_key_created_ = (pthread_key_create(&gemm_pack_key_, &free) == 0);
+}
+
+static gemm_pack_* gemm_pack_get_(void) {
+    pthread_once(&gemm_pack_once_, &gemm_pack_key_create_);
+    return gemm_pack_key_created_ ? (gemm_pack_*)pthread_getspecific(gemm_pack_key_) : NULL;
+}
+
+static bool gemm_pack_set_(gemm_pack_* pack) {
+    return gemm_pack_key_created_ && pthread_setspecific(gemm_pack_key_, pack) == 0;
+}
+#else
+static gemm_pack_* gemm_pack_instance_ = NULL;
+
+static gemm_pack_* gemm_pack_get_(void) {
+    return gemm_pack_instance_;
+}
+
+static bool gemm_pack_set_(gemm_pack_* pack) {
+    gemm_pack_instance_ = pack;
+    return true;
+}
+#endif // SN_USE_PTHREAD
+
+/* Returns the panels of the calling thread grown to at least size elements, or NULL if they cannot be allocated. */
+static SN_FLOAT* gemm_pack_acquire_(SN_UINT size) {
+    gemm_pack_* pack = gemm_pack_get_();
+    if (pack == NULL || pack->capacity < size) {
+        gemm_pack_* grown = (gemm_pack_*)realloc(pack, sizeof(gemm_pack_) + size * sizeof(SN_FLOAT));
+        if (grown == NULL) {
+            return NULL;
+        }
+        grown->capacity = size;
+        if (!gemm_pack_set_(grown)) { // Only if the key could not be created, so nothing else refers to the panels.
+            free(grown);
+            return NULL;
+        }
+        pack = grown;
+    }
+    return pack->data;
+}
+
+void sn_gemm_release(void) {
+    gemm_pack_* pack = gemm_pack_get_();
+    if (pack != NULL) {
+        gemm_pack_set_(NULL);
+        free(pack);
+    }
+}
+
+/* Multiplies without packing, for thin products and in case the panels cannot be allocated. */
+static void gemm_unpacked_(SN_UINT m, SN_UINT n, SN_UINT k,
+    const SN_FLOAT* a, SN_UINT a_row_step, SN_UINT a_column_step,
+    const SN_FLOAT* b, SN_UINT b_row_step, SN_UINT b_column_step,
+    SN_FLOAT* c, SN_UINT ldc) {
+    for (SN_UINT j = 0; j < n; ++j) {
+        for (SN_UINT p = 0; p < k; ++p) {
+            SN_FLOAT b_pj = b[p * b_row_step + j * b_column_step];
+            for (SN_UINT i = 0; i < m; ++i) {
+                c[i + j * ldc] += a[i * a_row_step + p * a_column_step] * b_pj;
+            }
+        }
+    }
+}
+
+/* Multiplies with the blocked algorithm on the calling thread. */
+static void gemm_blocked_(gemm_kernel_ kernel, SN_UINT m, SN_UINT n, SN_UINT k,
+    const SN_FLOAT* a, SN_UINT a_row_step, SN_UINT a_column_step,
+    const SN_FLOAT* b, SN_UINT b_row_step, SN_UINT b_column_step,
+    SN_FLOAT* c, SN_UINT ldc) {
+    SN_UINT mc_max = (SN_GEMM_MC / kernel.mr > 0) ? (SN_GEMM_MC / kernel.mr) * kernel.mr : kernel.mr;
+    SN_UINT kc_max = SN_GEMM_KC;
+    SN_UINT nc_max = (SN_GEMM_NC / kernel.nr > 0) ? (SN_GEMM_NC / kernel.nr) * kernel.nr : kernel.nr;
+    if (mc_max > m) {
+        mc_max = (m + kernel.mr - 1) / kernel.mr * kernel.mr;
+    }
+    if (kc_max > k) {
+        kc_max = k;
+    }
+    if (nc_max > n) {
+        nc_max = (n + kernel.nr - 1) / kernel.nr * kernel.nr;
+    }
+    SN_FLOAT* a_pack = gemm_pack_acquire_(mc_max * kc_max + kc_max * nc_max);
+    if (a_pack == NULL) {
+        gemm_unpacked_(m, n, k, a, a_row_step, a_column_step, b, b_row_step, b_column_step, c, ldc);
+        return;
+    }
+    SN_FLOAT* b_pack = &(a_pack[mc_max * kc_max]);
+    SN_FLOAT tile[GEMM_TILE_CAPACITY_];
+    SN_ASSERT(kernel.mr * kernel.nr <= GEMM_TILE_CAPACITY_);
+
+    for (SN_UINT jc = 0; jc < n; jc += nc_max) {
+        SN_UINT nc = (n - jc < nc_max) ? n - jc : nc_max;
+        for (SN_UINT pc = 0; pc < k; pc += kc_max) {
+            SN_UINT kc = (k - pc < kc_max) ? k - pc : kc_max;
+            gemm_pack_b_(kc, nc, &(b[pc * b_row_step + jc * b_column_step]), b_row_step, b_column_step, kernel.nr, b_pack);
+            for (SN_UINT ic = 0; ic < m; ic += mc_max) {
+                SN_UINT mc = (m - ic < mc_max) ? m - ic : mc_max;
+                gemm_pack_a_(mc, kc, &(a[ic * a_row_step + pc * a_column_step]), a_row_step, a_column_step, kernel.mr, a_pack);
+                for (SN_UINT jr = 0; jr < nc; jr += kernel.nr) {
+                    SN_UINT columns = (nc - jr < kernel.nr) ? nc - jr : kernel.nr;
+                    const SN_FLOAT* b_panel = &(b_pack[jr * kc]);
+                    for (SN_UINT ir = 0; ir < mc; ir += kernel.mr) {
+                        SN_UINT rows = (mc - ir < kernel.mr) ? mc - ir : kernel.mr;
+                        const SN_FLOAT* a_panel = &(a_pack[ir * kc]);
+                        SN_FLOAT* c_tile = &(c[(ic + ir) + (jc + jr) * ldc]);
+                        if (rows == kernel.mr && columns == kernel.nr) {
+                            kernel.kernel(kc, a_panel, b_panel, c_tile, ldc);
+                        }
+                        else { // Edge tiles go through a full-sized scratch tile.
+                            for (SN_UINT i = 0; i < kernel.mr * kernel.nr; ++i) {
+                                tile[i] = 0.0;
+                            }
+                            kernel.kernel(kc, a_panel, b_panel, tile, kernel.mr);
+                            for (SN_UINT j = 0; j < columns; ++j) {
+                                for (SN_UINT i = 0; i < rows; ++i) {
+                                    c_tile[i + j * ldc] += tile[i + j * kernel.mr];
+                                }
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+typedef struct gemm_context_st_ {
+    gemm_kernel_ kernel;
+    SN_UINT m;
+    SN_UINT k;
+    const SN_FLOAT* a;
+    SN_UINT a_row_step;
+    SN_UINT a_column_step;
+    const SN_FLOAT* b;
+    SN_UINT b_row_step;
+    SN_UINT b_column_step;
+    SN_FLOAT* c;
+    SN_UINT ldc;
+} gemm_context_;
+
+/* Multiplies the columns in [ begin, end ) of B and C. Every element of C is calculated in the same order wherever the range splits. */
+static void gemm_range_(void* context, SN_UINT begin, SN_UINT end) {
+    gemm_context_* gemm = (gemm_context_*)context;
+    gemm_blocked_(gemm->kernel, gemm->m, end - begin, gemm->k,
+        gemm->a, gemm->a_row_step, gemm->a_column_step,
+        &(gemm->b[begin * gemm->b_column_step]), gemm->b_row_step, gemm->b_column_step,
+        &(gemm->c[begin * gemm->ldc]), gemm->ldc);
+}
+
+
+void sn_gemm(SN_UINT m, SN_UINT n, SN_UINT k,
+    const SN_FLOAT* a, SN_UINT a_row_step, SN_UINT a_column_step,
+    const SN_FLOAT* b, SN_UINT b_row_step, SN_UINT b_column_step,
+    SN_FLOAT* c, SN_UINT ldc, bool accumulate) {
+    if (!accumulate) {
+        for (SN_UINT j = 0; j < n; ++j) {
+            for (SN_UINT i = 0; i < m; ++i) {
+                c[i + j * ldc] = 0.0;
+            }
+        }
+    }
+    if (m == 0 || n == 0 || k == 0) {
+        return;
+    }
+
+    gemm_kernel_ kernel = gemm_kernels_[sn_gemm_get_isa()];
+    if (m < kernel.mr || n < kernel.nr) { // Packing does not pay off for thin products such as a matrix-vector one.
+        gemm_unpacked_(m, n, k, a, a_row_step, a_column_step, b, b_row_step, b_column_step, c, ldc);
+        return;
+    }
+
+    gemm_context_ context = { kernel, m, k, a, a_row_step, a_column_step, b, b_row_step, b_column_step, c, ldc };
+    SN_UINT grain = sn_thread_get_threshold() / (m * k); // Each range has at least the threshold of multiply-adds.
+    if (grain < kernel.nr) {
+        grain = kernel.nr;
+    }
+    sn_thread_parallel_for(n, grain, &gemm_range_, &context);
+}
@@ -0,0 +1,141 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_graph.c
+//! \brief This file implements sinae_graph.h.
+
+#include "../sinae_graph.h"
+
+
+/* struct sn_graph_st */
+
+static void graph_rehash_(sn_graph* self, SN_UINT table_capacity) {
+    SN_FREE(self->table);
+    self->table_capacity = table_capacity;
+    self->table = SN_DYNAMIC_ARRAY(SN_UINT, table_capacity);
+    for (SN_UINT i = 0; i < table_capacity; ++i) {
+        self->table[i] = 0;
+    }
+    for (SN_UINT i = 0; i < self->count; ++i) {
+        SN_UINT slot = SN_PTR_HASH(self->ops[i]) & (table_capacity - 1);
+        while (self->table[slot] != 0) {
+            slot = (slot + 1) & (table_capacity - 1);
+        }
+        self->table[slot] = i + 1;
+    }
+}
+
+static void graph_append_(sn_graph* self, sn_op* op, SN_UINT* ops_capacity) {
+    if (self->count == *ops_capacity) {
+        sn_op** new_ops = SN_DYNAMIC_ARRAY(sn_op*, 2 * *ops_capacity);
+        for (SN_UINT i = 0; i < self->count; ++i) {
+            new_ops[i] = self->ops[i];
+        }
+        SN_FREE(self->ops);
+        self->ops = new_ops;
+        *ops_capacity *= 2;
+    }
+    self->ops[self->count] = op;
+    ++(self->count);
+    if (2 * self->count > self->table_capacity) {
+        graph_rehash_(self, 2 * self->table_capacity);
+    }
+    else {
+        SN_UINT slot = SN_PTR_HASH(op) & (self->table_capacity - 1);
+        while (self->table[slot] != 0) {
+            slot = (slot + 1) & (self->table_capacity - 1);
+        }
+        self->table[slot] = self->count;
+    }
+}
+
+// Nodes are visited depth-first with an explicit stack, so that the depth of a graph is limited by memory and not by
+// the native stack. Each entry holds a node and the index of its next input, and the node is appended once every
+// input is, which gives the same order as visiting the inputs recursively.
+typedef struct graph_frame_st_ {
+    sn_op* op;
+    SN_UINT next;
+} graph_frame_;
+
+static void graph_visit_(sn_graph* self, sn_op* root, SN_UINT* ops_capacity) {
+    SN_UINT stack_capacity = 64;
+    SN_UINT stack_count = 1;
+    graph_frame_* stack = SN_DYNAMIC_ARRAY(graph_frame_, stack_capacity);
+    stack[0].op = root;
+    stack[0].next = 0;
+    while (stack_count > 0) {
+        graph_frame_* frame = &(stack[stack_count - 1]);
+        if (frame->next == frame->op->x_count) {
+            graph_append_(self, frame->op, ops_capacity);
+            --stack_count;
+            continue;
+        }
+        sn_op* x = frame->op->x[(frame->next)++];
+        if (sn_graph_find(self, x) != self->count) {
+            continue;
+        }
+        if (stack_count == stack_capacity) {
+            graph_frame_* new_stack = SN_DYNAMIC_ARRAY(graph_frame_, 2 * stack_capacity);
+            for (SN_UINT i = 0; i < stack_count; ++i) {
+                new_stack[i] = stack[i];
+            }
+            SN_FREE(stack);
+            stack = new_stack;
+            stack_capacity *= 2;
+        }
+        stack[stack_count].op = x;
+        stack[stack_count].next = 0;
+        ++stack_count;
+    }
+    SN_FREE(stack);
+}
+
+sn_graph* sn_graph_create(sn_op* root) {
+    sn_graph* obj = (sn_graph*)SN_MALLOC(sizeof(sn_graph));
+    SN_UINT ops_capacity = 16;
+    obj->count = 0;
+    obj->ops = SN_DYNAMIC_ARRAY(sn_op*, ops_capacity);
+    obj->table = NULL;
+    graph_rehash_(obj, 32);
+
+    graph_visit_(obj, root, &ops_capacity);
+
+    SN_UINT x_index_count = 0;
+    obj->x_offset = SN_DYNAMIC_ARRAY(SN_UINT, obj->count + 1);
+    for (SN_UINT i = 0; i < obj->count; ++i) {
+        obj->x_offset[i] = x_index_count;
+        x_index_count += obj->ops[i]->x_count;
+    }
+    obj->x_offset[obj->count] = x_index_count;
+    obj->x_index = SN_DYNAMIC_ARRAY(SN_UINT, x_index_count);
+    for (SN_UINT i = 0; i < obj->count; ++i) {
+        SN_UINT* x_index = sn_graph_x_index(obj, i);
+        for (SN_UINT j = 0; j < obj->ops[i]->x_count; ++j) {
+            x_index[j] = sn_graph_find(obj, obj->ops[i]->x[j]);
+        }
+    }
+    return obj;
+}
+
+void sn_graph_destroy(sn_graph* self) {
+    SN_FREE(self->ops);
+    SN_FREE(self->x_offset);
+    SN_FREE(self->x_index);
+    SN_FREE(self->table);
+    SN_FREE(self);
+}
+
+SN_UINT sn_graph_find(const sn_graph* self, const sn_op* op) {
+    SN_UINT slot = SN_PTR_HASH(op) & (self->table_capacity - 1);
+    while (self->table[slot] != 0) {
+        if (self->ops[self->table[slot] - 1] == op) {
+            return self->table[slot] - 1;
+        }
+        slot = (slot + 1) & (self->table_capacity - 1);
+    }
+    return self->count;
+}
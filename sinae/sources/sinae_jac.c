@@ -0,0 +1,422 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_jac.c
+//! \brief This file implements sinae_jac.h.
+
+#include "../sinae_jac.h"
+#include "../sinae_view.h"
+
+
+/* struct sn_jac_st */
+
+static SN_UINT sizeof_shape_(SN_UINT rank, const SN_UINT shape[]) {
+    SN_UINT size = 1;
+    for (SN_UINT i = 0; i < rank; ++i) {
+        size *= shape[i];
+    }
+    return size;
+}
+
+static sn_jac* jac_create_(sn_jac_kind kind, SN_UINT y_rank, const SN_UINT y_shape[], SN_UINT x_rank, const SN_UINT x_shape[]) {
+    sn_jac* obj = (sn_jac*)SN_MALLOC(sizeof(sn_jac) + (y_rank + x_rank) * sizeof(SN_UINT));
+    obj->kind = kind;
+    obj->y_rank = y_rank;
+    obj->x_rank = x_rank;
+    obj->shape = (SN_UINT*)&(obj[1]);
+    for (SN_UINT i = 0; i < y_rank; ++i) {
+        obj->shape[i] = y_shape[i];
+    }
+    for (SN_UINT i = 0; i < x_rank; ++i) {
+        obj->shape[y_rank + i] = x_shape[i];
+    }
+    obj->scalar = 0.0;
+    obj->values = NULL;
+    return obj;
+}
+
+/* Creates a dense Jacobian of dy/dm * dm/dx with uninitialized values. */
+static sn_jac* jac_dense_create_(const sn_jac* dy_dm, const sn_jac* dm_dx) {
+    SN_UINT y_rank = dy_dm->y_rank;
+    SN_UINT x_rank = dm_dx->x_rank;
+    sn_jac* obj = jac_create_(DENSE, y_rank, dy_dm->shape, x_rank, &(dm_dx->shape[dm_dx->y_rank]));
+    obj->values = sn_mda_create(y_rank + x_rank, obj->shape);
+    return obj;
+}
+
+sn_jac* sn_jac_identity(SN_UINT rank, const SN_UINT shape[]) {
+    return jac_create_(IDENTITY, rank, shape, rank, shape);
+}
+
+sn_jac* sn_jac_diagonal(sn_mda* diagonal) {
+    sn_jac* obj = jac_create_(DIAGONAL, diagonal->rank, diagonal->shape, diagonal->rank, diagonal->shape);
+    obj->values = diagonal;
+    return obj;
+}
+
+sn_jac* sn_jac_broadcast(SN_UINT y_rank, const SN_UINT y_shape[], SN_UINT x_rank, const SN_UINT x_shape[], SN_FLOAT value) {
+    sn_jac* obj = jac_create_(BROADCAST, y_rank, y_shape, x_rank, x_shape);
+    obj->scalar = value;
+    return obj;
+}
+
+sn_jac* sn_jac_dense(SN_UINT y_rank, sn_mda* dense) {
+    SN_ASSERT(y_rank <= dense->rank);
+    sn_jac* obj = jac_create_(DENSE, y_rank, dense->shape, dense->rank - y_rank, &(dense->shape[y_rank]));
+    obj->values = dense;
+    return obj;
+}
+
+sn_jac* sn_jac_expand(sn_mda* derivatives, SN_UINT x_rank, const SN_UINT x_shape[]) {
+    bool is_same_shape = (derivatives->rank == x_rank);
+    for (SN_UINT i = 0; i < x_rank && is_same_shape; ++i) {
+        is_same_shape = (derivatives->shape[i] == x_shape[i]);
+    }
+    if (is_same_shape) {
+        return sn_jac_diagonal(derivatives);
+    }
+    sn_jac* obj = jac_create_(EXPANDED, derivatives->rank, derivatives->shape, x_rank, x_shape);
+    obj->values = derivatives;
+    return obj;
+}
+
+/* Products of EXPANDED Jacobians */
+
+// The element i of y is read from the element j of x broadcasted to y, so the row i has its only non-zero element,
+// values[i], at the column j. The pairs (i, j) are visited by a loop over the values and x broadcasted to y,
+// where x is passed as a header of sn_mda without data, since the loop reads only its rank and shape.
+
+typedef enum jac_expanded_mode_en_ {
+    JAC_EXPANDED_VJP_,   //!< out[j] += in[i] * values[i], which sums over the broadcasted axes.
+    JAC_EXPANDED_JVP_,   //!< out[i] += values[i] * in[j].
+    JAC_EXPANDED_DENSE_, //!< out[i + j * y_size] = values[i].
+} jac_expanded_mode_;
+
+typedef struct jac_expanded_context_st_ {
+    jac_expanded_mode_ mode;
+    const SN_FLOAT* values;
+    const SN_FLOAT* in;
+    SN_UINT in_step;  //!< Step of \p in between consecutive elements, which is 0 to read a single value.
+    SN_FLOAT* out;
+    SN_UINT out_step; //!< Step of \p out between consecutive elements.
+    SN_UINT y_size;
+} jac_expanded_context_;
+
+static void jac_expanded_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    jac_expanded_context_* c = (jac_expanded_context_*)context;
+    (void)position;
+    switch (c->mode) {
+    case JAC_EXPANDED_VJP_:
+        for (SN_UINT i = 0; i < n; ++i) {
+            SN_UINT y = offset[0] + i * step[0];
+            c->out[(offset[1] + i * step[1]) * c->out_step] += c->in[y * c->in_step] * c->values[y];
+        }
+        break;
+    case JAC_EXPANDED_JVP_:
+        for (SN_UINT i = 0; i < n; ++i) {
+            SN_UINT y = offset[0] + i * step[0];
+            c->out[y * c->out_step] += c->values[y] * c->in[(offset[1] + i * step[1]) * c->in_step];
+        }
+        break;
+    case JAC_EXPANDED_DENSE_:
+        for (SN_UINT i = 0; i < n; ++i) {
+            SN_UINT y = offset[0] + i * step[0];
+            SN_MATRIX_GET(c->out, c->y_size, y, offset[1] + i * step[1]) = c->values[y];
+        }
+        break;
+    }
+}
+
+/* Applies the EXPANDED Jacobian self to in, whose elements are in_step apart, into out, whose elements are out_step apart. */
+static void jac_expanded_product_(const sn_jac* self, jac_expanded_mode_ mode, const SN_FLOAT in[], SN_UINT in_step,
+                                  SN_FLOAT out[], SN_UINT out_step) {
+    sn_mda x_like = { self->x_rank, &(self->shape[self->y_rank]) };
+    const sn_mda* x[] = { self->values, &x_like };
+    jac_expanded_context_ context = { mode, self->values->ptr, in, in_step, out, out_step, sn_jac_y_size(self) };
+    sn_view_loop_storage storage;
+    sn_view_loop* loop = sn_view_loop_broadcast_in(&storage, 2, x, self->y_rank, self->shape);
+    if (!loop) {
+        loop = sn_view_loop_broadcast(2, x, self->y_rank, self->shape);
+    }
+    sn_view_loop_run(loop, 0, context.y_size, &jac_expanded_run_, &context);
+    if (loop != &(storage.loop)) {
+        sn_view_loop_destroy(loop);
+    }
+}
+
+/* Returns dy/dx = dy/dm * dm/dx where either is EXPANDED and neither is IDENTITY, keeping the structure if possible. */
+static sn_jac* jac_expanded_compose_(const sn_jac* dy_dm, const sn_jac* dm_dx) {
+    SN_UINT y_size = sn_jac_y_size(dy_dm);
+    SN_UINT m_size = sn_jac_x_size(dy_dm);
+    SN_UINT x_size = sn_jac_x_size(dm_dx);
+    sn_jac* obj = NULL;
+    if (dy_dm->kind == EXPANDED && (dm_dx->kind == DIAGONAL || dm_dx->kind == EXPANDED)) {
+        // values[i] times the diagonal of dm/dx at the element m[j] read by y[i]. Broadcasting x to m and m to y
+        // broadcasts x to y, so the result reads x like dy/dm reads m.
+        obj = jac_create_(EXPANDED, dy_dm->y_rank, dy_dm->shape, dm_dx->x_rank, &(dm_dx->shape[dm_dx->y_rank]));
+        obj->values = sn_mda_full(dy_dm->y_rank, dy_dm->shape, 0.0);
+        jac_expanded_product_(dy_dm, JAC_EXPANDED_JVP_, dm_dx->values->ptr, 1, obj->values->ptr, 1);
+    }
+    else if (dy_dm->kind == EXPANDED) { // Every column j of dm/dx is gathered and scaled.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT i = 0; i < y_size * x_size; ++i) {
+            obj->values->ptr[i] = 0.0;
+        }
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            const SN_FLOAT* column = (dm_dx->kind == BROADCAST) ? &(dm_dx->scalar) : &(dm_dx->values->ptr[j * m_size]);
+            jac_expanded_product_(dy_dm, JAC_EXPANDED_JVP_, column, (dm_dx->kind == BROADCAST) ? 0 : 1,
+                                  &(obj->values->ptr[j * y_size]), 1);
+        }
+    }
+    else if (dy_dm->kind == DIAGONAL) {
+        obj = jac_create_(EXPANDED, dy_dm->y_rank, dy_dm->shape, dm_dx->x_rank, &(dm_dx->shape[dm_dx->y_rank]));
+        obj->values = sn_mda_copy(dm_dx->values);
+        for (SN_UINT i = 0; i < m_size; ++i) {
+            obj->values->ptr[i] *= dy_dm->values->ptr[i];
+        }
+    }
+    else { // Every row i of dy/dm is summed over the broadcasted axes.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT i = 0; i < y_size * x_size; ++i) {
+            obj->values->ptr[i] = 0.0;
+        }
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            const SN_FLOAT* row = (dy_dm->kind == BROADCAST) ? &(dy_dm->scalar) : &(dy_dm->values->ptr[i]);
+            jac_expanded_product_(dm_dx, JAC_EXPANDED_VJP_, row, (dy_dm->kind == BROADCAST) ? 0 : y_size,
+                                  &(obj->values->ptr[i]), y_size);
+        }
+    }
+    return obj;
+}
+
+void sn_jac_destroy(sn_jac* self) {
+    if (self->values) {
+        sn_mda_destroy(self->values);
+    }
+    SN_FREE(self);
+}
+
+SN_UINT sn_jac_y_size(const sn_jac* self) {
+    return sizeof_shape_(self->y_rank, self->shape);
+}
+
+SN_UINT sn_jac_x_size(const sn_jac* self) {
+    return sizeof_shape_(self->x_rank, &(self->shape[self->y_rank]));
+}
+
+sn_mda* sn_jac_to_mda(const sn_jac* self) {
+    if (self->kind == DENSE) {
+        return sn_mda_copy(self->values);
+    }
+    SN_UINT y_size = sn_jac_y_size(self);
+    SN_UINT x_size = sn_jac_x_size(self);
+    sn_mda* obj = sn_mda_full(self->y_rank + self->x_rank, self->shape, (self->kind == BROADCAST) ? self->scalar : 0.0);
+    if (self->kind == EXPANDED) {
+        jac_expanded_product_(self, JAC_EXPANDED_DENSE_, NULL, 0, obj->ptr, 1);
+    }
+    else if (self->kind == IDENTITY) {
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            SN_MATRIX_GET(obj->ptr, y_size, i, i) = 1.0;
+        }
+    }
+    else if (self->kind == DIAGONAL) {
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            SN_MATRIX_GET(obj->ptr, y_size, i, i) = self->values->ptr[i];
+        }
+    }
+    return obj;
+}
+
+sn_jac* sn_jac_compose(const sn_jac* dy_dm, const sn_jac* dm_dx) {
+    SN_UINT y_size = sn_jac_y_size(dy_dm);
+    SN_UINT m_size = sn_jac_x_size(dy_dm);
+    SN_UINT x_size = sn_jac_x_size(dm_dx);
+    SN_ASSERT(m_size == sn_jac_y_size(dm_dx));
+
+    sn_jac* obj = NULL;
+    if (dy_dm->kind == IDENTITY || dm_dx->kind == IDENTITY) {
+        const sn_jac* other = (dy_dm->kind == IDENTITY) ? dm_dx : dy_dm;
+        obj = jac_create_(other->kind, dy_dm->y_rank, dy_dm->shape, dm_dx->x_rank, &(dm_dx->shape[dm_dx->y_rank]));
+        obj->scalar = other->scalar;
+        obj->values = other->values ? sn_mda_copy(other->values) : NULL;
+    }
+    else if (dy_dm->kind == EXPANDED || dm_dx->kind == EXPANDED) {
+        obj = jac_expanded_compose_(dy_dm, dm_dx);
+    }
+    else if (dy_dm->kind == DIAGONAL && dm_dx->kind == DIAGONAL) {
+        sn_mda* diagonal = sn_mda_copy(dm_dx->values);
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            diagonal->ptr[i] *= dy_dm->values->ptr[i];
+        }
+        obj = sn_jac_diagonal(diagonal);
+    }
+    else if (dy_dm->kind == BROADCAST && dm_dx->kind == BROADCAST) {
+        obj = jac_create_(BROADCAST, dy_dm->y_rank, dy_dm->shape, dm_dx->x_rank, &(dm_dx->shape[dm_dx->y_rank]));
+        obj->scalar = dy_dm->scalar * dm_dx->scalar * (SN_FLOAT)m_size;
+    }
+    else if (dy_dm->kind == DENSE && dm_dx->kind == DENSE) {
+        obj = sn_jac_dense(dy_dm->y_rank, sn_mda_gmatmul(dy_dm->values, dm_dx->values, dy_dm->x_rank));
+    }
+    else if (dy_dm->kind == DIAGONAL) { // Scales the rows of dm/dx.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                SN_FLOAT dm_dx_ij = (dm_dx->kind == BROADCAST) ? dm_dx->scalar : SN_MATRIX_GET(dm_dx->values->ptr, m_size, i, j);
+                SN_MATRIX_GET(obj->values->ptr, y_size, i, j) = dy_dm->values->ptr[i] * dm_dx_ij;
+            }
+        }
+    }
+    else if (dm_dx->kind == DIAGONAL) { // Scales the columns of dy/dm.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                SN_FLOAT dy_dm_ij = (dy_dm->kind == BROADCAST) ? dy_dm->scalar : SN_MATRIX_GET(dy_dm->values->ptr, y_size, i, j);
+                SN_MATRIX_GET(obj->values->ptr, y_size, i, j) = dy_dm_ij * dm_dx->values->ptr[j];
+            }
+        }
+    }
+    else if (dy_dm->kind == BROADCAST) { // Every row is the column sum of dm/dx.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            SN_FLOAT temp_sum = 0.0;
+            for (SN_UINT k = 0; k < m_size; ++k) {
+                temp_sum += SN_MATRIX_GET(dm_dx->values->ptr, m_size, k, j);
+            }
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                SN_MATRIX_GET(obj->values->ptr, y_size, i, j) = dy_dm->scalar * temp_sum;
+            }
+        }
+    }
+    else { // Every column is the row sum of dy/dm.
+        obj = jac_dense_create_(dy_dm, dm_dx);
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            obj->values->ptr[i] = 0.0;
+        }
+        for (SN_UINT k = 0; k < m_size; ++k) {
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                obj->values->ptr[i] += SN_MATRIX_GET(dy_dm->values->ptr, y_size, i, k);
+            }
+        }
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            obj->values->ptr[i] *= dm_dx->scalar;
+        }
+        for (SN_UINT j = 1; j < x_size; ++j) {
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                SN_MATRIX_GET(obj->values->ptr, y_size, i, j) = obj->values->ptr[i];
+            }
+        }
+    }
+    return obj;
+}
+
+sn_jac* sn_jac_add(const sn_jac* x0, const sn_jac* x1) {
+    SN_ASSERT(sn_jac_y_size(x0) == sn_jac_y_size(x1) && sn_jac_x_size(x0) == sn_jac_x_size(x1));
+    SN_UINT y_size = sn_jac_y_size(x0);
+    SN_UINT x_size = sn_jac_x_size(x0);
+
+    sn_jac* obj = NULL;
+    if ((x0->kind == IDENTITY || x0->kind == DIAGONAL) && (x1->kind == IDENTITY || x1->kind == DIAGONAL)) {
+        sn_mda* diagonal = sn_mda_create(x0->x_rank, &(x0->shape[x0->y_rank]));
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            diagonal->ptr[i] = ((x0->kind == IDENTITY) ? 1.0 : x0->values->ptr[i]) + ((x1->kind == IDENTITY) ? 1.0 : x1->values->ptr[i]);
+        }
+        obj = sn_jac_diagonal(diagonal);
+    }
+    else if (x0->kind == BROADCAST && x1->kind == BROADCAST) {
+        obj = jac_create_(BROADCAST, x0->y_rank, x0->shape, x0->x_rank, &(x0->shape[x0->y_rank]));
+        obj->scalar = x0->scalar + x1->scalar;
+    }
+    else if (x0->kind == EXPANDED && x1->kind == EXPANDED) { // Both read x the same way, since y and x are in the same shapes.
+        obj = jac_create_(EXPANDED, x0->y_rank, x0->shape, x0->x_rank, &(x0->shape[x0->y_rank]));
+        obj->values = sn_mda_copy(x0->values);
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            obj->values->ptr[i] += x1->values->ptr[i];
+        }
+    }
+    else {
+        obj = sn_jac_dense(x0->y_rank, sn_jac_to_mda(x0));
+        sn_mda* dense = (x1->kind == DENSE) ? x1->values : sn_jac_to_mda(x1);
+        SN_UINT size = y_size * x_size;
+        for (SN_UINT i = 0; i < size; ++i) {
+            obj->values->ptr[i] += dense->ptr[i];
+        }
+        if (dense != x1->values) {
+            sn_mda_destroy(dense);
+        }
+    }
+    return obj;
+}
+
+void sn_jac_vjp(const sn_jac* self, const SN_FLOAT dy[], SN_FLOAT dx[]) {
+    SN_UINT y_size = sn_jac_y_size(self);
+    SN_UINT x_size = sn_jac_x_size(self);
+    if (self->kind == IDENTITY) {
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            dx[i] += dy[i];
+        }
+    }
+    else if (self->kind == DIAGONAL) {
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            dx[i] += dy[i] * self->values->ptr[i];
+        }
+    }
+    else if (self->kind == EXPANDED) {
+        jac_expanded_product_(self, JAC_EXPANDED_VJP_, dy, 1, dx, 1);
+    }
+    else if (self->kind == BROADCAST) {
+        SN_FLOAT temp_sum = 0.0;
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            temp_sum += dy[i];
+        }
+        for (SN_UINT i = 0; i < x_size; ++i) {
+            dx[i] += self->scalar * temp_sum;
+        }
+    }
+    else {
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            SN_FLOAT temp_sum = 0.0;
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                temp_sum += dy[i] * SN_MATRIX_GET(self->values->ptr, y_size, i, j);
+            }
+            dx[j] += temp_sum;
+        }
+    }
+}
+
+void sn_jac_jvp(const sn_jac* self, const SN_FLOAT dx[], SN_FLOAT dy[]) {
+    SN_UINT y_size = sn_jac_y_size(self);
+    SN_UINT x_size = sn_jac_x_size(self);
+    if (self->kind == IDENTITY) {
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            dy[i] += dx[i];
+        }
+    }
+    else if (self->kind == DIAGONAL) {
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            dy[i] += dx[i] * self->values->ptr[i];
+        }
+    }
+    else if (self->kind == EXPANDED) {
+        jac_expanded_product_(self, JAC_EXPANDED_JVP_, dx, 1, dy, 1);
+    }
+    else if (self->kind == BROADCAST) {
+        SN_FLOAT temp_sum = 0.0;
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            temp_sum += dx[j];
+        }
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            dy[i] += self->scalar * temp_sum;
+        }
+    }
+    else {
+        for (SN_UINT j = 0; j < x_size; ++j) {
+            for (SN_UINT i = 0; i < y_size; ++i) {
+                dy[i] += SN_MATRIX_GET(self->values->ptr, y_size, i, j) * dx[j];
+            }
+        }
+    }
+}
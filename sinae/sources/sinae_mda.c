@@ -8,9 +8,22 @@
 //! \file  sinae_mda.c
 //! \brief This file implements sinae_mda.h.
 
+#ifdef SN_USE_MMAP
+    #define _POSIX_C_SOURCE 200112L
+    #include <sys/mman.h>
+#endif
+
 #include "../sinae_mda.h"
+#include "../sinae_gemm.h"
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SN_USE_PTHREAD
+    #include <pthread.h>
+#endif
 
 
 /* struct sn_list_st */
@@ -72,7 +85,120 @@ sn_mda* sn_mda_copy(const sn_mda* self) {
     return obj;
 }
 
+/* Mapping */
+
+// Mappings of sn_mda_map() are recorded by the address of their sn_mda, sorted, with the length to unmap,
+// so sn_mda_is_mapped() never reads memory around an object it did not map.
+// The table is kept with malloc() like the registry of kinds of sinae_file.c.
+
+#ifdef SN_USE_MMAP
+
+typedef struct mda_mapping_st_ {
+    const sn_mda* obj;
+    void* base;
+    size_t length;
+} mda_mapping_;
+
+static mda_mapping_* mda_mappings_ = NULL;
+static SN_UINT mda_mapping_count_ = 0;
+static SN_UINT mda_mapping_capacity_ = 0;
+
+    #ifdef SN_USE_PTHREAD
+static pthread_mutex_t mda_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+        #define MDA_LOCK_() pthread_mutex_lock(&mda_mutex_)
+        #define MDA_UNLOCK_() pthread_mutex_unlock(&mda_mutex_)
+    #else
+        #define MDA_LOCK_()
+        #define MDA_UNLOCK_()
+    #endif // SN_USE_PTHREAD
+
+/* Returns the position of the first mapping whose object is not before obj. Called with the lock held. */
+static SN_UINT mda_mapping_find_(const sn_mda* obj) {
+    SN_UINT low = 0;
+    SN_UINT high = mda_mapping_count_;
+    while (low < high) {
+        SN_UINT middle = low + (high - low) / 2;
+        if ((uintptr_t)mda_mappings_[middle].obj < (uintptr_t)obj) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+bool sn_mda_add_mapping_(const sn_mda* self, void* base, size_t length) {
+    MDA_LOCK_();
+    if (mda_mapping_count_ == mda_mapping_capacity_) {
+        SN_UINT capacity = (mda_mapping_capacity_ > 0) ? 2 * mda_mapping_capacity_ : 16;
+        mda_mapping_* mappings = (mda_mapping_*)realloc(mda_mappings_, capacity * sizeof(mda_mapping_));
+        if (mappings == NULL) {
+            MDA_UNLOCK_();
+            return false;
+        }
+        mda_mappings_ = mappings;
+        mda_mapping_capacity_ = capacity;
+    }
+    SN_UINT i = mda_mapping_find_(self);
+    memmove(&(mda_mappings_[i + 1]), &(mda_mappings_[i]), (mda_mapping_count_ - i) * sizeof(mda_mapping_));
+    mda_mappings_[i].obj = self;
+    mda_mappings_[i].base = base;
+    mda_mappings_[i].length = length;
+    ++mda_mapping_count_;
+    MDA_UNLOCK_();
+    return true;
+}
+
+bool sn_mda_is_mapped(const sn_mda* self) {
+    if (self == NULL) {
+        return false;
+    }
+    MDA_LOCK_();
+    SN_UINT i = mda_mapping_find_(self);
+    bool is_mapped = (i < mda_mapping_count_ && mda_mappings_[i].obj == self);
+    MDA_UNLOCK_();
+    return is_mapped;
+}
+
+/* Unmaps self and returns true if it was mapped, or returns false otherwise. */
+static bool mda_unmap_(sn_mda* self) {
+    MDA_LOCK_();
+    SN_UINT i = mda_mapping_find_(self);
+    if (i == mda_mapping_count_ || mda_mappings_[i].obj != self) {
+        MDA_UNLOCK_();
+        return false;
+    }
+    mda_mapping_ mapping = mda_mappings_[i];
+    memmove(&(mda_mappings_[i]), &(mda_mappings_[i + 1]), (mda_mapping_count_ - i - 1) * sizeof(mda_mapping_));
+    --mda_mapping_count_;
+    MDA_UNLOCK_();
+    munmap(mapping.base, mapping.length);
+    return true;
+}
+
+#else
+
+bool sn_mda_add_mapping_(const sn_mda* self, void* base, size_t length) {
+    (void)self;
+    (void)base;
+    (void)length;
+    return false;
+}
+
+bool sn_mda_is_mapped(const sn_mda* self) {
+    (void)self;
+    return false;
+}
+
+#endif // SN_USE_MMAP
+
 void sn_mda_destroy(sn_mda* self) {
+#ifdef SN_USE_MMAP
+    if (self != NULL && mda_unmap_(self)) {
+        return;
+    }
+#endif
     SN_FREE(self);
 }
 
@@ -104,11 +230,6 @@ SN_FLOAT sn_mda_view(const sn_mda* self, const SN_UINT index[]) {
 }
 
 sn_mda* sn_mda_gmatmul(const sn_mda* x0, const sn_mda* x1, SN_UINT overwrap) {
-#ifndef SN_NDEBUG
-    for (SN_UINT i = 0; i < overwrap; ++i) {
-        SN_ASSERT(x0->shape[x0->rank - overwrap + i] == x1->shape[i]);
-    }
-#endif
     SN_UINT* y_shape = SN_DYNAMIC_ARRAY(SN_UINT, x0->rank - overwrap + x1->rank - overwrap);
     for (SN_UINT i = 0; i < x0->rank - overwrap; ++i) {
         y_shape[i] = x0->shape[i];
@@ -117,21 +238,22 @@ sn_mda* sn_mda_gmatmul(const sn_mda* x0, const sn_mda* x1, SN_UINT overwrap) {
         y_shape[x0->rank - overwrap + i] = x1->shape[overwrap + i];
     }
     sn_mda* y = sn_mda_create(x0->rank - overwrap + x1->rank - overwrap, y_shape);
+    SN_FREE(y_shape);
+    sn_mda_gmatmul_into(x0, x1, overwrap, y);
+    return y;
+}
 
+void sn_mda_gmatmul_into(const sn_mda* x0, const sn_mda* x1, SN_UINT overwrap, sn_mda* y) {
+#ifndef SN_NDEBUG
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        SN_ASSERT(x0->shape[x0->rank - overwrap + i] == x1->shape[i]);
+    }
+#endif
     SN_UINT x0_front_size = sizeof_shape_(x0->rank - overwrap, x0->shape);
     SN_UINT overwrap_size = sizeof_shape_(overwrap, x1->shape);
     SN_UINT x1_back_size = sizeof_shape_(x1->rank - overwrap, &(x1->shape[overwrap]));
+    SN_ASSERT(sn_mda_size(y) == x0_front_size * x1_back_size);
 
-    for (SN_UINT j = 0; j < x1_back_size; ++j) {
-        for (SN_UINT i = 0; i < x0_front_size; ++i) {
-            SN_FLOAT temp_sum = 0;
-            for (SN_UINT k = 0; k < overwrap_size; ++k) {
-                temp_sum += SN_MATRIX_GET(x0->ptr, x0_front_size, i, k) * SN_MATRIX_GET(x1->ptr, overwrap_size, k, j);
-            }
-            SN_MATRIX_GET(y->ptr, x0_front_size, i, j) = temp_sum;
-        }
-    }
-
-    SN_FREE(y_shape);
-    return y;
+    sn_gemm(x0_front_size, x1_back_size, overwrap_size,
+        x0->ptr, 1, x0_front_size, x1->ptr, 1, overwrap_size, y->ptr, x0_front_size, false);
 }
\ No newline at end of file
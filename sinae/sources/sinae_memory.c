@@ -0,0 +1,236 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_memory.c
+//! \brief This file implements sinae_memory.h.
+
+#include <stdlib.h>
+
+#ifdef SN_USE_PTHREAD
+    #include <pthread.h>
+#endif
+
+#include "../sinae_memory.h"
+
+
+/* Counters */
+
+// Records of operators are kept with malloc() and realloc(), so that they are neither counted nor allocated from an arena.
+// They are dense in the order of the first allocation, and found by an open-addressing table of their index + 1.
+// A destroyed operator leaves a tombstone in the table, so that a new operator at its address gets a new record,
+// and blocks refer to their record by its index, so that they are freed from the right one.
+// If they cannot grow, an allocation is still counted in total but not attributed to its operator.
+static sn_memory_stats memory_stats_ = { 0, 0, 0, 0, 0 };
+static sn_memory_op_stats* memory_ops_ = NULL;
+static SN_UINT memory_op_count_ = 0;
+static SN_UINT memory_op_capacity_ = 0;
+static SN_UINT* memory_table_ = NULL;
+static SN_UINT memory_table_capacity_ = 0; //!< Always zero or a power of two.
+#define MEMORY_TOMBSTONE_ (~(SN_UINT)0) //!< Slot of the record of a destroyed operator.
+static SN_THREAD_LOCAL const sn_op* memory_owner_ = NULL; //!< Operator being evaluated by this thread.
+
+#ifdef SN_USE_PTHREAD
+static pthread_mutex_t memory_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+    #define MEMORY_LOCK_() pthread_mutex_lock(&memory_mutex_)
+    #define MEMORY_UNLOCK_() pthread_mutex_unlock(&memory_mutex_)
+#else
+    #define MEMORY_LOCK_()
+    #define MEMORY_UNLOCK_()
+#endif // SN_USE_PTHREAD
+
+/* Returns the slot of op in the table, which is either empty or holds op. */
+static SN_UINT memory_slot_(const sn_op* op) {
+    SN_UINT mask = memory_table_capacity_ - 1;
+    SN_UINT slot = SN_PTR_HASH(op) & mask;
+    while (memory_table_[slot] != 0
+           && (memory_table_[slot] == MEMORY_TOMBSTONE_ || memory_ops_[memory_table_[slot] - 1].op != op)) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+/* Returns the index + 1 of the record of op, creating it if needed, or 0 if the records cannot grow.
+   Called with the lock held. */
+static SN_UINT memory_op_(const sn_op* op) {
+    // Records of destroyed operators count towards the load, since their tombstones occupy slots until the table grows.
+    if (2 * (memory_op_count_ + 1) > memory_table_capacity_) {
+        SN_UINT capacity = (memory_table_capacity_ > 0) ? 2 * memory_table_capacity_ : 64;
+        SN_UINT* table = (SN_UINT*)calloc(capacity, sizeof(SN_UINT));
+        if (table == NULL) {
+            return 0;
+        }
+        SN_UINT* old_table = memory_table_;
+        SN_UINT old_capacity = memory_table_capacity_;
+        memory_table_ = table;
+        memory_table_capacity_ = capacity;
+        for (SN_UINT i = 0; i < old_capacity; ++i) {
+            if (old_table[i] != 0 && old_table[i] != MEMORY_TOMBSTONE_) {
+                memory_table_[memory_slot_(memory_ops_[old_table[i] - 1].op)] = old_table[i];
+            }
+        }
+        free(old_table);
+    }
+    SN_UINT slot = memory_slot_(op);
+    if (memory_table_[slot] == 0) {
+        if (memory_op_count_ == memory_op_capacity_) {
+            SN_UINT capacity = (memory_op_capacity_ > 0) ? 2 * memory_op_capacity_ : 32;
+            sn_memory_op_stats* ops = (sn_memory_op_stats*)realloc(memory_ops_, capacity * sizeof(sn_memory_op_stats));
+            if (ops == NULL) {
+                return 0;
+            }
+            memory_ops_ = ops;
+            memory_op_capacity_ = capacity;
+        }
+        sn_memory_op_stats record = { op, 0, 0, 0 };
+        memory_ops_[memory_op_count_++] = record;
+        memory_table_[slot] = memory_op_count_;
+    }
+    return memory_table_[slot];
+}
+
+
+/* Allocation */
+
+// The header keeps the returned pointer aligned as malloc() would.
+typedef union memory_header_un_ {
+    struct {
+        SN_UINT size;
+        SN_UINT record; //!< Index + 1 of the record of the operator, or 0 if it could not be created.
+    } info;
+    long double alignment;
+    void* pointer;
+} memory_header_;
+
+void* sn_memory_malloc_(size_t size) {
+#ifdef SN_USE_ARENA
+    memory_header_* header = (memory_header_*)sn_arena_malloc_(sizeof(memory_header_) + size);
+#else
+    memory_header_* header = (memory_header_*)malloc(sizeof(memory_header_) + size);
+#endif
+    if (header == NULL) {
+        return NULL;
+    }
+    header->info.size = (SN_UINT)size;
+
+    MEMORY_LOCK_();
+    header->info.record = memory_op_(memory_owner_);
+    if (header->info.record != 0) {
+        sn_memory_op_stats* record = &(memory_ops_[header->info.record - 1]);
+        ++(record->allocation_count);
+        record->allocated_bytes += size;
+        record->live_bytes += size;
+    }
+    ++(memory_stats_.allocation_count);
+    memory_stats_.live_bytes += size;
+    if (memory_stats_.live_bytes > memory_stats_.peak_bytes) {
+        memory_stats_.peak_bytes = memory_stats_.live_bytes;
+    }
+    MEMORY_UNLOCK_();
+    return &(header[1]);
+}
+
+void sn_memory_free_(void* ptr) {
+    if (ptr == NULL) {
+        return;
+    }
+    memory_header_* header = &(((memory_header_*)ptr)[-1]);
+    MEMORY_LOCK_();
+    if (header->info.record != 0) {
+        memory_ops_[header->info.record - 1].live_bytes -= header->info.size;
+    }
+    memory_stats_.live_bytes -= header->info.size;
+    MEMORY_UNLOCK_();
+#ifdef SN_USE_ARENA
+    sn_arena_free_(header);
+#else
+    free(header);
+#endif
+}
+
+void sn_memory_forget_(const void* op) {
+    MEMORY_LOCK_();
+    if (memory_table_capacity_ > 0) {
+        SN_UINT slot = memory_slot_((const sn_op*)op);
+        if (memory_table_[slot] != 0) {
+            memory_table_[slot] = MEMORY_TOMBSTONE_;
+        }
+    }
+    MEMORY_UNLOCK_();
+}
+
+const void* sn_memory_enter_(const void* op) {
+    const sn_op* previous = memory_owner_;
+    memory_owner_ = (const sn_op*)op;
+    return previous;
+}
+
+void sn_memory_leave_(const void* previous) {
+    memory_owner_ = (const sn_op*)previous;
+}
+
+int sn_memory_exceeded_(void) {
+    MEMORY_LOCK_();
+    int exceeded = (memory_stats_.budget_bytes > 0 && memory_stats_.live_bytes > memory_stats_.budget_bytes);
+    memory_stats_.failure_count += (SN_UINT)exceeded;
+    MEMORY_UNLOCK_();
+    return exceeded;
+}
+
+
+/* Queries */
+
+sn_memory_stats sn_memory_query(void) {
+    MEMORY_LOCK_();
+    sn_memory_stats stats = memory_stats_;
+    MEMORY_UNLOCK_();
+    return stats;
+}
+
+sn_memory_op_stats sn_memory_query_op(const sn_op* op) {
+    sn_memory_op_stats stats = { op, 0, 0, 0 };
+    MEMORY_LOCK_();
+    if (memory_table_capacity_ > 0) {
+        SN_UINT slot = memory_slot_(op);
+        if (memory_table_[slot] != 0) {
+            stats = memory_ops_[memory_table_[slot] - 1];
+        }
+    }
+    MEMORY_UNLOCK_();
+    return stats;
+}
+
+SN_UINT sn_memory_op_count(void) {
+    MEMORY_LOCK_();
+    SN_UINT count = memory_op_count_;
+    MEMORY_UNLOCK_();
+    return count;
+}
+
+const sn_memory_op_stats* sn_memory_ops(void) {
+    MEMORY_LOCK_();
+    const sn_memory_op_stats* ops = memory_ops_;
+    MEMORY_UNLOCK_();
+    return ops;
+}
+
+void sn_memory_set_budget(SN_UINT bytes) {
+    MEMORY_LOCK_();
+    memory_stats_.budget_bytes = bytes;
+    MEMORY_UNLOCK_();
+}
+
+void sn_memory_reset(void) {
+    MEMORY_LOCK_();
+    memory_stats_.peak_bytes = memory_stats_.live_bytes;
+    memory_stats_.allocation_count = 0;
+    memory_stats_.failure_count = 0;
+    for (SN_UINT i = 0; i < memory_op_count_; ++i) {
+        memory_ops_[i].allocation_count = 0;
+        memory_ops_[i].allocated_bytes = 0;
+    }
+    MEMORY_UNLOCK_();
+}
@@ -9,128 +9,1468 @@
 //! \brief This file implements sinae_op.h.
 
 #include "../sinae_op.h"
+#include "../sinae_gemm.h"
+#include "../sinae_thread.h"
+#include "../sinae_view.h"
 
 #include <math.h>
 
 
 /* Helper macros */
 
-#define SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(OP_NAME, FLOW, DFLOW)                         \
-    sn_mda* OP_NAME##_flow_(sn_op* self, const sn_mda* x[]) {                               \
+// Element-wise kernels are split into ranges by sn_thread_parallel_for(), which passes the operands as a context.
+// A batch of a unary element-wise operator is just a larger array, so its batched flow and vjp are the plain ones.
+// Tile functions work on raw pointers for sn_opt_fuse(), which chains them over blocks small enough to stay in cache.
+// A jvp evaluates the derivatives of OP_JVP_TILE_ elements once and then sweeps each tangent over them contiguously.
+#define OP_JVP_TILE_ 256
+
+typedef struct element_wise_context_st_ {
+    const sn_mda** x;
+    sn_mda* y;
+} element_wise_context_;
+
+#define SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(OP_NAME, FLOW, DFLOW, D2FLOW)                 \
+    static void OP_NAME##_range_(void* context, SN_UINT begin, SN_UINT end) {               \
+        const sn_mda* x0 = ((element_wise_context_*)context)->x[0];                         \
+        sn_mda* y = ((element_wise_context_*)context)->y;                                   \
+        for (SN_UINT i = begin; i < end; ++i) {                                             \
+            y->ptr[i] = FLOW(x0->ptr[i]);                                                   \
+        }                                                                                   \
+    }                                                                                       \
+    static void OP_NAME##_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {              \
+        element_wise_context_ context = { x, y };                                           \
+        sn_thread_parallel_for(sn_mda_size(x[0]), sn_thread_get_threshold(),                \
+                               &OP_NAME##_range_, &context);                                \
+    }                                                                                       \
+    static sn_mda* OP_NAME##_flow_(sn_op* self, const sn_mda* x[]) {                        \
         sn_mda* y = sn_mda_create(x[0]->rank, x[0]->shape);                                 \
+        OP_NAME##_kernel_(self, x, y);                                                      \
+        return y;                                                                           \
+    }                                                                                       \
+    static sn_jac** OP_NAME##_dflow_(sn_op* self, const sn_mda* x[]) {                      \
+        sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 1);                                 \
+        sn_mda* diagonal = sn_mda_create(x[0]->rank, x[0]->shape);                          \
         SN_UINT size = sn_mda_size(x[0]);                                                   \
         for (SN_UINT i = 0; i < size; ++i) {                                                \
-            y->ptr[i] = FLOW(x[0]->ptr[i]);                                                 \
+            diagonal->ptr[i] = DFLOW(x[0]->ptr[i]);                                         \
+        }                                                                                   \
+        dy_dx_list[0] = sn_jac_diagonal(diagonal);                                          \
+        return dy_dx_list;                                                                  \
+    }                                                                                       \
+    static void OP_NAME##_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y,             \
+                               const sn_mda* dy, sn_mda* dx[]) {                            \
+        SN_UINT size = sn_mda_size(x[0]);                                                   \
+        for (SN_UINT i = 0; i < size; ++i) {                                                \
+            dx[0]->ptr[i] += dy->ptr[i] * DFLOW(x[0]->ptr[i]);                              \
         }                                                                                   \
-        return y;                                                                           \
     }                                                                                       \
-    sn_mda** OP_NAME##_dflow_(sn_op* self, const sn_mda* x[]) {                             \
-        sn_mda** dy_dx_list = SN_DYNAMIC_ARRAY(sn_mda*, 1);                                 \
-        dy_dx_list[0] = sn_mda_diagonal_full(x[0]->rank, x[0]->shape, 0.0);                 \
-        SN_UINT one_side_size = sn_mda_size(x[0]);                                          \
-        for (SN_UINT i = 0; i < one_side_size; ++i) {                                       \
-            SN_MATRIX_GET(dy_dx_list[0]->ptr, one_side_size, i, i) = DFLOW(x[0]->ptr[i]);   \
+    static void OP_NAME##_jvp_(sn_op* self, const sn_mda* x[], const sn_mda* y,             \
+                               SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy) {     \
+        SN_UINT size = sn_mda_size(x[0]);                                                   \
+        SN_FLOAT derivative[OP_JVP_TILE_];                                                  \
+        for (SN_UINT begin = 0; begin < size; begin += OP_JVP_TILE_) {                      \
+            SN_UINT n = (size - begin < OP_JVP_TILE_) ? size - begin : OP_JVP_TILE_;        \
+            const SN_FLOAT* x0 = &(x[0]->ptr[begin]);                                       \
+            for (SN_UINT i = 0; i < n; ++i) {                                               \
+                derivative[i] = DFLOW(x0[i]);                                               \
+            }                                                                               \
+            for (SN_UINT k = 0; k < tangent_count; ++k) {                                   \
+                const SN_FLOAT* dx0 = &(dx[0]->ptr[begin + k * size]);                      \
+                SN_FLOAT* dy0 = &(dy->ptr[begin + k * size]);                               \
+                for (SN_UINT i = 0; i < n; ++i) {                                           \
+                    dy0[i] += derivative[i] * dx0[i];                                       \
+                }                                                                           \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+    static void OP_NAME##_hvp_(sn_op* self, const sn_mda* x[], const sn_mda* tx[],          \
+                               const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {           \
+        if (tx[0] && dx[0]) {                                                               \
+            SN_UINT size = sn_mda_size(x[0]);                                               \
+            for (SN_UINT i = 0; i < size; ++i) {                                            \
+                dx[0]->ptr[i] += dy->ptr[i] * D2FLOW(x[0]->ptr[i]) * tx[0]->ptr[i];         \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+    static sn_mda* OP_NAME##_bflow_(sn_op* self, SN_UINT batch_count, const sn_mda* x[],    \
+                                    const bool x_batched[]) {                               \
+        return OP_NAME##_flow_(self, x);                                                    \
+    }                                                                                       \
+    static void OP_NAME##_bvjp_(sn_op* self, SN_UINT batch_count, const sn_mda* x[],        \
+                                const bool x_batched[], const sn_mda* y, const sn_mda* dy,  \
+                                sn_mda* dx[]) {                                             \
+        OP_NAME##_vjp_(self, x, y, dy, dx);                                                 \
+    }                                                                                       \
+    static void OP_NAME##_tile_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0,              \
+                                const SN_FLOAT x1[], SN_UINT step1, SN_FLOAT y[]) {         \
+        if (step0 == 1) {                                                                   \
+            for (SN_UINT i = 0; i < n; ++i) {                                               \
+                y[i] = FLOW(x0[i]);                                                         \
+            }                                                                               \
+        }                                                                                   \
+        else {                                                                              \
+            for (SN_UINT i = 0; i < n; ++i) {                                               \
+                y[i] = FLOW(x0[i * step0]);                                                 \
+            }                                                                               \
         }                                                                                   \
-        return dy_dx_list;                                                                  \
     }                                                                                       \
+    static void OP_NAME##_tile_vjp_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0,          \
+                                    const SN_FLOAT x1[], SN_UINT step1,                     \
+                                    const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[]) {  \
+        if (dx0) {                                                                          \
+            for (SN_UINT i = 0; i < n; ++i) {                                               \
+                dx0[i * step0] += dy[i] * DFLOW(x0[i * step0]);                             \
+            }                                                                               \
+        }                                                                                   \
+    }                                                                                       \
+    static const sn_element_wise OP_NAME##_element_wise_ = {                                \
+        &OP_NAME##_tile_, &OP_NAME##_tile_vjp_, false                                       \
+    };                                                                                      \
     sn_op* sn_##OP_NAME(sn_op* x) {                                                         \
-        return sn_op_create(OPERATOR, &OP_NAME##_flow_, &OP_NAME##_dflow_, 1, (sn_op**)&x); \
+        sn_op* obj = sn_op_create(OPERATOR, &OP_NAME##_flow_, &OP_NAME##_dflow_,            \
+                                  1, (sn_op**)&x);                                          \
+        obj->vjp = &OP_NAME##_vjp_;                                                         \
+        obj->kernel = &OP_NAME##_kernel_;                                                   \
+        obj->bflow = &OP_NAME##_bflow_;                                                     \
+        obj->bvjp = &OP_NAME##_bvjp_;                                                       \
+        obj->jvp = &OP_NAME##_jvp_;                                                         \
+        obj->hvp = &OP_NAME##_hvp_;                                                         \
+        obj->element_wise = &OP_NAME##_element_wise_;                                       \
+        obj->name = #OP_NAME;                                                               \
+        return obj;                                                                         \
+    }
+
+// Binary operators broadcast their operands like sn_broadcast_shape(). If each operand is either in the shape of the output
+// or a single element, it is read with a step of 1 or 0 without a loop. Otherwise the elements are visited by the runs
+// of a sn_view_loop, whose steps are given to the tile functions.
+typedef struct element_wise_binary_context_st_ {
+    sn_view_loop* loop;     //!< Loop over x0, x1 in the shape of the output, or NULL if the steps are enough.
+    const SN_FLOAT* x[2];
+    SN_UINT step[2];
+    SN_FLOAT* y;
+    sn_tile_fn* tile;
+    const SN_FLOAT* dy;
+    SN_FLOAT* dx[2];
+    sn_tile_vjp_fn* tile_vjp;
+} element_wise_binary_context_;
+
+static void element_wise_binary_operator_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    element_wise_binary_context_* binary = (element_wise_binary_context_*)context;
+    binary->tile(n, &(binary->x[0][offset[0]]), step[0], &(binary->x[1][offset[1]]), step[1], &(binary->y[position]));
+}
+
+static void element_wise_binary_operator_range_(void* context, SN_UINT begin, SN_UINT end) {
+    element_wise_binary_context_* binary = (element_wise_binary_context_*)context;
+    if (binary->loop) {
+        sn_view_loop_run(binary->loop, begin, end, &element_wise_binary_operator_run_, context);
+    }
+    else {
+        binary->tile(end - begin, &(binary->x[0][begin * binary->step[0]]), binary->step[0],
+                     &(binary->x[1][begin * binary->step[1]]), binary->step[1], &(binary->y[begin]));
     }
+}
+
+static void element_wise_binary_operator_vjp_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    element_wise_binary_context_* binary = (element_wise_binary_context_*)context;
+    binary->tile_vjp(n, &(binary->x[0][offset[0]]), step[0], &(binary->x[1][offset[1]]), step[1], &(binary->dy[position]),
+                     binary->dx[0] ? &(binary->dx[0][offset[0]]) : NULL, binary->dx[1] ? &(binary->dx[1][offset[1]]) : NULL);
+}
 
-static sn_mda* element_wise_binary_operator_flow_(sn_op* self, const sn_mda* x[], SN_FLOAT f(SN_FLOAT, SN_FLOAT)) {
-    SN_ASSERT((x[0]->rank == x[1]->rank || x[0]->rank * x[1]->rank == 0)); // If the rank of x0 and x1 does not match.
-    sn_mda* y = (x[0]->rank == 0) ? sn_mda_create(x[1]->rank, x[1]->shape) : sn_mda_create(x[0]->rank, x[0]->shape);
-    SN_UINT size = (x[0]->rank == 0) ? sn_mda_size(x[1]) : sn_mda_size(x[0]);
-    if (x[0]->rank == x[1]->rank) { // If both are in same shape.
-#ifndef SN_NDEBUG
-        for (SN_UINT i = 0; i < x[0]->rank; ++i) {
-            SN_ASSERT(x[0]->shape[i] == x[1]->shape[i]);
+/* Returns the context of x0, x1 broadcasted to the shape, with a loop only if an operand is partially broadcasted.
+   The loop is built in the storage unless it has too many axes, so it is released by element_wise_binary_operator_release_(). */
+static element_wise_binary_context_ element_wise_binary_operator_context_(const sn_mda* x[], SN_UINT rank, const SN_UINT shape[],
+                                                                          sn_view_loop_storage* storage) {
+    element_wise_binary_context_ context = { NULL, { x[0]->ptr, x[1]->ptr }, { 0, 0 }, NULL, NULL, NULL, { NULL, NULL }, NULL };
+    SN_UINT size = 1;
+    for (SN_UINT i = 0; i < rank; ++i) {
+        size *= shape[i];
+    }
+    for (SN_UINT k = 0; k < 2; ++k) {
+        SN_UINT x_size = sn_mda_size(x[k]);
+        context.step[k] = (x_size == 1) ? 0 : 1;
+        if (x_size != 1 && x_size != size) {
+            context.loop = sn_view_loop_broadcast_in(storage, 2, x, rank, shape);
+            if (!context.loop) {
+                context.loop = sn_view_loop_broadcast(2, x, rank, shape);
+            }
+            break;
         }
-#endif
+    }
+    return context;
+}
+
+static void element_wise_binary_operator_release_(const element_wise_binary_context_* context, sn_view_loop_storage* storage) {
+    if (context->loop && context->loop != &(storage->loop)) {
+        sn_view_loop_destroy(context->loop);
+    }
+}
+
+/* Returns the output of x0, x1 broadcasted to each other. */
+static sn_mda* element_wise_binary_operator_y_(const sn_mda* x[]) {
+    SN_UINT rank = (x[0]->rank > x[1]->rank) ? x[0]->rank : x[1]->rank;
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, rank + 1);
+    bool is_broadcastable = sn_broadcast_shape(x[0]->rank, x[0]->shape, x[1]->rank, x[1]->shape, &rank, shape);
+    SN_ASSERT(is_broadcastable); // If the shapes of x0 and x1 cannot be broadcasted.
+    (void)is_broadcastable;
+    sn_mda* y = sn_mda_create(rank, shape);
+    SN_FREE(shape);
+    return y;
+}
+
+static void element_wise_binary_operator_kernel_(const sn_mda* x[], sn_mda* y, sn_tile_fn* tile) {
+    sn_view_loop_storage storage;
+    element_wise_binary_context_ context = element_wise_binary_operator_context_(x, y->rank, y->shape, &storage);
+    context.y = y->ptr;
+    context.tile = tile;
+    sn_thread_parallel_for(sn_mda_size(y), sn_thread_get_threshold(), &element_wise_binary_operator_range_, &context);
+    element_wise_binary_operator_release_(&context, &storage);
+}
+
+static sn_mda* element_wise_binary_operator_flow_(const sn_mda* x[], sn_tile_fn* tile) {
+    sn_mda* y = element_wise_binary_operator_y_(x);
+    element_wise_binary_operator_kernel_(x, y, tile);
+    return y;
+}
+
+// The adjoint of a broadcasted operand is accumulated from every element it is read into, so the vjp is not split into threads.
+static void element_wise_binary_operator_vjp_(const sn_mda* x[], const sn_mda* dy, sn_mda* dx[], sn_tile_vjp_fn* tile_vjp) {
+    sn_view_loop_storage storage;
+    element_wise_binary_context_ context = element_wise_binary_operator_context_(x, dy->rank, dy->shape, &storage);
+    context.dy = dy->ptr;
+    context.dx[0] = dx[0] ? dx[0]->ptr : NULL;
+    context.dx[1] = dx[1] ? dx[1]->ptr : NULL;
+    context.tile_vjp = tile_vjp;
+    if (context.loop) {
+        sn_view_loop_run(context.loop, 0, sn_mda_size(dy), &element_wise_binary_operator_vjp_run_, &context);
+    }
+    else {
+        tile_vjp(sn_mda_size(dy), context.x[0], context.step[0], context.x[1], context.step[1], context.dy, context.dx[0], context.dx[1]);
+    }
+    element_wise_binary_operator_release_(&context, &storage);
+}
+
+static void element_wise_binary_operator_offset_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    SN_UINT** offsets = (SN_UINT**)context;
+    for (SN_UINT i = 0; i < n; ++i) {
+        offsets[0][position + i] = offset[0] + i * step[0];
+        offsets[1][position + i] = offset[1] + i * step[1];
+    }
+}
+
+static sn_jac** element_wise_binary_operator_dflow_(const sn_mda* x[], SN_FLOAT df0(SN_FLOAT, SN_FLOAT), SN_FLOAT df1(SN_FLOAT, SN_FLOAT)) {
+    sn_mda* y_like = element_wise_binary_operator_y_(x);
+    SN_UINT size = sn_mda_size(y_like);
+    SN_UINT* offsets[2] = { SN_DYNAMIC_ARRAY(SN_UINT, size), SN_DYNAMIC_ARRAY(SN_UINT, size) };
+    sn_view_loop* loop = sn_view_loop_broadcast(2, x, y_like->rank, y_like->shape);
+    sn_view_loop_run(loop, 0, size, &element_wise_binary_operator_offset_run_, offsets);
+    sn_view_loop_destroy(loop);
+
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 2);
+    for (SN_UINT k = 0; k < 2; ++k) {
+        SN_FLOAT (*df)(SN_FLOAT, SN_FLOAT) = (k == 0) ? df0 : df1;
+        sn_mda* derivatives = sn_mda_create(y_like->rank, y_like->shape);
         for (SN_UINT i = 0; i < size; ++i) {
-            y->ptr[i] = f(x[0]->ptr[i], x[1]->ptr[i]);
+            derivatives->ptr[i] = df(x[0]->ptr[offsets[0][i]], x[1]->ptr[offsets[1][i]]);
         }
+        dy_dx_list[k] = sn_jac_expand(derivatives, x[k]->rank, x[k]->shape);
     }
-    else if (x[0]->rank == 0) { // If x[0] is scalar.
-        for (SN_UINT i = 0; i < size; ++i) {
-            y->ptr[i] = f(x[0]->ptr[0], x[1]->ptr[i]);
+    SN_FREE(offsets[0]);
+    SN_FREE(offsets[1]);
+    sn_mda_destroy(y_like);
+    return dy_dx_list;
+}
+
+// Tangents are visited like the adjoints of the vjp: by the steps or the runs of a loop over the output of a single tangent.
+// The k-th tangent of an operand follows the previous one, so it is read at the same offset plus k times its size.
+// The derivatives with respect to operand m are computed by a tile function, so they are inlined like the flow of a tile.
+typedef void element_wise_binary_derivative_fn_(SN_UINT m, SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1,
+                                                SN_FLOAT derivative[]);
+
+typedef struct element_wise_binary_jvp_context_st_ {
+    const sn_mda** x;
+    const sn_mda** dx;
+    SN_UINT tangent_count;
+    SN_UINT y_size;
+    SN_FLOAT* dy;
+    element_wise_binary_derivative_fn_* tile_derivative;
+} element_wise_binary_jvp_context_;
+
+static void element_wise_binary_operator_jvp_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    element_wise_binary_jvp_context_* jvp = (element_wise_binary_jvp_context_*)context;
+    SN_FLOAT derivative[OP_JVP_TILE_];
+    for (SN_UINT begin = 0; begin < n; begin += OP_JVP_TILE_) {
+        SN_UINT count = (n - begin < OP_JVP_TILE_) ? n - begin : OP_JVP_TILE_;
+        const SN_FLOAT* x0 = &(jvp->x[0]->ptr[offset[0] + begin * step[0]]);
+        const SN_FLOAT* x1 = &(jvp->x[1]->ptr[offset[1] + begin * step[1]]);
+        for (SN_UINT m = 0; m < 2; ++m) {
+            if (jvp->dx[m] == NULL) {
+                continue;
+            }
+            jvp->tile_derivative(m, count, x0, step[0], x1, step[1], derivative);
+            SN_UINT x_size = sn_mda_size(jvp->x[m]);
+            for (SN_UINT k = 0; k < jvp->tangent_count; ++k) {
+                const SN_FLOAT* dx = &(jvp->dx[m]->ptr[offset[m] + begin * step[m] + k * x_size]);
+                SN_FLOAT* dy = &(jvp->dy[position + begin + k * jvp->y_size]);
+                if (step[m] == 1) {
+                    for (SN_UINT i = 0; i < count; ++i) {
+                        dy[i] += derivative[i] * dx[i];
+                    }
+                }
+                else {
+                    for (SN_UINT i = 0; i < count; ++i) {
+                        dy[i] += derivative[i] * dx[i * step[m]];
+                    }
+                }
+            }
         }
     }
-    else if (x[1]->rank == 0) { // If x[1] is scalar.
-        for (SN_UINT i = 0; i < size; ++i) {
-            y->ptr[i] = f(x[0]->ptr[i], x[1]->ptr[0]);
+}
+
+static void element_wise_binary_operator_jvp_(const sn_mda* x[], SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy,
+                                              element_wise_binary_derivative_fn_* tile_derivative) {
+    element_wise_binary_jvp_context_ jvp = { x, dx, tangent_count, sn_mda_size(dy) / tangent_count, dy->ptr, tile_derivative };
+    sn_view_loop_storage storage;
+    element_wise_binary_context_ context = element_wise_binary_operator_context_(x, dy->rank - 1, dy->shape, &storage);
+    if (context.loop) {
+        sn_view_loop_run(context.loop, 0, jvp.y_size, &element_wise_binary_operator_jvp_run_, &jvp);
+    }
+    else {
+        SN_UINT offset[2] = { 0, 0 };
+        element_wise_binary_operator_jvp_run_(&jvp, jvp.y_size, 0, offset, context.step);
+    }
+    element_wise_binary_operator_release_(&context, &storage);
+}
+
+// The second-order term reads the tangents of the operands at their offsets and, like the vjp, is not split into threads.
+typedef void element_wise_binary_tile_hvp_fn_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1,
+                                              const SN_FLOAT tx0[], const SN_FLOAT tx1[], const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[]);
+
+typedef struct element_wise_binary_hvp_context_st_ {
+    const SN_FLOAT* x[2];
+    const SN_FLOAT* tx[2];
+    const SN_FLOAT* dy;
+    SN_FLOAT* dx[2];
+    element_wise_binary_tile_hvp_fn_* tile_hvp;
+} element_wise_binary_hvp_context_;
+
+static void element_wise_binary_operator_hvp_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    element_wise_binary_hvp_context_* hvp = (element_wise_binary_hvp_context_*)context;
+    hvp->tile_hvp(n, &(hvp->x[0][offset[0]]), step[0], &(hvp->x[1][offset[1]]), step[1],
+                  hvp->tx[0] ? &(hvp->tx[0][offset[0]]) : NULL, hvp->tx[1] ? &(hvp->tx[1][offset[1]]) : NULL, &(hvp->dy[position]),
+                  hvp->dx[0] ? &(hvp->dx[0][offset[0]]) : NULL, hvp->dx[1] ? &(hvp->dx[1][offset[1]]) : NULL);
+}
+
+static void element_wise_binary_operator_hvp_(const sn_mda* x[], const sn_mda* tx[], const sn_mda* dy, sn_mda* dx[],
+                                              element_wise_binary_tile_hvp_fn_* tile_hvp) {
+    sn_view_loop_storage storage;
+    element_wise_binary_context_ context = element_wise_binary_operator_context_(x, dy->rank, dy->shape, &storage);
+    element_wise_binary_hvp_context_ hvp = {
+        { x[0]->ptr, x[1]->ptr }, { tx[0] ? tx[0]->ptr : NULL, tx[1] ? tx[1]->ptr : NULL }, dy->ptr,
+        { dx[0] ? dx[0]->ptr : NULL, dx[1] ? dx[1]->ptr : NULL }, tile_hvp
+    };
+    SN_UINT offset[2] = { 0, 0 };
+    if (context.loop) {
+        sn_view_loop_run(context.loop, 0, sn_mda_size(dy), &element_wise_binary_operator_hvp_run_, &hvp);
+    }
+    else {
+        element_wise_binary_operator_hvp_run_(&hvp, sn_mda_size(dy), 0, offset, context.step);
+    }
+    element_wise_binary_operator_release_(&context, &storage);
+}
+
+// In a batch, the samples are padded with axes of 1 to the largest rank and followed by the batch axis, which is broadcasted
+// for a shared operand. The batch is then a single broadcasted operation over views, and the output is in the broadcasted shape.
+static void element_wise_binary_operator_batch_views_(SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], sn_view* views[],
+                                                      SN_UINT* y_rank, SN_UINT** y_shape) {
+    SN_UINT sample_rank[2];
+    for (SN_UINT k = 0; k < 2; ++k) {
+        sample_rank[k] = x_batched[k] ? x[k]->rank - 1 : x[k]->rank;
+    }
+    SN_UINT rank = ((sample_rank[0] > sample_rank[1]) ? sample_rank[0] : sample_rank[1]) + 1;
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, rank);
+    SN_UINT* x_shape = SN_DYNAMIC_ARRAY(SN_UINT, rank);
+    for (SN_UINT k = 0; k < 2; ++k) {
+        for (SN_UINT i = 0; i + 1 < rank; ++i) {
+            x_shape[i] = (i < sample_rank[k]) ? x[k]->shape[i] : 1;
         }
+        x_shape[rank - 1] = x_batched[k] ? batch_count : 1;
+        sn_view* view = sn_view_create((sn_mda*)x[k]);
+        views[k] = sn_view_reshape(view, rank, x_shape); // Inserting axes of 1 into a contiguous view never fails.
+        sn_view_destroy(view);
+    }
+    bool is_broadcastable = sn_broadcast_shape(rank, views[0]->shape, rank, views[1]->shape, &rank, shape);
+    SN_ASSERT(is_broadcastable); // If the samples of x0 and x1 cannot be broadcasted.
+    (void)is_broadcastable;
+    for (SN_UINT k = 0; k < 2; ++k) {
+        sn_view* view = sn_view_broadcast(views[k], rank, shape);
+        sn_view_destroy(views[k]);
+        views[k] = view;
     }
-    // (x[0]->rank == 0) ? sn_mda_destroy(x[0]) : sn_mda_destroy(x[1]);
+    SN_FREE(x_shape);
+    *y_rank = rank;
+    *y_shape = shape;
+}
+
+static inline sn_mda* element_wise_binary_operator_bflow_(SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], sn_tile_fn* tile) {
+    sn_view* views[2];
+    SN_UINT y_rank;
+    SN_UINT* y_shape;
+    element_wise_binary_operator_batch_views_(batch_count, x, x_batched, views, &y_rank, &y_shape);
+    sn_mda* y = sn_mda_create(y_rank, y_shape);
+    SN_FREE(y_shape);
+
+    element_wise_binary_context_ context = { NULL, { x[0]->ptr, x[1]->ptr }, { 0, 0 }, y->ptr, tile, NULL, { NULL, NULL }, NULL };
+    context.loop = sn_view_loop_create(2, (const sn_view**)views);
+    sn_thread_parallel_for(sn_mda_size(y), sn_thread_get_threshold(), &element_wise_binary_operator_range_, &context);
+    sn_view_loop_destroy(context.loop);
+    sn_view_destroy(views[0]);
+    sn_view_destroy(views[1]);
     return y;
 }
 
-#define SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(OP_NAME, FLOW, DFLOW)                                              \
-    sn_mda* OP_NAME##_flow_(sn_op* self, const sn_mda* x[]) {                                                     \
-        return element_wise_binary_operator_flow_(self, x, FLOW);                                                 \
+static inline void element_wise_binary_operator_bvjp_(SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], sn_mda* dx[], const sn_mda* dy,
+                                                      sn_tile_vjp_fn* tile_vjp) {
+    sn_view* views[2];
+    SN_UINT y_rank;
+    SN_UINT* y_shape;
+    element_wise_binary_operator_batch_views_(batch_count, x, x_batched, views, &y_rank, &y_shape);
+    SN_FREE(y_shape);
+
+    element_wise_binary_context_ context = { NULL, { x[0]->ptr, x[1]->ptr }, { 0, 0 }, NULL, NULL, dy->ptr,
+                                             { dx[0] ? dx[0]->ptr : NULL, dx[1] ? dx[1]->ptr : NULL }, tile_vjp };
+    context.loop = sn_view_loop_create(2, (const sn_view**)views);
+    sn_view_loop_run(context.loop, 0, sn_mda_size(dy), &element_wise_binary_operator_vjp_run_, &context);
+    sn_view_loop_destroy(context.loop);
+    sn_view_destroy(views[0]);
+    sn_view_destroy(views[1]);
+}
+
+static inline void element_wise_binary_operator_tile_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1, SN_FLOAT y[],
+                                                      SN_FLOAT f(SN_FLOAT, SN_FLOAT)) {
+    if (step0 == 1 && step1 == 1) { // If both are contiguous.
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = f(x0[i], x1[i]);
+        }
+    }
+    else if (step0 == 0) { // If x0 is broadcasted.
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = f(x0[0], x1[i * step1]);
+        }
+    }
+    else if (step1 == 0) { // If x1 is broadcasted.
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = f(x0[i * step0], x1[0]);
+        }
+    }
+    else {
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = f(x0[i * step0], x1[i * step1]);
+        }
+    }
+}
+
+static inline void element_wise_binary_operator_tile_vjp_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1,
+                                                          const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[],
+                                                          SN_FLOAT df0(SN_FLOAT, SN_FLOAT), SN_FLOAT df1(SN_FLOAT, SN_FLOAT)) {
+    if (dx0) {
+        for (SN_UINT i = 0; i < n; ++i) {
+            dx0[i * step0] += dy[i] * df0(x0[i * step0], x1[i * step1]);
+        }
+    }
+    if (dx1) {
+        for (SN_UINT i = 0; i < n; ++i) {
+            dx1[i * step1] += dy[i] * df1(x0[i * step0], x1[i * step1]);
+        }
+    }
+}
+
+// d2f01 is the mixed second derivative, so the tangent of each operand contributes to the adjoints of both.
+static inline void element_wise_binary_operator_tile_hvp_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1,
+                                                          const SN_FLOAT tx0[], const SN_FLOAT tx1[], const SN_FLOAT dy[],
+                                                          SN_FLOAT dx0[], SN_FLOAT dx1[], SN_FLOAT d2f00(SN_FLOAT, SN_FLOAT),
+                                                          SN_FLOAT d2f01(SN_FLOAT, SN_FLOAT), SN_FLOAT d2f11(SN_FLOAT, SN_FLOAT)) {
+    for (SN_UINT i = 0; i < n; ++i) {
+        SN_FLOAT a = x0[i * step0];
+        SN_FLOAT b = x1[i * step1];
+        SN_FLOAT t0 = tx0 ? tx0[i * step0] : 0.0;
+        SN_FLOAT t1 = tx1 ? tx1[i * step1] : 0.0;
+        if (dx0) {
+            dx0[i * step0] += dy[i] * (d2f00(a, b) * t0 + d2f01(a, b) * t1);
+        }
+        if (dx1) {
+            dx1[i * step1] += dy[i] * (d2f01(a, b) * t0 + d2f11(a, b) * t1);
+        }
+    }
+}
+
+#define SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(OP_NAME, FLOW, DFLOW0, DFLOW1, D2FLOW00, D2FLOW01, D2FLOW11)       \
+    static void OP_NAME##_tile_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[], SN_UINT step1, \
+                                SN_FLOAT y[]) {                                                                    \
+        element_wise_binary_operator_tile_(n, x0, step0, x1, step1, y, FLOW);                                     \
+    }                                                                                                             \
+    static void OP_NAME##_tile_vjp_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[],            \
+                                    SN_UINT step1, const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[]) {          \
+        element_wise_binary_operator_tile_vjp_(n, x0, step0, x1, step1, dy, dx0, dx1, DFLOW0, DFLOW1);            \
+    }                                                                                                             \
+    static void OP_NAME##_tile_derivative_(SN_UINT m, SN_UINT n, const SN_FLOAT x0[], SN_UINT step0,               \
+                                           const SN_FLOAT x1[], SN_UINT step1, SN_FLOAT derivative[]) {            \
+        if (m == 0) {                                                                                             \
+            element_wise_binary_operator_tile_(n, x0, step0, x1, step1, derivative, DFLOW0);                      \
+        }                                                                                                         \
+        else {                                                                                                    \
+            element_wise_binary_operator_tile_(n, x0, step0, x1, step1, derivative, DFLOW1);                      \
+        }                                                                                                         \
+    }                                                                                                             \
+    static void OP_NAME##_tile_hvp_(SN_UINT n, const SN_FLOAT x0[], SN_UINT step0, const SN_FLOAT x1[],            \
+                                    SN_UINT step1, const SN_FLOAT tx0[], const SN_FLOAT tx1[],                     \
+                                    const SN_FLOAT dy[], SN_FLOAT dx0[], SN_FLOAT dx1[]) {                         \
+        element_wise_binary_operator_tile_hvp_(n, x0, step0, x1, step1, tx0, tx1, dy, dx0, dx1,                   \
+                                               D2FLOW00, D2FLOW01, D2FLOW11);                                     \
     }                                                                                                             \
-    sn_mda** OP_NAME##_dflow_(sn_op* self, const sn_mda* x[]) {                                                    \
-        /* !!! Not implemented !!! */                                                                             \
-        return NULL;                                                                                              \
+    static void OP_NAME##_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {                                    \
+        element_wise_binary_operator_kernel_(x, y, &(OP_NAME##_tile_));                                           \
     }                                                                                                             \
+    static sn_mda* OP_NAME##_flow_(sn_op* self, const sn_mda* x[]) {                                              \
+        return element_wise_binary_operator_flow_(x, &(OP_NAME##_tile_));                                         \
+    }                                                                                                             \
+    static sn_jac** OP_NAME##_dflow_(sn_op* self, const sn_mda* x[]) {                                            \
+        return element_wise_binary_operator_dflow_(x, DFLOW0, DFLOW1);                                            \
+    }                                                                                                             \
+    static void OP_NAME##_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) { \
+        element_wise_binary_operator_vjp_(x, dy, dx, &(OP_NAME##_tile_vjp_));                                     \
+    }                                                                                                             \
+    static void OP_NAME##_jvp_(sn_op* self, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count,            \
+                               const sn_mda* dx[], sn_mda* dy) {                                                  \
+        element_wise_binary_operator_jvp_(x, tangent_count, dx, dy, &(OP_NAME##_tile_derivative_));               \
+    }                                                                                                             \
+    static void OP_NAME##_hvp_(sn_op* self, const sn_mda* x[], const sn_mda* tx[], const sn_mda* y,               \
+                               const sn_mda* dy, sn_mda* dx[]) {                                                  \
+        element_wise_binary_operator_hvp_(x, tx, dy, dx, &(OP_NAME##_tile_hvp_));                                 \
+    }                                                                                                             \
+    static sn_mda* OP_NAME##_bflow_(sn_op* self, SN_UINT batch_count, const sn_mda* x[],                          \
+                                    const bool x_batched[]) {                                                     \
+        return element_wise_binary_operator_bflow_(batch_count, x, x_batched, &(OP_NAME##_tile_));                \
+    }                                                                                                             \
+    static void OP_NAME##_bvjp_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[],      \
+                                const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {                                \
+        element_wise_binary_operator_bvjp_(batch_count, x, x_batched, dx, dy, &(OP_NAME##_tile_vjp_));            \
+    }                                                                                                             \
+    static const sn_element_wise OP_NAME##_element_wise_ = { &(OP_NAME##_tile_), &(OP_NAME##_tile_vjp_),          \
+                                                               false };                                           \
     sn_op* sn_##OP_NAME(sn_op* x0, sn_op* x1) {                                                                   \
-        return sn_op_create(OPERATOR, &(OP_NAME##_flow_), &(OP_NAME##_dflow_), 2, SN_TEMP_ARRAY(sn_op*, x0, x1)); \
+        sn_op* obj = sn_op_create(OPERATOR, &(OP_NAME##_flow_), &(OP_NAME##_dflow_), 2,                           \
+                                  SN_TEMP_ARRAY(sn_op*, x0, x1));                                                 \
+        obj->vjp = &(OP_NAME##_vjp_);                                                                             \
+        obj->kernel = &(OP_NAME##_kernel_);                                                                       \
+        obj->bflow = &(OP_NAME##_bflow_);                                                                         \
+        obj->bvjp = &(OP_NAME##_bvjp_);                                                                           \
+        obj->jvp = &(OP_NAME##_jvp_);                                                                             \
+        obj->hvp = &(OP_NAME##_hvp_);                                                                             \
+        obj->element_wise = &(OP_NAME##_element_wise_);                                                           \
+        obj->name = #OP_NAME;                                                                                     \
+        return obj;                                                                                               \
     }
 
 
 /* Element-wise unary operators. */
 
 static inline SN_FLOAT dabs_(SN_FLOAT x) { return (x >= (SN_FLOAT)0.0) ? 1.0 : -1.0; }
-SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(abs, fabs, dabs_);
-SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(exp, exp, exp);
+static inline SN_FLOAT d2abs_(SN_FLOAT x) { return 0.0; }
+SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(abs, fabs, dabs_, d2abs_);
+SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(exp, exp, exp, exp);
 static inline SN_FLOAT dnegative_(SN_FLOAT x) { return -1.0; }
-SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(negative, -, dnegative_);
+static inline SN_FLOAT d2negative_(SN_FLOAT x) { return 0.0; }
+SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(negative, -, dnegative_, d2negative_);
 static inline SN_FLOAT dreciprocal_(SN_FLOAT x) { return -(SN_FLOAT)1.0 / (SN_FLOAT)(pow(x, 2.0)); }
-SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(reciprocal, (SN_FLOAT)1.0/, dreciprocal_);
+static inline SN_FLOAT d2reciprocal_(SN_FLOAT x) { return (SN_FLOAT)2.0 / (x * x * x); }
+SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(reciprocal, (SN_FLOAT)1.0/, dreciprocal_, d2reciprocal_);
 static inline SN_FLOAT dsqrt_(SN_FLOAT x) { return 1.0 / (2 * sqrt(x)); }
-SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(sqrt, sqrt, dsqrt_);
+static inline SN_FLOAT d2sqrt_(SN_FLOAT x) { return -1.0 / (4 * x * sqrt(x)); }
+SN_DEFINE_ELEMENT_WISE_UNARY_OPERATOR(sqrt, sqrt, dsqrt_, d2sqrt_);
 
 
 /* Unary operators */
 
+// sn_thread_reduce() passes one block at a time, which is summed pairwise like sn_reduce_sum() does.
+static SN_FLOAT sum_range_(void* context, SN_UINT begin, SN_UINT end) {
+    const SN_FLOAT* x0 = (const SN_FLOAT*)context;
+    return sn_sum_block_(&(x0[begin]), end - begin);
+}
+static void sum_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {
+    y->ptr[0] = sn_thread_reduce(sn_mda_size(x[0]), &sum_range_, (void*)x[0]->ptr);
+}
 static sn_mda* sum_flow_(sn_op* self, const sn_mda* x[]) {
+    sn_mda* y = sn_mda_create(0, NULL);
+    sum_kernel_(self, x, y);
+    return y;
+}
+static sn_jac** sum_dflow_(sn_op* self, const sn_mda* x[]) {
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 1);
+    dy_dx_list[0] = sn_jac_broadcast(0, NULL, x[0]->rank, x[0]->shape, 1.0);
+    return dy_dx_list;
+}
+static void sum_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
     SN_UINT size = sn_mda_size(x[0]);
-    SN_FLOAT y = 0.0;
     for (SN_UINT i = 0; i < size; ++i) {
-        y += x[0]->ptr[i];
+        dx[0]->ptr[i] += dy->ptr[0];
     }
-    return sn_mda_full(0, NULL, y);
 }
-static sn_mda** sum_dflow_(sn_op* self, const sn_mda* x[]) {
-    sn_mda** dy_dx_list = SN_DYNAMIC_ARRAY(sn_mda*, 1);
-    dy_dx_list[0] = sn_mda_full(1, x[0]->shape, 1.0);
-    return dy_dx_list;
+static sn_mda* sum_bflow_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]) {
+    sn_mda* y = sn_mda_create(1, &batch_count);
+    SN_UINT size = sn_mda_size(x[0]) / batch_count;
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        y->ptr[s] = sn_thread_reduce(size, &sum_range_, (void*)&(x[0]->ptr[s * size]));
+    }
+    return y;
+}
+static void sum_bvjp_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_UINT size = sn_mda_size(x[0]) / batch_count;
+    for (SN_UINT s = 0; s < batch_count; ++s) {
+        for (SN_UINT i = 0; i < size; ++i) {
+            dx[0]->ptr[s * size + i] += dy->ptr[s];
+        }
+    }
+}
+static void sum_jvp_(sn_op* self, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy) {
+    SN_UINT size = sn_mda_size(x[0]);
+    for (SN_UINT k = 0; k < tangent_count; ++k) {
+        dy->ptr[k] += sn_thread_reduce(size, &sum_range_, (void*)&(dx[0]->ptr[k * size]));
+    }
+}
+
+// The vjp of a sum does not depend on its input, so its second-order term vanishes.
+static void sum_hvp_(sn_op* self, const sn_mda* x[], const sn_mda* tx[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
 }
+static const sn_element_wise sum_element_wise_ = { NULL, NULL, true };
 sn_op* sn_sum(sn_op* x) {
-    return sn_op_create(OPERATOR, &sum_flow_, &sum_dflow_, 1, &x);
+    sn_op* obj = sn_op_create(OPERATOR, &sum_flow_, &sum_dflow_, 1, &x);
+    obj->vjp = &sum_vjp_;
+    obj->kernel = &sum_kernel_;
+    obj->bflow = &sum_bflow_;
+    obj->bvjp = &sum_bvjp_;
+    obj->jvp = &sum_jvp_;
+    obj->hvp = &sum_hvp_;
+    obj->element_wise = &sum_element_wise_;
+    obj->name = "sum";
+    return obj;
+}
+
+
+/* Reductions over axes */
+
+// The reduced axes are a mask stored after the input like the overwrap of sn_matmul(), bit a selecting the axis a.
+// Axes of a single element are dropped and neighbouring axes of the same kind are merged into groups.
+// The elements of an output are rows, one for each index of the reduced groups after the first. If the first group
+// is kept, the rows of its outputs are combined REDUCE_TILE_ columns at a time, and otherwise each row is first reduced
+// contiguously. Every reduced group is combined in a single pass, so nothing is allocated. Sums are pairwise down to
+// blocks summed by REDUCE_LEAF_ accumulators, or to REDUCE_ROWS_ rows, so the rounding error grows with log(R) instead of R.
+#define REDUCE_ALL_ (~(SN_UINT)0)
+#define REDUCE_MAX_RANK_ 63
+#define REDUCE_TILE_ 256
+#define REDUCE_LEAF_ 8
+#define REDUCE_BLOCK_ 128
+#define REDUCE_ROWS_ 32
+#define REDUCE_LEVEL_COUNT_ 60 // Levels of the pairwise tree below the output for up to 2^64 rows.
+#define REDUCE_NONE_ (~(SN_UINT)0)
+
+typedef enum reduce_kind_en_ {
+    REDUCE_SUM_,
+    REDUCE_MEAN_,
+    REDUCE_MAX_,
+    REDUCE_MIN_
+} reduce_kind_;
+
+typedef struct reduce_groups_st_ {
+    SN_UINT count;
+    SN_UINT size[REDUCE_MAX_RANK_ + 1];
+    bool reduced[REDUCE_MAX_RANK_ + 1];
+    SN_UINT reduced_size; //!< Number of elements combined into each output.
+} reduce_groups_;
+
+/* Returns the mask of the reduced axes of x whose first rank axes are the ones of a sample. */
+static SN_UINT reduce_mask_(const sn_op* self, SN_UINT rank) {
+    SN_UINT mask = *((SN_UINT*)&(self->x[1]));
+    SN_ASSERT(rank <= REDUCE_MAX_RANK_); // If the rank is too large for the mask.
+    if (mask == REDUCE_ALL_) {
+        return ((SN_UINT)1 << rank) - 1;
+    }
+    SN_ASSERT((mask >> rank) == 0); // If an axis is out of the rank.
+    return mask;
+}
+
+static void reduce_groups_init_(reduce_groups_* groups, SN_UINT mask, SN_UINT rank, const SN_UINT shape[]) {
+    groups->count = 0;
+    groups->reduced_size = 1;
+    for (SN_UINT a = 0; a < rank; ++a) {
+        bool reduced = (mask >> a) & 1;
+        groups->reduced_size *= reduced ? shape[a] : 1;
+        if (shape[a] == 1) {
+            continue;
+        }
+        if (groups->count > 0 && groups->reduced[groups->count - 1] == reduced) {
+            groups->size[groups->count - 1] *= shape[a];
+        }
+        else {
+            groups->size[groups->count] = shape[a];
+            groups->reduced[groups->count] = reduced;
+            ++(groups->count);
+        }
+    }
+    if (groups->count == 0) { // A single element is kept as it is.
+        groups->size[0] = 1;
+        groups->reduced[0] = false;
+        groups->count = 1;
+    }
+}
+
+/* Returns the rank of y, the kept axes of x in order, and stores its shape into y_shape. */
+static SN_UINT reduce_y_shape_(SN_UINT mask, SN_UINT rank, const SN_UINT shape[], SN_UINT y_shape[]) {
+    SN_UINT y_rank = 0;
+    for (SN_UINT a = 0; a < rank; ++a) {
+        if (((mask >> a) & 1) == 0) {
+            y_shape[y_rank++] = shape[a];
+        }
+    }
+    return y_rank;
+}
+
+static SN_FLOAT reduce_sum_contiguous_(const SN_FLOAT* x, SN_UINT n) {
+    if (n < REDUCE_LEAF_) {
+        SN_FLOAT sum = 0.0;
+        for (SN_UINT i = 0; i < n; ++i) {
+            sum += x[i];
+        }
+        return sum;
+    }
+    if (n <= REDUCE_BLOCK_) {
+        SN_FLOAT r[REDUCE_LEAF_];
+        for (SN_UINT k = 0; k < REDUCE_LEAF_; ++k) {
+            r[k] = x[k];
+        }
+        SN_UINT i = REDUCE_LEAF_;
+        for (; i + REDUCE_LEAF_ <= n; i += REDUCE_LEAF_) {
+            for (SN_UINT k = 0; k < REDUCE_LEAF_; ++k) {
+                r[k] += x[i + k];
+            }
+        }
+        SN_FLOAT sum = ((r[0] + r[1]) + (r[2] + r[3])) + ((r[4] + r[5]) + (r[6] + r[7]));
+        for (; i < n; ++i) {
+            sum += x[i];
+        }
+        return sum;
+    }
+    SN_UINT half = n / 2;
+    half -= half % REDUCE_LEAF_;
+    return reduce_sum_contiguous_(x, half) + reduce_sum_contiguous_(&(x[half]), n - half);
+}
+
+SN_FLOAT sn_sum_block_(const SN_FLOAT x[], SN_UINT n) {
+    return reduce_sum_contiguous_(x, n);
+}
+
+// An extremum keeps REDUCE_LEAF_ candidates to break the dependency chain.
+#define REDUCE_DEFINE_EXTREMUM_(OP_NAME, COMPARE, EMPTY)                                                            \
+    static SN_FLOAT reduce_##OP_NAME##_contiguous_(const SN_FLOAT* x, SN_UINT n) {                                    \
+        if (n < REDUCE_LEAF_) {                                                                                       \
+            SN_FLOAT y = (n > 0) ? x[0] : (EMPTY);                                                                    \
+            for (SN_UINT i = 1; i < n; ++i) {                                                                         \
+                y = (x[i] COMPARE y) ? x[i] : y;                                                                      \
+            }                                                                                                         \
+            return y;                                                                                                 \
+        }                                                                                                             \
+        SN_FLOAT r[REDUCE_LEAF_];                                                                                     \
+        for (SN_UINT k = 0; k < REDUCE_LEAF_; ++k) {                                                                  \
+            r[k] = x[k];                                                                                              \
+        }                                                                                                             \
+        SN_UINT i = REDUCE_LEAF_;                                                                                     \
+        for (; i + REDUCE_LEAF_ <= n; i += REDUCE_LEAF_) {                                                            \
+            for (SN_UINT k = 0; k < REDUCE_LEAF_; ++k) {                                                              \
+                r[k] = (x[i + k] COMPARE r[k]) ? x[i + k] : r[k];                                                     \
+            }                                                                                                         \
+        }                                                                                                             \
+        for (; i < n; ++i) {                                                                                          \
+            r[0] = (x[i] COMPARE r[0]) ? x[i] : r[0];                                                                 \
+        }                                                                                                             \
+        SN_FLOAT y = r[0];                                                                                            \
+        for (SN_UINT k = 1; k < REDUCE_LEAF_; ++k) {                                                                  \
+            y = (r[k] COMPARE y) ? r[k] : y;                                                                          \
+        }                                                                                                             \
+        return y;                                                                                                     \
+    }
+
+REDUCE_DEFINE_EXTREMUM_(max, >, -INFINITY)
+REDUCE_DEFINE_EXTREMUM_(min, <, INFINITY)
+
+static SN_FLOAT reduce_contiguous_(reduce_kind_ kind, const SN_FLOAT* x, SN_UINT n) {
+    switch (kind) {
+    case REDUCE_MAX_:
+        return reduce_max_contiguous_(x, n);
+    case REDUCE_MIN_:
+        return reduce_min_contiguous_(x, n);
+    default:
+        return reduce_sum_contiguous_(x, n);
+    }
+}
+
+/* Combines the count rows of n elements, step apart from x, into y, or stores the combination if first is true. */
+static void reduce_combine_(reduce_kind_ kind, bool first, SN_UINT count, const SN_FLOAT* x, SN_UINT step, SN_UINT n, SN_FLOAT* y) {
+    SN_UINT r = 0;
+    if (first) {
+        for (SN_UINT c = 0; c < n; ++c) {
+            y[c] = x[c];
+        }
+        r = 1;
+    }
+    switch (kind) {
+    case REDUCE_MAX_:
+        for (; r < count; ++r) {
+            const SN_FLOAT* row = &(x[r * step]);
+            for (SN_UINT c = 0; c < n; ++c) {
+                y[c] = (row[c] > y[c]) ? row[c] : y[c];
+            }
+        }
+        break;
+    case REDUCE_MIN_:
+        for (; r < count; ++r) {
+            const SN_FLOAT* row = &(x[r * step]);
+            for (SN_UINT c = 0; c < n; ++c) {
+                y[c] = (row[c] < y[c]) ? row[c] : y[c];
+            }
+        }
+        break;
+    default:
+        for (; r < count; ++r) {
+            const SN_FLOAT* row = &(x[r * step]);
+            for (SN_UINT c = 0; c < n; ++c) {
+                y[c] += row[c];
+            }
+        }
+    }
+}
+
+typedef struct reduce_context_st_ {
+    reduce_kind_ kind;
+    SN_UINT run;                                   //!< Size of the first group.
+    bool run_reduced;                              //!< True if the first group is reduced.
+    SN_UINT row_count;                             //!< Number of rows of each output.
+    SN_UINT row_group_count;                       //!< Number of reduced groups after the first.
+    SN_UINT row_size[REDUCE_MAX_RANK_ + 1];        //!< Sizes of those groups.
+    SN_UINT row_step[REDUCE_MAX_RANK_ + 1];        //!< Steps of those groups in x.
+    SN_UINT y_group_count;                         //!< Number of kept groups after the first.
+    SN_UINT y_size[REDUCE_MAX_RANK_ + 1];          //!< Sizes of those groups.
+    SN_UINT y_step[REDUCE_MAX_RANK_ + 1];          //!< Steps of those groups in x.
+    const SN_FLOAT* x;
+    SN_FLOAT* y;
+} reduce_context_;
+
+/* Returns the offset in x of an index over the count groups of the given sizes and steps. */
+static SN_UINT reduce_offset_(SN_UINT count, const SN_UINT size[], const SN_UINT step[], SN_UINT index) {
+    SN_UINT offset = 0;
+    for (SN_UINT g = 0; g < count && index > 0; ++g) {
+        offset += (index % size[g]) * step[g];
+        index /= size[g];
+    }
+    return offset;
+}
+
+/* Combines the rows [ begin, end ), at most REDUCE_ROWS_, like reduce_rows_(). Rows are combined by segments within
+   the first of their groups, whose rows follow each other by its step. */
+static void reduce_leaf_(const reduce_context_* c, const SN_FLOAT* x, SN_UINT begin, SN_UINT end, SN_UINT n, SN_FLOAT* y) {
+    SN_FLOAT values[REDUCE_TILE_];
+    SN_UINT step = (c->row_group_count > 0) ? c->row_step[0] : 0;
+    for (SN_UINT r = begin; r < end;) {
+        const SN_FLOAT* row = &(x[r * step]);
+        SN_UINT count = end - r;
+        if (c->row_group_count > 1) {
+            row = &(x[reduce_offset_(c->row_group_count, c->row_size, c->row_step, r)]);
+            count = (c->row_size[0] - r % c->row_size[0] < count) ? c->row_size[0] - r % c->row_size[0] : count;
+        }
+        if (c->run_reduced) { // The outputs of a tile reduce neighbouring runs of the row.
+            for (SN_UINT i = 0; i < count; ++i) {
+                for (SN_UINT j = 0; j < n; ++j) {
+                    values[j] = reduce_contiguous_(c->kind, &(row[i * step + j * c->run]), c->run);
+                }
+                reduce_combine_(c->kind, r + i == begin, 1, values, 0, n, y);
+            }
+        }
+        else {
+            reduce_combine_(c->kind, r == begin, count, row, step, n, y);
+        }
+        r += count;
+    }
 }
 
+/* Combines the rows [ begin, end ) of n <= REDUCE_TILE_ columns from x into y. If the first group is reduced, the
+   columns are contiguous runs reduced first. scratch holds a tile for each lower level of the pairwise tree. */
+static void reduce_rows_(const reduce_context_* c, const SN_FLOAT* x, SN_UINT begin, SN_UINT end, SN_UINT n,
+                         SN_FLOAT* y, SN_FLOAT (*scratch)[REDUCE_TILE_]) {
+    if (end - begin <= REDUCE_ROWS_) {
+        reduce_leaf_(c, x, begin, end, n, y);
+        return;
+    }
+    SN_ASSERT(scratch != NULL);
+    SN_UINT half = (end - begin) / 2;
+    reduce_rows_(c, x, begin, begin + half, n, y, scratch + 1);
+    reduce_rows_(c, x, begin + half, end, n, scratch[0], scratch + 1);
+    reduce_combine_(c->kind, false, 1, scratch[0], 0, n, y);
+}
+
+/* Reduces the outputs [ begin, end ). */
+static void reduce_range_(void* context, SN_UINT begin, SN_UINT end) {
+    const reduce_context_* c = (const reduce_context_*)context;
+    SN_FLOAT scratch[REDUCE_LEVEL_COUNT_][REDUCE_TILE_];
+    // Neighbouring outputs of the first kept group are reduced together, so a row is read once for a tile of them.
+    SN_UINT width = c->run_reduced ? ((c->y_group_count > 0) ? c->y_size[0] : 1) : c->run;
+    for (SN_UINT o = begin; o < end;) {
+        SN_UINT a = o % width;
+        SN_UINT n = (width - a < end - o) ? width - a : end - o;
+        n = (n < REDUCE_TILE_) ? n : REDUCE_TILE_;
+        const SN_FLOAT* x = c->run_reduced ? &(c->x[reduce_offset_(c->y_group_count, c->y_size, c->y_step, o)])
+                                           : &(c->x[reduce_offset_(c->y_group_count, c->y_size, c->y_step, o / width) + a]);
+        reduce_rows_(c, x, 0, c->row_count, n, &(c->y[o]), scratch);
+        o += n;
+    }
+}
+
+/* Reduces x of the given shape over the axes of the mask into y. */
+static void reduce_run_(reduce_kind_ kind, SN_UINT mask, SN_UINT rank, const SN_UINT shape[], const SN_FLOAT* x, SN_FLOAT* y) {
+    reduce_groups_ groups;
+    reduce_groups_init_(&groups, mask, rank, shape);
+    reduce_context_ context;
+    context.kind = kind;
+    context.run = groups.size[0];
+    context.run_reduced = groups.reduced[0];
+    context.row_count = 1;
+    context.row_group_count = 0;
+    context.y_group_count = 0;
+    context.x = x;
+    context.y = y;
+    SN_UINT size = groups.size[0];
+    SN_UINT y_size = groups.reduced[0] ? 1 : groups.size[0];
+    for (SN_UINT g = 1; g < groups.count; ++g) {
+        if (groups.reduced[g]) {
+            context.row_size[context.row_group_count] = groups.size[g];
+            context.row_step[context.row_group_count++] = size;
+            context.row_count *= groups.size[g];
+        }
+        else {
+            context.y_size[context.y_group_count] = groups.size[g];
+            context.y_step[context.y_group_count++] = size;
+            y_size *= groups.size[g];
+        }
+        size *= groups.size[g];
+    }
+    if (size == 0) { // An empty reduction gives the identity, or NaN for a mean.
+        SN_FLOAT empty = (kind == REDUCE_MAX_) ? -INFINITY : (kind == REDUCE_MIN_) ? INFINITY : (kind == REDUCE_MEAN_) ? NAN : 0.0;
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            y[i] = empty;
+        }
+        return;
+    }
+    if (y_size == size) {
+        for (SN_UINT i = 0; i < size; ++i) {
+            y[i] = x[i];
+        }
+        return;
+    }
+    SN_UINT grain = sn_thread_get_threshold() / (size / y_size);
+    sn_thread_parallel_for(y_size, (grain > 0) ? grain : 1, &reduce_range_, &context);
+    if (kind == REDUCE_MEAN_) {
+        SN_FLOAT scale = 1.0 / (SN_FLOAT)groups.reduced_size;
+        for (SN_UINT i = 0; i < y_size; ++i) {
+            y[i] *= scale;
+        }
+    }
+}
+
+// A cursor walks x one run of its first group at a time and follows the offset of the output element of the run.
+typedef struct reduce_cursor_st_ {
+    SN_UINT y_offset;
+    SN_UINT index[REDUCE_MAX_RANK_ + 1];
+    SN_UINT y_stride[REDUCE_MAX_RANK_ + 1];
+} reduce_cursor_;
+
+static void reduce_cursor_init_(reduce_cursor_* cursor, const reduce_groups_* groups) {
+    SN_UINT y_stride = 1;
+    cursor->y_offset = 0;
+    for (SN_UINT g = 0; g < groups->count; ++g) {
+        cursor->index[g] = 0;
+        cursor->y_stride[g] = groups->reduced[g] ? 0 : y_stride;
+        y_stride *= groups->reduced[g] ? 1 : groups->size[g];
+    }
+}
+
+static void reduce_cursor_next_(reduce_cursor_* cursor, const reduce_groups_* groups) {
+    for (SN_UINT g = 1; g < groups->count; ++g) {
+        cursor->y_offset += cursor->y_stride[g];
+        if (++(cursor->index[g]) < groups->size[g]) {
+            return;
+        }
+        cursor->y_offset -= cursor->y_stride[g] * groups->size[g];
+        cursor->index[g] = 0;
+    }
+}
+
+/* Accumulates scale * dy, broadcasted back over the reduced axes, into dx. */
+static void reduce_broadcast_(const reduce_groups_* groups, const SN_FLOAT* dy, SN_FLOAT scale, SN_FLOAT* dx) {
+    SN_UINT run = groups->size[0];
+    SN_UINT size = 1;
+    for (SN_UINT g = 0; g < groups->count; ++g) {
+        size *= groups->size[g];
+    }
+    reduce_cursor_ cursor;
+    reduce_cursor_init_(&cursor, groups);
+    for (SN_UINT begin = 0; begin < size; begin += run) {
+        SN_FLOAT* dx_run = &(dx[begin]);
+        if (groups->reduced[0]) {
+            SN_FLOAT value = scale * dy[cursor.y_offset];
+            for (SN_UINT i = 0; i < run; ++i) {
+                dx_run[i] += value;
+            }
+        }
+        else {
+            const SN_FLOAT* dy_run = &(dy[cursor.y_offset]);
+            for (SN_UINT i = 0; i < run; ++i) {
+                dx_run[i] += scale * dy_run[i];
+            }
+        }
+        reduce_cursor_next_(&cursor, groups);
+    }
+}
+
+/* Returns the position in x of the first element equal to each of the y_size elements of y, or REDUCE_NONE_. */
+static SN_UINT* reduce_arg_(const reduce_groups_* groups, const SN_FLOAT* x, const SN_FLOAT* y, SN_UINT y_size) {
+    SN_UINT* arg = SN_DYNAMIC_ARRAY(SN_UINT, y_size);
+    for (SN_UINT j = 0; j < y_size; ++j) {
+        arg[j] = REDUCE_NONE_;
+    }
+    SN_UINT run = groups->size[0];
+    SN_UINT y_step = groups->reduced[0] ? 0 : 1;
+    SN_UINT size = 1;
+    for (SN_UINT g = 0; g < groups->count; ++g) {
+        size *= groups->size[g];
+    }
+    reduce_cursor_ cursor;
+    reduce_cursor_init_(&cursor, groups);
+    for (SN_UINT begin = 0; begin < size; begin += run) {
+        for (SN_UINT i = 0; i < run; ++i) {
+            SN_UINT j = cursor.y_offset + i * y_step;
+            if (arg[j] == REDUCE_NONE_ && x[begin + i] == y[j]) {
+                arg[j] = begin + i;
+            }
+        }
+        reduce_cursor_next_(&cursor, groups);
+    }
+    return arg;
+}
+
+static sn_mda* reduce_flow_(sn_op* self, reduce_kind_ kind, const sn_mda* x[]) {
+    SN_UINT mask = reduce_mask_(self, x[0]->rank);
+    SN_UINT y_shape[REDUCE_MAX_RANK_];
+    SN_UINT y_rank = reduce_y_shape_(mask, x[0]->rank, x[0]->shape, y_shape);
+    sn_mda* y = sn_mda_create(y_rank, y_shape);
+    reduce_run_(kind, mask, x[0]->rank, x[0]->shape, x[0]->ptr, y->ptr);
+    return y;
+}
+
+static void reduce_kernel_(sn_op* self, reduce_kind_ kind, const sn_mda* x[], sn_mda* y) {
+    reduce_run_(kind, reduce_mask_(self, x[0]->rank), x[0]->rank, x[0]->shape, x[0]->ptr, y->ptr);
+}
+
+// The Jacobian of a reduction to a scalar is a broadcast. Otherwise it is dense with one non-zero element in each column
+// for a sum, and in each row for an extremum, at the first element equal to the output.
+static sn_jac** reduce_dflow_(sn_op* self, reduce_kind_ kind, const sn_mda* x[]) {
+    SN_UINT mask = reduce_mask_(self, x[0]->rank);
+    reduce_groups_ groups;
+    reduce_groups_init_(&groups, mask, x[0]->rank, x[0]->shape);
+    SN_FLOAT scale = (kind == REDUCE_MEAN_) ? 1.0 / (SN_FLOAT)groups.reduced_size : 1.0;
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, 2 * x[0]->rank + 1);
+    SN_UINT y_rank = reduce_y_shape_(mask, x[0]->rank, x[0]->shape, shape);
+    SN_UINT y_size = 1;
+    for (SN_UINT a = 0; a < y_rank; ++a) {
+        y_size *= shape[a];
+    }
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 1);
+    if (y_rank == 0 && (kind == REDUCE_SUM_ || kind == REDUCE_MEAN_)) {
+        dy_dx_list[0] = sn_jac_broadcast(0, NULL, x[0]->rank, x[0]->shape, scale);
+        SN_FREE(shape);
+        return dy_dx_list;
+    }
+    for (SN_UINT a = 0; a < x[0]->rank; ++a) {
+        shape[y_rank + a] = x[0]->shape[a];
+    }
+    sn_mda* dense = sn_mda_full(y_rank + x[0]->rank, shape, 0.0);
+    SN_FREE(shape);
+    SN_UINT x_size = sn_mda_size(x[0]);
+    if (kind == REDUCE_SUM_ || kind == REDUCE_MEAN_) {
+        SN_UINT run = groups.size[0];
+        SN_UINT y_step = groups.reduced[0] ? 0 : 1;
+        reduce_cursor_ cursor;
+        reduce_cursor_init_(&cursor, &groups);
+        for (SN_UINT begin = 0; begin < x_size; begin += run) {
+            for (SN_UINT i = 0; i < run; ++i) {
+                SN_MATRIX_GET(dense->ptr, y_size, cursor.y_offset + i * y_step, begin + i) = scale;
+            }
+            reduce_cursor_next_(&cursor, &groups);
+        }
+    }
+    else {
+        sn_mda* y = reduce_flow_(self, kind, x);
+        SN_UINT* arg = reduce_arg_(&groups, x[0]->ptr, y->ptr, y_size);
+        for (SN_UINT j = 0; j < y_size; ++j) {
+            if (arg[j] != REDUCE_NONE_) {
+                SN_MATRIX_GET(dense->ptr, y_size, j, arg[j]) = 1.0;
+            }
+        }
+        SN_FREE(arg);
+        sn_mda_destroy(y);
+    }
+    dy_dx_list[0] = sn_jac_dense(y_rank, dense);
+    return dy_dx_list;
+}
+
+/* Accumulates the vjp of x whose first rank axes are the ones of a sample, with y and dy of the same leading axes. */
+static void reduce_vjp_run_(sn_op* self, reduce_kind_ kind, SN_UINT rank, const sn_mda* x, const sn_mda* y, const sn_mda* dy, sn_mda* dx) {
+    reduce_groups_ groups;
+    reduce_groups_init_(&groups, reduce_mask_(self, rank), x->rank, x->shape);
+    if (kind == REDUCE_SUM_ || kind == REDUCE_MEAN_) {
+        reduce_broadcast_(&groups, dy->ptr, (kind == REDUCE_MEAN_) ? 1.0 / (SN_FLOAT)groups.reduced_size : 1.0, dx->ptr);
+        return;
+    }
+    SN_UINT y_size = sn_mda_size(y);
+    SN_UINT* arg = reduce_arg_(&groups, x->ptr, y->ptr, y_size);
+    for (SN_UINT j = 0; j < y_size; ++j) {
+        if (arg[j] != REDUCE_NONE_) {
+            dx->ptr[arg[j]] += dy->ptr[j];
+        }
+    }
+    SN_FREE(arg);
+}
+
+static void reduce_vjp_(sn_op* self, reduce_kind_ kind, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    sn_mda* temp = (y == NULL && (kind == REDUCE_MAX_ || kind == REDUCE_MIN_)) ? reduce_flow_(self, kind, x) : NULL;
+    reduce_vjp_run_(self, kind, x[0]->rank, x[0], temp ? temp : y, dy, dx[0]);
+    sn_mda_destroy(temp);
+}
+
+// A batch is one more kept axis after those of a sample.
+static sn_mda* reduce_bflow_(sn_op* self, reduce_kind_ kind, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]) {
+    SN_UINT mask = reduce_mask_(self, x[0]->rank - 1);
+    SN_UINT y_shape[REDUCE_MAX_RANK_ + 1];
+    SN_UINT y_rank = reduce_y_shape_(mask, x[0]->rank, x[0]->shape, y_shape);
+    sn_mda* y = sn_mda_create(y_rank, y_shape);
+    reduce_run_(kind, mask, x[0]->rank, x[0]->shape, x[0]->ptr, y->ptr);
+    return y;
+}
+
+static void reduce_bvjp_(sn_op* self, reduce_kind_ kind, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    sn_mda* temp = (y == NULL && (kind == REDUCE_MAX_ || kind == REDUCE_MIN_)) ? reduce_bflow_(self, kind, batch_count, x, x_batched) : NULL;
+    reduce_vjp_run_(self, kind, x[0]->rank - 1, x[0], temp ? temp : y, dy, dx[0]);
+    sn_mda_destroy(temp);
+}
+
+// The tangents are reduced like a batch. An extremum passes on the tangent of the element it selected.
+static void reduce_jvp_(sn_op* self, reduce_kind_ kind, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy) {
+    SN_UINT mask = reduce_mask_(self, x[0]->rank);
+    SN_UINT y_size = sn_mda_size(y);
+    if (kind == REDUCE_SUM_ || kind == REDUCE_MEAN_) {
+        SN_FLOAT* temp = SN_DYNAMIC_ARRAY(SN_FLOAT, y_size * tangent_count);
+        reduce_run_(kind, mask, dx[0]->rank, dx[0]->shape, dx[0]->ptr, temp);
+        for (SN_UINT i = 0; i < y_size * tangent_count; ++i) {
+            dy->ptr[i] += temp[i];
+        }
+        SN_FREE(temp);
+        return;
+    }
+    reduce_groups_ groups;
+    reduce_groups_init_(&groups, mask, x[0]->rank, x[0]->shape);
+    SN_UINT x_size = sn_mda_size(x[0]);
+    SN_UINT* arg = reduce_arg_(&groups, x[0]->ptr, y->ptr, y_size);
+    for (SN_UINT k = 0; k < tangent_count; ++k) {
+        for (SN_UINT j = 0; j < y_size; ++j) {
+            if (arg[j] != REDUCE_NONE_) {
+                dy->ptr[k * y_size + j] += dx[0]->ptr[k * x_size + arg[j]];
+            }
+        }
+    }
+    SN_FREE(arg);
+}
+
+// Sums are linear and extrema are linear almost everywhere, so their second-order terms vanish.
+static void reduce_hvp_(sn_op* self, const sn_mda* x[], const sn_mda* tx[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+}
+
+static sn_op* reduce_create_(sn_op* x, SN_UINT axis_count, const SN_UINT axes[], sn_flow_fn* flow, sn_dflow_fn* dflow, sn_vjp_fn* vjp,
+                             sn_kernel_fn* kernel, sn_bflow_fn* bflow, sn_bvjp_fn* bvjp, sn_jvp_fn* jvp, const char* name) {
+    SN_UINT mask = (axis_count == 0) ? REDUCE_ALL_ : 0;
+    for (SN_UINT i = 0; i < axis_count; ++i) {
+        SN_ASSERT(axes[i] < REDUCE_MAX_RANK_); // If the axis cannot be held by the mask.
+        mask |= (SN_UINT)1 << axes[i];
+    }
+    sn_op* obj = (sn_op*)SN_MALLOC(sizeof(sn_op) + sizeof(sn_op*) + sizeof(SN_UINT));
+    obj->ref_count = 1;
+    obj->type = OPERATOR;
+    obj->flow = flow;
+    obj->dflow = dflow;
+    obj->vjp = vjp;
+    obj->kernel = kernel;
+    obj->bflow = bflow;
+    obj->bvjp = bvjp;
+    obj->jvp = jvp;
+    obj->hvp = &reduce_hvp_;
+    obj->element_wise = NULL;
+    obj->name = name;
+    obj->x_count = 1;
+    ++(x->ref_count);
+    obj->x[0] = x;
+    *((SN_UINT*)&(obj->x[1])) = mask;
+    return obj;
+}
+
+#define REDUCE_DEFINE_OPERATOR_(OP_NAME, KIND)                                                                                  \
+    static sn_mda* reduce_##OP_NAME##_flow_(sn_op* self, const sn_mda* x[]) {                                                   \
+        return reduce_flow_(self, KIND, x);                                                                                     \
+    }                                                                                                                           \
+    static sn_jac** reduce_##OP_NAME##_dflow_(sn_op* self, const sn_mda* x[]) {                                                 \
+        return reduce_dflow_(self, KIND, x);                                                                                    \
+    }                                                                                                                           \
+    static void reduce_##OP_NAME##_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {      \
+        reduce_vjp_(self, KIND, x, y, dy, dx);                                                                                  \
+    }                                                                                                                           \
+    static void reduce_##OP_NAME##_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {                                         \
+        reduce_kernel_(self, KIND, x, y);                                                                                       \
+    }                                                                                                                           \
+    static sn_mda* reduce_##OP_NAME##_bflow_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]) {     \
+        return reduce_bflow_(self, KIND, batch_count, x, x_batched);                                                            \
+    }                                                                                                                           \
+    static void reduce_##OP_NAME##_bvjp_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[],           \
+                                         const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {                                     \
+        reduce_bvjp_(self, KIND, batch_count, x, x_batched, y, dy, dx);                                                         \
+    }                                                                                                                           \
+    static void reduce_##OP_NAME##_jvp_(sn_op* self, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count,                 \
+                                        const sn_mda* dx[], sn_mda* dy) {                                                       \
+        reduce_jvp_(self, KIND, x, y, tangent_count, dx, dy);                                                                   \
+    }                                                                                                                           \
+    sn_op* sn_reduce_##OP_NAME(sn_op* x, SN_UINT axis_count, const SN_UINT axes[]) {                                            \
+        return reduce_create_(x, axis_count, axes, &reduce_##OP_NAME##_flow_, &reduce_##OP_NAME##_dflow_,                       \
+                              &reduce_##OP_NAME##_vjp_, &reduce_##OP_NAME##_kernel_, &reduce_##OP_NAME##_bflow_,                \
+                              &reduce_##OP_NAME##_bvjp_, &reduce_##OP_NAME##_jvp_, "reduce_" #OP_NAME);                         \
+    }
+
+REDUCE_DEFINE_OPERATOR_(sum, REDUCE_SUM_)
+REDUCE_DEFINE_OPERATOR_(mean, REDUCE_MEAN_)
+REDUCE_DEFINE_OPERATOR_(max, REDUCE_MAX_)
+REDUCE_DEFINE_OPERATOR_(min, REDUCE_MIN_)
+
 
 /* Element-wise binary operators */
 
 static inline SN_FLOAT add_(SN_FLOAT x0, SN_FLOAT x1) { return x0 + x1; }
-SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(add, &add_, NULL);
+static inline SN_FLOAT dadd0_(SN_FLOAT x0, SN_FLOAT x1) { return 1.0; }
+static inline SN_FLOAT dadd1_(SN_FLOAT x0, SN_FLOAT x1) { return 1.0; }
+static inline SN_FLOAT d2add_(SN_FLOAT x0, SN_FLOAT x1) { return 0.0; }
+SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(add, &add_, &dadd0_, &dadd1_, &d2add_, &d2add_, &d2add_);
 static inline SN_FLOAT subtract_(SN_FLOAT x0, SN_FLOAT x1) { return x0 - x1; }
-SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(subtract, &subtract_, NULL);
+static inline SN_FLOAT dsubtract0_(SN_FLOAT x0, SN_FLOAT x1) { return 1.0; }
+static inline SN_FLOAT dsubtract1_(SN_FLOAT x0, SN_FLOAT x1) { return -1.0; }
+static inline SN_FLOAT d2subtract_(SN_FLOAT x0, SN_FLOAT x1) { return 0.0; }
+SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(subtract, &subtract_, &dsubtract0_, &dsubtract1_, &d2subtract_, &d2subtract_, &d2subtract_);
 static inline SN_FLOAT multiply_(SN_FLOAT x0, SN_FLOAT x1) { return x0 * x1; }
-SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(multiply, &multiply_, NULL);
+static inline SN_FLOAT dmultiply0_(SN_FLOAT x0, SN_FLOAT x1) { return x1; }
+static inline SN_FLOAT dmultiply1_(SN_FLOAT x0, SN_FLOAT x1) { return x0; }
+static inline SN_FLOAT d2multiply00_(SN_FLOAT x0, SN_FLOAT x1) { return 0.0; }
+static inline SN_FLOAT d2multiply01_(SN_FLOAT x0, SN_FLOAT x1) { return 1.0; }
+static inline SN_FLOAT d2multiply11_(SN_FLOAT x0, SN_FLOAT x1) { return 0.0; }
+SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(multiply, &multiply_, &dmultiply0_, &dmultiply1_, &d2multiply00_, &d2multiply01_, &d2multiply11_);
 static inline SN_FLOAT divide_(SN_FLOAT x0, SN_FLOAT x1) { return x0 / x1; }
-SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(divide, &divide_, NULL);
+static inline SN_FLOAT ddivide0_(SN_FLOAT x0, SN_FLOAT x1) { return (SN_FLOAT)1.0 / x1; }
+static inline SN_FLOAT ddivide1_(SN_FLOAT x0, SN_FLOAT x1) { return -x0 / (x1 * x1); }
+static inline SN_FLOAT d2divide00_(SN_FLOAT x0, SN_FLOAT x1) { return 0.0; }
+static inline SN_FLOAT d2divide01_(SN_FLOAT x0, SN_FLOAT x1) { return -(SN_FLOAT)1.0 / (x1 * x1); }
+static inline SN_FLOAT d2divide11_(SN_FLOAT x0, SN_FLOAT x1) { return (SN_FLOAT)2.0 * x0 / (x1 * x1 * x1); }
+SN_DEFINE_ELEMENT_WISE_BINARY_OPERATOR(divide, &divide_, &ddivide0_, &ddivide1_, &d2divide00_, &d2divide01_, &d2divide11_);
 
 
 /* Binary operators */
 
+static void matmul_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {
+    sn_mda_gmatmul_into(x[0], x[1], *((SN_UINT*)&(self->x[2])), y);
+}
 static sn_mda* matmul_flow_(sn_op * self, const sn_mda* x[]) {
     return sn_mda_gmatmul(x[0], x[1], *((SN_UINT*)&(self->x[2])));
 }
-static sn_mda** matmul_dflow_(sn_op* self, const sn_mda* x[]) {
-    /* !!! Not implemented !!! */
-    return NULL;
+static sn_jac** matmul_dflow_(sn_op* self, const sn_mda* x[]) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    SN_UINT overwrap_size = 1;
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        overwrap_size *= x[1]->shape[i];
+    }
+    SN_UINT x0_front_rank = x[0]->rank - overwrap;
+    SN_UINT x1_back_rank = x[1]->rank - overwrap;
+    SN_UINT x0_front_size = sn_mda_size(x[0]) / overwrap_size;
+    SN_UINT x1_back_size = sn_mda_size(x[1]) / overwrap_size;
+    SN_UINT y_size = x0_front_size * x1_back_size;
+
+    // Shape of ( y.shape, x0.shape ) followed by the shape of x1.
+    SN_UINT* shape = SN_DYNAMIC_ARRAY(SN_UINT, x0_front_rank + x1_back_rank + x[0]->rank + x[1]->rank);
+    for (SN_UINT i = 0; i < x0_front_rank; ++i) {
+        shape[i] = x[0]->shape[i];
+    }
+    for (SN_UINT i = 0; i < x1_back_rank; ++i) {
+        shape[x0_front_rank + i] = x[1]->shape[overwrap + i];
+    }
+    for (SN_UINT i = 0; i < x[0]->rank; ++i) {
+        shape[x0_front_rank + x1_back_rank + i] = x[0]->shape[i];
+    }
+    sn_mda* dy_dx0 = sn_mda_full(x0_front_rank + x1_back_rank + x[0]->rank, shape, 0.0);
+    for (SN_UINT i = 0; i < x[1]->rank; ++i) {
+        shape[x0_front_rank + x1_back_rank + i] = x[1]->shape[i];
+    }
+    sn_mda* dy_dx1 = sn_mda_full(x0_front_rank + x1_back_rank + x[1]->rank, shape, 0.0);
+    SN_FREE(shape);
+
+    for (SN_UINT j = 0; j < x1_back_size; ++j) {
+        for (SN_UINT k = 0; k < overwrap_size; ++k) {
+            for (SN_UINT i = 0; i < x0_front_size; ++i) {
+                // d y[i, j] / d x0[i, k] = x1[k, j] and d y[i, j] / d x1[k, j] = x0[i, k]
+                SN_MATRIX_GET(dy_dx0->ptr, y_size, i + j * x0_front_size, i + k * x0_front_size) = SN_MATRIX_GET(x[1]->ptr, overwrap_size, k, j);
+                SN_MATRIX_GET(dy_dx1->ptr, y_size, i + j * x0_front_size, k + j * overwrap_size) = SN_MATRIX_GET(x[0]->ptr, x0_front_size, i, k);
+            }
+        }
+    }
+
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, 2);
+    dy_dx_list[0] = sn_jac_dense(x0_front_rank + x1_back_rank, dy_dx0);
+    dy_dx_list[1] = sn_jac_dense(x0_front_rank + x1_back_rank, dy_dx1);
+    return dy_dx_list;
+}
+static void matmul_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    SN_UINT overwrap_size = 1;
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        overwrap_size *= x[1]->shape[i];
+    }
+    SN_UINT x0_front_size = sn_mda_size(x[0]) / overwrap_size;
+    SN_UINT x1_back_size = sn_mda_size(x[1]) / overwrap_size;
+    if (dx[0]) { // dx0 += dy * transpose(x1)
+        sn_gemm(x0_front_size, overwrap_size, x1_back_size,
+            dy->ptr, 1, x0_front_size, x[1]->ptr, overwrap_size, 1, dx[0]->ptr, x0_front_size, true);
+    }
+    if (dx[1]) { // dx1 += transpose(x0) * dy
+        sn_gemm(overwrap_size, x1_back_size, x0_front_size,
+            x[0]->ptr, x0_front_size, 1, dy->ptr, 1, x0_front_size, dx[1]->ptr, overwrap_size, true);
+    }
+}
+/* Returns the sizes of a sample of x0 = ( front, overwrap ) and x1 = ( overwrap, back ). */
+static void matmul_batch_sizes_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], SN_UINT* front, SN_UINT* overwrap_size, SN_UINT* back) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    *overwrap_size = 1;
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        *overwrap_size *= x[1]->shape[i];
+    }
+    *front = sn_mda_size(x[0]) / (x_batched[0] ? batch_count : 1) / *overwrap_size;
+    *back = sn_mda_size(x[1]) / (x_batched[1] ? batch_count : 1) / *overwrap_size;
+}
+// A batch is lowered to a single GEMM when a shared matrix multiplies every sample, W * [ x_1 ... x_n ] or [ x_1; ...; x_n ] * W
+// for row vectors. Otherwise every sample is multiplied by its own GEMM.
+static sn_mda* matmul_bflow_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[]) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    SN_UINT front, overwrap_size, back;
+    matmul_batch_sizes_(self, batch_count, x, x_batched, &front, &overwrap_size, &back);
+    SN_UINT x0_front_rank = (x_batched[0] ? x[0]->rank - 1 : x[0]->rank) - overwrap;
+    SN_UINT x1_back_rank = (x_batched[1] ? x[1]->rank - 1 : x[1]->rank) - overwrap;
+    SN_UINT* y_shape = SN_DYNAMIC_ARRAY(SN_UINT, x0_front_rank + x1_back_rank + 1);
+    for (SN_UINT i = 0; i < x0_front_rank; ++i) {
+        y_shape[i] = x[0]->shape[i];
+    }
+    for (SN_UINT i = 0; i < x1_back_rank; ++i) {
+        y_shape[x0_front_rank + i] = x[1]->shape[overwrap + i];
+    }
+    y_shape[x0_front_rank + x1_back_rank] = batch_count;
+    sn_mda* y = sn_mda_create(x0_front_rank + x1_back_rank + 1, y_shape);
+    SN_FREE(y_shape);
+
+    if (!x_batched[0]) { // y = x0 * [ x1_1 ... x1_n ]
+        sn_gemm(front, back * batch_count, overwrap_size, x[0]->ptr, 1, front, x[1]->ptr, 1, overwrap_size, y->ptr, front, false);
+    }
+    else if (!x_batched[1] && front == 1) { // transpose(y) = transpose(x1) * [ transpose(x0_1) ... transpose(x0_n) ]
+        sn_gemm(back, batch_count, overwrap_size, x[1]->ptr, overwrap_size, 1, x[0]->ptr, 1, overwrap_size, y->ptr, back, false);
+    }
+    else {
+        for (SN_UINT s = 0; s < batch_count; ++s) {
+            sn_gemm(front, back, overwrap_size,
+                &(x[0]->ptr[s * front * overwrap_size]), 1, front,
+                &(x[1]->ptr[x_batched[1] ? s * overwrap_size * back : 0]), 1, overwrap_size,
+                &(y->ptr[s * front * back]), front, false);
+        }
+    }
+    return y;
+}
+static void matmul_bvjp_(sn_op* self, SN_UINT batch_count, const sn_mda* x[], const bool x_batched[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_UINT front, overwrap_size, back;
+    matmul_batch_sizes_(self, batch_count, x, x_batched, &front, &overwrap_size, &back);
+    if (dx[0]) { // dx0 += dy * transpose(x1)
+        if (!x_batched[1] && front == 1) {
+            sn_gemm(overwrap_size, batch_count, back, x[1]->ptr, 1, overwrap_size, dy->ptr, 1, back, dx[0]->ptr, overwrap_size, true);
+        }
+        else {
+            for (SN_UINT s = 0; s < batch_count; ++s) {
+                sn_gemm(front, overwrap_size, back,
+                    &(dy->ptr[s * front * back]), 1, front,
+                    &(x[1]->ptr[x_batched[1] ? s * overwrap_size * back : 0]), overwrap_size, 1,
+                    &(dx[0]->ptr[s * front * overwrap_size]), front, true);
+            }
+        }
+    }
+    if (dx[1]) { // dx1 += transpose(x0) * dy
+        if (!x_batched[0]) {
+            sn_gemm(overwrap_size, back * batch_count, front, x[0]->ptr, front, 1, dy->ptr, 1, front, dx[1]->ptr, overwrap_size, true);
+        }
+        else {
+            for (SN_UINT s = 0; s < batch_count; ++s) {
+                sn_gemm(overwrap_size, back, front,
+                    &(x[0]->ptr[s * front * overwrap_size]), front, 1,
+                    &(dy->ptr[s * front * back]), 1, front,
+                    &(dx[1]->ptr[s * overwrap_size * back]), overwrap_size, true);
+            }
+        }
+    }
+}
+// The tangents of x1 are a single matrix of ( overwrap, back * tangent_count ), so x0 multiplies all of them at once.
+static void matmul_jvp_(sn_op* self, const sn_mda* x[], const sn_mda* y, SN_UINT tangent_count, const sn_mda* dx[], sn_mda* dy) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    SN_UINT overwrap_size = 1;
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        overwrap_size *= x[1]->shape[i];
+    }
+    SN_UINT front = sn_mda_size(x[0]) / overwrap_size;
+    SN_UINT back = sn_mda_size(x[1]) / overwrap_size;
+    if (dx[1]) {
+        sn_gemm(front, back * tangent_count, overwrap_size, x[0]->ptr, 1, front, dx[1]->ptr, 1, overwrap_size, dy->ptr, front, true);
+    }
+    if (dx[0]) {
+        for (SN_UINT k = 0; k < tangent_count; ++k) {
+            sn_gemm(front, back, overwrap_size, &(dx[0]->ptr[k * front * overwrap_size]), 1, front,
+                x[1]->ptr, 1, overwrap_size, &(dy->ptr[k * front * back]), front, true);
+        }
+    }
+}
+
+// The product is bilinear, so the vjp of each input is differentiated along the tangent of the other one only.
+static void matmul_hvp_(sn_op* self, const sn_mda* x[], const sn_mda* tx[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    SN_UINT overwrap = *((SN_UINT*)&(self->x[2]));
+    SN_UINT overwrap_size = 1;
+    for (SN_UINT i = 0; i < overwrap; ++i) {
+        overwrap_size *= x[1]->shape[i];
+    }
+    SN_UINT front = sn_mda_size(x[0]) / overwrap_size;
+    SN_UINT back = sn_mda_size(x[1]) / overwrap_size;
+    if (dx[0] && tx[1]) { // dx0 += dy * transpose(tx1)
+        sn_gemm(front, overwrap_size, back, dy->ptr, 1, front, tx[1]->ptr, overwrap_size, 1, dx[0]->ptr, front, true);
+    }
+    if (dx[1] && tx[0]) { // dx1 += transpose(tx0) * dy
+        sn_gemm(overwrap_size, back, front, tx[0]->ptr, front, 1, dy->ptr, 1, front, dx[1]->ptr, overwrap_size, true);
+    }
 }
 sn_op* sn_matmul(sn_op* x0, sn_op* x1, SN_UINT overwrap) {
     sn_op* obj = (sn_op*)SN_MALLOC(sizeof(sn_op) + 2 * sizeof(sn_op*) + sizeof(SN_UINT));
@@ -138,7 +1478,17 @@ sn_op* sn_matmul(sn_op* x0, sn_op* x1, SN_UINT overwrap) {
     obj->type = OPERATOR;
     obj->flow = &matmul_flow_;
     obj->dflow = &matmul_dflow_;
+    obj->vjp = &matmul_vjp_;
+    obj->kernel = &matmul_kernel_;
+    obj->bflow = &matmul_bflow_;
+    obj->bvjp = &matmul_bvjp_;
+    obj->jvp = &matmul_jvp_;
+    obj->hvp = &matmul_hvp_;
+    obj->element_wise = NULL;
+    obj->name = "matmul";
     obj->x_count = 2;
+    ++(x0->ref_count);
+    ++(x1->ref_count);
     obj->x[0] = x0;
     obj->x[1] = x1;
     *((SN_UINT*)&(obj->x[2])) = overwrap;
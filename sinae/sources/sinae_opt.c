@@ -0,0 +1,894 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_opt.c
+//! \brief This file implements sinae_opt.h.
+
+#include "../sinae_opt.h"
+#include "../sinae_file.h"
+#include "../sinae_graph.h"
+#include "../sinae_op.h"
+#include "../sinae_thread.h"
+#include "../sinae_view.h"
+
+#include <stdint.h>
+#include <string.h>
+
+
+/* Fused operator */
+
+// A fused operator stores its program right after its inputs. The operand k < x_count is the input k,
+// and the operand x_count + s is the result of the step s. The last step gives the output, or its sum if reduction is set.
+typedef struct fuse_step_st_ {
+    const sn_element_wise* element_wise;
+    SN_UINT operand_count;
+    SN_UINT operand[2];
+} fuse_step_;
+
+typedef struct fuse_program_st_ {
+    bool reduction;
+    SN_UINT step_count;
+    fuse_step_ steps[];
+} fuse_program_;
+
+static inline fuse_program_* fuse_program_of_(const sn_op* op) {
+    return (fuse_program_*)&(op->x[op->x_count]);
+}
+
+// An input is read with a step of 1 if it has the size of the output and with a step of 0 if it has a single element.
+// Otherwise it is gathered into its register tile through a sn_view_loop built on the stack, so a kernel does not allocate.
+#define FUSE_MAX_X_COUNT_ (SN_FUSE_MAX_LENGTH + 1)
+#define FUSE_REGISTER_COUNT_ (FUSE_MAX_X_COUNT_ + SN_FUSE_MAX_LENGTH)
+#define FUSE_GATHERED_ (~(SN_UINT)0)
+
+typedef struct fuse_context_st_ {
+    const fuse_program_* program;
+    const sn_mda** x;
+    SN_UINT x_count;
+    SN_UINT size;
+    SN_UINT x_step[FUSE_MAX_X_COUNT_]; //!< 1, 0 or FUSE_GATHERED_.
+    const sn_view_loop* loop;          //!< Loop over the inputs broadcasted to each other, or NULL if none is gathered.
+    sn_mda* y;
+} fuse_context_;
+
+/* Initializes the context of the inputs broadcasted to each other, building the loop in the storage if it is needed.
+   Returns false if the loop does not fit in the storage. */
+static bool fuse_context_init_(fuse_context_* context, const sn_op* self, const sn_mda* x[], sn_view_loop_storage* storage, sn_mda* y) {
+    SN_ASSERT(self->x_count <= FUSE_MAX_X_COUNT_); // If the program reads more inputs than it has steps.
+    context->program = fuse_program_of_(self);
+    context->x = x;
+    context->x_count = self->x_count;
+    context->loop = NULL;
+    context->y = y;
+    SN_UINT max_rank = 0;
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        max_rank = (x[k]->rank > max_rank) ? x[k]->rank : max_rank;
+    }
+    context->size = 1;
+    for (SN_UINT i = 0; i < max_rank; ++i) {
+        SN_UINT size = 1;
+        for (SN_UINT k = 0; k < self->x_count; ++k) {
+            SN_UINT x_size = (i < x[k]->rank) ? x[k]->shape[i] : 1;
+            SN_ASSERT(x_size == 1 || size == 1 || x_size == size); // If the inputs cannot be broadcasted.
+            size = (x_size != 1) ? x_size : size;
+        }
+        context->size *= size;
+    }
+    bool is_gathered = false;
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        SN_UINT x_size = sn_mda_size(x[k]);
+        context->x_step[k] = (x_size == context->size) ? 1 : (x_size == 1) ? 0 : FUSE_GATHERED_;
+        is_gathered = is_gathered || (context->x_step[k] == FUSE_GATHERED_);
+    }
+    if (is_gathered) {
+        context->loop = sn_view_loop_broadcast_in(storage, self->x_count, x, 0, NULL);
+        return context->loop != NULL;
+    }
+    return true;
+}
+
+typedef struct fuse_gather_st_ {
+    const fuse_context_* context;
+    SN_FLOAT (*registers)[SN_FUSE_TILE];
+    SN_UINT begin;
+} fuse_gather_;
+
+static void fuse_gather_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    fuse_gather_* gather = (fuse_gather_*)context;
+    const fuse_context_* fuse = gather->context;
+    for (SN_UINT k = 0; k < fuse->x_count; ++k) {
+        if (fuse->x_step[k] == FUSE_GATHERED_) {
+            const SN_FLOAT* x = &(fuse->x[k]->ptr[offset[k]]);
+            SN_FLOAT* tile = &(gather->registers[k][position - gather->begin]);
+            for (SN_UINT i = 0; i < n; ++i) {
+                tile[i] = x[i * step[k]];
+            }
+        }
+    }
+}
+
+// Used by flow, vjp and dflow, which allocate anyway, and by a kernel whose loop does not fit, to get the full shape of the output.
+typedef struct fuse_shape_st_ {
+    SN_UINT rank;
+    SN_UINT size;
+    SN_UINT shape[];
+} fuse_shape_;
+
+static fuse_shape_* fuse_shape_create_(const sn_op* self, const sn_mda* x[]) {
+    SN_UINT max_rank = 0;
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        max_rank = (x[k]->rank > max_rank) ? x[k]->rank : max_rank;
+    }
+    fuse_shape_* obj = (fuse_shape_*)SN_MALLOC(sizeof(fuse_shape_) + max_rank * sizeof(SN_UINT));
+    obj->rank = 0;
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        bool is_broadcastable = sn_broadcast_shape(obj->rank, obj->shape, x[k]->rank, x[k]->shape, &(obj->rank), obj->shape);
+        SN_ASSERT(is_broadcastable); // If the inputs cannot be broadcasted.
+        (void)is_broadcastable;
+    }
+    obj->size = 1;
+    for (SN_UINT i = 0; i < obj->rank; ++i) {
+        obj->size *= obj->shape[i];
+    }
+    return obj;
+}
+
+/* Returns the inputs with every partially broadcasted one expanded to the shape of the output, or NULL if there is none.
+   The others have the shape of the output or a single element, which the tiles read with a step of 1 or 0. */
+static const sn_mda** fuse_expand_(const sn_op* self, const sn_mda* x[], const fuse_shape_* shape) {
+    const sn_mda** expanded = NULL;
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        SN_UINT size = sn_mda_size(x[k]);
+        if (size != 1 && size != shape->size) {
+            if (expanded == NULL) {
+                expanded = SN_DYNAMIC_ARRAY(const sn_mda*, self->x_count);
+                for (SN_UINT j = 0; j < self->x_count; ++j) {
+                    expanded[j] = x[j];
+                }
+            }
+            sn_view* view = sn_view_create((sn_mda*)x[k]);
+            sn_view* broadcasted = sn_view_broadcast(view, shape->rank, shape->shape);
+            expanded[k] = sn_view_to_mda(broadcasted);
+            sn_view_destroy(broadcasted);
+            sn_view_destroy(view);
+        }
+    }
+    return expanded;
+}
+
+static void fuse_expanded_destroy_(const sn_op* self, const sn_mda* x[], const sn_mda** expanded) {
+    if (expanded) {
+        for (SN_UINT k = 0; k < self->x_count; ++k) {
+            if (expanded[k] != x[k]) {
+                sn_mda_destroy((sn_mda*)expanded[k]);
+            }
+        }
+        SN_FREE(expanded);
+    }
+}
+
+/* Returns the elements [ begin, begin + SN_FUSE_TILE ) of an operand, whose step is stored into step.
+   A gathered input and the result of a step are read from their register tiles. */
+static inline const SN_FLOAT* fuse_operand_(const fuse_context_* context, SN_FLOAT registers[][SN_FUSE_TILE], SN_UINT operand, SN_UINT begin, SN_UINT* step) {
+    if (operand < context->x_count && context->x_step[operand] != FUSE_GATHERED_) {
+        *step = context->x_step[operand];
+        return &(context->x[operand]->ptr[begin * *step]);
+    }
+    *step = 1;
+    return registers[operand];
+}
+
+/* Runs every step over the n elements from begin. The last step writes into last instead if it is not NULL. */
+static void fuse_tile_flow_(const fuse_context_* context, SN_UINT begin, SN_UINT n, SN_FLOAT registers[][SN_FUSE_TILE], SN_FLOAT* last) {
+    const fuse_program_* program = context->program;
+    if (context->loop) {
+        fuse_gather_ gather = { context, registers, begin };
+        sn_view_loop_run(context->loop, begin, begin + n, &fuse_gather_run_, &gather);
+    }
+    for (SN_UINT s = 0; s < program->step_count; ++s) {
+        const fuse_step_* step = &(program->steps[s]);
+        SN_UINT step0, step1;
+        const SN_FLOAT* x0 = fuse_operand_(context, registers, step->operand[0], begin, &step0);
+        const SN_FLOAT* x1 = fuse_operand_(context, registers, step->operand[1], begin, &step1);
+        SN_FLOAT* y = (last != NULL && s + 1 == program->step_count) ? last : registers[context->x_count + s];
+        step->element_wise->flow(n, x0, step0, x1, step1, y);
+    }
+}
+
+static void fuse_range_(void* context, SN_UINT begin, SN_UINT end) {
+    fuse_context_* fuse = (fuse_context_*)context;
+    SN_FLOAT registers[FUSE_REGISTER_COUNT_][SN_FUSE_TILE];
+    for (SN_UINT tile = begin; tile < end; tile += SN_FUSE_TILE) {
+        SN_UINT n = (end - tile < SN_FUSE_TILE) ? end - tile : SN_FUSE_TILE;
+        fuse_tile_flow_(fuse, tile, n, registers, &(fuse->y->ptr[tile]));
+    }
+}
+
+// sn_thread_reduce() passes one block at a time, whose results are summed by sn_sum_block_() like sn_sum() does,
+// so that a fused sum gives the same bits.
+static SN_FLOAT fuse_reduce_range_(void* context, SN_UINT begin, SN_UINT end) {
+    fuse_context_* fuse = (fuse_context_*)context;
+    SN_FLOAT registers[FUSE_REGISTER_COUNT_][SN_FUSE_TILE];
+    SN_FLOAT block[SN_THREAD_BLOCK];
+    SN_ASSERT(end - begin <= SN_THREAD_BLOCK);
+    for (SN_UINT tile = begin; tile < end; tile += SN_FUSE_TILE) {
+        SN_UINT n = (end - tile < SN_FUSE_TILE) ? end - tile : SN_FUSE_TILE;
+        fuse_tile_flow_(fuse, tile, n, registers, &(block[tile - begin]));
+    }
+    return sn_sum_block_(block, end - begin);
+}
+
+static void fuse_run_(fuse_context_* context) {
+    if (context->program->reduction) {
+        context->y->ptr[0] = sn_thread_reduce(context->size, &fuse_reduce_range_, context);
+    }
+    else {
+        sn_thread_parallel_for(context->size, sn_thread_get_threshold(), &fuse_range_, context);
+    }
+}
+
+static void fuse_kernel_(sn_op* self, const sn_mda* x[], sn_mda* y) {
+    sn_view_loop_storage storage;
+    fuse_context_ context;
+    if (fuse_context_init_(&context, self, x, &storage, y)) {
+        fuse_run_(&context);
+        return;
+    }
+    // The loop has too many merged axes to gather an input, which is expanded instead.
+    fuse_shape_* shape = fuse_shape_create_(self, x);
+    const sn_mda** expanded = fuse_expand_(self, x, shape);
+    fuse_context_init_(&context, self, expanded, &storage, y);
+    fuse_run_(&context);
+    fuse_expanded_destroy_(self, x, expanded);
+    SN_FREE(shape);
+}
+
+static sn_mda* fuse_flow_(sn_op* self, const sn_mda* x[]) {
+    fuse_shape_* shape = fuse_shape_create_(self, x);
+    sn_mda* y = fuse_program_of_(self)->reduction ? sn_mda_create(0, NULL) : sn_mda_create(shape->rank, shape->shape);
+    SN_FREE(shape);
+    fuse_kernel_(self, x, y);
+    return y;
+}
+
+// Every tile is evaluated again and its adjoints are propagated through the steps in reverse.
+// The adjoint of the last step is dy itself, or dy broadcasted if reduction is set.
+// The adjoint of an expanded input is accumulated in its expanded shape and then summed into dx.
+static void fuse_vjp_(sn_op* self, const sn_mda* x[], const sn_mda* y, const sn_mda* dy, sn_mda* dx[]) {
+    fuse_shape_* shape = fuse_shape_create_(self, x);
+    const sn_mda** expanded = fuse_expand_(self, x, shape);
+    sn_mda** expanded_dx = dx;
+    if (expanded) {
+        expanded_dx = SN_DYNAMIC_ARRAY(sn_mda*, self->x_count);
+        for (SN_UINT k = 0; k < self->x_count; ++k) {
+            expanded_dx[k] = (dx[k] && expanded[k] != x[k]) ? sn_mda_full(shape->rank, shape->shape, 0.0) : dx[k];
+        }
+    }
+    sn_view_loop_storage storage;
+    fuse_context_ context;
+    fuse_context_init_(&context, self, expanded ? expanded : x, &storage, NULL);
+    const fuse_program_* program = context.program;
+    SN_UINT size = shape->size;
+    SN_FLOAT registers[FUSE_REGISTER_COUNT_][SN_FUSE_TILE];
+    SN_FLOAT adjoints[SN_FUSE_MAX_LENGTH][SN_FUSE_TILE];
+    SN_FLOAT broadcasted[SN_FUSE_TILE];
+    if (program->reduction) {
+        for (SN_UINT i = 0; i < SN_FUSE_TILE; ++i) {
+            broadcasted[i] = dy->ptr[0];
+        }
+    }
+    for (SN_UINT tile = 0; tile < size; tile += SN_FUSE_TILE) {
+        SN_UINT n = (size - tile < SN_FUSE_TILE) ? size - tile : SN_FUSE_TILE;
+        fuse_tile_flow_(&context, tile, n, registers, NULL);
+        for (SN_UINT s = 0; s + 1 < program->step_count; ++s) {
+            for (SN_UINT i = 0; i < n; ++i) {
+                adjoints[s][i] = 0.0;
+            }
+        }
+        for (SN_UINT s = program->step_count; s-- > 0;) {
+            const fuse_step_* step = &(program->steps[s]);
+            const SN_FLOAT* step_dy = (s + 1 < program->step_count) ? adjoints[s] : (program->reduction ? broadcasted : &(dy->ptr[tile]));
+            const SN_FLOAT* x_operand[2];
+            SN_FLOAT* dx_operand[2] = { NULL, NULL };
+            SN_UINT x_step[2];
+            for (SN_UINT k = 0; k < 2; ++k) {
+                SN_UINT operand = step->operand[k];
+                x_operand[k] = fuse_operand_(&context, registers, operand, tile, &(x_step[k]));
+                if (k >= step->operand_count) {
+                    continue;
+                }
+                if (operand >= self->x_count) {
+                    dx_operand[k] = adjoints[operand - self->x_count];
+                }
+                else if (expanded_dx[operand]) {
+                    dx_operand[k] = &(expanded_dx[operand]->ptr[tile * x_step[k]]);
+                }
+            }
+            step->element_wise->vjp(n, x_operand[0], x_step[0], x_operand[1], x_step[1], step_dy, dx_operand[0], dx_operand[1]);
+        }
+    }
+
+    if (expanded) {
+        for (SN_UINT k = 0; k < self->x_count; ++k) {
+            if (expanded_dx[k] != dx[k]) {
+                sn_view* view = sn_view_create(dx[k]);
+                sn_view* broadcasted_view = sn_view_broadcast(view, shape->rank, shape->shape);
+                sn_view* expanded_view = sn_view_create(expanded_dx[k]);
+                sn_view_accumulate(broadcasted_view, expanded_view);
+                sn_view_destroy(expanded_view);
+                sn_view_destroy(broadcasted_view);
+                sn_view_destroy(view);
+                sn_mda_destroy(expanded_dx[k]);
+            }
+        }
+        SN_FREE(expanded_dx);
+    }
+    fuse_expanded_destroy_(self, x, expanded);
+    SN_FREE(shape);
+}
+
+// The Jacobians are diagonal, or have one non-zero element in each row, or are a single row of a scalar output,
+// so they are read from one vjp with ones, after every input is expanded so that its derivatives are not summed.
+static sn_jac** fuse_dflow_(sn_op* self, const sn_mda* x[]) {
+    const fuse_program_* program = fuse_program_of_(self);
+    fuse_shape_* shape = fuse_shape_create_(self, x);
+    const sn_mda** expanded = SN_DYNAMIC_ARRAY(const sn_mda*, self->x_count);
+    sn_mda** derivatives = SN_DYNAMIC_ARRAY(sn_mda*, self->x_count);
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        sn_view* view = sn_view_create((sn_mda*)x[k]);
+        sn_view* broadcasted = sn_view_broadcast(view, shape->rank, shape->shape);
+        expanded[k] = sn_view_to_mda(broadcasted);
+        sn_view_destroy(broadcasted);
+        sn_view_destroy(view);
+        derivatives[k] = sn_mda_full(shape->rank, shape->shape, 0.0);
+    }
+    sn_mda* ones = program->reduction ? sn_mda_full(0, NULL, 1.0) : sn_mda_full(shape->rank, shape->shape, 1.0);
+    fuse_vjp_(self, expanded, NULL, ones, derivatives);
+    sn_mda_destroy(ones);
+
+    sn_jac** dy_dx_list = SN_DYNAMIC_ARRAY(sn_jac*, self->x_count);
+    for (SN_UINT k = 0; k < self->x_count; ++k) {
+        if (!program->reduction) {
+            dy_dx_list[k] = sn_jac_expand(derivatives[k], x[k]->rank, x[k]->shape);
+        }
+        else { // The row of a scalar output sums the derivatives of the elements read from each element of x.
+            sn_mda* row = sn_mda_full(x[k]->rank, x[k]->shape, 0.0);
+            sn_view* view = sn_view_create(row);
+            sn_view* broadcasted = sn_view_broadcast(view, shape->rank, shape->shape);
+            sn_view* derivatives_view = sn_view_create(derivatives[k]);
+            sn_view_accumulate(broadcasted, derivatives_view);
+            sn_view_destroy(derivatives_view);
+            sn_view_destroy(broadcasted);
+            sn_view_destroy(view);
+            sn_mda_destroy(derivatives[k]);
+            dy_dx_list[k] = sn_jac_dense(0, row);
+        }
+        sn_mda_destroy((sn_mda*)expanded[k]);
+    }
+    SN_FREE(derivatives);
+    SN_FREE(expanded);
+    SN_FREE(shape);
+    return dy_dx_list;
+}
+
+
+/* Graph rewriting */
+
+/* Counts the consumers of every node of the graph. */
+static SN_UINT* opt_consumer_count_(const sn_graph* graph) {
+    SN_UINT* consumer_count = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        consumer_count[i] = 0;
+    }
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            ++(consumer_count[x_index[j]]);
+        }
+    }
+    return consumer_count;
+}
+
+/* Returns the largest number of inputs of a node. */
+static SN_UINT opt_x_capacity_(const sn_graph* graph) {
+    SN_UINT x_capacity = 1;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
+        }
+    }
+    return x_capacity;
+}
+
+/* Frees a node removed from its graph, with the array of a constant. */
+static void opt_free_(sn_op* op) {
+    if (op->type == CONSTANT) {
+        sn_mda_destroy(*((sn_mda**)(op->x)));
+    }
+    SN_MEMORY_FORGET(op);
+    SN_FREE(op);
+}
+
+/* Returns the node which replaces the node at position p. */
+static inline sn_op* opt_replaced_(const sn_graph* graph, sn_op* replacement[], SN_UINT p) {
+    return replacement[p] ? replacement[p] : graph->ops[p];
+}
+
+
+/* Element-wise fusion */
+
+/* Returns true if the operator can be a member of a fused operator and the graph owns every reference to it. */
+static bool fuse_is_candidate_(const sn_op* op, SN_UINT consumer_count) {
+    return op->type == OPERATOR && op->element_wise != NULL && op->ref_count == consumer_count + 1;
+}
+
+/* Creates the fused operator of the group whose sink is at position sink. The members are marked with the sink in group. */
+static sn_op* fuse_create_(const sn_graph* graph, const SN_UINT group[], SN_UINT sink, sn_op* replacement[]) {
+    // The inputs are the distinct nodes outside of the group, which are already replaced if they are fused.
+    SN_UINT member_count = 0;
+    for (SN_UINT m = 0; m <= sink; ++m) {
+        member_count += (group[m] == sink);
+    }
+    sn_op** x = SN_DYNAMIC_ARRAY(sn_op*, 2 * member_count);
+    SN_UINT* step_of = SN_DYNAMIC_ARRAY(SN_UINT, sink + 1);
+    SN_UINT x_count = 0;
+    SN_UINT step_count = 0;
+    for (SN_UINT m = 0; m <= sink; ++m) {
+        if (group[m] != sink) {
+            continue;
+        }
+        SN_UINT* x_index = sn_graph_x_index(graph, m);
+        for (SN_UINT j = 0; j < graph->ops[m]->x_count; ++j) {
+            if (group[x_index[j]] == sink) {
+                continue;
+            }
+            sn_op* input = opt_replaced_(graph, replacement, x_index[j]);
+            SN_UINT k = 0;
+            while (k < x_count && x[k] != input) {
+                ++k;
+            }
+            if (k == x_count) {
+                x[x_count++] = input;
+            }
+        }
+        if (!graph->ops[m]->element_wise->reduction) {
+            step_of[m] = step_count++;
+        }
+    }
+
+    sn_op* obj = (sn_op*)SN_MALLOC(sizeof(sn_op) + x_count * sizeof(sn_op*) + sizeof(fuse_program_) + step_count * sizeof(fuse_step_));
+    obj->ref_count = graph->ops[sink]->ref_count;
+    obj->type = OPERATOR;
+    obj->flow = &fuse_flow_;
+    obj->dflow = &fuse_dflow_;
+    obj->vjp = &fuse_vjp_;
+    obj->kernel = &fuse_kernel_;
+    obj->bflow = NULL;
+    obj->bvjp = NULL;
+    obj->jvp = NULL;
+    obj->hvp = NULL;
+    obj->element_wise = NULL;
+    obj->name = "fused";
+    obj->x_count = x_count;
+    for (SN_UINT k = 0; k < x_count; ++k) {
+        ++(x[k]->ref_count);
+        obj->x[k] = x[k];
+    }
+    fuse_program_* program = fuse_program_of_(obj);
+    program->reduction = graph->ops[sink]->element_wise->reduction;
+    program->step_count = step_count;
+    for (SN_UINT m = 0; m <= sink; ++m) {
+        if (group[m] != sink || graph->ops[m]->element_wise->reduction) {
+            continue;
+        }
+        fuse_step_* step = &(program->steps[step_of[m]]);
+        SN_UINT* x_index = sn_graph_x_index(graph, m);
+        step->element_wise = graph->ops[m]->element_wise;
+        step->operand_count = graph->ops[m]->x_count;
+        for (SN_UINT j = 0; j < 2; ++j) {
+            SN_UINT p = x_index[(j < step->operand_count) ? j : 0]; // A unary step reads its operand twice.
+            if (group[p] == sink) {
+                step->operand[j] = x_count + step_of[p];
+            }
+            else {
+                sn_op* input = opt_replaced_(graph, replacement, p);
+                SN_UINT k = 0;
+                while (x[k] != input) {
+                    ++k;
+                }
+                step->operand[j] = k;
+            }
+        }
+    }
+    SN_FREE(step_of);
+    SN_FREE(x);
+    return obj;
+}
+
+sn_op* sn_opt_fuse(sn_op* root) {
+    sn_graph* graph = sn_graph_create(root);
+    SN_UINT count = graph->count;
+
+    SN_UINT* consumer_count = opt_consumer_count_(graph);
+
+    // Groups grow from their sink toward the inputs, so every sink is visited before its members.
+    // group[ i ] is the position of the sink of the group of the node i, or count if it is in no group.
+    SN_UINT* group = SN_DYNAMIC_ARRAY(SN_UINT, count);
+    SN_UINT* member_count = SN_DYNAMIC_ARRAY(SN_UINT, count);
+    SN_UINT* stack = SN_DYNAMIC_ARRAY(SN_UINT, count);
+    for (SN_UINT i = 0; i < count; ++i) {
+        group[i] = count;
+        member_count[i] = 0;
+    }
+    for (SN_UINT i = count; i-- > 0;) {
+        if (group[i] != count || !fuse_is_candidate_(graph->ops[i], consumer_count[i])) {
+            continue;
+        }
+        group[i] = i;
+        member_count[i] = 1;
+        SN_UINT step_count = graph->ops[i]->element_wise->reduction ? 0 : 1;
+        SN_UINT stack_count = 0;
+        stack[stack_count++] = i;
+        while (stack_count > 0) {
+            SN_UINT m = stack[--stack_count];
+            SN_UINT* x_index = sn_graph_x_index(graph, m);
+            for (SN_UINT j = 0; j < graph->ops[m]->x_count; ++j) {
+                SN_UINT p = x_index[j];
+                if (group[p] == count && consumer_count[p] == 1 && step_count < SN_FUSE_MAX_LENGTH &&
+                    fuse_is_candidate_(graph->ops[p], 1) && !graph->ops[p]->element_wise->reduction) {
+                    group[p] = i;
+                    ++(member_count[i]);
+                    ++step_count;
+                    stack[stack_count++] = p;
+                }
+            }
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        if (group[i] != count && member_count[group[i]] < 2) { // A single operator is not worth fusing.
+            group[i] = count;
+        }
+    }
+
+    sn_op** replacement = SN_DYNAMIC_ARRAY(sn_op*, count);
+    for (SN_UINT i = 0; i < count; ++i) {
+        replacement[i] = NULL;
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        if (group[i] == i) {
+            replacement[i] = fuse_create_(graph, group, i, replacement);
+        }
+    }
+
+    // The consumers outside of the groups are redirected, and the members release their inputs before they are freed.
+    // The references to a sink are inherited by its fused operator.
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (group[i] == count) {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                op->x[j] = opt_replaced_(graph, replacement, x_index[j]);
+            }
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (group[i] != count) {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (group[x_index[j]] != group[i]) {
+                    --(opt_replaced_(graph, replacement, x_index[j])->ref_count);
+                }
+            }
+            SN_MEMORY_FORGET(op);
+            SN_FREE(op);
+        }
+    }
+
+    sn_op* obj = opt_replaced_(graph, replacement, count - 1);
+    SN_FREE(replacement);
+    SN_FREE(stack);
+    SN_FREE(member_count);
+    SN_FREE(group);
+    SN_FREE(consumer_count);
+    sn_graph_destroy(graph);
+    return obj;
+}
+
+
+/* Constant folding */
+
+// Every node is first given a state, from the root toward the inputs. The root and the nodes read by a kept node are
+// folded if they are constant-only operators which the graph owns, and kept otherwise. The other nodes leave the graph:
+// they are removed if nothing else refers to them, and detached otherwise, staying alive for their outside references.
+enum {
+    FOLD_KEPT_,
+    FOLD_FOLDED_,
+    FOLD_REMOVED_,
+    FOLD_DETACHED_
+};
+
+sn_op* sn_opt_fold(sn_op* root, SN_UINT* removed_count) {
+    sn_graph* graph = sn_graph_create(root);
+    SN_UINT count = graph->count;
+    SN_UINT* consumer_count = opt_consumer_count_(graph);
+
+    // is_constant[ i ] is true if the node i is a constant or an operator whose inputs are all constant.
+    bool* is_constant = SN_DYNAMIC_ARRAY(bool, count);
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        is_constant[i] = (op->type == CONSTANT) || (op->type == OPERATOR && op->x_count > 0);
+        for (SN_UINT j = 0; j < op->x_count && is_constant[i]; ++j) {
+            is_constant[i] = is_constant[x_index[j]];
+        }
+    }
+
+    int* state = SN_DYNAMIC_ARRAY(int, count);
+    bool* is_read = SN_DYNAMIC_ARRAY(bool, count);
+    bool* is_held = SN_DYNAMIC_ARRAY(bool, count);
+    bool* is_needed = SN_DYNAMIC_ARRAY(bool, count);
+    for (SN_UINT i = 0; i < count; ++i) {
+        is_read[i] = (i == count - 1);
+        is_held[i] = false;
+        is_needed[i] = false;
+    }
+    SN_UINT removed = 0;
+    for (SN_UINT i = count; i-- > 0;) {
+        sn_op* op = graph->ops[i];
+        bool is_owned = op->ref_count == consumer_count[i] + 1;
+        if (is_read[i]) {
+            state[i] = (is_constant[i] && op->type == OPERATOR && is_owned) ? FOLD_FOLDED_ : FOLD_KEPT_;
+        }
+        else {
+            state[i] = (is_owned && !is_held[i]) ? FOLD_REMOVED_ : FOLD_DETACHED_;
+            ++removed;
+        }
+        is_needed[i] = is_needed[i] || state[i] == FOLD_FOLDED_;
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            is_read[x_index[j]] = is_read[x_index[j]] || state[i] == FOLD_KEPT_;
+            is_held[x_index[j]] = is_held[x_index[j]] || state[i] == FOLD_DETACHED_;
+            is_needed[x_index[j]] = is_needed[x_index[j]] || is_needed[i];
+        }
+    }
+
+    // The needed nodes are evaluated once, and the values of the folded ones are moved into new constants.
+    sn_mda** y = SN_DYNAMIC_ARRAY(sn_mda*, count);
+    const sn_mda** x = SN_DYNAMIC_ARRAY(const sn_mda*, opt_x_capacity_(graph));
+    sn_op** replacement = SN_DYNAMIC_ARRAY(sn_op*, count);
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        y[i] = NULL;
+        replacement[i] = NULL;
+        if (!is_needed[i]) {
+            continue;
+        }
+        if (op->type == CONSTANT) {
+            y[i] = *((sn_mda**)(op->x));
+            continue;
+        }
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            x[j] = y[x_index[j]];
+        }
+        y[i] = op->flow(op, x);
+        if (state[i] == FOLD_FOLDED_) {
+            replacement[i] = sn_const(y[i]);
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        if (y[i] && graph->ops[i]->type == OPERATOR && state[i] != FOLD_FOLDED_) {
+            sn_mda_destroy(y[i]);
+        }
+    }
+
+    // The kept and detached nodes read the new constants, and the freed nodes release their inputs which stay alive.
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (state[i] == FOLD_KEPT_ || state[i] == FOLD_DETACHED_) {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (replacement[x_index[j]]) {
+                    op->x[j] = replacement[x_index[j]];
+                    ++(op->x[j]->ref_count);
+                }
+            }
+        }
+        else {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (state[x_index[j]] == FOLD_KEPT_ || state[x_index[j]] == FOLD_DETACHED_) {
+                    --(op->x[j]->ref_count);
+                }
+            }
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        if (state[i] == FOLD_FOLDED_ || state[i] == FOLD_REMOVED_) {
+            opt_free_(graph->ops[i]);
+        }
+    }
+
+    sn_op* obj = opt_replaced_(graph, replacement, count - 1);
+    if (removed_count) {
+        *removed_count = removed;
+    }
+    SN_FREE(replacement);
+    SN_FREE(x);
+    SN_FREE(y);
+    SN_FREE(is_needed);
+    SN_FREE(is_held);
+    SN_FREE(is_read);
+    SN_FREE(state);
+    SN_FREE(is_constant);
+    SN_FREE(consumer_count);
+    sn_graph_destroy(graph);
+    return obj;
+}
+
+
+/* Common subexpression elimination */
+
+// Nodes are hashed in topological order with their inputs already replaced by the first of their equals.
+// An operator is keyed by its flow function, its inputs and its parameters, so only operators of registered kinds
+// are merged, since the number of parameters of others is unknown. A constant is keyed by its shape and elements.
+typedef struct cse_table_st_ {
+    SN_UINT capacity;
+    SN_UINT* slots; // Position + 1 of the node in each slot, or 0 if the slot is empty.
+} cse_table_;
+
+static inline uint64_t cse_mix_(uint64_t hash, uint64_t word) {
+    return (hash ^ word) * UINT64_C(0x100000001B3);
+}
+
+/* Returns the parameters of an operator, which follow its inputs. */
+static inline const SN_UINT* cse_parameters_(const sn_op* op) {
+    return (const SN_UINT*)&(op->x[op->x_count]);
+}
+
+static uint64_t cse_hash_(const sn_graph* graph, const SN_UINT canonical[], SN_UINT i, SN_UINT parameter_count) {
+    const sn_op* op = graph->ops[i];
+    uint64_t hash = UINT64_C(0xCBF29CE484222325);
+    if (op->type == CONSTANT) {
+        const sn_mda* array = *((sn_mda* const*)(op->x));
+        hash = cse_mix_(hash, array->rank);
+        for (SN_UINT d = 0; d < array->rank; ++d) {
+            hash = cse_mix_(hash, array->shape[d]);
+        }
+        const unsigned char* bytes = (const unsigned char*)array->ptr;
+        size_t byte_count = sn_mda_size(array) * sizeof(SN_FLOAT);
+        for (size_t b = 0; b < byte_count; ++b) {
+            hash = cse_mix_(hash, bytes[b]);
+        }
+    }
+    else {
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        hash = cse_mix_(hash, (uint64_t)(uintptr_t)op->flow);
+        hash = cse_mix_(hash, op->x_count);
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            hash = cse_mix_(hash, canonical[x_index[j]]);
+        }
+        for (SN_UINT k = 0; k < parameter_count; ++k) {
+            hash = cse_mix_(hash, cse_parameters_(op)[k]);
+        }
+    }
+    return hash ^ (hash >> 32);
+}
+
+/* Returns true if the nodes at positions i and r compute the same values. The node r is the first of its equals. */
+static bool cse_equals_(const sn_graph* graph, const SN_UINT canonical[], SN_UINT i, SN_UINT r, SN_UINT parameter_count) {
+    const sn_op* a = graph->ops[i];
+    const sn_op* b = graph->ops[r];
+    if (a->type != b->type) {
+        return false;
+    }
+    if (a->type == CONSTANT) {
+        const sn_mda* x = *((sn_mda* const*)(a->x));
+        const sn_mda* y = *((sn_mda* const*)(b->x));
+        if (x->rank != y->rank) {
+            return false;
+        }
+        for (SN_UINT d = 0; d < x->rank; ++d) {
+            if (x->shape[d] != y->shape[d]) {
+                return false;
+            }
+        }
+        return memcmp(x->ptr, y->ptr, sn_mda_size(x) * sizeof(SN_FLOAT)) == 0;
+    }
+    if (a->flow != b->flow || a->x_count != b->x_count) {
+        return false;
+    }
+    SN_UINT* a_index = sn_graph_x_index(graph, i);
+    SN_UINT* b_index = sn_graph_x_index(graph, r);
+    for (SN_UINT j = 0; j < a->x_count; ++j) {
+        if (canonical[a_index[j]] != canonical[b_index[j]]) {
+            return false;
+        }
+    }
+    for (SN_UINT k = 0; k < parameter_count; ++k) {
+        if (cse_parameters_(a)[k] != cse_parameters_(b)[k]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+sn_op* sn_opt_cse(sn_op* root, SN_UINT* removed_count) {
+    sn_graph* graph = sn_graph_create(root);
+    SN_UINT count = graph->count;
+    SN_UINT* consumer_count = opt_consumer_count_(graph);
+
+    cse_table_ table;
+    table.capacity = 1;
+    while (table.capacity < 2 * count) {
+        table.capacity *= 2;
+    }
+    table.slots = SN_DYNAMIC_ARRAY(SN_UINT, table.capacity);
+    for (SN_UINT s = 0; s < table.capacity; ++s) {
+        table.slots[s] = 0;
+    }
+
+    // canonical[ i ] is the position of the first node equal to the node i. A node which is referenced from outside
+    // the graph is never merged into another, but others can be merged into it.
+    SN_UINT* canonical = SN_DYNAMIC_ARRAY(SN_UINT, count);
+    SN_UINT removed = 0;
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT parameter_count = 0;
+        canonical[i] = i;
+        if (op->type == PLACEHOLDER || (op->type == OPERATOR && !sn_op_parameter_count(op, &parameter_count))) {
+            continue;
+        }
+        SN_UINT slot = (SN_UINT)cse_hash_(graph, canonical, i, parameter_count) & (table.capacity - 1);
+        while (table.slots[slot] != 0 && !cse_equals_(graph, canonical, i, table.slots[slot] - 1, parameter_count)) {
+            slot = (slot + 1) & (table.capacity - 1);
+        }
+        if (table.slots[slot] == 0) {
+            table.slots[slot] = i + 1;
+        }
+        else if (op->ref_count == consumer_count[i] + 1) {
+            canonical[i] = table.slots[slot] - 1;
+            ++removed;
+        }
+    }
+
+    // The remaining nodes read the first of the equals, and the merged nodes release their inputs before they are freed.
+    // A merged node is never the root, which is the only node without consumers.
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (canonical[i] == i) {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (canonical[x_index[j]] != x_index[j]) {
+                    op->x[j] = graph->ops[canonical[x_index[j]]];
+                    ++(op->x[j]->ref_count);
+                }
+            }
+        }
+    }
+    for (SN_UINT i = 0; i < count; ++i) {
+        sn_op* op = graph->ops[i];
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        if (canonical[i] != i) {
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                if (canonical[x_index[j]] == x_index[j]) {
+                    --(op->x[j]->ref_count);
+                }
+            }
+            opt_free_(op);
+        }
+    }
+
+    if (removed_count) {
+        *removed_count = removed;
+    }
+    SN_FREE(canonical);
+    SN_FREE(table.slots);
+    SN_FREE(consumer_count);
+    sn_graph_destroy(graph);
+    return root;
+}
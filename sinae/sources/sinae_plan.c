@@ -0,0 +1,234 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_plan.c
+//! \brief This file implements sinae_plan.h.
+
+#include "../sinae_plan.h"
+#include "../sinae_graph.h"
+#include "../sinae_profile.h"
+
+
+/* struct sn_plan_st */
+
+static bool plan_is_same_shape_(const sn_mda* x0, const sn_mda* x1) {
+    if (x0->rank != x1->rank) {
+        return false;
+    }
+    for (SN_UINT i = 0; i < x0->rank; ++i) {
+        if (x0->shape[i] != x1->shape[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool plan_is_released_(sn_mda* released[], SN_UINT released_count, const sn_mda* buffer) {
+    for (SN_UINT k = 0; k < released_count; ++k) {
+        if (released[k] == buffer) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Returns a buffer in the shape of value for the operator at position i, or NULL if it needs its own.
+   An element-wise operator takes the buffer of an input whose last consumer it is, otherwise a released buffer is taken. */
+static sn_mda* plan_buffer_(const sn_graph* graph, SN_UINT i, const SN_UINT last_use[], sn_mda* values[], const sn_mda* value,
+                            sn_mda* released[], SN_UINT* released_count) {
+    sn_op* op = graph->ops[i];
+    SN_UINT* x_index = sn_graph_x_index(graph, i);
+    if (op->element_wise && !op->element_wise->reduction && op->kernel) {
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            SN_UINT p = x_index[j];
+            if (graph->ops[p]->type == OPERATOR && last_use[p] == i && plan_is_same_shape_(values[p], value)) {
+                return values[p];
+            }
+        }
+    }
+    for (SN_UINT k = 0; k < *released_count; ++k) {
+        if (plan_is_same_shape_(released[k], value)) {
+            sn_mda* buffer = released[k];
+            released[k] = released[--(*released_count)];
+            return buffer;
+        }
+    }
+    return NULL;
+}
+
+sn_plan* sn_plan_compile(sn_op* root, SN_UINT input_count, sn_op* placeholders[], const sn_mda* inputs[]) {
+    sn_graph* graph = sn_graph_create(root);
+    sn_plan* obj = (sn_plan*)SN_MALLOC(sizeof(sn_plan));
+    obj->value_count = graph->count;
+    obj->values = SN_DYNAMIC_ARRAY(sn_mda*, graph->count);
+    obj->input_count = input_count;
+    obj->input_index = SN_DYNAMIC_ARRAY(SN_UINT, input_count);
+    obj->output_index = graph->count - 1;
+
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        obj->values[i] = NULL;
+    }
+    SN_UINT input_shape_count = 0;
+    for (SN_UINT i = 0; i < input_count; ++i) {
+        input_shape_count += 1 + inputs[i]->rank;
+    }
+    obj->input_shapes = SN_DYNAMIC_ARRAY(SN_UINT, input_shape_count + 1);
+    for (SN_UINT i = 0, k = 0; i < input_count; ++i) {
+        obj->input_index[i] = sn_graph_find(graph, placeholders[i]);
+        SN_ASSERT(obj->input_index[i] != graph->count); // If the placeholder is not in the expression.
+        obj->values[obj->input_index[i]] = (sn_mda*)inputs[i];
+        obj->input_shapes[k++] = inputs[i]->rank;
+        for (SN_UINT j = 0; j < inputs[i]->rank; ++j) {
+            obj->input_shapes[k++] = inputs[i]->shape[j];
+        }
+    }
+
+    SN_UINT x_capacity = 1;
+    obj->step_count = 0;
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        if (graph->ops[i]->type == OPERATOR) {
+            ++(obj->step_count);
+        }
+        if (graph->ops[i]->x_count > x_capacity) {
+            x_capacity = graph->ops[i]->x_count;
+        }
+    }
+    obj->step_ops = SN_DYNAMIC_ARRAY(sn_op*, obj->step_count);
+    obj->step_y_index = SN_DYNAMIC_ARRAY(SN_UINT, obj->step_count);
+    obj->step_x_offset = SN_DYNAMIC_ARRAY(SN_UINT, obj->step_count + 1);
+    obj->step_x_index = SN_DYNAMIC_ARRAY(SN_UINT, graph->x_offset[graph->count]);
+    obj->x = SN_DYNAMIC_ARRAY(const sn_mda*, x_capacity);
+
+    // A buffer is released after the last consumer of its value, unless it holds the root.
+    SN_UINT* last_use = SN_DYNAMIC_ARRAY(SN_UINT, graph->count);
+    for (SN_UINT i = 0; i < graph->count; ++i) {
+        last_use[i] = i;
+        SN_UINT* x_index = sn_graph_x_index(graph, i);
+        for (SN_UINT j = 0; j < graph->ops[i]->x_count; ++j) {
+            last_use[x_index[j]] = i;
+        }
+    }
+    last_use[graph->count - 1] = graph->count;
+    sn_mda** released = SN_DYNAMIC_ARRAY(sn_mda*, obj->step_count);
+    SN_UINT released_count = 0;
+    obj->buffers = SN_DYNAMIC_ARRAY(sn_mda*, obj->step_count);
+    obj->buffer_count = 0;
+    obj->buffer_bytes = 0;
+    obj->value_bytes = 0;
+
+    // Evaluates the samples once. The outputs of the operators are kept in their buffers.
+    SN_UINT x_index_count = 0;
+    for (SN_UINT i = 0, step = 0; i < graph->count; ++i) {
+        sn_op* op = graph->ops[i];
+        if (op->type == CONSTANT) {
+            obj->values[i] = *((sn_mda**)(op->x));
+        }
+        else if (op->type == OPERATOR) {
+            SN_UINT* x_index = sn_graph_x_index(graph, i);
+            obj->step_ops[step] = op;
+            obj->step_y_index[step] = i;
+            obj->step_x_offset[step] = x_index_count;
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                obj->step_x_index[x_index_count] = x_index[j];
+                obj->x[j] = obj->values[x_index[j]];
+                ++x_index_count;
+            }
+            SN_MEMORY_BEGIN(owner, op);
+            SN_PROFILE_BEGIN(mark);
+            sn_mda* value = op->flow(op, obj->x);
+            SN_PROFILE_END(mark, PROFILE_FLOW, op, value);
+            SN_MEMORY_END(owner);
+            SN_UINT size = sn_mda_size(value);
+            obj->value_bytes += size * sizeof(SN_FLOAT);
+            obj->values[i] = plan_buffer_(graph, i, last_use, obj->values, value, released, &released_count);
+            if (obj->values[i] == NULL) {
+                obj->values[i] = value;
+                obj->buffers[obj->buffer_count++] = value;
+                obj->buffer_bytes += size * sizeof(SN_FLOAT);
+            }
+            else {
+                for (SN_UINT k = 0; k < size; ++k) {
+                    obj->values[i]->ptr[k] = value->ptr[k];
+                }
+                sn_mda_destroy(value);
+            }
+            for (SN_UINT j = 0; j < op->x_count; ++j) {
+                SN_UINT p = x_index[j];
+                if (graph->ops[p]->type == OPERATOR && last_use[p] == i && obj->values[p] != obj->values[i] && !plan_is_released_(released, released_count, obj->values[p])) {
+                    released[released_count++] = obj->values[p];
+                }
+            }
+            ++step;
+        }
+        else {
+            SN_ASSERT(obj->values[i] != NULL); // If the placeholder is not given.
+        }
+    }
+    obj->step_x_offset[obj->step_count] = x_index_count;
+    for (SN_UINT i = 0; i < input_count; ++i) { // The samples are not retained.
+        obj->values[obj->input_index[i]] = NULL;
+    }
+
+    SN_FREE(released);
+    SN_FREE(last_use);
+    sn_graph_destroy(graph);
+    return obj;
+}
+
+void sn_plan_destroy(sn_plan* self) {
+    for (SN_UINT i = 0; i < self->buffer_count; ++i) {
+        sn_mda_destroy(self->buffers[i]);
+    }
+    SN_FREE(self->buffers);
+    SN_FREE(self->values);
+    SN_FREE(self->input_index);
+    SN_FREE(self->input_shapes);
+    SN_FREE(self->step_ops);
+    SN_FREE(self->step_y_index);
+    SN_FREE(self->step_x_offset);
+    SN_FREE(self->step_x_index);
+    SN_FREE(self->x);
+    SN_FREE(self);
+}
+
+const sn_mda* sn_plan_run(sn_plan* self, const sn_mda* inputs[]) {
+    for (SN_UINT i = 0, k = 0; i < self->input_count; ++i) {
+#ifndef SN_NDEBUG
+        SN_ASSERT(inputs[i]->rank == self->input_shapes[k]); // If the input is not in the shape of the sample.
+        for (SN_UINT j = 0; j < inputs[i]->rank; ++j) {
+            SN_ASSERT(inputs[i]->shape[j] == self->input_shapes[k + 1 + j]);
+        }
+#endif
+        k += 1 + self->input_shapes[k];
+        self->values[self->input_index[i]] = (sn_mda*)inputs[i];
+    }
+
+    for (SN_UINT i = 0; i < self->step_count; ++i) {
+        sn_op* op = self->step_ops[i];
+        sn_mda* y = self->values[self->step_y_index[i]];
+        for (SN_UINT j = 0; j < op->x_count; ++j) {
+            self->x[j] = self->values[self->step_x_index[self->step_x_offset[i] + j]];
+        }
+        SN_MEMORY_BEGIN(owner, op);
+        SN_PROFILE_BEGIN(mark);
+        if (op->kernel) {
+            op->kernel(op, self->x, y);
+        }
+        else {
+            sn_mda* temp = op->flow(op, self->x);
+            SN_UINT size = sn_mda_size(y);
+            SN_ASSERT(sn_mda_size(temp) == size);
+            for (SN_UINT j = 0; j < size; ++j) {
+                y->ptr[j] = temp->ptr[j];
+            }
+            sn_mda_destroy(temp);
+        }
+        SN_PROFILE_END(mark, PROFILE_FLOW, op, y);
+        SN_MEMORY_END(owner);
+    }
+    return self->values[self->output_index];
+}
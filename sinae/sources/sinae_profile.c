@@ -0,0 +1,257 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_profile.c
+//! \brief This file implements sinae_profile.h.
+
+#define _POSIX_C_SOURCE 200112L
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef SN_USE_PTHREAD
+    #include <pthread.h>
+#endif
+
+#include "../sinae_profile.h"
+
+
+/* Recorder */
+
+// Events are kept with malloc() and realloc(), so that they are neither counted as allocations of operators
+// nor released by sn_arena_reset().
+static sn_profile_event* profile_events_ = NULL;
+static SN_UINT profile_count_ = 0;
+static SN_UINT profile_capacity_ = 0;
+static SN_UINT profile_thread_count_ = 0;
+static SN_THREAD_LOCAL SN_UINT profile_thread_ = 0; //!< Index + 1 of this thread. Zero until its first event.
+static SN_THREAD_LOCAL SN_UINT profile_bytes_ = 0;  //!< Bytes allocated by this thread so far.
+
+#ifdef SN_USE_PTHREAD
+static pthread_mutex_t profile_mutex_ = PTHREAD_MUTEX_INITIALIZER;
+    #define PROFILE_LOCK_() pthread_mutex_lock(&profile_mutex_)
+    #define PROFILE_UNLOCK_() pthread_mutex_unlock(&profile_mutex_)
+#else
+    #define PROFILE_LOCK_()
+    #define PROFILE_UNLOCK_()
+#endif // SN_USE_PTHREAD
+
+static uint64_t profile_now_ns_(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * UINT64_C(1000000000) + (uint64_t)ts.tv_nsec;
+}
+
+size_t sn_profile_count_(size_t size) {
+    profile_bytes_ += (SN_UINT)size;
+    return size;
+}
+
+sn_profile_mark sn_profile_begin_(void) {
+    sn_profile_mark mark;
+    mark.bytes = profile_bytes_;
+    mark.start_ns = profile_now_ns_();
+    return mark;
+}
+
+void sn_profile_end_(const sn_profile_mark* mark, sn_profile_phase phase, const sn_op* op, const sn_mda* y) {
+    uint64_t end_ns = profile_now_ns_();
+    sn_profile_event event;
+    event.op = op;
+    event.name = (op->name != NULL) ? op->name : "operator";
+    event.phase = phase;
+    event.start_ns = mark->start_ns;
+    event.duration_ns = end_ns - mark->start_ns;
+    event.bytes = profile_bytes_ - mark->bytes;
+    event.rank = (y != NULL) ? y->rank : 0;
+    for (SN_UINT i = 0; i < event.rank && i < SN_PROFILE_MAX_RANK; ++i) {
+        event.shape[i] = y->shape[i];
+    }
+
+    PROFILE_LOCK_();
+    if (profile_thread_ == 0) {
+        profile_thread_ = ++profile_thread_count_;
+    }
+    event.thread = profile_thread_ - 1;
+    if (profile_count_ == profile_capacity_) {
+        SN_UINT capacity = (profile_capacity_ > 0) ? 2 * profile_capacity_ : 1024;
+        sn_profile_event* events = (sn_profile_event*)realloc(profile_events_, capacity * sizeof(sn_profile_event));
+        if (events == NULL) { // The event is dropped, and the recorded ones are kept.
+            PROFILE_UNLOCK_();
+            return;
+        }
+        profile_events_ = events;
+        profile_capacity_ = capacity;
+    }
+    profile_events_[profile_count_++] = event;
+    PROFILE_UNLOCK_();
+}
+
+void sn_profile_reset(void) {
+    PROFILE_LOCK_();
+    free(profile_events_);
+    profile_events_ = NULL;
+    profile_count_ = 0;
+    profile_capacity_ = 0;
+    PROFILE_UNLOCK_();
+}
+
+SN_UINT sn_profile_count(void) {
+    PROFILE_LOCK_();
+    SN_UINT count = profile_count_;
+    PROFILE_UNLOCK_();
+    return count;
+}
+
+const sn_profile_event* sn_profile_events(void) {
+    PROFILE_LOCK_();
+    const sn_profile_event* events = profile_events_;
+    PROFILE_UNLOCK_();
+    return events;
+}
+
+
+/* Reports */
+
+// A row sums the events of one kind or one node in one phase. Events are sorted by the key of the rows and then summed in runs.
+typedef struct profile_row_st_ {
+    const sn_profile_event* first;
+    SN_UINT calls;
+    uint64_t total_ns;
+    SN_UINT bytes;
+} profile_row_;
+
+static int profile_compare_phase_(const sn_profile_event* e0, const sn_profile_event* e1) {
+    return (e0->phase > e1->phase) - (e0->phase < e1->phase);
+}
+
+static int profile_compare_kind_(const void* p0, const void* p1) {
+    const sn_profile_event* e0 = *(const sn_profile_event* const*)p0;
+    const sn_profile_event* e1 = *(const sn_profile_event* const*)p1;
+    int order = profile_compare_phase_(e0, e1);
+    return (order != 0) ? order : strcmp(e0->name, e1->name);
+}
+
+static int profile_compare_node_(const void* p0, const void* p1) {
+    const sn_profile_event* e0 = *(const sn_profile_event* const*)p0;
+    const sn_profile_event* e1 = *(const sn_profile_event* const*)p1;
+    int order = profile_compare_phase_(e0, e1);
+    return (order != 0) ? order : ((uintptr_t)e0->op > (uintptr_t)e1->op) - ((uintptr_t)e0->op < (uintptr_t)e1->op);
+}
+
+static int profile_compare_row_(const void* p0, const void* p1) {
+    const profile_row_* r0 = (const profile_row_*)p0;
+    const profile_row_* r1 = (const profile_row_*)p1;
+    return (r0->total_ns < r1->total_ns) - (r0->total_ns > r1->total_ns);
+}
+
+/* Returns the rows of the events grouped by compare, the most expensive first, or NULL without rows if memory runs out. */
+static profile_row_* profile_rows_(int (*compare)(const void*, const void*), SN_UINT* row_count) {
+    const sn_profile_event** sorted = (const sn_profile_event**)malloc((profile_count_ + 1) * sizeof(const sn_profile_event*));
+    profile_row_* rows = (profile_row_*)malloc((profile_count_ + 1) * sizeof(profile_row_));
+    *row_count = 0;
+    if (sorted == NULL || rows == NULL) {
+        free(sorted);
+        free(rows);
+        return NULL;
+    }
+    for (SN_UINT i = 0; i < profile_count_; ++i) {
+        sorted[i] = &(profile_events_[i]);
+    }
+    qsort(sorted, profile_count_, sizeof(const sn_profile_event*), compare);
+    for (SN_UINT i = 0; i < profile_count_; ++i) {
+        if (i == 0 || compare(&(sorted[i - 1]), &(sorted[i])) != 0) {
+            profile_row_ row = { sorted[i], 0, 0, 0 };
+            rows[(*row_count)++] = row;
+        }
+        profile_row_* row = &(rows[*row_count - 1]);
+        ++(row->calls);
+        row->total_ns += sorted[i]->duration_ns;
+        row->bytes += sorted[i]->bytes;
+    }
+    qsort(rows, *row_count, sizeof(profile_row_), &profile_compare_row_);
+    free(sorted);
+    return rows;
+}
+
+static const char* profile_phase_name_(sn_profile_phase phase) {
+    return (phase == PROFILE_FLOW) ? "flow" : "dflow";
+}
+
+static void profile_print_shape_(FILE* stream, const sn_profile_event* event) {
+    fputc('[', stream);
+    for (SN_UINT i = 0; i < event->rank && i < SN_PROFILE_MAX_RANK; ++i) {
+        fprintf(stream, (i > 0) ? ", %ju" : "%ju", (uintmax_t)event->shape[i]);
+    }
+    fputs((event->rank > SN_PROFILE_MAX_RANK) ? ", ...]" : "]", stream);
+}
+
+void sn_profile_print_summary(FILE* stream, SN_UINT node_count) {
+    PROFILE_LOCK_();
+    SN_UINT row_count;
+    profile_row_* rows = profile_rows_(&profile_compare_kind_, &row_count);
+    fprintf(stream, "%-6s %-16s %10s %12s %12s %14s\n", "phase", "kind", "calls", "total ms", "mean us", "bytes");
+    for (SN_UINT i = 0; i < row_count; ++i) {
+        fprintf(stream, "%-6s %-16s %10ju %12.3f %12.3f %14ju\n",
+                profile_phase_name_(rows[i].first->phase), rows[i].first->name, (uintmax_t)rows[i].calls,
+                (double)rows[i].total_ns * 1e-6, (double)rows[i].total_ns * 1e-3 / (double)rows[i].calls, (uintmax_t)rows[i].bytes);
+    }
+    free(rows);
+
+    rows = profile_rows_(&profile_compare_node_, &row_count);
+    fprintf(stream, "\n%-6s %-18s %-16s %10s %12s %14s  %s\n", "phase", "node", "kind", "calls", "total ms", "bytes", "shape");
+    for (SN_UINT i = 0; i < row_count && i < node_count; ++i) {
+        fprintf(stream, "%-6s %-18p %-16s %10ju %12.3f %14ju  ",
+                profile_phase_name_(rows[i].first->phase), (const void*)rows[i].first->op, rows[i].first->name,
+                (uintmax_t)rows[i].calls, (double)rows[i].total_ns * 1e-6, (uintmax_t)rows[i].bytes);
+        profile_print_shape_(stream, rows[i].first);
+        fputc('\n', stream);
+    }
+    free(rows);
+    PROFILE_UNLOCK_();
+}
+
+/* Writes the string as the contents of a JSON string, escaping quotes, backslashes and control characters. */
+static void profile_write_json_string_(FILE* stream, const char* string) {
+    for (const unsigned char* c = (const unsigned char*)string; *c != '\0'; ++c) {
+        if (*c == '"' || *c == '\\') {
+            fputc('\\', stream);
+            fputc(*c, stream);
+        }
+        else if (*c < 0x20) {
+            fprintf(stream, "\\u%04x", (unsigned)*c);
+        }
+        else {
+            fputc(*c, stream);
+        }
+    }
+}
+
+// Every event is a complete event ("ph": "X") whose timestamps are in microseconds from the earliest event.
+void sn_profile_write_trace(FILE* stream) {
+    PROFILE_LOCK_();
+    uint64_t origin_ns = UINT64_MAX;
+    for (SN_UINT i = 0; i < profile_count_; ++i) {
+        origin_ns = (profile_events_[i].start_ns < origin_ns) ? profile_events_[i].start_ns : origin_ns;
+    }
+    fputs("{\"traceEvents\":[", stream);
+    for (SN_UINT i = 0; i < profile_count_; ++i) {
+        const sn_profile_event* event = &(profile_events_[i]);
+        fprintf(stream, "%s\n{\"name\":\"", (i > 0) ? "," : "");
+        profile_write_json_string_(stream, event->name);
+        fprintf(stream, "\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%ju,"
+                "\"args\":{\"node\":\"%p\",\"bytes\":%ju,\"shape\":",
+                profile_phase_name_(event->phase),
+                (double)(event->start_ns - origin_ns) * 1e-3, (double)event->duration_ns * 1e-3, (uintmax_t)event->thread,
+                (const void*)event->op, (uintmax_t)event->bytes);
+        profile_print_shape_(stream, event);
+        fputs("}}", stream);
+    }
+    fputs("\n],\"displayTimeUnit\":\"ms\"}\n", stream);
+    PROFILE_UNLOCK_();
+}
@@ -0,0 +1,430 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_thread.c
+//! \brief This file implements sinae_thread.h.
+
+#ifdef SN_USE_PTHREAD
+    #define _POSIX_C_SOURCE 200112L
+    #include <pthread.h>
+    #include <stdlib.h>
+#endif
+
+#include "../sinae_thread.h"
+
+
+/* Thread pool */
+
+static SN_UINT thread_threshold_ = SN_THREAD_THRESHOLD;
+
+void sn_thread_set_threshold(SN_UINT threshold) {
+    thread_threshold_ = threshold;
+}
+
+SN_UINT sn_thread_get_threshold(void) {
+    return thread_threshold_;
+}
+
+#ifdef SN_USE_PTHREAD
+
+// One job runs at a time. Its ranges are taken one by one under the mutex by the workers and the calling thread.
+
+typedef struct thread_pool_st_ {
+    pthread_mutex_t mutex;
+    pthread_cond_t job_cond;  //!< Signaled when a job is posted or the pool stops.
+    pthread_cond_t done_cond; //!< Signaled when the last range of a job is done.
+    pthread_t* threads;       //!< Workers. The calling thread is not included.
+    SN_UINT count;            //!< Number of threads including the calling one.
+    bool stop;
+    bool busy;
+    SN_UINT generation;       //!< Incremented for every job.
+    sn_thread_range_fn* fn;
+    void* context;
+    SN_UINT size;
+    SN_UINT task_count;
+    SN_UINT next_task;
+    SN_UINT done_task;
+} thread_pool_;
+
+static thread_pool_ thread_pool_instance_ = {
+    PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, PTHREAD_COND_INITIALIZER,
+    NULL, 1, false, false, 0, NULL, NULL, 0, 0, 0, 0
+};
+
+static SN_THREAD_LOCAL bool thread_is_worker_ = false;
+
+/* Runs the remaining ranges of the current job. The mutex is locked on entry and on exit. */
+static void thread_run_tasks_(thread_pool_* pool) {
+    while (pool->next_task < pool->task_count) {
+        SN_UINT task = (pool->next_task)++;
+        SN_UINT begin = pool->size * task / pool->task_count;
+        SN_UINT end = pool->size * (task + 1) / pool->task_count;
+        pthread_mutex_unlock(&(pool->mutex));
+        pool->fn(pool->context, begin, end);
+        pthread_mutex_lock(&(pool->mutex));
+        if (++(pool->done_task) == pool->task_count) {
+            pthread_cond_signal(&(pool->done_cond));
+        }
+    }
+}
+
+static void* thread_worker_(void* arg) {
+    thread_pool_* pool = (thread_pool_*)arg;
+    thread_is_worker_ = true;
+    pthread_mutex_lock(&(pool->mutex));
+    SN_UINT generation = pool->generation;
+    while (true) {
+        while (!pool->stop && pool->generation == generation) {
+            pthread_cond_wait(&(pool->job_cond), &(pool->mutex));
+        }
+        if (pool->stop) {
+            break;
+        }
+        generation = pool->generation;
+        thread_run_tasks_(pool);
+    }
+    pthread_mutex_unlock(&(pool->mutex));
+    return NULL;
+}
+
+bool sn_thread_set_count(SN_UINT count) {
+    thread_pool_* pool = &thread_pool_instance_;
+    if (pool->count > 1) {
+        pthread_mutex_lock(&(pool->mutex));
+        pool->stop = true;
+        pthread_cond_broadcast(&(pool->job_cond));
+        pthread_mutex_unlock(&(pool->mutex));
+        for (SN_UINT i = 0; i + 1 < pool->count; ++i) {
+            pthread_join(pool->threads[i], NULL);
+        }
+        free(pool->threads);
+        pool->threads = NULL;
+        pool->count = 1;
+        pool->stop = false;
+    }
+    if (count <= 1) {
+        return true;
+    }
+
+    // The threads outlive any arena, so they are allocated from the heap directly.
+    pool->threads = (pthread_t*)malloc(sizeof(pthread_t) * (count - 1));
+    if (pool->threads == NULL) {
+        return false;
+    }
+    for (SN_UINT i = 0; i + 1 < count; ++i) {
+        if (pthread_create(&(pool->threads[i]), NULL, &thread_worker_, pool) != 0) {
+            break;
+        }
+        ++(pool->count);
+    }
+    return pool->count == count;
+}
+
+SN_UINT sn_thread_get_count(void) {
+    return thread_pool_instance_.count;
+}
+
+void sn_thread_parallel_for(SN_UINT size, SN_UINT grain, sn_thread_range_fn* fn, void* context) {
+    thread_pool_* pool = &thread_pool_instance_;
+    SN_UINT task_count = (grain > 0) ? size / grain : size;
+    if (task_count > pool->count) {
+        task_count = pool->count;
+    }
+    if (task_count <= 1 || thread_is_worker_) {
+        fn(context, 0, size);
+        return;
+    }
+
+    pthread_mutex_lock(&(pool->mutex));
+    if (pool->busy) { // Another thread is running a job, e.g. an operator scheduled concurrently.
+        pthread_mutex_unlock(&(pool->mutex));
+        fn(context, 0, size);
+        return;
+    }
+    pool->busy = true;
+    pool->fn = fn;
+    pool->context = context;
+    pool->size = size;
+    pool->task_count = task_count;
+    pool->next_task = 0;
+    pool->done_task = 0;
+    ++(pool->generation);
+    pthread_cond_broadcast(&(pool->job_cond));
+    thread_run_tasks_(pool);
+    while (pool->done_task < pool->task_count) {
+        pthread_cond_wait(&(pool->done_cond), &(pool->mutex));
+    }
+    pool->busy = false;
+    pthread_mutex_unlock(&(pool->mutex));
+}
+
+#else
+
+bool sn_thread_set_count(SN_UINT count) {
+    return count <= 1;
+}
+
+SN_UINT sn_thread_get_count(void) {
+    return 1;
+}
+
+void sn_thread_parallel_for(SN_UINT size, SN_UINT grain, sn_thread_range_fn* fn, void* context) {
+    (void)grain;
+    fn(context, 0, size);
+}
+
+#endif // SN_USE_PTHREAD
+
+
+/* Deterministic reduction */
+
+// Blocks are reduced in rounds so that the partial results fit in a fixed array on the stack.
+#define THREAD_ROUND_BLOCK_COUNT_ 256
+
+typedef struct thread_reduce_context_st_ {
+    sn_thread_reduce_fn* fn;
+    void* context;
+    SN_UINT offset; //!< First element of the round.
+    SN_UINT size;   //!< Number of elements in the whole reduction.
+    SN_FLOAT* partials;
+} thread_reduce_context_;
+
+static void thread_reduce_range_(void* context, SN_UINT begin, SN_UINT end) {
+    thread_reduce_context_* reduce = (thread_reduce_context_*)context;
+    for (SN_UINT block = begin; block < end; ++block) {
+        SN_UINT block_begin = reduce->offset + block * SN_THREAD_BLOCK;
+        SN_UINT block_end = (reduce->size - block_begin < SN_THREAD_BLOCK) ? reduce->size : block_begin + SN_THREAD_BLOCK;
+        reduce->partials[block] = reduce->fn(reduce->context, block_begin, block_end);
+    }
+}
+
+/* Adds the count > 0 partial results pairwise, so that the rounding error grows with log(count) instead of count. */
+static SN_FLOAT thread_sum_pairwise_(const SN_FLOAT* partials, SN_UINT count) {
+    if (count == 1) {
+        return partials[0];
+    }
+    SN_UINT half = count / 2;
+    return thread_sum_pairwise_(partials, half) + thread_sum_pairwise_(&(partials[half]), count - half);
+}
+
+SN_FLOAT sn_thread_reduce(SN_UINT size, sn_thread_reduce_fn* fn, void* context) {
+    SN_FLOAT partials[THREAD_ROUND_BLOCK_COUNT_];
+    thread_reduce_context_ reduce = { fn, context, 0, size, partials };
+    SN_UINT grain = (thread_threshold_ + SN_THREAD_BLOCK - 1) / SN_THREAD_BLOCK;
+    SN_FLOAT result = 0.0;
+    for (; reduce.offset < size; reduce.offset += THREAD_ROUND_BLOCK_COUNT_ * SN_THREAD_BLOCK) {
+        SN_UINT block_count = (size - reduce.offset + SN_THREAD_BLOCK - 1) / SN_THREAD_BLOCK;
+        if (block_count > THREAD_ROUND_BLOCK_COUNT_) {
+            block_count = THREAD_ROUND_BLOCK_COUNT_;
+        }
+        sn_thread_parallel_for(block_count, grain, &thread_reduce_range_, &reduce);
+        result += thread_sum_pairwise_(partials, block_count);
+    }
+    return result;
+}
+
+
+/* DAG scheduler */
+
+/* Runs the tasks in a topological order on the calling thread. */
+static void thread_run_dag_sequential_(SN_UINT task_count, SN_UINT pending[], const SN_UINT successor_offset[], const SN_UINT successor_index[],
+                                       sn_thread_task_fn* fn, void* context) {
+    SN_UINT* ready = SN_DYNAMIC_ARRAY(SN_UINT, task_count + 1);
+    SN_UINT ready_count = 0;
+    for (SN_UINT i = task_count; i-- > 0;) {
+        if (pending[i] == 0) {
+            ready[ready_count++] = i;
+        }
+    }
+    while (ready_count > 0) {
+        SN_UINT task = ready[--ready_count];
+        fn(context, 0, task);
+        for (SN_UINT i = successor_offset[task]; i < successor_offset[task + 1]; ++i) {
+            if (--(pending[successor_index[i]]) == 0) {
+                ready[ready_count++] = successor_index[i];
+            }
+        }
+    }
+    SN_FREE(ready);
+}
+
+#ifdef SN_USE_PTHREAD
+
+// A deque is a ring buffer guarded by its own mutex. The owner works at the bottom and thieves take from the top.
+// A worker which finds every deque empty waits on the condition of the run, signaled when a task is pushed
+// and broadcast when the last task is done, instead of spinning while the remaining tasks run elsewhere.
+
+typedef struct thread_deque_st_ {
+    pthread_mutex_t mutex;
+    SN_UINT* tasks;
+    SN_UINT capacity; //!< Always a power of two.
+    SN_UINT top;      //!< Position of the oldest task. Only increases.
+    SN_UINT bottom;   //!< Position after the newest task.
+} thread_deque_;
+
+typedef struct thread_dag_st_ {
+    SN_UINT* pending;
+    const SN_UINT* successor_offset;
+    const SN_UINT* successor_index;
+    sn_thread_task_fn* fn;
+    void* context;
+    SN_UINT worker_count;
+    thread_deque_* deques;
+    SN_UINT remaining; //!< Number of unfinished tasks. Accessed atomically.
+    SN_UINT queued;    //!< Number of tasks in the deques. Accessed atomically.
+    pthread_mutex_t mutex;
+    pthread_cond_t ready_cond; //!< Signaled when a task is pushed and broadcast when the last task is done.
+} thread_dag_;
+
+static void thread_deque_push_(thread_deque_* deque, SN_UINT task) {
+    pthread_mutex_lock(&(deque->mutex));
+    if (deque->bottom - deque->top == deque->capacity) {
+        SN_UINT* tasks = SN_DYNAMIC_ARRAY(SN_UINT, deque->capacity * 2);
+        for (SN_UINT i = deque->top; i != deque->bottom; ++i) {
+            tasks[i & (deque->capacity * 2 - 1)] = deque->tasks[i & (deque->capacity - 1)];
+        }
+        SN_FREE(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity *= 2;
+    }
+    deque->tasks[deque->bottom & (deque->capacity - 1)] = task;
+    ++(deque->bottom);
+    pthread_mutex_unlock(&(deque->mutex));
+}
+
+static bool thread_deque_pop_(thread_deque_* deque, SN_UINT* task) {
+    bool found = false;
+    pthread_mutex_lock(&(deque->mutex));
+    if (deque->bottom != deque->top) {
+        --(deque->bottom);
+        *task = deque->tasks[deque->bottom & (deque->capacity - 1)];
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->mutex));
+    return found;
+}
+
+static bool thread_deque_steal_(thread_deque_* deque, SN_UINT* task) {
+    bool found = false;
+    pthread_mutex_lock(&(deque->mutex));
+    if (deque->bottom != deque->top) {
+        *task = deque->tasks[deque->top & (deque->capacity - 1)];
+        ++(deque->top);
+        found = true;
+    }
+    pthread_mutex_unlock(&(deque->mutex));
+    return found;
+}
+
+/* Pushes a ready task to the deque of worker and wakes an idle worker for it. */
+static void thread_dag_push_(thread_dag_* dag, SN_UINT worker, SN_UINT task) {
+    thread_deque_push_(&(dag->deques[worker]), task);
+    __atomic_add_fetch(&(dag->queued), 1, __ATOMIC_ACQ_REL);
+    pthread_mutex_lock(&(dag->mutex));
+    pthread_cond_signal(&(dag->ready_cond));
+    pthread_mutex_unlock(&(dag->mutex));
+}
+
+/* Waits until a task is queued or every task is done. The counters are changed before the mutex is taken to signal,
+   so a change after the check below is always followed by a signal. */
+static void thread_dag_wait_(thread_dag_* dag) {
+    pthread_mutex_lock(&(dag->mutex));
+    while (__atomic_load_n(&(dag->queued), __ATOMIC_ACQUIRE) == 0 && __atomic_load_n(&(dag->remaining), __ATOMIC_ACQUIRE) > 0) {
+        pthread_cond_wait(&(dag->ready_cond), &(dag->mutex));
+    }
+    pthread_mutex_unlock(&(dag->mutex));
+}
+
+static void thread_dag_worker_(thread_dag_* dag, SN_UINT worker) {
+    while (__atomic_load_n(&(dag->remaining), __ATOMIC_ACQUIRE) > 0) {
+        SN_UINT task = 0;
+        bool found = thread_deque_pop_(&(dag->deques[worker]), &task);
+        for (SN_UINT i = 1; !found && i < dag->worker_count; ++i) {
+            found = thread_deque_steal_(&(dag->deques[(worker + i) % dag->worker_count]), &task);
+        }
+        if (!found) { // The remaining tasks are running on the other workers.
+            thread_dag_wait_(dag);
+            continue;
+        }
+        __atomic_sub_fetch(&(dag->queued), 1, __ATOMIC_ACQ_REL);
+        dag->fn(dag->context, worker, task);
+        for (SN_UINT i = dag->successor_offset[task]; i < dag->successor_offset[task + 1]; ++i) {
+            if (__atomic_sub_fetch(&(dag->pending[dag->successor_index[i]]), 1, __ATOMIC_ACQ_REL) == 0) {
+                thread_dag_push_(dag, worker, dag->successor_index[i]);
+            }
+        }
+        if (__atomic_sub_fetch(&(dag->remaining), 1, __ATOMIC_ACQ_REL) == 0) {
+            pthread_mutex_lock(&(dag->mutex));
+            pthread_cond_broadcast(&(dag->ready_cond));
+            pthread_mutex_unlock(&(dag->mutex));
+        }
+    }
+}
+
+static void thread_dag_range_(void* context, SN_UINT begin, SN_UINT end) {
+    for (SN_UINT worker = begin; worker < end; ++worker) {
+        thread_dag_worker_((thread_dag_*)context, worker);
+    }
+}
+
+void sn_thread_run_dag(SN_UINT task_count, SN_UINT pending[], const SN_UINT successor_offset[], const SN_UINT successor_index[],
+                       sn_thread_task_fn* fn, void* context, SN_UINT worker_count) {
+    if (worker_count > thread_pool_instance_.count) {
+        worker_count = thread_pool_instance_.count;
+    }
+    if (worker_count <= 1 || thread_is_worker_) {
+        thread_run_dag_sequential_(task_count, pending, successor_offset, successor_index, fn, context);
+        return;
+    }
+
+    thread_dag_ dag;
+    dag.pending = pending;
+    dag.successor_offset = successor_offset;
+    dag.successor_index = successor_index;
+    dag.fn = fn;
+    dag.context = context;
+    dag.worker_count = worker_count;
+    dag.remaining = task_count;
+    dag.queued = 0;
+    pthread_mutex_init(&(dag.mutex), NULL);
+    pthread_cond_init(&(dag.ready_cond), NULL);
+    dag.deques = SN_DYNAMIC_ARRAY(thread_deque_, worker_count);
+    for (SN_UINT i = 0; i < worker_count; ++i) {
+        pthread_mutex_init(&(dag.deques[i].mutex), NULL);
+        dag.deques[i].capacity = 64;
+        dag.deques[i].tasks = SN_DYNAMIC_ARRAY(SN_UINT, dag.deques[i].capacity);
+        dag.deques[i].top = 0;
+        dag.deques[i].bottom = 0;
+    }
+    for (SN_UINT i = 0, worker = 0; i < task_count; ++i) { // Deals the initially ready tasks round-robin.
+        if (pending[i] == 0) {
+            thread_deque_push_(&(dag.deques[worker]), i);
+            ++(dag.queued);
+            worker = (worker + 1) % worker_count;
+        }
+    }
+
+    sn_thread_parallel_for(worker_count, 1, &thread_dag_range_, &dag);
+
+    for (SN_UINT i = 0; i < worker_count; ++i) {
+        pthread_mutex_destroy(&(dag.deques[i].mutex));
+        SN_FREE(dag.deques[i].tasks);
+    }
+    SN_FREE(dag.deques);
+    pthread_cond_destroy(&(dag.ready_cond));
+    pthread_mutex_destroy(&(dag.mutex));
+}
+
+#else
+
+void sn_thread_run_dag(SN_UINT task_count, SN_UINT pending[], const SN_UINT successor_offset[], const SN_UINT successor_index[],
+                       sn_thread_task_fn* fn, void* context, SN_UINT worker_count) {
+    (void)worker_count;
+    thread_run_dag_sequential_(task_count, pending, successor_offset, successor_index, fn, context);
+}
+
+#endif // SN_USE_PTHREAD
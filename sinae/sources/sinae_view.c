@@ -0,0 +1,432 @@
+// This file is the part of "sinae", an automatic differentiation library written in C99.
+//
+// Copyright © 2020 SitD0813 <sitd0813@gmail.com>
+//
+// This file is licensed under the MIT License.
+// See LICENSE.txt for more informtation or you can obtain a copy at https://opensource.org/licenses/MIT/.
+
+//! \file  sinae_view.c
+//! \brief This file implements sinae_view.h.
+
+#include "../sinae_view.h"
+
+
+/* Broadcasting */
+
+bool sn_broadcast_shape(SN_UINT rank0, const SN_UINT shape0[], SN_UINT rank1, const SN_UINT shape1[], SN_UINT* rank, SN_UINT shape[]) {
+    SN_UINT max_rank = (rank0 > rank1) ? rank0 : rank1;
+    for (SN_UINT i = 0; i < max_rank; ++i) {
+        SN_UINT size0 = (i < rank0) ? shape0[i] : 1;
+        SN_UINT size1 = (i < rank1) ? shape1[i] : 1;
+        if (size0 != size1 && size0 != 1 && size1 != 1) {
+            return false;
+        }
+        shape[i] = (size0 == 1) ? size1 : size0;
+    }
+    *rank = max_rank;
+    return true;
+}
+
+
+/* struct sn_view_st */
+
+static sn_view* view_create_(SN_UINT rank, sn_mda* base, SN_UINT offset) {
+    sn_view* obj = (sn_view*)SN_MALLOC(sizeof(sn_view) + 2 * rank * sizeof(SN_UINT));
+    obj->rank = rank;
+    obj->shape = (SN_UINT*)&(obj[1]);
+    obj->stride = &(obj->shape[rank]);
+    obj->offset = offset;
+    obj->base = base;
+    return obj;
+}
+
+sn_view* sn_view_create(sn_mda* base) {
+    sn_view* obj = view_create_(base->rank, base, 0);
+    SN_UINT stride = 1;
+    for (SN_UINT i = 0; i < base->rank; ++i) {
+        obj->shape[i] = base->shape[i];
+        obj->stride[i] = stride;
+        stride *= base->shape[i];
+    }
+    return obj;
+}
+
+void sn_view_destroy(sn_view* self) {
+    SN_FREE(self);
+}
+
+SN_UINT sn_view_size(const sn_view* self) {
+    SN_UINT size = 1;
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        size *= self->shape[i];
+    }
+    return size;
+}
+
+bool sn_view_is_contiguous(const sn_view* self) {
+    SN_UINT stride = 1;
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        if (self->shape[i] != 1) {
+            if (self->stride[i] != stride) {
+                return false;
+            }
+            stride *= self->shape[i];
+        }
+    }
+    return true;
+}
+
+SN_FLOAT* sn_view_get(const sn_view* self, const SN_UINT index[]) {
+    SN_UINT offset = self->offset;
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        SN_ASSERT(index[i] < self->shape[i]);
+        offset += index[i] * self->stride[i];
+    }
+    return &(self->base->ptr[offset]);
+}
+
+// The axes of 1 are skipped, and the rest are split into the shortest groups whose sizes are equal in both shapes.
+// A group of the old axes is one strided axis if each of them continues the previous one, and it is then split into the new axes.
+sn_view* sn_view_reshape(const sn_view* self, SN_UINT rank, const SN_UINT shape[]) {
+    SN_UINT* old_shape = SN_DYNAMIC_ARRAY(SN_UINT, 2 * self->rank + 1);
+    SN_UINT* old_stride = &(old_shape[self->rank]);
+    SN_UINT old_rank = 0;
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        if (self->shape[i] != 1) {
+            old_shape[old_rank] = self->shape[i];
+            old_stride[old_rank] = self->stride[i];
+            ++old_rank;
+        }
+    }
+    sn_view* obj = view_create_(rank, self->base, self->offset);
+    SN_UINT size = 1;
+    for (SN_UINT i = 0; i < rank; ++i) {
+        obj->shape[i] = shape[i];
+        obj->stride[i] = 0;
+        size *= shape[i];
+    }
+    SN_ASSERT(size == sn_view_size(self)); // If the sizes do not match.
+    if (size == 0) { // An empty view has no element to be located.
+        SN_FREE(old_shape);
+        return obj;
+    }
+
+    SN_UINT oi = 0;
+    SN_UINT ni = 0;
+    while (oi < old_rank && ni < rank) {
+        if (shape[ni] == 1) {
+            ++ni;
+            continue;
+        }
+        SN_UINT oj = oi + 1;
+        SN_UINT nj = ni + 1;
+        SN_UINT old_size = old_shape[oi];
+        SN_UINT new_size = shape[ni];
+        while (old_size != new_size) {
+            if (old_size < new_size) {
+                old_size *= old_shape[oj++];
+            }
+            else {
+                new_size *= shape[nj++];
+            }
+        }
+        for (SN_UINT k = oi; k + 1 < oj; ++k) {
+            if (old_stride[k + 1] != old_stride[k] * old_shape[k]) {
+                SN_FREE(old_shape);
+                sn_view_destroy(obj);
+                return NULL;
+            }
+        }
+        obj->stride[ni] = old_stride[oi];
+        for (SN_UINT k = ni + 1; k < nj; ++k) {
+            obj->stride[k] = obj->stride[k - 1] * shape[k - 1];
+        }
+        oi = oj;
+        ni = nj;
+    }
+    SN_FREE(old_shape);
+    return obj;
+}
+
+sn_view* sn_view_transpose(const sn_view* self, const SN_UINT axes[]) {
+    sn_view* obj = view_create_(self->rank, self->base, self->offset);
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        SN_UINT axis = axes ? axes[i] : self->rank - 1 - i;
+        SN_ASSERT(axis < self->rank);
+        obj->shape[i] = self->shape[axis];
+        obj->stride[i] = self->stride[axis];
+    }
+    return obj;
+}
+
+sn_view* sn_view_slice(const sn_view* self, SN_UINT axis, SN_UINT begin, SN_UINT end, SN_UINT step) {
+    SN_ASSERT(axis < self->rank && begin <= end && end <= self->shape[axis] && step > 0);
+    sn_view* obj = view_create_(self->rank, self->base, self->offset + begin * self->stride[axis]);
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        obj->shape[i] = self->shape[i];
+        obj->stride[i] = self->stride[i];
+    }
+    obj->shape[axis] = (end - begin + step - 1) / step;
+    obj->stride[axis] *= step;
+    return obj;
+}
+
+sn_view* sn_view_broadcast(const sn_view* self, SN_UINT rank, const SN_UINT shape[]) {
+    SN_ASSERT(self->rank <= rank);
+    sn_view* obj = view_create_(rank, self->base, self->offset);
+    for (SN_UINT i = 0; i < rank; ++i) {
+        SN_UINT size = (i < self->rank) ? self->shape[i] : 1;
+        SN_ASSERT(size == shape[i] || size == 1); // If the view cannot be broadcasted to the shape.
+        obj->shape[i] = shape[i];
+        obj->stride[i] = (size == shape[i] && i < self->rank) ? self->stride[i] : 0;
+    }
+    return obj;
+}
+
+static void view_copy_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    SN_FLOAT* y = &(((SN_FLOAT**)context)[0][position]);
+    const SN_FLOAT* x = &(((SN_FLOAT**)context)[1][offset[0]]);
+    if (step[0] == 1) {
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = x[i];
+        }
+    }
+    else {
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] = x[i * step[0]];
+        }
+    }
+}
+
+sn_mda* sn_view_to_mda(const sn_view* self) {
+    sn_mda* obj = sn_mda_create(self->rank, self->shape);
+    sn_view_loop* loop = sn_view_loop_create(1, &self);
+    SN_FLOAT* context[2] = { obj->ptr, self->base->ptr };
+    sn_view_loop_run(loop, 0, sn_view_size(self), &view_copy_run_, context);
+    sn_view_loop_destroy(loop);
+    return obj;
+}
+
+static void view_accumulate_run_(void* context, SN_UINT n, SN_UINT position, const SN_UINT offset[], const SN_UINT step[]) {
+    (void)position;
+    SN_FLOAT* y = &(((SN_FLOAT**)context)[0][offset[0]]);
+    const SN_FLOAT* x = &(((SN_FLOAT**)context)[1][offset[1]]);
+    if (step[0] == 1 && step[1] == 1) {
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i] += x[i];
+        }
+    }
+    else if (step[0] == 0) { // If the run is broadcasted in the view, it is summed into one element.
+        SN_FLOAT temp_sum = 0.0;
+        for (SN_UINT i = 0; i < n; ++i) {
+            temp_sum += x[i * step[1]];
+        }
+        y[0] += temp_sum;
+    }
+    else {
+        for (SN_UINT i = 0; i < n; ++i) {
+            y[i * step[0]] += x[i * step[1]];
+        }
+    }
+}
+
+void sn_view_accumulate(sn_view* self, const sn_view* x) {
+#ifndef SN_NDEBUG
+    SN_ASSERT(self->rank == x->rank);
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        SN_ASSERT(self->shape[i] == x->shape[i]);
+    }
+#endif
+    sn_view_loop* loop = sn_view_loop_create(2, SN_TEMP_ARRAY(const sn_view*, self, x));
+    SN_FLOAT* context[2] = { self->base->ptr, x->base->ptr };
+    sn_view_loop_run(loop, 0, sn_view_size(self), &view_accumulate_run_, context);
+    sn_view_loop_destroy(loop);
+}
+
+
+/* struct sn_view_loop_st */
+
+/* Starts an empty loop whose shape, strides and offsets are laid out in data for at most max_rank axes. */
+static void loop_init_(sn_view_loop* self, SN_UINT* data, SN_UINT count, SN_UINT max_rank, const SN_UINT offset[]) {
+    self->count = count;
+    self->rank = 0;
+    self->shape = data;
+    self->stride = &(self->shape[max_rank]);
+    self->offset = &(self->stride[max_rank * count]);
+    for (SN_UINT k = 0; k < count; ++k) {
+        self->offset[k] = offset ? offset[k] : 0;
+    }
+}
+
+/* Appends an axis with the stride of every operand, merging it into the last axis if possible.
+   Returns false if the axis is not merged and the loop already has max_rank axes. */
+static bool loop_push_(sn_view_loop* self, SN_UINT max_rank, SN_UINT size, const SN_UINT stride[]) {
+    if (size == 1) {
+        return true;
+    }
+    SN_UINT count = self->count;
+    bool mergeable = (self->rank > 0);
+    for (SN_UINT k = 0; k < count && mergeable; ++k) {
+        SN_UINT m = self->rank - 1;
+        mergeable = (stride[k] == self->stride[m * count + k] * self->shape[m]);
+    }
+    if (mergeable) {
+        self->shape[self->rank - 1] *= size;
+        return true;
+    }
+    if (self->rank == max_rank) {
+        return false;
+    }
+    self->shape[self->rank] = size;
+    for (SN_UINT k = 0; k < count; ++k) {
+        self->stride[self->rank * count + k] = stride[k];
+    }
+    ++(self->rank);
+    return true;
+}
+
+/* Makes the merged shape of a loop without axes [1]. */
+static void loop_finish_(sn_view_loop* self) {
+    if (self->rank == 0) {
+        self->shape[0] = 1;
+        for (SN_UINT k = 0; k < self->count; ++k) {
+            self->stride[k] = 0;
+        }
+        self->rank = 1;
+    }
+}
+
+/* Creates a loop from the strides of every operand along every axis, laid out as the stride of the merged shape. */
+static sn_view_loop* loop_create_(SN_UINT count, SN_UINT rank, const SN_UINT shape[], const SN_UINT stride[], const SN_UINT offset[]) {
+    SN_UINT max_rank = (rank > 0) ? rank : 1;
+    sn_view_loop* obj = (sn_view_loop*)SN_MALLOC(sizeof(sn_view_loop) + (max_rank + max_rank * count + count) * sizeof(SN_UINT));
+    loop_init_(obj, (SN_UINT*)&(obj[1]), count, max_rank, offset);
+    for (SN_UINT i = 0; i < rank; ++i) {
+        loop_push_(obj, max_rank, shape[i], &(stride[i * count]));
+    }
+    loop_finish_(obj);
+    return obj;
+}
+
+sn_view_loop* sn_view_loop_create(SN_UINT count, const sn_view* views[]) {
+    SN_UINT rank = views[0]->rank;
+    SN_UINT* stride = SN_DYNAMIC_ARRAY(SN_UINT, rank * count + count);
+    SN_UINT* offset = &(stride[rank * count]);
+    for (SN_UINT k = 0; k < count; ++k) {
+        SN_ASSERT(views[k]->rank == rank);
+        for (SN_UINT i = 0; i < rank; ++i) {
+            SN_ASSERT(views[k]->shape[i] == views[0]->shape[i]);
+            stride[i * count + k] = views[k]->stride[i];
+        }
+        offset[k] = views[k]->offset;
+    }
+    sn_view_loop* obj = loop_create_(count, rank, views[0]->shape, stride, offset);
+    SN_FREE(stride);
+    return obj;
+}
+
+sn_view_loop* sn_view_loop_broadcast(SN_UINT count, const sn_mda* x[], SN_UINT rank, const SN_UINT shape[]) {
+    SN_UINT* stride = SN_DYNAMIC_ARRAY(SN_UINT, rank * count + 1);
+    for (SN_UINT k = 0; k < count; ++k) {
+        SN_ASSERT(x[k]->rank <= rank);
+        SN_UINT x_stride = 1;
+        for (SN_UINT i = 0; i < rank; ++i) {
+            SN_UINT size = (i < x[k]->rank) ? x[k]->shape[i] : 1;
+            SN_ASSERT(size == shape[i] || size == 1); // If the array cannot be broadcasted to the shape.
+            stride[i * count + k] = (size == shape[i]) ? x_stride : 0;
+            x_stride *= size;
+        }
+    }
+    sn_view_loop* obj = loop_create_(count, rank, shape, stride, NULL);
+    SN_FREE(stride);
+    return obj;
+}
+
+sn_view_loop* sn_view_loop_broadcast_in(sn_view_loop_storage* storage, SN_UINT count, const sn_mda* x[], SN_UINT rank, const SN_UINT shape[]) {
+    if (count > SN_VIEW_LOOP_MAX_COUNT) {
+        return NULL;
+    }
+    if (!shape) {
+        rank = 0;
+        for (SN_UINT k = 0; k < count; ++k) {
+            rank = (x[k]->rank > rank) ? x[k]->rank : rank;
+        }
+    }
+    sn_view_loop* obj = &(storage->loop);
+    loop_init_(obj, storage->data, count, SN_VIEW_LOOP_MAX_RANK, NULL);
+    SN_UINT x_stride[SN_VIEW_LOOP_MAX_COUNT];
+    SN_UINT stride[SN_VIEW_LOOP_MAX_COUNT];
+    for (SN_UINT k = 0; k < count; ++k) {
+        SN_ASSERT(!shape || x[k]->rank <= rank);
+        x_stride[k] = 1;
+    }
+    for (SN_UINT i = 0; i < rank; ++i) {
+        SN_UINT size = shape ? shape[i] : 1;
+        if (!shape) {
+            for (SN_UINT k = 0; k < count; ++k) {
+                SN_UINT x_size = (i < x[k]->rank) ? x[k]->shape[i] : 1;
+                size = (x_size != 1) ? x_size : size;
+            }
+        }
+        for (SN_UINT k = 0; k < count; ++k) {
+            SN_UINT x_size = (i < x[k]->rank) ? x[k]->shape[i] : 1;
+            SN_ASSERT(x_size == size || x_size == 1); // If the array cannot be broadcasted to the shape.
+            stride[k] = (x_size == size) ? x_stride[k] : 0;
+            x_stride[k] *= x_size;
+        }
+        if (!loop_push_(obj, SN_VIEW_LOOP_MAX_RANK, size, stride)) {
+            return NULL;
+        }
+    }
+    loop_finish_(obj);
+    return obj;
+}
+
+void sn_view_loop_destroy(sn_view_loop* self) {
+    SN_FREE(self);
+}
+
+void sn_view_loop_run(const sn_view_loop* self, SN_UINT begin, SN_UINT end, sn_view_run_fn* run, void* context) {
+    if (begin >= end) {
+        return;
+    }
+    SN_UINT count = self->count;
+    SN_UINT local_index[SN_VIEW_LOOP_MAX_RANK + SN_VIEW_LOOP_MAX_COUNT];
+    bool is_local = (self->rank <= SN_VIEW_LOOP_MAX_RANK && count <= SN_VIEW_LOOP_MAX_COUNT);
+    SN_UINT* index = is_local ? local_index : SN_DYNAMIC_ARRAY(SN_UINT, self->rank + count);
+    SN_UINT* offset = &(index[self->rank]);
+    for (SN_UINT k = 0; k < count; ++k) {
+        offset[k] = self->offset[k];
+    }
+    SN_UINT rest = begin;
+    for (SN_UINT i = 0; i < self->rank; ++i) {
+        index[i] = rest % self->shape[i];
+        rest /= self->shape[i];
+        for (SN_UINT k = 0; k < count; ++k) {
+            offset[k] += index[i] * self->stride[i * count + k];
+        }
+    }
+
+    for (SN_UINT position = begin; position < end;) {
+        SN_UINT n = self->shape[0] - index[0];
+        if (n > end - position) {
+            n = end - position;
+        }
+        run(context, n, position, offset, self->stride);
+        position += n;
+        index[0] += n;
+        for (SN_UINT k = 0; k < count; ++k) {
+            offset[k] += n * self->stride[k];
+        }
+        for (SN_UINT i = 0; i + 1 < self->rank && index[i] == self->shape[i]; ++i) { // Carries into the next axis.
+            index[i] = 0;
+            ++(index[i + 1]);
+            for (SN_UINT k = 0; k < count; ++k) {
+                offset[k] += self->stride[(i + 1) * count + k] - self->shape[i] * self->stride[i * count + k];
+            }
+        }
+    }
+    if (!is_local) {
+        SN_FREE(index);
+    }
+}